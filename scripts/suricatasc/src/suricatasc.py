@@ -200,6 +200,19 @@ class SuricataSC:
                         else:
                             arguments = {}
                             arguments["variable"] = variable
+                    elif "profiling-sample-rate" in command:
+                        try:
+                            [cmd, rate] = command.split(' ', 1)
+                            rate = int(rate)
+                        except:
+                            print "Error: unable to split command '%s'" % (command)
+                            continue
+                        if cmd != "profiling-sample-rate":
+                            print "Error: invalid command '%s'" % (command)
+                            continue
+                        else:
+                            arguments = {}
+                            arguments["rate"] = rate
                     else:
                         cmd = command
                 else:
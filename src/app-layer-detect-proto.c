@@ -42,6 +42,7 @@
 #include "detect-engine-state.h"
 
 #include "util-print.h"
+#include "util-cpu.h"
 #include "util-pool.h"
 #include "util-unittest.h"
 #include "util-unittest-helper.h"
@@ -243,6 +244,7 @@ void AlpProtoAdd(AlpProtoDetectCtx *ctx, char *name, uint16_t ip_proto, uint16_t
                                 cd->offset, cd->depth, cd->id, cd->id, 0);
     BUG_ON(dir->id == ALP_DETECT_MAX);
     dir->map[dir->id] = al_proto;
+    dir->depth[dir->id] = depth;
     dir->id++;
 
     if (depth > dir->max_len)
@@ -261,6 +263,14 @@ void AlpProtoAdd(AlpProtoDetectCtx *ctx, char *name, uint16_t ip_proto, uint16_t
 void AlpProtoTestDestroy(AlpProtoDetectCtx *ctx) {
     mpm_table[ctx->toserver.mpm_ctx.mpm_type].DestroyCtx(&ctx->toserver.mpm_ctx);
     mpm_table[ctx->toclient.mpm_ctx.mpm_type].DestroyCtx(&ctx->toclient.mpm_ctx);
+    if (ctx->toserver.depth_next != NULL) {
+        SCFree(ctx->toserver.depth_next);
+        ctx->toserver.depth_next = NULL;
+    }
+    if (ctx->toclient.depth_next != NULL) {
+        SCFree(ctx->toclient.depth_next);
+        ctx->toclient.depth_next = NULL;
+    }
     AlpProtoFreeSignature(ctx->head);
     AppLayerFreeProbingParsers(ctx->probing_parsers);
     ctx->probing_parsers = NULL;
@@ -274,6 +284,14 @@ void AlpProtoDestroy() {
     mpm_table[alp_proto_ctx.toserver.mpm_ctx.mpm_type].DestroyCtx(&alp_proto_ctx.toserver.mpm_ctx);
     mpm_table[alp_proto_ctx.toclient.mpm_ctx.mpm_type].DestroyCtx(&alp_proto_ctx.toclient.mpm_ctx);
     MpmPatternIdTableFreeHash(alp_proto_ctx.mpm_pattern_id_store);
+    if (alp_proto_ctx.toserver.depth_next != NULL) {
+        SCFree(alp_proto_ctx.toserver.depth_next);
+        alp_proto_ctx.toserver.depth_next = NULL;
+    }
+    if (alp_proto_ctx.toclient.depth_next != NULL) {
+        SCFree(alp_proto_ctx.toclient.depth_next);
+        alp_proto_ctx.toclient.depth_next = NULL;
+    }
     AppLayerFreeProbingParsers(alp_proto_ctx.probing_parsers);
     alp_proto_ctx.probing_parsers = NULL;
     AppLayerFreeProbingParsersInfo(alp_proto_ctx.probing_parsers_info);
@@ -281,6 +299,61 @@ void AlpProtoDestroy() {
     SCReturn;
 }
 
+/**
+ *  \brief Get the name of an app layer proto for use in counter names.
+ *
+ *  Protocols that are only detected by a probing parser don't register
+ *  a name in the al_proto_table, so fall back to the probing parser info.
+ *
+ *  \retval name or NULL if the proto has no name
+ */
+static const char *AlpProtoGetName(AlpProtoDetectCtx *ctx, uint16_t alproto)
+{
+    if (al_proto_table[alproto].name != NULL)
+        return al_proto_table[alproto].name;
+
+    AppLayerProbingParserInfo *ppi = ctx->probing_parsers_info;
+    for ( ; ppi != NULL; ppi = ppi->next) {
+        if (ppi->al_proto == alproto)
+            return ppi->al_proto_name;
+    }
+
+    return NULL;
+}
+
+/**
+ *  \brief Register the per proto detection counters for a thread:
+ *         app_layer.detect.<proto> counts the detected flows. Per detected
+ *         flow, .avg_bytes is the stream data it took, .avg_passes the
+ *         number of detection passes and .avg_ticks the cpu ticks spent
+ *         in those passes.
+ */
+static void AlpProtoRegisterCounters(AlpProtoDetectCtx *ctx, ThreadVars *tv,
+                                     AlpProtoDetectThreadCtx *tctx)
+{
+    char cname[64];
+    uint16_t alproto;
+
+    for (alproto = ALPROTO_UNKNOWN + 1; alproto < ALPROTO_FAILED; alproto++) {
+        const char *name = AlpProtoGetName(ctx, alproto);
+        if (name == NULL)
+            continue;
+
+        snprintf(cname, sizeof(cname), "app_layer.detect.%s", name);
+        tctx->counter_detect[alproto] = SCPerfTVRegisterCounter(cname, tv,
+                SC_PERF_TYPE_UINT64, "NULL");
+        snprintf(cname, sizeof(cname), "app_layer.detect.%s.avg_bytes", name);
+        tctx->counter_detect_bytes[alproto] = SCPerfTVRegisterAvgCounter(cname,
+                tv, SC_PERF_TYPE_UINT64, "NULL");
+        snprintf(cname, sizeof(cname), "app_layer.detect.%s.avg_passes", name);
+        tctx->counter_detect_passes[alproto] = SCPerfTVRegisterAvgCounter(cname,
+                tv, SC_PERF_TYPE_UINT64, "NULL");
+        snprintf(cname, sizeof(cname), "app_layer.detect.%s.avg_ticks", name);
+        tctx->counter_detect_ticks[alproto] = SCPerfTVRegisterAvgCounter(cname,
+                tv, SC_PERF_TYPE_UINT64, "NULL");
+    }
+}
+
 void AlpProtoFinalizeThread(ThreadVars *tv, AlpProtoDetectCtx *ctx, AlpProtoDetectThreadCtx *tctx) {
     uint32_t sig_maxid = 0;
     uint32_t pat_maxid = ctx->mpm_pattern_id_store ? ctx->mpm_pattern_id_store->max_id : 0;
@@ -303,6 +376,11 @@ void AlpProtoFinalizeThread(ThreadVars *tv, AlpProtoDetectCtx *ctx, AlpProtoDete
         tctx->alproto_local_storage[i] = AppLayerGetProtocolParserLocalStorage(tv, i);
     }
 
+    if (tv != NULL) {
+        tctx->tv = tv;
+        AlpProtoRegisterCounters(ctx, tv, tctx);
+    }
+
     return;
 }
 
@@ -325,6 +403,38 @@ void AlpProtoFinalize2Thread(ThreadVars *tv, AlpProtoDetectThreadCtx *tctx) {
     return AlpProtoFinalizeThread(tv, &alp_proto_ctx, tctx);
 }
 
+/**
+ *  \brief Build the depth_next table of a direction. For each stream offset
+ *         up to max_len it holds the smallest condition depth beyond that
+ *         offset. A condition can only match once the stream covers its
+ *         depth and won't change its mind after that, so a flow that
+ *         inspected up to offset N only has to search again once the
+ *         stream reaches depth_next[N].
+ */
+static void AlpProtoFinalizeDirection(AlpProtoDetectDirection *dir)
+{
+    uint32_t u;
+    uint16_t i;
+
+    if (dir->id == 0 || dir->depth_next != NULL)
+        return;
+
+    dir->depth_next = SCMalloc((dir->max_len + 1) * sizeof(uint16_t));
+    if (dir->depth_next == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "%s", strerror(errno));
+        return;
+    }
+    memset(dir->depth_next, 0x00, (dir->max_len + 1) * sizeof(uint16_t));
+
+    for (u = 0; u < dir->id; u++) {
+        uint16_t depth = dir->depth[u];
+        for (i = 0; i < depth; i++) {
+            if (dir->depth_next[i] == 0 || dir->depth_next[i] > depth)
+                dir->depth_next[i] = depth;
+        }
+    }
+}
+
 void AlpProtoFinalizeGlobal(AlpProtoDetectCtx *ctx) {
     if (ctx == NULL)
         return;
@@ -332,6 +442,9 @@ void AlpProtoFinalizeGlobal(AlpProtoDetectCtx *ctx) {
     mpm_table[ctx->toclient.mpm_ctx.mpm_type].Prepare(&ctx->toclient.mpm_ctx);
     mpm_table[ctx->toserver.mpm_ctx.mpm_type].Prepare(&ctx->toserver.mpm_ctx);
 
+    AlpProtoFinalizeDirection(&ctx->toclient);
+    AlpProtoFinalizeDirection(&ctx->toserver);
+
 #ifdef __SC_CUDA_SUPPORT__
     CUcontext context;
     if (SCCudaCtxPopCurrent(&context) == -1)
@@ -373,21 +486,24 @@ void AppLayerDetectProtoThreadInit(void) {
 }
 
 /**
- *  \brief Get the app layer proto based on a buffer using a Patter matcher
- *         parser.
+ *  \brief Run the pattern matcher over the part of the buffer that can
+ *         still decide a condition.
  *
- *  \param ctx Global app layer detection context
- *  \param tctx Thread app layer detection context
- *  \param buf Pointer to the buffer to inspect
- *  \param buflen Lenght of the buffer
- *  \param flags Flags.
+ *  Conditions with a depth up to inspected were already decided on an
+ *  earlier pass over the same stream start, so they are skipped. If no
+ *  condition ends between inspected and buflen the search is skipped
+ *  altogether.
+ *
+ *  \param inspected bytes of buf inspected by an earlier pass, 0 if none
  *
  *  \retval proto App Layer proto, or ALPROTO_UNKNOWN if unknown
  */
-uint16_t AppLayerDetectGetProtoPMParser(AlpProtoDetectCtx *ctx,
-                                        AlpProtoDetectThreadCtx *tctx,
-                                        uint8_t *buf, uint16_t buflen,
-                                        uint8_t flags, uint8_t ipproto) {
+static uint16_t AlpProtoDetectPM(AlpProtoDetectCtx *ctx,
+                                 AlpProtoDetectThreadCtx *tctx,
+                                 uint8_t *buf, uint16_t buflen,
+                                 uint8_t flags, uint8_t ipproto,
+                                 uint16_t inspected)
+{
     SCEnter();
 
     AlpProtoDetectDirection *dir;
@@ -405,6 +521,17 @@ uint16_t AppLayerDetectGetProtoPMParser(AlpProtoDetectCtx *ctx,
         SCReturnUInt(ALPROTO_UNKNOWN);
     }
 
+    /* see if the new data can decide anything */
+    if (dir->depth_next != NULL) {
+        uint16_t depth = (inspected < dir->max_len) ?
+            dir->depth_next[inspected] : 0;
+        if (depth == 0 || depth > buflen) {
+            SCLogDebug("no condition ends between %"PRIu16" and %"PRIu16,
+                    inspected, buflen);
+            SCReturnUInt(ALPROTO_UNKNOWN);
+        }
+    }
+
     /* see if we can limit the data we inspect */
     uint16_t searchlen = buflen;
     if (searchlen > dir->max_len)
@@ -459,7 +586,8 @@ uint16_t AppLayerDetectGetProtoPMParser(AlpProtoDetectCtx *ctx,
     uint8_t s_cnt = 1;
 
     while (proto == ALPROTO_UNKNOWN && s != NULL) {
-        proto = AlpProtoMatchSignature(s, buf, buflen, ipproto);
+        if (s->co->depth > inspected)
+            proto = AlpProtoMatchSignature(s, buf, buflen, ipproto);
 
         s = s->map_next;
         if (s == NULL && s_cnt < tdir->pmq.pattern_id_array_cnt) {
@@ -533,6 +661,25 @@ end:
     SCReturnUInt(proto);
 }
 
+/**
+ *  \brief Get the app layer proto based on a buffer using a Patter matcher
+ *         parser.
+ *
+ *  \param ctx Global app layer detection context
+ *  \param tctx Thread app layer detection context
+ *  \param buf Pointer to the buffer to inspect
+ *  \param buflen Lenght of the buffer
+ *  \param flags Flags.
+ *
+ *  \retval proto App Layer proto, or ALPROTO_UNKNOWN if unknown
+ */
+uint16_t AppLayerDetectGetProtoPMParser(AlpProtoDetectCtx *ctx,
+                                        AlpProtoDetectThreadCtx *tctx,
+                                        uint8_t *buf, uint16_t buflen,
+                                        uint8_t flags, uint8_t ipproto) {
+    return AlpProtoDetectPM(ctx, tctx, buf, buflen, flags, ipproto, 0);
+}
+
 /**
  * \brief Call the probing parser if it exists for this src or dst port.
  */
@@ -616,9 +763,52 @@ uint16_t AppLayerDetectGetProtoProbingParser(AlpProtoDetectCtx *ctx, Flow *f,
     return ALPROTO_UNKNOWN;
 }
 
+/**
+ *  \brief Update the detection counters of a thread for a flow we just
+ *         detected the proto of.
+ */
+static void AlpProtoDetectUpdateCounters(AlpProtoDetectThreadCtx *tctx,
+                                         Flow *f, uint16_t alproto,
+                                         uint32_t buflen)
+{
+    if (tctx->tv == NULL || alproto >= ALPROTO_MAX ||
+        tctx->counter_detect[alproto] == 0)
+        return;
+
+    SCPerfCounterIncr(tctx->counter_detect[alproto], tctx->tv->sc_perf_pca);
+    SCPerfCounterAddUI64(tctx->counter_detect_bytes[alproto],
+            tctx->tv->sc_perf_pca, buflen);
+    SCPerfCounterAddUI64(tctx->counter_detect_passes[alproto],
+            tctx->tv->sc_perf_pca, f->alproto_detect_passes);
+    SCPerfCounterAddUI64(tctx->counter_detect_ticks[alproto],
+            tctx->tv->sc_perf_pca, f->alproto_detect_ticks);
+}
+
+/**
+ *  \brief Add the ticks of a detection pass to the flow's total.
+ */
+static inline void AlpProtoDetectAddTicks(Flow *f, uint64_t start)
+{
+    uint64_t ticks = UtilCpuGetTicks() - start;
+
+    if (ticks > UINT32_MAX - f->alproto_detect_ticks)
+        f->alproto_detect_ticks = UINT32_MAX;
+    else
+        f->alproto_detect_ticks += (uint32_t)ticks;
+}
+
 /**
  *  \brief Get the app layer proto.
  *
+ *  Pattern and port based candidates are tried in one call: first the
+ *  conditions of the pattern matcher, then the probing parsers that are
+ *  registered for the port, in order of their priority. A pattern match
+ *  wins over a probing parser. For TCP the
+ *  stream is handed to us from its start until detection completes, so
+ *  we remember per direction how much of it we have inspected and only
+ *  look at what the new data can still decide. Once both the pattern
+ *  matcher and the probing parsers are exhausted we bail out for good.
+ *
  *  \param ctx    Global app layer detection context.
  *  \param tctx   Thread app layer detection context.
  *  \param f      Pointer to the flow.
@@ -634,61 +824,66 @@ uint16_t AppLayerDetectGetProto(AlpProtoDetectCtx *ctx,
                                 uint8_t flags, uint8_t ipproto)
 {
     uint16_t alproto = ALPROTO_UNKNOWN;
+    uint16_t *inspected;
+    uint16_t max_len;
+    uint32_t pm_done, pp_done, pm_pp_done;
+    uint64_t ticks = UtilCpuGetTicks();
 
     if (flags & STREAM_TOSERVER) {
-        if (buflen >= alp_proto_ctx.toserver.max_len) {
-            if (f->flags & FLOW_TS_PM_ALPROTO_DETECT_DONE) {
-                /* the PM parser has already tried and failed.  Now it is
-                 * upto the probing parser */
-                ;
-            } else {
-                alproto = AppLayerDetectGetProtoPMParser(ctx, tctx, buf, buflen,
-                                                         flags, ipproto);
-                if (alproto != ALPROTO_UNKNOWN)
-                    return alproto;
-                /* the alproto hasn't been detected at this point */
-                if (f->flags & FLOW_TS_PP_ALPROTO_DETECT_DONE) {
-                    f->flags |= FLOW_TS_PM_PP_ALPROTO_DETECT_DONE;
-                    return ALPROTO_UNKNOWN;
-                }
-                f->flags |= FLOW_TS_PM_ALPROTO_DETECT_DONE;
-            }
-        } else {
-            alproto = AppLayerDetectGetProtoPMParser(ctx, tctx, buf, buflen,
-                                                     flags, ipproto);
-            if (alproto != ALPROTO_UNKNOWN)
-                return alproto;
-        }
-        /* If we have reached here, the PM parser has failed to detect the
-         * alproto */
-        return AppLayerDetectGetProtoProbingParser(ctx, f, buf, buflen,
-                                                   flags, ipproto);
-
-        /* STREAM_TOCLIENT */
+        inspected = &f->alproto_ts_inspected;
+        max_len = ctx->toserver.max_len;
+        pm_done = FLOW_TS_PM_ALPROTO_DETECT_DONE;
+        pp_done = FLOW_TS_PP_ALPROTO_DETECT_DONE;
+        pm_pp_done = FLOW_TS_PM_PP_ALPROTO_DETECT_DONE;
     } else {
-        if (buflen >= alp_proto_ctx.toclient.max_len) {
-            if (f->flags & FLOW_TC_PM_ALPROTO_DETECT_DONE) {
-                ;
-            } else {
-                alproto = AppLayerDetectGetProtoPMParser(ctx, tctx, buf, buflen,
-                                                         flags, ipproto);
-                if (alproto != ALPROTO_UNKNOWN)
-                    return alproto;
-                if (f->flags & FLOW_TC_PP_ALPROTO_DETECT_DONE) {
-                    f->flags |= FLOW_TC_PM_PP_ALPROTO_DETECT_DONE;
-                    return ALPROTO_UNKNOWN;
-                }
-                f->flags |= FLOW_TC_PM_ALPROTO_DETECT_DONE;
-            }
-        } else {
-            alproto = AppLayerDetectGetProtoPMParser(ctx, tctx, buf, buflen,
-                                                     flags, ipproto);
-            if (alproto != ALPROTO_UNKNOWN)
-                return alproto;
-        }
-        return AppLayerDetectGetProtoProbingParser(ctx, f, buf, buflen,
-                                                       flags, ipproto);
+        inspected = &f->alproto_tc_inspected;
+        max_len = ctx->toclient.max_len;
+        pm_done = FLOW_TC_PM_ALPROTO_DETECT_DONE;
+        pp_done = FLOW_TC_PP_ALPROTO_DETECT_DONE;
+        pm_pp_done = FLOW_TC_PM_PP_ALPROTO_DETECT_DONE;
     }
+
+    /* only a stream keeps its start between passes */
+    uint16_t offset = (ipproto == IPPROTO_TCP) ? *inspected : 0;
+    uint16_t len = (buflen > UINT16_MAX) ? UINT16_MAX : (uint16_t)buflen;
+
+    if (f->alproto_detect_passes < UINT16_MAX)
+        f->alproto_detect_passes++;
+
+    if (!(f->flags & pm_done)) {
+        alproto = AlpProtoDetectPM(ctx, tctx, buf, len, flags, ipproto,
+                                   offset);
+        if (alproto != ALPROTO_UNKNOWN)
+            goto detected;
+
+        /* all conditions are decided, it is upto the probing parser now */
+        if (buflen >= max_len)
+            f->flags |= pm_done;
+    }
+
+    if ((f->flags & pm_done) && (f->flags & pp_done)) {
+        f->flags |= pm_pp_done;
+        goto end;
+    }
+
+    /* the probing parsers gave the same answer on this data already */
+    if (!(f->flags & pp_done) && (offset == 0 || len > offset)) {
+        alproto = AppLayerDetectGetProtoProbingParser(ctx, f, buf, buflen,
+                                                      flags, ipproto);
+        if (alproto != ALPROTO_UNKNOWN)
+            goto detected;
+    }
+
+end:
+    if (ipproto == IPPROTO_TCP)
+        *inspected = len;
+    AlpProtoDetectAddTicks(f, ticks);
+    return ALPROTO_UNKNOWN;
+
+detected:
+    AlpProtoDetectAddTicks(f, ticks);
+    AlpProtoDetectUpdateCounters(tctx, f, alproto, buflen);
+    return alproto;
 }
 
 /* VJ Originally I thought of having separate app layer
@@ -1546,6 +1741,132 @@ int AlpDetectTest14(void) {
     return r;
 }
 
+/** \test the depth_next table and the incremental pattern search: a
+ *        condition that was decided on an earlier pass isn't tried again */
+int AlpDetectTest15(void) {
+    uint8_t l7data_partial[] = "SS";
+    uint8_t l7data[] = "SSH-2.0-OpenSSH\r\n";
+    uint8_t l7data_other[] = "XXXX-2.0-OpenSSH\r\n";
+    int r = 0;
+    AlpProtoDetectCtx ctx;
+    AlpProtoDetectThreadCtx tctx;
+    Flow f;
+
+    AlpProtoInit(&ctx);
+
+    AlpProtoAdd(&ctx, "ssh", IPPROTO_TCP, ALPROTO_SSH, "SSH-", 4, 0, STREAM_TOSERVER);
+    AlpProtoAdd(&ctx, "imap", IPPROTO_TCP, ALPROTO_IMAP, "1|20|capability", 12, 0, STREAM_TOSERVER);
+
+    AlpProtoFinalizeGlobal(&ctx);
+    AlpProtoFinalizeThread(NULL, &ctx, &tctx);
+
+    if (ctx.toserver.depth_next == NULL ||
+        ctx.toserver.depth_next[0] != 4 || ctx.toserver.depth_next[3] != 4 ||
+        ctx.toserver.depth_next[4] != 12 || ctx.toserver.depth_next[12] != 0) {
+        printf("depth_next table wrong: ");
+        goto end;
+    }
+
+    memset(&f, 0x00, sizeof(f));
+    f.dp = 22;
+
+    uint16_t proto = AppLayerDetectGetProto(&ctx, &tctx, &f, l7data_partial,
+            sizeof(l7data_partial) - 1, STREAM_TOSERVER, IPPROTO_TCP);
+    if (proto != ALPROTO_UNKNOWN) {
+        printf("proto %"PRIu16" != %"PRIu16": ", proto, ALPROTO_UNKNOWN);
+        goto end;
+    }
+    if (f.alproto_ts_inspected != 2 || (f.flags & FLOW_TS_PM_ALPROTO_DETECT_DONE)) {
+        printf("inspected %"PRIu16" != 2 or pm done: ", f.alproto_ts_inspected);
+        goto end;
+    }
+
+    proto = AppLayerDetectGetProto(&ctx, &tctx, &f, l7data,
+            sizeof(l7data) - 1, STREAM_TOSERVER, IPPROTO_TCP);
+    if (proto != ALPROTO_SSH) {
+        printf("proto %"PRIu16" != %"PRIu16": ", proto, ALPROTO_SSH);
+        goto end;
+    }
+    if (f.alproto_detect_passes != 2) {
+        printf("passes %"PRIu16" != 2: ", f.alproto_detect_passes);
+        goto end;
+    }
+
+    /* "SSH-" was decided against on the first 4 bytes, so a stream start
+     * we have already seen isn't looked at again */
+    memset(&f, 0x00, sizeof(f));
+    f.dp = 22;
+
+    proto = AppLayerDetectGetProto(&ctx, &tctx, &f, l7data_other, 4,
+            STREAM_TOSERVER, IPPROTO_TCP);
+    if (proto != ALPROTO_UNKNOWN) {
+        printf("proto %"PRIu16" != %"PRIu16": ", proto, ALPROTO_UNKNOWN);
+        goto end;
+    }
+
+    proto = AppLayerDetectGetProto(&ctx, &tctx, &f, l7data, 6,
+            STREAM_TOSERVER, IPPROTO_TCP);
+    if (proto != ALPROTO_UNKNOWN) {
+        printf("proto %"PRIu16" != %"PRIu16": ", proto, ALPROTO_UNKNOWN);
+        goto end;
+    }
+
+    r = 1;
+end:
+    AlpProtoTestDestroy(&ctx);
+    return r;
+}
+
+/** \test pattern matcher and probing parsers run out: bail out for good */
+int AlpDetectTest16(void) {
+    uint8_t l7data[] = "XXXXXXXXXXXXXXXXXXXX";
+    int r = 0;
+    AlpProtoDetectCtx ctx;
+    AlpProtoDetectThreadCtx tctx;
+    Flow f;
+
+    AlpProtoInit(&ctx);
+
+    AlpProtoAdd(&ctx, "ssh", IPPROTO_TCP, ALPROTO_SSH, "SSH-", 4, 0, STREAM_TOSERVER);
+    AlpProtoAdd(&ctx, "imap", IPPROTO_TCP, ALPROTO_IMAP, "1|20|capability", 12, 0, STREAM_TOSERVER);
+
+    AlpProtoFinalizeGlobal(&ctx);
+    AlpProtoFinalizeThread(NULL, &ctx, &tctx);
+
+    memset(&f, 0x00, sizeof(f));
+    f.dp = 22;
+
+    uint16_t proto = AppLayerDetectGetProto(&ctx, &tctx, &f, l7data, 8,
+            STREAM_TOSERVER, IPPROTO_TCP);
+    if (proto != ALPROTO_UNKNOWN) {
+        printf("proto %"PRIu16" != %"PRIu16": ", proto, ALPROTO_UNKNOWN);
+        goto end;
+    }
+    /* no probing parser for the port, but the pattern matcher isn't done */
+    if (!(f.flags & FLOW_TS_PP_ALPROTO_DETECT_DONE) ||
+        (f.flags & FLOW_TS_PM_PP_ALPROTO_DETECT_DONE)) {
+        printf("flags %08x: ", f.flags);
+        goto end;
+    }
+
+    proto = AppLayerDetectGetProto(&ctx, &tctx, &f, l7data,
+            sizeof(l7data) - 1, STREAM_TOSERVER, IPPROTO_TCP);
+    if (proto != ALPROTO_UNKNOWN) {
+        printf("proto %"PRIu16" != %"PRIu16": ", proto, ALPROTO_UNKNOWN);
+        goto end;
+    }
+    if (!(f.flags & FLOW_TS_PM_ALPROTO_DETECT_DONE) ||
+        !(f.flags & FLOW_TS_PM_PP_ALPROTO_DETECT_DONE)) {
+        printf("flags %08x: ", f.flags);
+        goto end;
+    }
+
+    r = 1;
+end:
+    AlpProtoTestDestroy(&ctx);
+    return r;
+}
+
 /** \test test if the engine detect the proto and match with it */
 static int AlpDetectTestSig1(void)
 {
@@ -2011,6 +2332,8 @@ void AlpDetectRegisterTests(void) {
     UtRegisterTest("AlpDetectTest12", AlpDetectTest12, 1);
     UtRegisterTest("AlpDetectTest13", AlpDetectTest13, 1);
     UtRegisterTest("AlpDetectTest14", AlpDetectTest14, 1);
+    UtRegisterTest("AlpDetectTest15", AlpDetectTest15, 1);
+    UtRegisterTest("AlpDetectTest16", AlpDetectTest16, 1);
     UtRegisterTest("AlpDetectTestSig1", AlpDetectTestSig1, 1);
     UtRegisterTest("AlpDetectTestSig2", AlpDetectTestSig2, 1);
     UtRegisterTest("AlpDetectTestSig3", AlpDetectTestSig3, 1);
@@ -46,6 +46,12 @@ typedef struct AlpProtoDetectDirection_ {
     uint32_t id;
     uint16_t map[ALP_DETECT_MAX];   /**< a mapping between condition id's and
                                          protocol */
+    uint16_t depth[ALP_DETECT_MAX]; /**< depth of each condition */
+    uint16_t *depth_next;           /**< for each stream offset up to max_len
+                                         the smallest condition depth beyond
+                                         it, 0 if none. Lets us skip the
+                                         search if no new condition can be
+                                         decided. */
     uint16_t max_len;              /**< max length of all patterns, so we can
                                          limit the search */
     uint16_t min_len;              /**< min length of all patterns, so we can
@@ -62,10 +62,119 @@
 #include "conf.h"
 
 #include "util-memcmp.h"
+#include "util-misc.h"
+#include "util-atomic.h"
+
+/** memory held by body pages of all transactions */
+SC_ATOMIC_DECLARE(uint64_t, htp_body_memuse);
+/** limit for htp_body_memuse, 0 means unlimited */
+static uint64_t htp_body_memcap = 0;
+
+/**
+ * \brief Set up the body page memcap from "libhtp.body-memcap"
+ */
+void HtpBodyConfig(void)
+{
+    char *conf_val;
+
+    SC_ATOMIC_INIT(htp_body_memuse);
+
+    htp_body_memcap = 0;
+    if ((ConfGet("libhtp.body-memcap", &conf_val)) == 1)
+    {
+        if (ParseSizeStringU64(conf_val, &htp_body_memcap) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "Error parsing libhtp.body-memcap "
+                       "from conf file - %s.  Killing engine",
+                       conf_val);
+            exit(EXIT_FAILURE);
+        }
+    }
+    SCLogDebug("libhtp body-memcap %"PRIu64, htp_body_memcap);
+}
+
+uint64_t HtpBodyMemuse(void)
+{
+    return SC_ATOMIC_GET(htp_body_memuse);
+}
+
+/**
+ *  \brief Check if alloc'ing "size" would mean we're over memcap
+ *
+ *  \retval 1 if in bounds
+ *  \retval 0 if not in bounds
+ */
+static int HtpBodyCheckMemcap(uint64_t size)
+{
+    if (htp_body_memcap == 0 || size + SC_ATOMIC_GET(htp_body_memuse) <= htp_body_memcap)
+        return 1;
+    return 0;
+}
+
+static void HtpBodyFreePage(HtpBodyChunk *bd)
+{
+    (void) SC_ATOMIC_SUB(htp_body_memuse, bd->size + sizeof(HtpBodyChunk));
+    SCFree(bd);
+}
+
+/**
+ * \brief Allocate a new page and add it to the end of the body
+ *
+ *  The first page is sized to the data it is about to hold, rounded up
+ *  to a power of 2, so small bodies don't take a large page. Following
+ *  pages double in size so large bodies are held in few pages and can
+ *  mostly be inspected in place.
+ *
+ * \param body pointer to the HtpBody holding the list
+ * \param len length of the data that is to be added
+ *
+ * \retval bd the new page or NULL on error or if over the memcap
+ */
+static HtpBodyChunk *HtpBodyAddPage(HtpBody *body, uint32_t len)
+{
+    uint32_t page_size = HTP_BODY_PAGE_MIN_SIZE;
+
+    if (body->last != NULL) {
+        page_size = (body->last->size + sizeof(HtpBodyChunk)) * 2;
+    } else {
+        while (page_size < HTP_BODY_PAGE_MAX_SIZE &&
+               page_size < len + sizeof(HtpBodyChunk))
+            page_size *= 2;
+    }
+    if (page_size > HTP_BODY_PAGE_MAX_SIZE)
+        page_size = HTP_BODY_PAGE_MAX_SIZE;
+
+    if (HtpBodyCheckMemcap((uint64_t)page_size) == 0) {
+        SCLogDebug("body page of %"PRIu32" would exceed the memcap", page_size);
+        return NULL;
+    }
+
+    HtpBodyChunk *bd = SCMalloc(page_size);
+    if (bd == NULL)
+        return NULL;
+    (void) SC_ATOMIC_ADD(htp_body_memuse, page_size);
+
+    bd->data = (uint8_t *)bd + sizeof(HtpBodyChunk);
+    bd->next = NULL;
+    bd->stream_offset = body->content_len_so_far;
+    bd->len = 0;
+    bd->size = page_size - sizeof(HtpBodyChunk);
+
+    if (body->first == NULL) {
+        body->first = body->last = bd;
+    } else {
+        body->last->next = bd;
+        body->last = bd;
+    }
+    return bd;
+}
 
 /**
  * \brief Append a chunk of body to the HtpBody struct
  *
+ *  The data is appended to the last page of the body, new pages are
+ *  only allocated when it is full. So consecutive chunks are held in
+ *  a single contiguous region.
+ *
  * \param body pointer to the HtpBody holding the list
  * \param data pointer to the data of the chunk
  * \param len length of the chunk pointed by data
@@ -77,63 +186,34 @@ int HtpBodyAppendChunk(HtpTxUserData *htud, HtpBody *body, uint8_t *data, uint32
 {
     SCEnter();
 
-    HtpBodyChunk *bd = NULL;
-
     if (len == 0 || data == NULL) {
         SCReturnInt(0);
     }
 
-    if (body->first == NULL) {
-        /* New chunk */
-        bd = (HtpBodyChunk *)SCMalloc(sizeof(HtpBodyChunk));
-        if (bd == NULL)
-            goto error;
-
-        bd->len = len;
-        bd->stream_offset = 0;
-        bd->next = NULL;
-
-        bd->data = SCMalloc(len);
-        if (bd->data == NULL) {
-            goto error;
-        }
-        memcpy(bd->data, data, len);
-
-        body->first = body->last = bd;
+    while (len > 0) {
+        HtpBodyChunk *bd = body->last;
 
-        body->content_len_so_far = len;
-    } else {
-        bd = (HtpBodyChunk *)SCMalloc(sizeof(HtpBodyChunk));
-        if (bd == NULL)
-            goto error;
+        if (bd == NULL || bd->len == bd->size) {
+            bd = HtpBodyAddPage(body, len);
+            if (bd == NULL)
+                SCReturnInt(-1);
+        }
 
-        bd->len = len;
-        bd->stream_offset = body->content_len_so_far;
-        bd->next = NULL;
+        uint32_t copy = bd->size - bd->len;
+        if (copy > len)
+            copy = len;
 
-        bd->data = SCMalloc(len);
-        if (bd->data == NULL) {
-            goto error;
-        }
-        memcpy(bd->data, data, len);
+        memcpy(bd->data + bd->len, data, copy);
+        bd->len += copy;
+        body->content_len_so_far += copy;
 
-        body->last->next = bd;
-        body->last = bd;
+        SCLogDebug("Body %p; data %p, len %"PRIu32, body, bd->data, (uint32_t)bd->len);
 
-        body->content_len_so_far += len;
+        data += copy;
+        len -= copy;
     }
-    SCLogDebug("Body %p; data %p, len %"PRIu32, body, bd->data, (uint32_t)bd->len);
 
     SCReturnInt(0);
-
-error:
-    if (bd != NULL) {
-        if (bd->data != NULL) {
-            SCFree(bd->data);
-        }
-        SCFree(bd);
-    }
-    SCReturnInt(-1);
 }
 
 /**
@@ -182,18 +262,16 @@ void HtpBodyFree(HtpBody *body)
     prev = body->first;
     while (prev != NULL) {
         cur = prev->next;
-        if (prev->data != NULL)
-            SCFree(prev->data);
-        SCFree(prev);
+        HtpBodyFreePage(prev);
         prev = cur;
     }
     body->first = body->last = NULL;
 }
 
 /**
- * \brief Free request body chunks that are already fully parsed.
+ * \brief Free request body pages that are already fully inspected.
  *
- * \param htud pointer to the HtpTxUserData holding the body
+ * \param body pointer to the HtpBody holding the list
  *
  * \retval none
  */
@@ -220,7 +298,9 @@ void HtpBodyPrune(HtpBody *body)
                 "body->body_parsed %"PRIu64, cur->stream_offset, cur->len,
                 cur->stream_offset + cur->len, body->body_parsed);
 
-        if (cur->stream_offset >= body->body_inspected) {
+        /* pages are filled by later chunks, so only free them once
+         * all of their data is inspected */
+        if (cur->stream_offset + cur->len > body->body_inspected) {
             break;
         }
 
@@ -229,13 +309,148 @@ void HtpBodyPrune(HtpBody *body)
             body->last = next;
         }
 
-        if (cur->data != NULL) {
-            SCFree(cur->data);
-        }
-        SCFree(cur);
+        HtpBodyFreePage(cur);
 
         cur = next;
     }
 
     SCReturn;
 }
+
+#ifdef UNITTESTS
+/** \test appended chunks are stored contiguously in pages and pruning
+ *        frees whole pages only */
+static int HtpBodyTest01(void)
+{
+    int result = 0;
+    HtpBody body;
+    uint8_t data[1000];
+    uint32_t i;
+
+    memset(&body, 0x00, sizeof(body));
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)i;
+
+    /* first page is sized for the first chunk, so it holds 2 chunks and
+     * the 3rd is split over 2 pages. The 2nd page is twice as large and
+     * holds the rest */
+    for (i = 0; i < 5; i++) {
+        if (HtpBodyAppendChunk(NULL, &body, data, sizeof(data)) != 0) {
+            printf("append %u failed: ", i);
+            goto end;
+        }
+    }
+
+    HtpBodyChunk *cur = body.first;
+    if (cur == NULL || cur->len != cur->size ||
+        cur->size != 2048 - sizeof(HtpBodyChunk)) {
+        printf("first page not full: ");
+        goto end;
+    }
+    if (memcmp(cur->data, data, sizeof(data)) != 0 ||
+        memcmp(cur->data + sizeof(data), data, sizeof(data)) != 0) {
+        printf("data in first page not contiguous: ");
+        goto end;
+    }
+    if (cur->next == NULL || cur->next != body.last ||
+        cur->next->stream_offset != cur->len ||
+        cur->next->len != 5 * sizeof(data) - cur->len ||
+        body.content_len_so_far != 5 * sizeof(data)) {
+        printf("second page not set up correctly: ");
+        goto end;
+    }
+
+    /* page isn't fully inspected, so it should be kept */
+    body.body_parsed = 1;
+    body.body_inspected = cur->len - 1;
+    HtpBodyPrune(&body);
+    if (body.first != cur) {
+        printf("page freed while not fully inspected: ");
+        goto end;
+    }
+
+    body.body_inspected = cur->len;
+    HtpBodyPrune(&body);
+    if (body.first == NULL || body.first != body.last ||
+        body.first->stream_offset != body.body_inspected) {
+        printf("first page not pruned: ");
+        goto end;
+    }
+
+    body.body_inspected = body.content_len_so_far;
+    HtpBodyPrune(&body);
+    if (body.first != NULL || body.last != NULL) {
+        printf("pages not all pruned: ");
+        goto end;
+    }
+
+    /* appending after pruning everything starts a new page */
+    if (HtpBodyAppendChunk(NULL, &body, data, sizeof(data)) != 0 ||
+        body.first == NULL || body.first->stream_offset != 5 * sizeof(data)) {
+        printf("append after prune failed: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    HtpBodyFree(&body);
+    return result;
+}
+
+/** \test body pages are accounted against the memcap */
+static int HtpBodyTest02(void)
+{
+    int result = 0;
+    HtpBody body;
+    uint8_t data[1000];
+    uint64_t memuse = HtpBodyMemuse();
+
+    memset(&body, 0x00, sizeof(body));
+    memset(data, 0x41, sizeof(data));
+
+    /* small first chunk gets the smallest page */
+    if (HtpBodyAppendChunk(NULL, &body, data, 100) != 0 ||
+        body.first == NULL ||
+        body.first->size != HTP_BODY_PAGE_MIN_SIZE - sizeof(HtpBodyChunk)) {
+        printf("first page not sized to the first chunk: ");
+        goto end;
+    }
+    if (HtpBodyMemuse() != memuse + HTP_BODY_PAGE_MIN_SIZE) {
+        printf("memuse %"PRIu64" != %"PRIu64": ", HtpBodyMemuse(),
+                memuse + HTP_BODY_PAGE_MIN_SIZE);
+        goto end;
+    }
+
+    /* no room for a second page */
+    htp_body_memcap = HtpBodyMemuse() + HTP_BODY_PAGE_MIN_SIZE;
+    if (HtpBodyAppendChunk(NULL, &body, data, sizeof(data)) != -1) {
+        printf("append over the memcap didn't fail: ");
+        goto end;
+    }
+    if (body.first != body.last || body.first->len != body.first->size) {
+        printf("first page not filled before hitting the memcap: ");
+        goto end;
+    }
+
+    HtpBodyFree(&body);
+    if (HtpBodyMemuse() != memuse) {
+        printf("memuse %"PRIu64" != %"PRIu64" after free: ",
+                HtpBodyMemuse(), memuse);
+        goto end;
+    }
+
+    result = 1;
+end:
+    htp_body_memcap = 0;
+    HtpBodyFree(&body);
+    return result;
+}
+#endif /* UNITTESTS */
+
+void HtpBodyRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("HtpBodyTest01", HtpBodyTest01, 1);
+    UtRegisterTest("HtpBodyTest02", HtpBodyTest02, 1);
+#endif /* UNITTESTS */
+}
@@ -28,9 +28,12 @@
 #ifndef __APP_LAYER_HTP_BODY_H__
 #define __APP_LAYER_HTP_BODY_H__
 
+void HtpBodyConfig(void);
+uint64_t HtpBodyMemuse(void);
 int HtpBodyAppendChunk(HtpTxUserData *, HtpBody *, uint8_t *, uint32_t);
 void HtpBodyPrint(HtpBody *);
 void HtpBodyFree(HtpBody *);
 void HtpBodyPrune(HtpBody *);
+void HtpBodyRegisterTests(void);
 
 #endif /* __APP_LAYER_HTP_BODY_H__ */
@@ -2376,6 +2376,8 @@ static void HTPConfigure(void)
     HTPConfigParseParameters(&cfglist, ConfGetNode("libhtp.default-config"),
                              cfgtree);
 
+    HtpBodyConfig();
+
     /* Read server config and create a parser for each IP in radix tree */
     ConfNode *server_config = ConfGetNode("libhtp.server-config");
     SCLogDebug("LIBHTP Configuring %p", server_config);
@@ -2418,6 +2420,7 @@ void AppLayerHtpPrintStats(void) {
     SCMutexLock(&htp_state_mem_lock);
     SCLogInfo("htp memory %"PRIu64" (%"PRIu64")", htp_state_memuse, htp_state_memcnt);
     SCMutexUnlock(&htp_state_mem_lock);
+    SCLogInfo("htp body memory %"PRIu64, HtpBodyMemuse());
 #endif
 }
 
@@ -4823,6 +4826,7 @@ void HTPParserRegisterTests(void) {
     UtRegisterTest("HTPSegvTest01", HTPSegvTest01, 1);
 
     HTPFileParserRegisterTests();
+    HtpBodyRegisterTests();
 #endif /* UNITTESTS */
 }
 
@@ -143,12 +143,20 @@ typedef struct HTPCfgRec_ {
     uint32_t            response_inspect_window;
 } HTPCfgRec;
 
-/** Struct used to hold chunks of a body on a request */
+/** minimal size of the first page of a body, header included. Following
+ *  pages double in size up to HTP_BODY_PAGE_MAX_SIZE */
+#define HTP_BODY_PAGE_MIN_SIZE      256
+#define HTP_BODY_PAGE_MAX_SIZE      65536
+
+/** Struct used to hold chunks of a body on a request. A chunk is a page
+ *  that is filled by consecutive body callbacks, the data follows the
+ *  header in the same allocation */
 struct HtpBodyChunk_ {
     uint8_t *data;              /**< Pointer to the data of the chunk */
     struct HtpBodyChunk_ *next; /**< Pointer to the next chunk */
     uint64_t stream_offset;
     uint32_t len;               /**< Length of the chunk */
+    uint32_t size;              /**< Space for data in the page */
 } __attribute__((__packed__));
 typedef struct HtpBodyChunk_ HtpBodyChunk;
 
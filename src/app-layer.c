@@ -296,6 +296,8 @@ int AppLayerHandleUdp(AlpProtoDetectThreadCtx *dp_ctx, Flow *f, Packet *p)
         SCReturnInt(r);
     }
 
+    PACKET_PROFILING_APP_SAMPLE(dp_ctx, p);
+
     FLOWLOCK_WRLOCK(f);
 
     uint8_t flags = 0;
@@ -384,6 +384,11 @@ static void SCPerfInitOPCtx(void)
         exit(EXIT_FAILURE);
     }
 
+    if (SCMutexInit(&sc_perf_op_ctx->output_lock, NULL) != 0) {
+        SCLogError(SC_ERR_INITIALIZATION, "error initializing output mutex");
+        exit(EXIT_FAILURE);
+    }
+
     SCReturn;
 }
 
@@ -420,6 +425,8 @@ static void SCPerfReleaseOPCtx()
         pctmi = temp;
     }
 
+    SCMutexDestroy(&sc_perf_op_ctx->output_lock);
+
     SCFree(sc_perf_op_ctx);
     sc_perf_op_ctx = NULL;
 
@@ -913,12 +920,12 @@ static void SCPerfCopyCounterValue(SCPCAElem *pcae, int reset_lc)
             } else if (pc->type_q->type & SC_PERF_TYPE_Q_TIMEBASED) {
                 /* we have a timebased counter.  Awesome.  Time for some more processing */
                 TimeGet(&curr_ts);
-                pc->type_q->tbc_secs += ((curr_ts.tv_sec + curr_ts.tv_usec / 1000000.0) -
-                                         (pcae->ts.tv_sec + pcae->ts.tv_usec / 1000000.0));
+                pc->type_q->tbc_usecs += (curr_ts.tv_sec - pcae->ts.tv_sec) * 1000000LL +
+                                         (curr_ts.tv_usec - pcae->ts.tv_usec);
 
                 /* special treatment for timebased counters.  We add instead of
-                 * copying to the global counters.  The job of resetting the
-                 * global counters is done by the output function */
+                 * copying to the global counters.  They are never reset, the
+                 * output function uses the difference with its last output */
                 *((uint64_t *)pc->value->cvalue) += ui64_temp;
                 pcae->ui64_cnt = 0;
                 /* reset it to the current time */
@@ -945,12 +952,12 @@ static void SCPerfCopyCounterValue(SCPCAElem *pcae, int reset_lc)
             } else if (pc->type_q->type & SC_PERF_TYPE_Q_TIMEBASED) {
                 /* we have a timebased counter.  Awesome.  Time for some more processing */
                 TimeGet(&curr_ts);
-                pc->type_q->tbc_secs += ((curr_ts.tv_sec + curr_ts.tv_usec / 1000000.0) -
-                                         (pcae->ts.tv_sec + pcae->ts.tv_usec / 1000000.0));
+                pc->type_q->tbc_usecs += (curr_ts.tv_sec - pcae->ts.tv_sec) * 1000000LL +
+                                         (curr_ts.tv_usec - pcae->ts.tv_usec);
 
                 /* special treatment for timebased counters.  We add instead of
-                 * copying to the global counters.  The job of resetting the
-                 * global counters is done by the output function */
+                 * copying to the global counters.  They are never reset, the
+                 * output function uses the difference with its last output */
                 *((double *)pc->value->cvalue) += d_temp;
                 pcae->d_cnt = 0;
                 /* reset it to the current time */
@@ -969,14 +976,58 @@ static void SCPerfCopyCounterValue(SCPCAElem *pcae, int reset_lc)
 }
 
 /**
- * \brief Calculates counter value that should be sent as output
+ * \brief Copies the global counter values of a SCPerfContext to the snap
+ *        fields of its counters, for the output functions
+ *
+ *        The thread owning the context makes the sequence number odd while it
+ *        updates the global counters, see SCPerfUpdateCounterArray(). If it
+ *        was odd or has changed by the time the copy is done, the copy is
+ *        retried. So the copy is consistent, and the owning thread never
+ *        waits on the output.
+ *
+ * \param pctx Pointer to the SCPerfContext
+ */
+static void SCPerfSnapshotContext(SCPerfContext *pctx)
+{
+    SCPerfCounter *pc = NULL;
+    uint32_t seq = 0;
+
+    do {
+        while ((seq = pctx->seq) & 1)
+            ;
+        hw_barrier();
+
+        for (pc = pctx->head; pc != NULL; pc = pc->next) {
+            if (pc->value == NULL)
+                continue;
+
+            switch (pc->value->type) {
+                case SC_PERF_TYPE_UINT64:
+                    pc->snap.ui64_cnt = *((uint64_t *)pc->value->cvalue);
+
+                    break;
+                case SC_PERF_TYPE_DOUBLE:
+                    pc->snap.d_cnt = *((double *)pc->value->cvalue);
+
+                    break;
+            }
+            pc->snap_tbc_usecs = pc->type_q->tbc_usecs;
+        }
+
+        hw_barrier();
+    } while (pctx->seq != seq);
+
+    return;
+}
+
+/**
+ * \brief Calculates counter value that should be sent as output, from the
+ *        values copied by SCPerfSnapshotContext()
  *
  *        If we aren't dealing with timebased counters, we just return the
- *        the counter value.  In case of Timebased counters, if we haven't
- *        crossed the interval, we display the current value without any
- *        modifications.  If we have crossed the limit, we calculate the counter
- *        value for the time period and also return 1, to indicate that the
- *        counter value can be reset after use
+ *        the counter value.  Timebased counters are only added to by the
+ *        thread owning them, so we calculate the counter value for the
+ *        period since the last output from what was added during it
  *
  * \param pc Pointer to the PerfCounter for which the timebased counter has to
  *           be calculated
@@ -984,28 +1035,43 @@ static void SCPerfCopyCounterValue(SCPCAElem *pcae, int reset_lc)
 static void SCPerfOutputCalculateCounterValue(SCPerfCounter *pc, void *cvalue_op)
 {
     double divisor = 0;
+    uint64_t tbc_usecs = 0;
+
+    /* if we don't have a Timebased counter, we are out of here */
+    if ( !(pc->type_q->type & SC_PERF_TYPE_Q_TIMEBASED)) {
+        switch (pc->value->type) {
+            case SC_PERF_TYPE_UINT64:
+                *((uint64_t *)cvalue_op) = pc->snap.ui64_cnt;
+
+                break;
+            case SC_PERF_TYPE_DOUBLE:
+                *((double *)cvalue_op) = pc->snap.d_cnt;
+
+                break;
+        }
+
+        return;
+    }
 
     switch (pc->value->type) {
         case SC_PERF_TYPE_UINT64:
-            *((uint64_t *)cvalue_op) = *((uint64_t *)pc->value->cvalue);
+            *((uint64_t *)cvalue_op) = pc->snap.ui64_cnt - pc->out.ui64_cnt;
 
             break;
         case SC_PERF_TYPE_DOUBLE:
-            *((double *)cvalue_op) = *((double *)pc->value->cvalue);
+            *((double *)cvalue_op) = pc->snap.d_cnt - pc->out.d_cnt;
 
             break;
     }
 
-    /* if we don't have a Timebased counter, we are out of here */
-    if ( !(pc->type_q->type & SC_PERF_TYPE_Q_TIMEBASED))
-        return;
+    tbc_usecs = pc->snap_tbc_usecs - pc->out_tbc_usecs;
+    pc->out = pc->snap;
+    pc->out_tbc_usecs = pc->snap_tbc_usecs;
 
-    //if (pc->type_q->tbc_secs < pc->type_q->total_secs)
-    //    return;
+    if (tbc_usecs == 0)
+        return;
 
-    divisor = pc->type_q->tbc_secs/pc->type_q->total_secs;
-    divisor += ((double)(pc->type_q->tbc_secs % pc->type_q->total_secs)/
-                pc->type_q->total_secs);
+    divisor = (double)tbc_usecs / (pc->type_q->total_secs * 1000000.0);
 
     switch (pc->value->type) {
         case SC_PERF_TYPE_UINT64:
@@ -1018,10 +1084,6 @@ static void SCPerfOutputCalculateCounterValue(SCPerfCounter *pc, void *cvalue_op
             break;
     }
 
-    pc->type_q->tbc_secs = 0;
-    /* reset the local counter back to 0 */
-    memset(pc->value->cvalue, 0, pc->value->size);
-
     return;
 }
 
@@ -1087,7 +1149,7 @@ static int SCPerfOutputCounterFileIface()
             //    continue;
 
             while (tv != NULL) {
-                SCMutexLock(&tv->sc_perf_pctx.m);
+                SCPerfSnapshotContext(&tv->sc_perf_pctx);
                 pc = tv->sc_perf_pctx.head;
 
                 while (pc != NULL) {
@@ -1116,7 +1178,6 @@ static int SCPerfOutputCounterFileIface()
                     pc = pc->next;
                 }
 
-                SCMutexUnlock(&tv->sc_perf_pctx.m);
                 tv = tv->next;
             }
             fflush(sc_perf_op_ctx->fp);
@@ -1132,10 +1193,9 @@ static int SCPerfOutputCounterFileIface()
         memset(pc_heads, 0, pctmi->size * sizeof(SCPerfCounter *));
 
         for (u = 0; u < pctmi->size; u++) {
+            SCPerfSnapshotContext(pctmi->head[u]);
             pc_heads[u] = pctmi->head[u]->head;
 
-            SCMutexLock(&pctmi->head[u]->m);
-
             while(pc_heads[u] != NULL && strcmp(pctmi->tm_name, pc_heads[u]->name->tm_name)) {
                 pc_heads[u] = pc_heads[u]->next;
             }
@@ -1190,9 +1250,6 @@ static int SCPerfOutputCounterFileIface()
             }
         }
 
-        for (u = 0; u < pctmi->size; u++)
-            SCMutexUnlock(&pctmi->head[u]->m);
-
         pctmi = pctmi->next;
 
         SCFree(pc_heads);
@@ -1205,10 +1262,9 @@ static int SCPerfOutputCounterFileIface()
 
 #ifdef BUILD_UNIX_SOCKET
 /**
- * \brief The file output interface for the Perf Counter api
+ * \brief Fills the answer of the socket output interface
  */
-TmEcode SCPerfOutputCounterSocket(json_t *cmd,
-                               json_t *answer, void *data)
+static TmEcode SCPerfOutputCounterJson(json_t *answer)
 {
     ThreadVars *tv = NULL;
     SCPerfClubTMInst *pctmi = NULL;
@@ -1224,12 +1280,6 @@ TmEcode SCPerfOutputCounterSocket(json_t *cmd,
     uint32_t u = 0;
     int flag = 0;
 
-    if (sc_perf_op_ctx == NULL) {
-        json_object_set_new(answer, "message",
-                json_string("No performance counter context"));
-        return TM_ECODE_FAILED;
-    }
-
     if (sc_perf_op_ctx->club_tm == 0) {
         json_t *tm_array;
 
@@ -1248,7 +1298,7 @@ TmEcode SCPerfOutputCounterSocket(json_t *cmd,
 
 
             while (tv != NULL) {
-                SCMutexLock(&tv->sc_perf_pctx.m);
+                SCPerfSnapshotContext(&tv->sc_perf_pctx);
                 pc = tv->sc_perf_pctx.head;
                 json_t *jdata;
                 int filled = 0;
@@ -1257,7 +1307,6 @@ TmEcode SCPerfOutputCounterSocket(json_t *cmd,
                     json_decref(tm_array);
                     json_object_set_new(answer, "message",
                             json_string("internal error at json object creation"));
-                    SCMutexUnlock(&tv->sc_perf_pctx.m);
                     return TM_ECODE_FAILED;
                 }
 
@@ -1284,7 +1333,6 @@ TmEcode SCPerfOutputCounterSocket(json_t *cmd,
                     pc = pc->next;
                 }
 
-                SCMutexUnlock(&tv->sc_perf_pctx.m);
                 if (filled == 1) {
                     json_object_set_new(tm_array, tv->name, jdata);
                 }
@@ -1325,10 +1373,9 @@ TmEcode SCPerfOutputCounterSocket(json_t *cmd,
         memset(pc_heads, 0, pctmi->size * sizeof(SCPerfCounter *));
 
         for (u = 0; u < pctmi->size; u++) {
+            SCPerfSnapshotContext(pctmi->head[u]);
             pc_heads[u] = pctmi->head[u]->head;
 
-            SCMutexLock(&pctmi->head[u]->m);
-
             while(pc_heads[u] != NULL && strcmp(pctmi->tm_name, pc_heads[u]->name->tm_name)) {
                 pc_heads[u] = pc_heads[u]->next;
             }
@@ -1381,8 +1428,6 @@ TmEcode SCPerfOutputCounterSocket(json_t *cmd,
             }
         }
 
-        for (u = 0; u < pctmi->size; u++)
-            SCMutexUnlock(&pctmi->head[u]->m);
         if (filled == 1) {
             json_object_set_new(tm_array, pctmi->tm_name, jdata);
         }
@@ -1397,6 +1442,27 @@ TmEcode SCPerfOutputCounterSocket(json_t *cmd,
     return TM_ECODE_OK;
 }
 
+/**
+ * \brief The socket output interface for the Perf Counter api
+ */
+TmEcode SCPerfOutputCounterSocket(json_t *cmd,
+                               json_t *answer, void *data)
+{
+    TmEcode r;
+
+    if (sc_perf_op_ctx == NULL) {
+        json_object_set_new(answer, "message",
+                json_string("No performance counter context"));
+        return TM_ECODE_FAILED;
+    }
+
+    SCMutexLock(&sc_perf_op_ctx->output_lock);
+    r = SCPerfOutputCounterJson(answer);
+    SCMutexUnlock(&sc_perf_op_ctx->output_lock);
+
+    return r;
+}
+
 #endif /* BUILD_UNIX_SOCKET */
 
 /**
@@ -1913,7 +1979,10 @@ int SCPerfUpdateCounterArray(SCPerfCounterArray *pca, SCPerfContext *pctx,
 
     pcae = pca->head;
 
-    SCMutexLock(&pctx->m);
+    /* odd while we update, so SCPerfSnapshotContext() retries its copy */
+    pctx->seq++;
+    hw_barrier();
+
     pc = pctx->head;
 
     for (i = 1; i <= pca->size; i++) {
@@ -1932,7 +2001,8 @@ int SCPerfUpdateCounterArray(SCPerfCounterArray *pca, SCPerfContext *pctx,
         }
     }
 
-    SCMutexUnlock(&pctx->m);
+    hw_barrier();
+    pctx->seq++;
 
     pctx->perf_flag = 0;
 
@@ -1982,7 +2052,9 @@ void SCPerfOutputCounters()
 {
     switch (sc_perf_op_ctx->iface) {
         case SC_PERF_IFACE_FILE:
+            SCMutexLock(&sc_perf_op_ctx->output_lock);
             SCPerfOutputCounterFileIface();
+            SCMutexUnlock(&sc_perf_op_ctx->output_lock);
 
             break;
         case SC_PERF_IFACE_CONSOLE:
@@ -2533,6 +2605,7 @@ static int SCPerfTestIntervalQual16()
 
     SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
 
+    SCPerfSnapshotContext(&tv.sc_perf_pctx);
     SCPerfOutputCalculateCounterValue(tv.sc_perf_pctx.head, &d_temp);
 
     result &= (d_temp > 10 && d_temp < 11);
@@ -2567,6 +2640,7 @@ static int SCPerfTestIntervalQual17()
 
     SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
 
+    SCPerfSnapshotContext(&tv.sc_perf_pctx);
     SCPerfOutputCalculateCounterValue(tv.sc_perf_pctx.head, &d_temp);
 
     return (d_temp == 1050.0);
@@ -2615,6 +2689,7 @@ static int SCPerfTestIntervalQual18()
     /* forward the time 3 seconds */
     TimeSetIncrementTime(3);
 
+    SCPerfSnapshotContext(&tv.sc_perf_pctx);
     SCPerfOutputCalculateCounterValue(tv.sc_perf_pctx.head, &d_temp);
 
     result &= (d_temp == 13.5);
@@ -2635,6 +2710,7 @@ static int SCPerfTestIntervalQual18()
     /* forward the time 1 second */
     TimeSetIncrementTime(1);
 
+    SCPerfSnapshotContext(&tv.sc_perf_pctx);
     SCPerfOutputCalculateCounterValue(tv.sc_perf_pctx.head, &d_temp);
 
     result &= (d_temp == 6);
@@ -2646,12 +2722,82 @@ static int SCPerfTestIntervalQual18()
 
     SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
 
+    SCPerfSnapshotContext(&tv.sc_perf_pctx);
     SCPerfOutputCalculateCounterValue(tv.sc_perf_pctx.head, &d_temp);
 
     result &= (d_temp == 12.0);
 
     return result;
 }
+
+typedef struct SCPerfTestSnapshotCtx_ {
+    ThreadVars *tv;
+    SCPerfCounterArray *pca;
+    uint16_t id1;
+    uint16_t id2;
+    int updates;
+} SCPerfTestSnapshotCtx;
+
+static void *SCPerfTestSnapshotWriter(void *arg)
+{
+    SCPerfTestSnapshotCtx *ctx = (SCPerfTestSnapshotCtx *)arg;
+    int i;
+
+    for (i = 0; i < ctx->updates; i++) {
+        SCPerfCounterIncr(ctx->id1, ctx->pca);
+        SCPerfCounterIncr(ctx->id2, ctx->pca);
+        SCPerfUpdateCounterArray(ctx->pca, &ctx->tv->sc_perf_pctx, 0);
+    }
+    return NULL;
+}
+
+/** \test the output copy of the counters is consistent while the owning
+ *        thread keeps updating them */
+static int SCPerfTestSnapshot19()
+{
+    ThreadVars tv;
+    SCPerfTestSnapshotCtx ctx;
+    pthread_t writer;
+    int result = 1;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&ctx, 0, sizeof(ctx));
+
+    ctx.tv = &tv;
+    ctx.updates = 100000;
+    ctx.id1 = SCPerfRegisterCounter("t1", "c1", SC_PERF_TYPE_UINT64, NULL,
+                                    &tv.sc_perf_pctx);
+    ctx.id2 = SCPerfRegisterCounter("t2", "c2", SC_PERF_TYPE_UINT64, NULL,
+                                    &tv.sc_perf_pctx);
+    ctx.pca = SCPerfGetAllCountersArray(&tv, &tv.sc_perf_pctx);
+
+    if (pthread_create(&writer, NULL, SCPerfTestSnapshotWriter, &ctx) != 0)
+        return 0;
+
+    uint64_t last = 0;
+    while (last < (uint64_t)ctx.updates) {
+        SCPerfSnapshotContext(&tv.sc_perf_pctx);
+
+        uint64_t v1 = tv.sc_perf_pctx.head->snap.ui64_cnt;
+        uint64_t v2 = tv.sc_perf_pctx.head->next->snap.ui64_cnt;
+        if (v1 != v2 || v1 < last) {
+            printf("inconsistent copy %"PRIu64" %"PRIu64" (last %"PRIu64"): ",
+                    v1, v2, last);
+            result = 0;
+            break;
+        }
+        last = v1;
+    }
+
+    pthread_join(writer, NULL);
+
+    result &= ((tv.sc_perf_pctx.seq & 1) == 0);
+
+    SCPerfReleasePerfCounterS(tv.sc_perf_pctx.head);
+    SCPerfReleasePCA(ctx.pca);
+
+    return result;
+}
 #endif
 
 void SCPerfRegisterTests()
@@ -2676,5 +2822,6 @@ void SCPerfRegisterTests()
     UtRegisterTest("SCPerfTestIntervalQual16", SCPerfTestIntervalQual16, 1);
     UtRegisterTest("SCPerfTestIntervalQual17", SCPerfTestIntervalQual17, 1);
     UtRegisterTest("SCPerfTestIntervalQual18", SCPerfTestIntervalQual18, 1);
+    UtRegisterTest("SCPerfTestSnapshot19", SCPerfTestSnapshot19, 1);
 #endif
 }
@@ -96,10 +96,18 @@ typedef struct SCPerfCounterTypeQ_ {
 
     /* the time interval that corresponds to the value stored for this counter.
      * Used for time_based_counters(tbc).  This represents the time period over
-     * which the value in this counter was accumulated. */
-    uint8_t tbc_secs;
+     * which the value in this counter was accumulated, in usecs. */
+    uint64_t tbc_usecs;
 } SCPerfCounterTypeQ;
 
+/**
+ * \brief Copy of a counter value, used by the output functions
+ */
+typedef union SCPerfCounterSnap_ {
+    uint64_t ui64_cnt;
+    double d_cnt;
+} SCPerfCounterSnap;
+
 /**
  * \brief Container to hold the counter variable
  */
@@ -122,6 +130,16 @@ typedef struct SCPerfCounter_ {
     /* counter qualifier */
     SCPerfCounterTypeQ *type_q;
 
+    /* copy of the value and the tbc_usecs, taken by the output functions while
+     * the owning thread keeps updating them */
+    SCPerfCounterSnap snap;
+    uint64_t snap_tbc_usecs;
+
+    /* snap values at the last output. Timebased counters are only added to,
+     * the output is the difference with these */
+    SCPerfCounterSnap out;
+    uint64_t out_tbc_usecs;
+
     /* the next perfcounter for this tv's tm instance */
     struct SCPerfCounter_ *next;
 } SCPerfCounter;
@@ -139,8 +157,9 @@ typedef struct SCPerfContext_ {
     /* holds the total no of counters already assigned for this perf context */
     uint16_t curr_id;
 
-    /* mutex to prevent simultaneous access during update_counter/output_stat */
-    SCMutex m;
+    /* sequence number, odd while the owning thread updates the counters.
+     * Lets the output functions copy them without a lock */
+    volatile uint32_t seq;
 } SCPerfContext;
 
 /**
@@ -213,6 +232,10 @@ typedef struct SCPerfOPIfaceContext_ {
 
     SCPerfClubTMInst *pctmi;
     SCMutex pctmi_lock;
+
+    /* serializes the output functions, which keep per counter state. Never
+     * taken by the threads updating the counters */
+    SCMutex output_lock;
 } SCPerfOPIfaceContext;
 
 /* the initialization functions */
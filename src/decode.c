@@ -53,6 +53,7 @@
 #include "util-debug.h"
 #include "util-mem.h"
 #include "app-layer-detect-proto.h"
+#include "defrag-hash.h"
 #include "tm-threads.h"
 #include "util-error.h"
 #include "util-print.h"
@@ -362,6 +363,10 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
                                                            SC_PERF_TYPE_DOUBLE, "NULL");
     dtv->counter_max_pkt_size = SCPerfTVRegisterMaxCounter("decoder.max_pkt_size", tv,
                                                            SC_PERF_TYPE_UINT64, "NULL");
+    dtv->counter_pkt_pool_depth = SCPerfTVRegisterCounter("packetpool.depth", tv,
+                                                 SC_PERF_TYPE_UINT64, "NULL");
+    dtv->counter_pkt_pool_starved = SCPerfTVRegisterCounter("packetpool.starved", tv,
+                                                 SC_PERF_TYPE_UINT64, "NULL");
 
     dtv->counter_defrag_ipv4_fragments =
         SCPerfTVRegisterCounter("defrag.ipv4.fragments", tv,
@@ -429,6 +434,20 @@ DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *tv) {
     return dtv;
 }
 
+/** \brief Free DecodeThreadVars, to be called from the decode thread's
+ *         deinit. Its defrag trackers and frags are handed back. */
+void DecodeThreadVarsFree(ThreadVars *tv, DecodeThreadVars *dtv) {
+    if (dtv == NULL)
+        return;
+
+    AlpProtoDeFinalize2Thread(&dtv->udp_dp_ctx);
+
+    DefragThreadCtxRelease(dtv->defrag_tctx);
+    dtv->defrag_tctx = NULL;
+
+    SCFree(dtv);
+}
+
 
 /**
  * \brief Set data for Packet and set length when zeo copy is used
@@ -59,6 +59,8 @@ enum {
 
 #include "action-globals.h"
 
+#include "util-checksum-simd.h"
+
 #include "decode-ethernet.h"
 #include "decode-gre.h"
 #include "decode-ppp.h"
@@ -324,6 +326,9 @@ typedef struct PktProfilingAppData_ {
 
 /** \brief Per pkt stats storage */
 typedef struct PktProfiling_ {
+    /** number of packets this profiled packet stands for, 0 if the
+     *  packet is not sampled */
+    uint32_t weight;
     uint64_t ticks_start;
     uint64_t ticks_end;
 
@@ -497,6 +502,10 @@ typedef struct Packet_
                            * It should always point to the lowest
                            * packet in a encapsulated packet */
 
+    /* per thread packet pool this packet was taken into, NULL if it
+     * belongs to the shared ringbuffer */
+    struct PktPool_ *pool;
+
     /* required for cuda support */
 #ifdef __SC_CUDA_SUPPORT__
     /* indicates if the cuda mpm would be conducted or a normal cpu mpm would
@@ -752,7 +761,17 @@ typedef struct AlpProtoDetectThreadCtx_ {
 
     void *alproto_local_storage[ALPROTO_MAX];
 
+    /** thread the ctx belongs to, for the detection counters */
+    struct ThreadVars_ *tv;
+    /** per proto: flows detected, and the avg stream bytes, passes and
+     *  cpu ticks it took */
+    uint16_t counter_detect[ALPROTO_MAX];
+    uint16_t counter_detect_bytes[ALPROTO_MAX];
+    uint16_t counter_detect_passes[ALPROTO_MAX];
+    uint16_t counter_detect_ticks[ALPROTO_MAX];
+
 #ifdef PROFILING
+    uint32_t profile_weight;    /**< weight of the packet being handled */
     uint64_t ticks_start;
     uint64_t ticks_end;
     uint64_t ticks_spent;
@@ -795,6 +814,10 @@ typedef struct DecodeThreadVars_
     uint16_t counter_avg_pkt_size;
     uint16_t counter_max_pkt_size;
 
+    /** packet pool stats of the capture thread */
+    uint16_t counter_pkt_pool_depth;
+    uint16_t counter_pkt_pool_starved;
+
     /** frag stats - defrag runs in the context of the decoder. */
     uint16_t counter_defrag_ipv4_fragments;
     uint16_t counter_defrag_ipv4_reassembled;
@@ -803,6 +826,9 @@ typedef struct DecodeThreadVars_
     uint16_t counter_defrag_ipv6_reassembled;
     uint16_t counter_defrag_ipv6_timeouts;
     uint16_t counter_defrag_max_hit;
+
+    /** frag cache and private trackers, set up on the first fragment */
+    struct DefragThreadCtx_ *defrag_tctx;
 } DecodeThreadVars;
 
 /**
@@ -1155,6 +1181,7 @@ int PacketSetData(Packet *p, uint8_t *pktdata, int pktlen);
 int PacketCopyDataOffset(Packet *p, int offset, uint8_t *data, int datalen);
 
 DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *tv);
+void DecodeThreadVarsFree(ThreadVars *tv, DecodeThreadVars *);
 
 /* decoder functions */
 void DecodeEthernet(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
@@ -74,7 +74,7 @@ void DefragTrackerFree(DefragTracker *dt) {
 #define DefragTrackerDecrUsecnt(dt) \
     SC_ATOMIC_SUB((dt)->use_cnt, 1)
 
-static void DefragTrackerInit(DefragTracker *dt, Packet *p) {
+static void DefragTrackerInitKey(DefragTracker *dt, Packet *p) {
     /* copy address */
     COPY_ADDRESS(&p->src, &dt->src_addr);
     COPY_ADDRESS(&p->dst, &dt->dst_addr);
@@ -87,7 +87,13 @@ static void DefragTrackerInit(DefragTracker *dt, Packet *p) {
         dt->af = AF_INET6;
     }
     dt->policy = DefragGetOsPolicy(p);
+    dt->seen_last = 0;
+    dt->remove = 0;
     TAILQ_INIT(&dt->frags);
+}
+
+static void DefragTrackerInit(DefragTracker *dt, Packet *p) {
+    DefragTrackerInitKey(dt, p);
     (void) DefragTrackerIncrUsecnt(dt);
 }
 
@@ -129,6 +135,8 @@ void DefragInitConfig(char quiet)
     SC_ATOMIC_INIT(defrag_memuse);
     SC_ATOMIC_INIT(defragtracker_prune_idx);
     DefragTrackerQueueInit(&defragtracker_spare_q);
+    defrag_thread_ctxs = NULL;
+    SCMutexInit(&defrag_thread_ctxs_lock, NULL);
 
     unsigned int seed = RandomTimePreseed();
     /* set defaults */
@@ -168,9 +176,14 @@ void DefragInitConfig(char quiet)
             defrag_config.prealloc = configval;
         }
     }
+    int thread_local = 0;
+    if (ConfGetBool("defrag.thread-local", &thread_local) == 1 && thread_local) {
+        defrag_config.thread_local = 1;
+    }
     SCLogDebug("DefragTracker config from suricata.yaml: memcap: %"PRIu64", hash-size: "
-               "%"PRIu32", prealloc: %"PRIu32, defrag_config.memcap,
-               defrag_config.hash_size, defrag_config.prealloc);
+               "%"PRIu32", prealloc: %"PRIu32", thread-local: %"PRIu8,
+               defrag_config.memcap, defrag_config.hash_size,
+               defrag_config.prealloc, defrag_config.thread_local);
 
     /* alloc hash memory */
     uint64_t hash_size = defrag_config.hash_size * sizeof(DefragTrackerHashRow);
@@ -203,7 +216,10 @@ void DefragInitConfig(char quiet)
                   (uintmax_t)sizeof(DefragTrackerHashRow));
     }
 
-    if ((ConfGet("defrag.prealloc", &conf_val)) == 1)
+    /* with thread local hashes the trackers are allocated on demand by
+     * the packet threads, the global hash only serves callers without a
+     * thread ctx */
+    if (!defrag_config.thread_local && (ConfGet("defrag.prealloc", &conf_val)) == 1)
     {
         if (ConfValIsTrue(conf_val)) {
             /* pre allocate defrag trackers */
@@ -238,6 +254,124 @@ void DefragInitConfig(char quiet)
     return;
 }
 
+/** \brief Set up the defrag state of a packet thread
+ *
+ *  Called by a packet thread on its first fragment. The frag cache is
+ *  always used. With defrag.thread-local the thread also gets a private
+ *  tracker hash of defrag.hash-size rows, counted against defrag.memcap.
+ *
+ *  \retval dt thread ctx or NULL on alloc failure
+ */
+DefragThreadCtx *DefragThreadCtxRegister(void)
+{
+    DefragThreadCtx *dt = SCMalloc(sizeof(DefragThreadCtx));
+    if (unlikely(dt == NULL))
+        return NULL;
+    memset(dt, 0, sizeof(DefragThreadCtx));
+    SCHandoffInit(&dt->handoff);
+    DefragTrackerQueueInit(&dt->spare_q);
+
+    if (defrag_config.thread_local) {
+        uint64_t hash_size = defrag_config.hash_size * sizeof(DefragTrackerHashRow);
+        if (!(DEFRAG_CHECK_MEMCAP(hash_size))) {
+            SCLogError(SC_ERR_DEFRAG_INIT, "allocating thread local defrag "
+                    "hash failed: max defrag memcap reached. Memcap %"PRIu64", "
+                    "Memuse %"PRIu64". Falling back to the global defrag hash.",
+                    defrag_config.memcap,
+                    ((uint64_t)SC_ATOMIC_GET(defrag_memuse) + hash_size));
+        } else {
+            dt->hash = SCCalloc(defrag_config.hash_size, sizeof(DefragTrackerHashRow));
+            if (dt->hash != NULL)
+                (void) SC_ATOMIC_ADD(defrag_memuse, hash_size);
+        }
+    }
+
+    SCMutexLock(&defrag_thread_ctxs_lock);
+    dt->id = (defrag_thread_ctxs != NULL) ? defrag_thread_ctxs->id + 1 : 0;
+    dt->next = defrag_thread_ctxs;
+    defrag_thread_ctxs = dt;
+    SCMutexUnlock(&defrag_thread_ctxs_lock);
+
+    SCLogDebug("defrag thread ctx %"PRIu16" set up, %s tracker hash",
+            dt->id, dt->hash ? "private" : "global");
+    return dt;
+}
+
+/** \brief Make sure a thread doesn't hold on to too many spare trackers.
+ *
+ *  Only to be called by the thread owning the ctx.
+ */
+void DefragPartitionUpdateSpareTrackers(DefragThreadCtx *dt)
+{
+    while (dt->spare_q.len > defrag_config.prealloc) {
+        DefragTracker *t = DefragTrackerDequeue(&dt->spare_q);
+        if (t == NULL)
+            break;
+
+        DefragTrackerFree(t);
+    }
+}
+
+/** \brief free a thread ctx, its trackers and its frag cache
+ *  \warning Not thread safe */
+static void DefragThreadCtxFree(DefragThreadCtx *dt)
+{
+    DefragTracker *t;
+    uint32_t u;
+
+    while ((t = DefragTrackerDequeue(&dt->spare_q))) {
+        DefragTrackerFree(t);
+    }
+
+    if (dt->hash != NULL) {
+        for (u = 0; u < defrag_config.hash_size; u++) {
+            t = dt->hash[u].head;
+            while (t) {
+                DefragTracker *n = t->hnext;
+                DefragTrackerFree(t);
+                t = n;
+            }
+        }
+        SCFree(dt->hash);
+        (void) SC_ATOMIC_SUB(defrag_memuse, defrag_config.hash_size * sizeof(DefragTrackerHashRow));
+    }
+    DefragTrackerQueueDestroy(&dt->spare_q);
+
+    DefragFragCacheFlush(dt);
+    SCHandoffDestroy(&dt->handoff);
+    SCFree(dt);
+}
+
+/** \brief Remove a thread ctx from the list and free it
+ *
+ *  Called when the owning thread goes away. Its trackers and frags are
+ *  handed back to the memcap and the frag pool.
+ *
+ *  \param dt thread ctx, no longer used by its owner
+ */
+void DefragThreadCtxRelease(DefragThreadCtx *dt)
+{
+    int found = 0;
+
+    if (dt == NULL)
+        return;
+
+    SCMutexLock(&defrag_thread_ctxs_lock);
+    DefragThreadCtx **pdt = &defrag_thread_ctxs;
+    for ( ; *pdt != NULL; pdt = &(*pdt)->next) {
+        if (*pdt == dt) {
+            *pdt = dt->next;
+            found = 1;
+            break;
+        }
+    }
+    SCMutexUnlock(&defrag_thread_ctxs_lock);
+
+    /* already gone if the engine was shut down before the thread */
+    if (found)
+        DefragThreadCtxFree(dt);
+}
+
 /** \brief print some defrag stats
  *  \warning Not thread safe */
 static void DefragTrackerPrintStats (void)
@@ -278,6 +412,14 @@ void DefragHashShutdown(void)
     (void) SC_ATOMIC_SUB(defrag_memuse, defrag_config.hash_size * sizeof(DefragTrackerHashRow));
     DefragTrackerQueueDestroy(&defragtracker_spare_q);
 
+    /* free the thread ctxs, their frags go back to the frag pool */
+    while (defrag_thread_ctxs != NULL) {
+        DefragThreadCtx *tctx = defrag_thread_ctxs;
+        defrag_thread_ctxs = tctx->next;
+        DefragThreadCtxFree(tctx);
+    }
+    SCMutexDestroy(&defrag_thread_ctxs_lock);
+
     SC_ATOMIC_DESTROY(defragtracker_prune_idx);
     SC_ATOMIC_DESTROY(defrag_memuse);
     SC_ATOMIC_DESTROY(defragtracker_counter);
@@ -697,3 +839,106 @@ static DefragTracker *DefragTrackerGetUsedDefragTracker(void) {
 }
 
 
+
+/** \internal
+ *  \brief Get a tracker from a thread local hash to reuse.
+ *
+ *  Called when the thread has no spare trackers and the memcap is reached.
+ *  Like DefragTrackerGetUsedDefragTracker(), but as only the owner touches
+ *  the hash nothing is locked, and the frags go to the thread's cache.
+ *
+ *  \retval t tracker or NULL
+ */
+static DefragTracker *DefragTrackerGetUsedFromPartition(DefragThreadCtx *dt)
+{
+    uint32_t cnt = defrag_config.hash_size;
+
+    while (cnt--) {
+        if (++dt->prune_idx >= defrag_config.hash_size)
+            dt->prune_idx = 0;
+
+        DefragTrackerHashRow *hb = &dt->hash[dt->prune_idx];
+        DefragTracker *t = hb->tail;
+        if (t == NULL)
+            continue;
+
+        /* remove from the hash */
+        if (t->hprev != NULL)
+            t->hprev->hnext = NULL;
+        if (hb->head == t)
+            hb->head = NULL;
+        hb->tail = t->hprev;
+
+        t->hnext = NULL;
+        t->hprev = NULL;
+
+        DefragTrackerReturnFrags(dt, t);
+        return t;
+    }
+
+    return NULL;
+}
+
+/**
+ *  \brief Get a tracker from a thread local hash
+ *
+ *  Thread local counterpart of DefragGetTrackerFromHash(). The hash, its
+ *  trackers and their frags are only ever touched by the owning thread,
+ *  so no row or tracker locks are taken and use_cnt is not used.
+ *
+ *  \param dt thread ctx with a private hash, owned by the calling thread
+ *  \param p fragment
+ *
+ *  \retval t *unlocked* tracker or NULL
+ */
+DefragTracker *DefragGetTrackerFromPartition(DefragThreadCtx *dt, Packet *p)
+{
+    uint32_t key = DefragHashGetKey(p);
+    DefragTrackerHashRow *hb = &dt->hash[key];
+    DefragTracker *t;
+
+    for (t = hb->head; t != NULL; t = t->hnext) {
+        if (DefragTrackerCompare(t, p) == 0)
+            continue;
+
+        /* put it on top of the hash list -- this rewards active trackers */
+        if (t != hb->head) {
+            t->hprev->hnext = t->hnext;
+            if (t->hnext != NULL)
+                t->hnext->hprev = t->hprev;
+            else
+                hb->tail = t->hprev;
+
+            t->hprev = NULL;
+            t->hnext = hb->head;
+            hb->head->hprev = t;
+            hb->head = t;
+        }
+        return t;
+    }
+
+    /* not found, get a new one: spare queue, new alloc or reuse */
+    t = DefragTrackerDequeue(&dt->spare_q);
+    if (t == NULL)
+        t = DefragTrackerAlloc();
+    if (t != NULL) {
+        (void) SC_ATOMIC_ADD(defragtracker_counter, 1);
+    } else {
+        /* memcap reached, a reused tracker is still counted as active */
+        t = DefragTrackerGetUsedFromPartition(dt);
+        if (t == NULL)
+            return NULL;
+    }
+
+    DefragTrackerInitKey(t, p);
+    t->timeout = 0;
+
+    t->hprev = NULL;
+    t->hnext = hb->head;
+    if (hb->head != NULL)
+        hb->head->hprev = t;
+    else
+        hb->tail = t;
+    hb->head = t;
+    return t;
+}
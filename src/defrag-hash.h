@@ -26,6 +26,8 @@
 
 #include "decode.h"
 #include "defrag.h"
+#include "defrag-queue.h"
+#include "util-handoff.h"
 
 /** Spinlocks or Mutex for the flow buckets. */
 //#define DRLOCK_SPIN
@@ -72,8 +74,34 @@ typedef struct DefragConfig_ {
     uint32_t hash_rand;
     uint32_t hash_size;
     uint32_t prealloc;
+    /** give each packet thread a private tracker hash (defrag.thread-local) */
+    uint8_t thread_local;
 } DefragConfig;
 
+/**
+ * Per packet thread defrag state. Only ever touched by the thread that
+ * registered it, so none of it is locked. Once the owner went idle the
+ * flow manager takes it over through the handoff to time it out.
+ */
+typedef struct DefragThreadCtx_ {
+    SCHandoff handoff;          /**< owner vs flow manager */
+
+    Frag *frag_cache;           /**< spare frags, linked through next */
+    uint32_t frag_cache_len;
+
+    DefragTrackerHashRow *hash; /**< private trackers, defrag.hash-size rows,
+                                 *   NULL unless defrag.thread-local is set */
+    DefragTrackerQueue spare_q; /**< spare trackers of the private hash */
+
+    uint32_t sweep_idx;         /**< next row to check for timeouts */
+    uint32_t sweep_left;        /**< rows left to check this second */
+    int32_t sweep_sec;          /**< second the current sweep was started */
+    uint32_t prune_idx;         /**< where the last prune left off */
+
+    uint16_t id;
+    struct DefragThreadCtx_ *next;
+} DefragThreadCtx;
+
 /** \brief check if a memory alloc would fit in the memcap
  *
  *  \param size memory allocation size to check
@@ -85,6 +113,8 @@ typedef struct DefragConfig_ {
     ((((uint64_t)SC_ATOMIC_GET(defrag_memuse) + (uint64_t)(size)) <= defrag_config.memcap))
 
 DefragConfig defrag_config;
+DefragThreadCtx *defrag_thread_ctxs;
+SCMutex defrag_thread_ctxs_lock;
 SC_ATOMIC_DECLARE(unsigned long long int,defrag_memuse);
 SC_ATOMIC_DECLARE(unsigned int,defragtracker_counter);
 SC_ATOMIC_DECLARE(unsigned int,defragtracker_prune_idx);
@@ -99,5 +129,10 @@ void DefragTrackerClearMemory(DefragTracker *);
 void DefragTrackerMoveToSpare(DefragTracker *);
 uint32_t DefragTrackerSpareQueueGetSize(void);
 
+DefragThreadCtx *DefragThreadCtxRegister(void);
+void DefragThreadCtxRelease(DefragThreadCtx *);
+DefragTracker *DefragGetTrackerFromPartition(DefragThreadCtx *, Packet *);
+void DefragPartitionUpdateSpareTrackers(DefragThreadCtx *);
+
 #endif /* __DEFRAG_HASH_H__ */
 
@@ -24,6 +24,7 @@
 #include "suricata-common.h"
 #include "defrag.h"
 #include "defrag-hash.h"
+#include "defrag-timeout.h"
 
 uint32_t DefragTrackerGetSpareCount(void) {
     return DefragTrackerSpareQueueGetSize();
@@ -118,6 +119,8 @@ static uint32_t DefragTrackerHashRowTimeout(DefragTrackerHashRow *hb, DefragTrac
 /**
  *  \brief time out tracker from the hash
  *
+ *  Also covers the thread ctxs whose owner went idle.
+ *
  *  \param ts timestamp
  *
  *  \retval cnt number of timed out tracker
@@ -145,6 +148,142 @@ uint32_t DefragTimeoutHash(struct timeval *ts) {
         DRLOCK_UNLOCK(hb);
     }
 
+    /* the private hashes of threads that went quiet */
+    cnt += DefragTimeoutIdleThreadCtxs(ts);
+    return cnt;
+}
+
+
+/** rows of a thread local tracker hash checked per call */
+#define DEFRAG_PARTITION_SWEEP_BATCH 64
+
+/**
+ *  \internal
+ *
+ *  \brief check all trackers in a row of a thread local tracker hash
+ *
+ *  \param dt thread ctx *LOCKED*
+ *  \param hb tracker hash row of the ctx
+ *  \param ts timestamp
+ *
+ *  \retval cnt timed out trackers
+ */
+static uint32_t DefragPartitionRowTimeout(DefragThreadCtx *dt,
+        DefragTrackerHashRow *hb, struct timeval *ts)
+{
+    uint32_t cnt = 0;
+
+    DefragTracker *t = hb->tail;
+    while (t != NULL) {
+        DefragTracker *prev_t = t->hprev;
+
+        if (DefragTrackerTimedOut(t, ts) == 1) {
+            if (t->hprev != NULL)
+                t->hprev->hnext = t->hnext;
+            if (t->hnext != NULL)
+                t->hnext->hprev = t->hprev;
+            if (hb->head == t)
+                hb->head = t->hnext;
+            if (hb->tail == t)
+                hb->tail = t->hprev;
+
+            t->hnext = NULL;
+            t->hprev = NULL;
+
+            DefragTrackerReturnFrags(dt, t);
+            DefragTrackerEnqueue(&dt->spare_q, t);
+            (void) SC_ATOMIC_SUB(defragtracker_counter, 1);
+            cnt++;
+        }
+
+        t = prev_t;
+    }
+
+    return cnt;
+}
+
+/**
+ *  \brief time out trackers from a thread local tracker hash
+ *
+ *  Called by the thread owning the hash for every fragment it sees. Each
+ *  call checks at most DEFRAG_PARTITION_SWEEP_BATCH rows and every second
+ *  a new pass over the hash is started. The owner holds the ctx lock, which
+ *  only the flow manager competes for once the owner went idle.
+ *
+ *  \param dt thread ctx owned by the calling thread *LOCKED*
+ *  \param ts timestamp of the current packet
+ *
+ *  \retval cnt number of timed out trackers
+ */
+uint32_t DefragTimeoutPartition(DefragThreadCtx *dt, struct timeval *ts) {
+    uint32_t cnt = 0;
+
+    if (dt->sweep_sec != (int32_t)ts->tv_sec) {
+        dt->sweep_sec = (int32_t)ts->tv_sec;
+        dt->sweep_left = defrag_config.hash_size;
+    }
+    if (dt->sweep_left == 0)
+        return 0;
+
+    uint32_t batch = DEFRAG_PARTITION_SWEEP_BATCH;
+    if (batch > dt->sweep_left)
+        batch = dt->sweep_left;
+    dt->sweep_left -= batch;
+
+    while (batch--) {
+        DefragTrackerHashRow *hb = &dt->hash[dt->sweep_idx];
+        if (++dt->sweep_idx >= defrag_config.hash_size)
+            dt->sweep_idx = 0;
+
+        cnt += DefragPartitionRowTimeout(dt, hb, ts);
+    }
+
+    if (cnt > 0)
+        DefragPartitionUpdateSpareTrackers(dt);
     return cnt;
 }
 
+/** seconds without fragments after which the flow manager takes over
+ *  timing out a thread ctx from its owner */
+#define DEFRAG_THREAD_IDLE_SEC 2
+
+/**
+ *  \brief time out the trackers of thread ctxs whose owner went idle
+ *
+ *  Owners only time out their private hash when they get fragments. For
+ *  an owner that didn't get any for DEFRAG_THREAD_IDLE_SEC we do a full
+ *  pass ourselves, if the owner isn't working on the ctx, and hand its
+ *  cached frags back to the frag pool.
+ *
+ *  \param ts timestamp
+ *
+ *  \retval cnt number of timed out trackers
+ */
+uint32_t DefragTimeoutIdleThreadCtxs(struct timeval *ts) {
+    uint32_t cnt = 0;
+    uint32_t u;
+
+    SCMutexLock(&defrag_thread_ctxs_lock);
+    DefragThreadCtx *dt = defrag_thread_ctxs;
+    for ( ; dt != NULL; dt = dt->next) {
+        if (SCHandoffSweepTry(&dt->handoff, (uint32_t)ts->tv_sec,
+                    DEFRAG_THREAD_IDLE_SEC) == 0)
+            continue;
+
+        if (dt->hash != NULL) {
+            uint32_t part_cnt = 0;
+            for (u = 0; u < defrag_config.hash_size; u++) {
+                part_cnt += DefragPartitionRowTimeout(dt, &dt->hash[u], ts);
+            }
+            if (part_cnt > 0)
+                DefragPartitionUpdateSpareTrackers(dt);
+            cnt += part_cnt;
+        }
+        DefragFragCacheFlush(dt);
+
+        SCHandoffSweepDone(&dt->handoff);
+    }
+    SCMutexUnlock(&defrag_thread_ctxs_lock);
+
+    return cnt;
+}
@@ -24,7 +24,11 @@
 #ifndef __DEFRAG_TIMEOUT_H__
 #define __DEFRAG_TIMEOUT_H__
 
+struct DefragThreadCtx_;
+
 uint32_t DefragTimeoutHash(struct timeval *ts);
+uint32_t DefragTimeoutPartition(struct DefragThreadCtx_ *, struct timeval *ts);
+uint32_t DefragTimeoutIdleThreadCtxs(struct timeval *ts);
 
 uint32_t DefragGetSpareCount(void);
 uint32_t DefragGetActiveCount(void);
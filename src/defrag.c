@@ -53,6 +53,7 @@
 #include "defrag.h"
 #include "defrag-hash.h"
 #include "defrag-queue.h"
+#include "defrag-timeout.h"
 
 #ifdef UNITTESTS
 #include "util-unittest.h"
@@ -61,6 +62,10 @@
 #define DEFAULT_DEFRAG_HASH_SIZE 0xffff
 #define DEFAULT_DEFRAG_POOL_SIZE 0xffff
 
+/** Number of frags moved between a thread's frag cache and the global
+ *  frag pool at once. */
+#define DEFRAG_FRAG_CACHE_BATCH 32
+
 /**
  * Default timeout (in seconds) before a defragmentation tracker will
  * be released.
@@ -161,6 +166,203 @@ DefragTrackerFreeFrags(DefragTracker *tracker)
     SCMutexUnlock(&defrag_context->frag_pool_lock);
 }
 
+/**
+ * \brief Reset a frag for reuse from a thread's frag cache.
+ *
+ * Packet sized buffers are kept, so the next fragment can be copied in
+ * without an allocation.
+ */
+static void
+DefragFragRecycle(Frag *frag)
+{
+    uint8_t *pkt = frag->pkt;
+    uint32_t pkt_size = frag->pkt_size;
+
+    if (pkt != NULL && pkt_size > default_packet_size) {
+        SCFree(pkt);
+        pkt = NULL;
+        pkt_size = 0;
+    }
+    memset(frag, 0, sizeof(*frag));
+    frag->pkt = pkt;
+    frag->pkt_size = pkt_size;
+}
+
+/**
+ * \brief Make sure a frag's buffer can hold len bytes.
+ *
+ * \retval 0 on success, -1 on allocation failure.
+ */
+static int
+DefragFragSetupBuffer(Frag *frag, uint32_t len)
+{
+    if (frag->pkt != NULL) {
+        if (frag->pkt_size >= len)
+            return 0;
+        SCFree(frag->pkt);
+    }
+
+    uint32_t size = (len > default_packet_size) ? len : default_packet_size;
+    frag->pkt = SCMalloc(size);
+    if (unlikely(frag->pkt == NULL)) {
+        frag->pkt_size = 0;
+        return -1;
+    }
+    frag->pkt_size = size;
+    return 0;
+}
+
+/**
+ * \brief Move up to cnt frags from a thread's frag cache to the global
+ * frag pool.
+ */
+static void
+DefragFragCacheFlushCnt(DefragThreadCtx *dt, uint32_t cnt)
+{
+    Frag *frag;
+
+    SCMutexLock(&defrag_context->frag_pool_lock);
+    while (cnt-- > 0 && (frag = dt->frag_cache) != NULL) {
+        dt->frag_cache = TAILQ_NEXT(frag, next);
+        dt->frag_cache_len--;
+
+        DefragFragReset(frag);
+        PoolReturn(defrag_context->frag_pool, frag);
+    }
+    SCMutexUnlock(&defrag_context->frag_pool_lock);
+}
+
+/**
+ * \brief Return all frags of a thread's frag cache to the global pool.
+ */
+void
+DefragFragCacheFlush(DefragThreadCtx *dt)
+{
+    DefragFragCacheFlushCnt(dt, dt->frag_cache_len);
+}
+
+/**
+ * \brief Take a batch of frags from the global pool into a thread's frag
+ * cache, so the pool lock is taken once per batch instead of once per
+ * fragment.
+ *
+ * \retval cnt number of frags added to the cache
+ */
+static uint32_t
+DefragFragCacheRefill(DefragThreadCtx *dt)
+{
+    uint32_t cnt = 0;
+
+    SCMutexLock(&defrag_context->frag_pool_lock);
+    for ( ; cnt < DEFRAG_FRAG_CACHE_BATCH; cnt++) {
+        /* only take frags the pool already has, don't make it alloc
+         * more than the one we need right now */
+        if (cnt > 0 && defrag_context->frag_pool->alloc_list_size == 0)
+            break;
+
+        Frag *frag = PoolGet(defrag_context->frag_pool);
+        if (frag == NULL)
+            break;
+
+        TAILQ_NEXT(frag, next) = dt->frag_cache;
+        dt->frag_cache = frag;
+        dt->frag_cache_len++;
+    }
+    SCMutexUnlock(&defrag_context->frag_pool_lock);
+
+    return cnt;
+}
+
+/**
+ * \brief Get a frag, from the thread's frag cache if we have one.
+ */
+static Frag *
+DefragFragGet(DefragThreadCtx *dt)
+{
+    Frag *frag;
+
+    if (dt == NULL) {
+        SCMutexLock(&defrag_context->frag_pool_lock);
+        frag = PoolGet(defrag_context->frag_pool);
+        SCMutexUnlock(&defrag_context->frag_pool_lock);
+        return frag;
+    }
+
+    if (dt->frag_cache == NULL && DefragFragCacheRefill(dt) == 0)
+        return NULL;
+
+    frag = dt->frag_cache;
+    dt->frag_cache = TAILQ_NEXT(frag, next);
+    dt->frag_cache_len--;
+    TAILQ_NEXT(frag, next) = NULL;
+    return frag;
+}
+
+/**
+ * \brief Give back a frag that is not (or no longer) in a tracker.
+ */
+static void
+DefragFragReturn(DefragThreadCtx *dt, Frag *frag)
+{
+    if (dt == NULL) {
+        SCMutexLock(&defrag_context->frag_pool_lock);
+        DefragFragReset(frag);
+        PoolReturn(defrag_context->frag_pool, frag);
+        SCMutexUnlock(&defrag_context->frag_pool_lock);
+        return;
+    }
+
+    DefragFragRecycle(frag);
+    TAILQ_NEXT(frag, next) = dt->frag_cache;
+    dt->frag_cache = frag;
+    dt->frag_cache_len++;
+
+    if (dt->frag_cache_len > 2 * DEFRAG_FRAG_CACHE_BATCH)
+        DefragFragCacheFlushCnt(dt, DEFRAG_FRAG_CACHE_BATCH);
+}
+
+/**
+ * \brief Return all frags of a tracker to the thread's frag cache, or to
+ * the global pool if dt is NULL.
+ */
+void
+DefragTrackerReturnFrags(DefragThreadCtx *dt, DefragTracker *tracker)
+{
+    Frag *frag;
+
+    if (dt == NULL) {
+        DefragTrackerFreeFrags(tracker);
+        return;
+    }
+
+    while ((frag = TAILQ_FIRST(&tracker->frags)) != NULL) {
+        TAILQ_REMOVE(&tracker->frags, frag, next);
+        DefragFragReturn(dt, frag);
+    }
+}
+
+/**
+ * \brief Size the reassembled packet for len bytes up front.
+ *
+ * If the packet won't fit the inline buffer we set up ext_pkt before
+ * copying in the first fragment, so the fragments are copied straight
+ * into their final place and PacketCopyDataOffset() never has to move
+ * the data from the inline buffer to ext_pkt half way through.
+ *
+ * \retval 0 on success, -1 on allocation failure.
+ */
+static int
+DefragPktReserve(Packet *rp, uint32_t len)
+{
+    if (len <= default_packet_size || rp->ext_pkt != NULL)
+        return 0;
+
+    rp->ext_pkt = SCMalloc(MAX_PAYLOAD_SIZE);
+    if (unlikely(rp->ext_pkt == NULL))
+        return -1;
+    return 0;
+}
+
 /**
  * \brief Create a new DefragContext.
  *
@@ -247,7 +449,8 @@ DefragContextDestroy(DefragContext *dc)
  * \param tracker The defragmentation tracker to reassemble from.
  */
 static Packet *
-Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
+Defrag4Reassemble(ThreadVars *tv, DefragThreadCtx *dt, DefragTracker *tracker,
+    Packet *p)
 {
     Packet *rp = NULL;
 
@@ -259,6 +462,7 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
      * fragments are inserted if frag_offset order. */
     Frag *frag;
     int len = 0;
+    int end = 0;
     TAILQ_FOREACH(frag, &tracker->frags, next) {
         if (frag->skip)
             continue;
@@ -279,6 +483,8 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
                 len += frag->data_len;
             }
         }
+        if (frag->offset + frag->data_len > end)
+            end = frag->offset + frag->data_len;
     }
 
     /* Allocate a Packet for the reassembled packet.  On failure we
@@ -292,6 +498,13 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     PKT_SET_SRC(rp, PKT_SRC_DEFRAG);
     rp->recursion_level = p->recursion_level;
 
+    frag = TAILQ_FIRST(&tracker->frags);
+    uint32_t rp_len = frag->ip_hdr_offset + frag->hlen + end;
+    if (rp_len < frag->len)
+        rp_len = frag->len;
+    if (DefragPktReserve(rp, rp_len) != 0)
+        goto remove_tracker;
+
     int fragmentable_offset = 0;
     int fragmentable_len = 0;
     int hlen = 0;
@@ -349,7 +562,7 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
 remove_tracker:
     /** \todo check locking */
     tracker->remove = 1;
-    DefragTrackerFreeFrags(tracker);
+    DefragTrackerReturnFrags(dt, tracker);
 done:
     return rp;
 }
@@ -360,7 +573,8 @@ done:
  * \param tracker The defragmentation tracker to reassemble from.
  */
 static Packet *
-Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
+Defrag6Reassemble(ThreadVars *tv, DefragThreadCtx *dt, DefragTracker *tracker,
+    Packet *p)
 {
     Packet *rp = NULL;
 
@@ -372,6 +586,7 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
      * fragments are inserted if frag_offset order. */
     Frag *frag;
     int len = 0;
+    int end = 0;
     TAILQ_FOREACH(frag, &tracker->frags, next) {
         if (frag->skip)
             continue;
@@ -392,12 +607,13 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
                 len += frag->data_len;
             }
         }
+        if (frag->offset + frag->data_len > end)
+            end = frag->offset + frag->data_len;
     }
 
     /* Allocate a Packet for the reassembled packet.  On failure we
      * SCFree all the resources held by this tracker. */
-    rp = PacketDefragPktSetup(p, (uint8_t *)p->ip6h,
-            IPV6_GET_PLEN(p) + sizeof(IPV6Hdr), 0);
+    rp = PacketDefragPktSetup(p, NULL, 0, 0);
     if (rp == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate packet for "
                 "fragmentation re-assembly, dumping fragments.");
@@ -405,6 +621,10 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     }
     PKT_SET_SRC(rp, PKT_SRC_DEFRAG);
 
+    frag = TAILQ_FIRST(&tracker->frags);
+    if (DefragPktReserve(rp, frag->frag_hdr_offset + end) != 0)
+        goto remove_tracker;
+
     int fragmentable_offset = 0;
     int fragmentable_len = 0;
     int ip_hdr_offset = 0;
@@ -454,7 +674,7 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
 remove_tracker:
     /** \todo check locking */
     tracker->remove = 1;
-    DefragTrackerFreeFrags(tracker);
+    DefragTrackerReturnFrags(dt, tracker);
 done:
     return rp;
 }
@@ -465,7 +685,8 @@ done:
  * \todo Allocate packet buffers from a pool.
  */
 static Packet *
-DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker, Packet *p)
+DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragThreadCtx *dt,
+    DefragTracker *tracker, Packet *p)
 {
     Packet *r = NULL;
     int ltrim = 0;
@@ -655,10 +876,18 @@ insert:
         goto done;
     }
 
+    /* The first fragment supplies the headers of the reassembled packet,
+     * so we keep all of it. Of the others we only keep the data they add,
+     * which is all reassembly copies out of them. */
+    uint32_t copy_offset = 0;
+    uint32_t copy_len = GET_PKT_LEN(p);
+    if (frag_offset + ltrim != 0) {
+        copy_offset = data_offset + ltrim;
+        copy_len = data_len - ltrim;
+    }
+
     /* Allocate fragment and insert. */
-    SCMutexLock(&defrag_context->frag_pool_lock);
-    Frag *new = PoolGet(defrag_context->frag_pool);
-    SCMutexUnlock(&defrag_context->frag_pool_lock);
+    Frag *new = DefragFragGet(dt);
     if (new == NULL) {
         if (af == AF_INET) {
             ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
@@ -667,11 +896,8 @@ insert:
         }
         goto done;
     }
-    new->pkt = SCMalloc(GET_PKT_LEN(p));
-    if (new->pkt == NULL) {
-        SCMutexLock(&defrag_context->frag_pool_lock);
-        PoolReturn(defrag_context->frag_pool, new);
-        SCMutexUnlock(&defrag_context->frag_pool_lock);
+    if (DefragFragSetupBuffer(new, copy_len) != 0) {
+        DefragFragReturn(dt, new);
         if (af == AF_INET) {
             ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
         } else {
@@ -679,11 +905,13 @@ insert:
         }
         goto done;
     }
-    memcpy(new->pkt, GET_PKT_DATA(p) + ltrim, GET_PKT_LEN(p) - ltrim);
-    new->len = GET_PKT_LEN(p) - ltrim;
+    /* the packet goes back to the pool before the datagram is complete,
+     * so the frag keeps its own copy of the data */
+    memcpy(new->pkt, GET_PKT_DATA(p) + copy_offset, copy_len);
+    new->len = copy_len;
     new->hlen = hlen;
     new->offset = frag_offset + ltrim;
-    new->data_offset = data_offset;
+    new->data_offset = copy_offset ? 0 : data_offset;
     new->data_len = data_len - ltrim;
     new->ip_hdr_offset = ip_hdr_offset;
     new->frag_hdr_offset = frag_hdr_offset;
@@ -709,14 +937,14 @@ insert:
 
     if (tracker->seen_last) {
         if (tracker->af == AF_INET) {
-            r = Defrag4Reassemble(tv, tracker, p);
+            r = Defrag4Reassemble(tv, dt, tracker, p);
             if (r != NULL && tv != NULL && dtv != NULL) {
                 SCPerfCounterIncr(dtv->counter_defrag_ipv4_reassembled,
                     tv->sc_perf_pca);
             }
         }
         else if (tracker->af == AF_INET6) {
-            r = Defrag6Reassemble(tv, tracker, p);
+            r = Defrag6Reassemble(tv, dt, tracker, p);
             if (r != NULL && tv != NULL && dtv != NULL) {
                 SCPerfCounterIncr(dtv->counter_defrag_ipv6_reassembled,
                     tv->sc_perf_pca);
@@ -860,14 +1088,36 @@ Defrag(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
         }
     }
 
-    /* return a locked tracker or NULL */
-    tracker = DefragGetTracker(tv, dtv, p);
-    if (tracker == NULL)
-        return NULL;
+    DefragThreadCtx *dt = NULL;
+    if (dtv != NULL) {
+        if (unlikely(dtv->defrag_tctx == NULL))
+            dtv->defrag_tctx = DefragThreadCtxRegister();
+        dt = dtv->defrag_tctx;
+    }
+
+    /* the flow manager only takes the ctx over once we went idle */
+    if (dt != NULL)
+        SCHandoffOwnerEnter(&dt->handoff);
 
-    Packet *rp = DefragInsertFrag(tv, dtv, tracker, p);
-    DefragTrackerRelease(tracker);
+    Packet *rp = NULL;
+    if (dt != NULL && dt->hash != NULL) {
+        /* private hash: we time out our own trackers */
+        DefragTimeoutPartition(dt, &p->ts);
+
+        tracker = DefragGetTrackerFromPartition(dt, p);
+        if (tracker != NULL)
+            rp = DefragInsertFrag(tv, dtv, dt, tracker, p);
+    } else {
+        /* return a locked tracker or NULL */
+        tracker = DefragGetTracker(tv, dtv, p);
+        if (tracker != NULL) {
+            rp = DefragInsertFrag(tv, dtv, dt, tracker, p);
+            DefragTrackerRelease(tracker);
+        }
+    }
 
+    if (dt != NULL)
+        SCHandoffOwnerLeave(&dt->handoff);
     return rp;
 }
 
@@ -2156,6 +2406,168 @@ end:
     return ret;
 }
 
+/**
+ * Reassemble through a thread local tracker hash: the tracker must live
+ * in the thread's hash, the frags must end up in the thread's frag cache
+ * and the tracker must be timed out by the owner.
+ */
+static int
+DefragThreadLocalTest(void)
+{
+    DecodeThreadVars dtv;
+    Packet *p1 = NULL, *p2 = NULL, *p3 = NULL;
+    Packet *reassembled = NULL;
+    int id = 12;
+    int i;
+    int ret = 0;
+
+    memset(&dtv, 0, sizeof(dtv));
+
+    DefragInit();
+    defrag_config.thread_local = 1;
+
+    p1 = BuildTestPacket(id, 0, 1, 'A', 8);
+    if (p1 == NULL)
+        goto end;
+    p2 = BuildTestPacket(id, 1, 1, 'B', 8);
+    if (p2 == NULL)
+        goto end;
+    p3 = BuildTestPacket(id, 2, 0, 'C', 3);
+    if (p3 == NULL)
+        goto end;
+
+    if (Defrag(NULL, &dtv, p1) != NULL)
+        goto end;
+    if (Defrag(NULL, &dtv, p2) != NULL)
+        goto end;
+
+    DefragThreadCtx *dt = dtv.defrag_tctx;
+    if (dt == NULL || dt->hash == NULL)
+        goto end;
+
+    /* the tracker is in our hash, not in the global one */
+    if (DefragLookupTrackerFromHash(p1) != NULL)
+        goto end;
+    DefragTracker *tracker = DefragGetTrackerFromPartition(dt, p1);
+    if (tracker == NULL || tracker->id != (uint32_t)id)
+        goto end;
+
+    reassembled = Defrag(NULL, &dtv, p3);
+    if (reassembled == NULL)
+        goto end;
+    if (IPV4_GET_IPLEN(reassembled) != 39)
+        goto end;
+    for (i = 20; i < 20 + 8; i++) {
+        if (GET_PKT_DATA(reassembled)[i] != 'A')
+            goto end;
+    }
+    for (i = 28; i < 28 + 8; i++) {
+        if (GET_PKT_DATA(reassembled)[i] != 'B')
+            goto end;
+    }
+    for (i = 36; i < 36 + 3; i++) {
+        if (GET_PKT_DATA(reassembled)[i] != 'C')
+            goto end;
+    }
+
+    /* the frags went back to our cache, the tracker waits for the sweep */
+    if (!tracker->remove || !TAILQ_EMPTY(&tracker->frags))
+        goto end;
+    if (dt->frag_cache_len < 3)
+        goto end;
+
+    struct timeval ts = p3->ts;
+    ts.tv_sec += defrag_context->timeout + 1;
+    uint32_t cnt = 0;
+    do {
+        cnt += DefragTimeoutPartition(dt, &ts);
+    } while (dt->sweep_left > 0);
+    if (cnt != 1 || dt->spare_q.len != 1)
+        goto end;
+
+    ret = 1;
+
+end:
+    if (p1 != NULL)
+        SCFree(p1);
+    if (p2 != NULL)
+        SCFree(p2);
+    if (p3 != NULL)
+        SCFree(p3);
+    if (reassembled != NULL)
+        SCFree(reassembled);
+
+    DefragDestroy();
+    return ret;
+}
+
+/**
+ * A thread that stops getting fragments doesn't time out its own hash.
+ * The flow manager's pass must do it for that thread, and the ctx must
+ * go away when the thread does.
+ */
+static int
+DefragThreadIdleTest(void)
+{
+    DecodeThreadVars dtv;
+    Packet *p1 = NULL, *p2 = NULL;
+    int id = 13;
+    int ret = 0;
+
+    memset(&dtv, 0, sizeof(dtv));
+
+    DefragInit();
+    defrag_config.thread_local = 1;
+
+    p1 = BuildTestPacket(id, 0, 1, 'A', 8);
+    if (p1 == NULL)
+        goto end;
+    p2 = BuildTestPacket(id, 1, 1, 'B', 8);
+    if (p2 == NULL)
+        goto end;
+
+    if (Defrag(NULL, &dtv, p1) != NULL)
+        goto end;
+    if (Defrag(NULL, &dtv, p2) != NULL)
+        goto end;
+
+    DefragThreadCtx *dt = dtv.defrag_tctx;
+    if (dt == NULL || dt->hash == NULL)
+        goto end;
+
+    /* owner not seen idle yet: left alone */
+    struct timeval ts = p2->ts;
+    if (DefragTimeoutIdleThreadCtxs(&ts) != 0)
+        goto end;
+    if (DefragGetTrackerFromPartition(dt, p1) == NULL)
+        goto end;
+
+    /* owner idle and the tracker timed out: the frags go back too */
+    ts.tv_sec += defrag_context->timeout + 5000;
+    if (DefragTimeoutIdleThreadCtxs(&ts) != 1)
+        goto end;
+    if (dt->spare_q.len != 1 || dt->frag_cache_len != 0)
+        goto end;
+
+    /* the ctx goes away with its thread */
+    DefragThreadCtxRelease(dt);
+    dtv.defrag_tctx = NULL;
+    if (defrag_thread_ctxs != NULL)
+        goto end;
+
+    ret = 1;
+
+end:
+    if (p1 != NULL)
+        SCFree(p1);
+    if (p2 != NULL)
+        SCFree(p2);
+
+    DefragDestroy();
+    return ret;
+}
+
+
 #endif /* UNITTESTS */
 
 void
@@ -2201,6 +2613,10 @@ DefragRegisterTests(void)
 
     UtRegisterTest("DefragTimeoutTest",
         DefragTimeoutTest, 1);
+    UtRegisterTest("DefragThreadLocalTest",
+        DefragThreadLocalTest, 1);
+    UtRegisterTest("DefragThreadIdleTest",
+        DefragThreadIdleTest, 1);
 #endif /* UNITTESTS */
 }
 
@@ -62,7 +62,10 @@ typedef struct Frag_ {
     uint16_t ltrim;             /**< Number of leading bytes to trim when
                                  * re-assembling the packet. */
 
-    uint8_t *pkt;               /**< The actual packet. */
+    uint8_t *pkt;               /**< The actual packet. For fragments not
+                                 * at offset 0 only the data they add is
+                                 * kept, data_offset is 0 then. */
+    uint32_t pkt_size;          /**< Size of the pkt buffer. */
 
 #ifdef DEBUG
     uint64_t pcap_cnt;          /**< pcap_cnt of original packet */
@@ -132,8 +135,12 @@ void DefragInit(void);
 void DefragDestroy(void);
 void DefragReload(void); /**< use only in unittests */
 
+struct DefragThreadCtx_;
+
 uint8_t DefragGetOsPolicy(Packet *);
 void DefragTrackerFreeFrags(DefragTracker *);
+void DefragTrackerReturnFrags(struct DefragThreadCtx_ *, DefragTracker *);
+void DefragFragCacheFlush(struct DefragThreadCtx_ *);
 Packet *Defrag(ThreadVars *, DecodeThreadVars *, Packet *);
 void DefragRegisterTests(void);
 
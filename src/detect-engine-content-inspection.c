@@ -244,7 +244,12 @@ int DetectEngineContentInspection(DetectEngineCtx *de_ctx, DetectEngineThreadCtx
              * greater than sbuffer_len found is anyways NULL */
 
             /* do the actual search */
-            if (cd->flags & DETECT_CONTENT_NOCASE)
+            if (de_ctx->spm_matcher == SPM_SIMD) {
+                if (cd->flags & DETECT_CONTENT_NOCASE)
+                    found = SimdSearchNocase(sbuffer, sbuffer_len, cd->content, cd->content_len);
+                else
+                    found = SimdSearch(sbuffer, sbuffer_len, cd->content, cd->content_len);
+            } else if (cd->flags & DETECT_CONTENT_NOCASE)
                 found = BoyerMooreNocase(cd->content, cd->content_len, sbuffer, sbuffer_len, cd->bm_ctx->bmGs, cd->bm_ctx->bmBc);
             else
                 found = BoyerMoore(cd->content, cd->content_len, sbuffer, sbuffer_len, cd->bm_ctx->bmGs, cd->bm_ctx->bmBc);
@@ -102,7 +102,7 @@ static uint8_t *DetectEngineHCBDGetBufferForTX(int tx_id,
         if ((tx_id - det_ctx->hcbd_start_tx_id) < det_ctx->hcbd_buffers_list_len) {
             if (det_ctx->hcbd[(tx_id - det_ctx->hcbd_start_tx_id)].buffer_len != 0) {
                 *buffer_len = det_ctx->hcbd[(tx_id - det_ctx->hcbd_start_tx_id)].buffer_len;
-                return det_ctx->hcbd[(tx_id - det_ctx->hcbd_start_tx_id)].buffer;
+                return det_ctx->hcbd[(tx_id - det_ctx->hcbd_start_tx_id)].data;
             }
         } else {
             if (HCBDCreateSpace(det_ctx, (tx_id - det_ctx->hcbd_start_tx_id) + 1) < 0)
@@ -180,47 +180,55 @@ static uint8_t *DetectEngineHCBDGetBufferForTX(int tx_id,
         goto end;
     }
 
-    int first = 1;
-    while (cur != NULL) {
-        /* see if we can filter out chunks */
-        if (htud->request_body.body_inspected > 0) {
-            if (cur->stream_offset < htud->request_body.body_inspected) {
-                if ((htud->request_body.body_inspected - cur->stream_offset) > htp_state->cfg->request_inspect_min_size) {
-                    cur = cur->next;
-                    continue;
-                } else {
-                    /* include this one */
-                }
-            } else {
-                /* include this one */
-            }
-        }
+    /* see if we can filter out data: skip what was inspected already,
+     * except for the last part of it, the inspect window */
+    uint32_t skip = 0;
+    if (htud->request_body.body_inspected > htp_state->cfg->request_inspect_min_size) {
+        uint64_t start = htud->request_body.body_inspected - htp_state->cfg->request_inspect_min_size;
 
-        if (first) {
-            det_ctx->hcbd[index].offset = cur->stream_offset;
-            first = 0;
+        while (cur != NULL && cur->stream_offset + cur->len <= start) {
+            cur = cur->next;
         }
+        if (cur == NULL)
+            goto end;
 
-        /* see if we need to grow the buffer */
-        if (det_ctx->hcbd[index].buffer == NULL || (det_ctx->hcbd[index].buffer_len + cur->len) > det_ctx->hcbd[index].buffer_size) {
-            det_ctx->hcbd[index].buffer_size += cur->len * 2;
+        if (cur->stream_offset < start)
+            skip = (uint32_t)(start - cur->stream_offset);
+    }
 
-            if ((det_ctx->hcbd[index].buffer = SCRealloc(det_ctx->hcbd[index].buffer, det_ctx->hcbd[index].buffer_size)) == NULL) {
-                det_ctx->hcbd[index].buffer_size = 0;
-                det_ctx->hcbd[index].buffer_len = 0;
-                goto end;
+    det_ctx->hcbd[index].offset = cur->stream_offset + skip;
+
+    if (cur->next == NULL) {
+        /* all data is in a single page, inspect it in place */
+        det_ctx->hcbd[index].data = cur->data + skip;
+        det_ctx->hcbd[index].buffer_len = cur->len - skip;
+    } else {
+        det_ctx->hcbd[index].buffer_len = 0;
+
+        for ( ; cur != NULL; cur = cur->next) {
+            uint32_t len = cur->len - skip;
+
+            /* see if we need to grow the buffer */
+            if (det_ctx->hcbd[index].buffer == NULL || (det_ctx->hcbd[index].buffer_len + len) > det_ctx->hcbd[index].buffer_size) {
+                det_ctx->hcbd[index].buffer_size += len * 2;
+
+                if ((det_ctx->hcbd[index].buffer = SCRealloc(det_ctx->hcbd[index].buffer, det_ctx->hcbd[index].buffer_size)) == NULL) {
+                    det_ctx->hcbd[index].buffer_size = 0;
+                    det_ctx->hcbd[index].buffer_len = 0;
+                    goto end;
+                }
             }
+            memcpy(det_ctx->hcbd[index].buffer + det_ctx->hcbd[index].buffer_len, cur->data + skip, len);
+            det_ctx->hcbd[index].buffer_len += len;
+            skip = 0;
         }
-        memcpy(det_ctx->hcbd[index].buffer + det_ctx->hcbd[index].buffer_len, cur->data, cur->len);
-        det_ctx->hcbd[index].buffer_len += cur->len;
-
-        cur = cur->next;
+        det_ctx->hcbd[index].data = det_ctx->hcbd[index].buffer;
     }
 
     /* update inspected tracker */
     htud->request_body.body_inspected = htud->request_body.last->stream_offset + htud->request_body.last->len;
 
-    buffer = det_ctx->hcbd[index].buffer;
+    buffer = det_ctx->hcbd[index].data;
     *buffer_len = det_ctx->hcbd[index].buffer_len;
  end:
     return buffer;
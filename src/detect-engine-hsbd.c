@@ -103,7 +103,7 @@ static uint8_t *DetectEngineHSBDGetBufferForTX(int tx_id,
         if ((tx_id - det_ctx->hsbd_start_tx_id) < det_ctx->hsbd_buffers_list_len) {
             if (det_ctx->hsbd[(tx_id - det_ctx->hsbd_start_tx_id)].buffer_len != 0) {
                 *buffer_len = det_ctx->hsbd[(tx_id - det_ctx->hsbd_start_tx_id)].buffer_len;
-                return det_ctx->hsbd[(tx_id - det_ctx->hsbd_start_tx_id)].buffer;
+                return det_ctx->hsbd[(tx_id - det_ctx->hsbd_start_tx_id)].data;
             }
         } else {
             if (HSBDCreateSpace(det_ctx, (tx_id - det_ctx->hsbd_start_tx_id) + 1) < 0)
@@ -181,47 +181,55 @@ static uint8_t *DetectEngineHSBDGetBufferForTX(int tx_id,
         goto end;
     }
 
-    int first = 1;
-    while (cur != NULL) {
-        /* see if we can filter out chunks */
-        if (htud->response_body.body_inspected > 0) {
-            if (cur->stream_offset < htud->response_body.body_inspected) {
-                if ((htud->response_body.body_inspected - cur->stream_offset) > htp_state->cfg->response_inspect_window) {
-                    cur = cur->next;
-                    continue;
-                } else {
-                    /* include this one */
-                }
-            } else {
-                /* include this one */
-            }
-        }
+    /* see if we can filter out data: skip what was inspected already,
+     * except for the last part of it, the inspect window */
+    uint32_t skip = 0;
+    if (htud->response_body.body_inspected > htp_state->cfg->response_inspect_window) {
+        uint64_t start = htud->response_body.body_inspected - htp_state->cfg->response_inspect_window;
 
-        if (first) {
-            det_ctx->hsbd[index].offset = cur->stream_offset;
-            first = 0;
+        while (cur != NULL && cur->stream_offset + cur->len <= start) {
+            cur = cur->next;
         }
+        if (cur == NULL)
+            goto end;
 
-        /* see if we need to grow the buffer */
-        if (det_ctx->hsbd[index].buffer == NULL || (det_ctx->hsbd[index].buffer_len + cur->len) > det_ctx->hsbd[index].buffer_size) {
-            det_ctx->hsbd[index].buffer_size += cur->len * 2;
+        if (cur->stream_offset < start)
+            skip = (uint32_t)(start - cur->stream_offset);
+    }
 
-            if ((det_ctx->hsbd[index].buffer = SCRealloc(det_ctx->hsbd[index].buffer, det_ctx->hsbd[index].buffer_size)) == NULL) {
-                det_ctx->hsbd[index].buffer_size = 0;
-                det_ctx->hsbd[index].buffer_len = 0;
-                goto end;
+    det_ctx->hsbd[index].offset = cur->stream_offset + skip;
+
+    if (cur->next == NULL) {
+        /* all data is in a single page, inspect it in place */
+        det_ctx->hsbd[index].data = cur->data + skip;
+        det_ctx->hsbd[index].buffer_len = cur->len - skip;
+    } else {
+        det_ctx->hsbd[index].buffer_len = 0;
+
+        for ( ; cur != NULL; cur = cur->next) {
+            uint32_t len = cur->len - skip;
+
+            /* see if we need to grow the buffer */
+            if (det_ctx->hsbd[index].buffer == NULL || (det_ctx->hsbd[index].buffer_len + len) > det_ctx->hsbd[index].buffer_size) {
+                det_ctx->hsbd[index].buffer_size += len * 2;
+
+                if ((det_ctx->hsbd[index].buffer = SCRealloc(det_ctx->hsbd[index].buffer, det_ctx->hsbd[index].buffer_size)) == NULL) {
+                    det_ctx->hsbd[index].buffer_size = 0;
+                    det_ctx->hsbd[index].buffer_len = 0;
+                    goto end;
+                }
             }
+            memcpy(det_ctx->hsbd[index].buffer + det_ctx->hsbd[index].buffer_len, cur->data + skip, len);
+            det_ctx->hsbd[index].buffer_len += len;
+            skip = 0;
         }
-        memcpy(det_ctx->hsbd[index].buffer + det_ctx->hsbd[index].buffer_len, cur->data, cur->len);
-        det_ctx->hsbd[index].buffer_len += cur->len;
-
-        cur = cur->next;
+        det_ctx->hsbd[index].data = det_ctx->hsbd[index].buffer;
     }
 
     /* update inspected tracker */
     htud->response_body.body_inspected = htud->response_body.last->stream_offset + htud->response_body.last->len;
 
-    buffer = det_ctx->hsbd[index].buffer;
+    buffer = det_ctx->hsbd[index].data;
     *buffer_len = det_ctx->hsbd[index].buffer_len;
  end:
     return buffer;
@@ -849,6 +849,165 @@ void PatternMatchThreadPrepare(ThreadVars *tv, MpmThreadCtx *mpm_thread_ctx, uin
     MpmInitThreadCtx(tv, mpm_thread_ctx, mpm_matcher, max_id);
 }
 
+/**
+ * \brief Prepare a mpm ctx, or queue it to be prepared by the build
+ *        threads in PatternMatchPrepareQueueRun.
+ *
+ * Ctxs are prepared right away if only one build thread is configured or
+ * if the matcher can't prepare ctxs concurrently.
+ *
+ * \param de_ctx detection engine ctx
+ * \param mpm_ctx ctx to prepare
+ * \param account 1 if the ctx counts towards de_ctx->mpm_memory_size. Its
+ *                memory_size is added by the caller, the run adds the
+ *                memory Prepare allocated on top of that.
+ */
+void PatternMatchPrepareMpmCtx(DetectEngineCtx *de_ctx, MpmCtx *mpm_ctx,
+                               uint8_t account)
+{
+    MpmTableElmt *m = &mpm_table[mpm_ctx->mpm_type];
+
+    if (m->Prepare == NULL)
+        return;
+
+    if (de_ctx->build_threads <= 1 || (m->flags & MPM_FLAG_SERIAL_PREPARE)) {
+        m->Prepare(mpm_ctx);
+        return;
+    }
+
+    if (de_ctx->mpm_prepare_queue_cnt == de_ctx->mpm_prepare_queue_size) {
+        uint32_t size = de_ctx->mpm_prepare_queue_size ?
+            de_ctx->mpm_prepare_queue_size * 2 : 256;
+        DetectMpmPrepareItem *ptmp = SCRealloc(de_ctx->mpm_prepare_queue,
+                size * sizeof(DetectMpmPrepareItem));
+        if (ptmp == NULL) {
+            /* prepare it here, it only costs us the parallelism */
+            m->Prepare(mpm_ctx);
+            return;
+        }
+        de_ctx->mpm_prepare_queue = ptmp;
+        de_ctx->mpm_prepare_queue_size = size;
+    }
+
+    DetectMpmPrepareItem *item =
+        &de_ctx->mpm_prepare_queue[de_ctx->mpm_prepare_queue_cnt++];
+    item->mpm_ctx = mpm_ctx;
+    item->memory_size = mpm_ctx->memory_size;
+    item->account = account;
+}
+
+/** \internal
+ *  \brief state shared by the build threads of a queue run */
+typedef struct PatternMatchPrepareRun_ {
+    DetectMpmPrepareItem *queue;
+    uint32_t cnt;
+    SC_ATOMIC_DECLARE(uint32_t, next);
+    SC_ATOMIC_DECLARE(uint32_t, failed);
+} PatternMatchPrepareRun;
+
+/** \internal
+ *  \brief build thread: prepare queued ctxs until the queue is empty */
+static void *PatternMatchPrepareQueueWorker(void *arg)
+{
+    PatternMatchPrepareRun *run = (PatternMatchPrepareRun *)arg;
+
+    while (1) {
+        uint32_t idx = SC_ATOMIC_ADD(run->next, 1) - 1;
+        if (idx >= run->cnt)
+            break;
+
+        MpmCtx *mpm_ctx = run->queue[idx].mpm_ctx;
+        if (mpm_table[mpm_ctx->mpm_type].Prepare(mpm_ctx) < 0)
+            (void)SC_ATOMIC_ADD(run->failed, 1);
+    }
+    return NULL;
+}
+
+/**
+ * \brief Prepare the mpm ctxs queued by PatternMatchPrepareMpmCtx on
+ *        de_ctx->build_threads threads and wait for them to finish.
+ *
+ * The calling thread is one of the build threads.
+ *
+ * \retval 0 ok, -1 if a ctx failed to prepare
+ */
+int PatternMatchPrepareQueueRun(DetectEngineCtx *de_ctx)
+{
+    uint32_t cnt = de_ctx->mpm_prepare_queue_cnt;
+    uint32_t nthreads = de_ctx->build_threads;
+    pthread_t *threads = NULL;
+    uint32_t started = 0;
+    struct timeval start, end;
+    PatternMatchPrepareRun run;
+    int r = 0;
+
+    if (cnt == 0)
+        return 0;
+
+    if (nthreads > cnt)
+        nthreads = cnt;
+
+    gettimeofday(&start, NULL);
+
+    memset(&run, 0, sizeof(run));
+    run.queue = de_ctx->mpm_prepare_queue;
+    run.cnt = cnt;
+    SC_ATOMIC_INIT(run.next);
+    SC_ATOMIC_INIT(run.failed);
+
+    if (nthreads > 1) {
+        threads = SCMalloc((nthreads - 1) * sizeof(pthread_t));
+        if (threads != NULL) {
+            for ( ; started < nthreads - 1; started++) {
+                if (pthread_create(&threads[started], NULL,
+                            PatternMatchPrepareQueueWorker, &run) != 0) {
+                    SCLogWarning(SC_ERR_THREAD_CREATE, "failed to start mpm "
+                            "build thread: %s", strerror(errno));
+                    break;
+                }
+            }
+        }
+    }
+
+    (void)PatternMatchPrepareQueueWorker(&run);
+
+    uint32_t i;
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    if (threads != NULL)
+        SCFree(threads);
+
+    for (i = 0; i < cnt; i++) {
+        DetectMpmPrepareItem *item = &de_ctx->mpm_prepare_queue[i];
+        if (item->account)
+            de_ctx->mpm_memory_size +=
+                item->mpm_ctx->memory_size - item->memory_size;
+    }
+
+    if (SC_ATOMIC_GET(run.failed) > 0) {
+        SCLogError(SC_ERR_INITIALIZATION, "%" PRIu32 " of %" PRIu32 " mpm "
+                "ctxs failed to prepare", SC_ATOMIC_GET(run.failed), cnt);
+        r = -1;
+    }
+    SC_ATOMIC_DESTROY(run.next);
+    SC_ATOMIC_DESTROY(run.failed);
+
+    gettimeofday(&end, NULL);
+    uint64_t usecs = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000 +
+        end.tv_usec - start.tv_usec;
+    if (!(de_ctx->flags & DE_QUIET)) {
+        SCLogInfo("prepared %" PRIu32 " mpm ctxs on %" PRIu32 " threads in "
+                "%" PRIu64 ".%03" PRIu64 " ms", cnt, started + 1,
+                usecs / 1000, usecs % 1000);
+    }
+
+    SCFree(de_ctx->mpm_prepare_queue);
+    de_ctx->mpm_prepare_queue = NULL;
+    de_ctx->mpm_prepare_queue_cnt = 0;
+    de_ctx->mpm_prepare_queue_size = 0;
+    return r;
+}
+
 
 /* free the pattern matcher part of a SigGroupHead */
 void PatternMatchDestroyGroup(SigGroupHead *sh) {
@@ -2503,10 +2662,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_proto_tcp_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_proto_tcp_ctx_ts->mpm_type].Prepare != NULL) {
-                         mpm_table[sh->mpm_proto_tcp_ctx_ts->mpm_type].
-                             Prepare(sh->mpm_proto_tcp_ctx_ts);
-                     }
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_proto_tcp_ctx_ts, 1);
                  }
              }
          }
@@ -2516,10 +2672,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_proto_tcp_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_proto_tcp_ctx_tc->mpm_type].Prepare != NULL) {
-                         mpm_table[sh->mpm_proto_tcp_ctx_tc->mpm_type].
-                             Prepare(sh->mpm_proto_tcp_ctx_tc);
-                     }
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_proto_tcp_ctx_tc, 1);
                  }
              }
          }
@@ -2530,10 +2683,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_proto_udp_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_proto_udp_ctx_ts->mpm_type].Prepare != NULL) {
-                         mpm_table[sh->mpm_proto_udp_ctx_ts->mpm_type].
-                             Prepare(sh->mpm_proto_udp_ctx_ts);
-                     }
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_proto_udp_ctx_ts, 1);
                  }
              }
          }
@@ -2543,10 +2693,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_proto_udp_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_proto_udp_ctx_tc->mpm_type].Prepare != NULL) {
-                         mpm_table[sh->mpm_proto_udp_ctx_tc->mpm_type].
-                             Prepare(sh->mpm_proto_udp_ctx_tc);
-                     }
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_proto_udp_ctx_tc, 1);
                  }
              }
          }
@@ -2557,10 +2704,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_proto_other_ctx = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_proto_other_ctx->mpm_type].Prepare != NULL) {
-                         mpm_table[sh->mpm_proto_other_ctx->mpm_type].
-                             Prepare(sh->mpm_proto_other_ctx);
-                     }
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_proto_other_ctx, 1);
                  }
              }
          }
@@ -2571,8 +2715,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_stream_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_stream_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_stream_ctx_ts->mpm_type].Prepare(sh->mpm_stream_ctx_ts);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_stream_ctx_ts, 0);
                  }
              }
          }
@@ -2582,8 +2725,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_stream_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_stream_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_stream_ctx_tc->mpm_type].Prepare(sh->mpm_stream_ctx_tc);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_stream_ctx_tc, 0);
                  }
              }
          }
@@ -2594,8 +2736,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_uri_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_uri_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_uri_ctx_ts->mpm_type].Prepare(sh->mpm_uri_ctx_ts);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_uri_ctx_ts, 1);
                  }
              }
          }
@@ -2605,8 +2746,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_uri_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_uri_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_uri_ctx_tc->mpm_type].Prepare(sh->mpm_uri_ctx_tc);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_uri_ctx_tc, 1);
                  }
              }
          }
@@ -2617,8 +2757,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hcbd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hcbd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hcbd_ctx_ts->mpm_type].Prepare(sh->mpm_hcbd_ctx_ts);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hcbd_ctx_ts, 0);
                  }
              }
          }
@@ -2628,8 +2767,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hcbd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hcbd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hcbd_ctx_tc->mpm_type].Prepare(sh->mpm_hcbd_ctx_tc);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hcbd_ctx_tc, 0);
                  }
              }
          }
@@ -2640,8 +2778,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hsbd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hsbd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hsbd_ctx_ts->mpm_type].Prepare(sh->mpm_hsbd_ctx_ts);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hsbd_ctx_ts, 0);
                  }
              }
          }
@@ -2651,8 +2788,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hsbd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hsbd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hsbd_ctx_tc->mpm_type].Prepare(sh->mpm_hsbd_ctx_tc);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hsbd_ctx_tc, 0);
                  }
              }
          }
@@ -2663,8 +2799,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hhd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hhd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hhd_ctx_ts->mpm_type].Prepare(sh->mpm_hhd_ctx_ts);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hhd_ctx_ts, 0);
                  }
              }
          }
@@ -2674,8 +2809,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hhd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hhd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hhd_ctx_tc->mpm_type].Prepare(sh->mpm_hhd_ctx_tc);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hhd_ctx_tc, 0);
                  }
              }
          }
@@ -2686,8 +2820,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hrhd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hrhd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hrhd_ctx_ts->mpm_type].Prepare(sh->mpm_hrhd_ctx_ts);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hrhd_ctx_ts, 0);
                  }
              }
          }
@@ -2697,8 +2830,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hrhd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hrhd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hrhd_ctx_tc->mpm_type].Prepare(sh->mpm_hrhd_ctx_tc);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hrhd_ctx_tc, 0);
                  }
              }
          }
@@ -2709,8 +2841,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hmd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hmd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hmd_ctx_ts->mpm_type].Prepare(sh->mpm_hmd_ctx_ts);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hmd_ctx_ts, 0);
                  }
              }
          }
@@ -2720,8 +2851,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hmd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hmd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hmd_ctx_tc->mpm_type].Prepare(sh->mpm_hmd_ctx_tc);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hmd_ctx_tc, 0);
                  }
              }
          }
@@ -2732,8 +2862,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hcd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hcd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hcd_ctx_ts->mpm_type].Prepare(sh->mpm_hcd_ctx_ts);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hcd_ctx_ts, 0);
                  }
              }
          }
@@ -2743,8 +2872,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hcd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hcd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hcd_ctx_tc->mpm_type].Prepare(sh->mpm_hcd_ctx_tc);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hcd_ctx_tc, 0);
                  }
              }
          }
@@ -2755,8 +2883,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hrud_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hrud_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hrud_ctx_ts->mpm_type].Prepare(sh->mpm_hrud_ctx_ts);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hrud_ctx_ts, 0);
                  }
              }
          }
@@ -2766,8 +2893,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hrud_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hrud_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hrud_ctx_tc->mpm_type].Prepare(sh->mpm_hrud_ctx_tc);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hrud_ctx_tc, 0);
                  }
              }
          }
@@ -2777,8 +2903,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hsmd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hsmd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hsmd_ctx_ts->mpm_type].Prepare(sh->mpm_hsmd_ctx_ts);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hsmd_ctx_ts, 0);
                  }
              }
          }
@@ -2788,8 +2913,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hsmd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hsmd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hsmd_ctx_tc->mpm_type].Prepare(sh->mpm_hsmd_ctx_tc);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hsmd_ctx_tc, 0);
                  }
              }
          }
@@ -2799,8 +2923,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hscd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hscd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hscd_ctx_ts->mpm_type].Prepare(sh->mpm_hscd_ctx_ts);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hscd_ctx_ts, 0);
                  }
              }
          }
@@ -2810,8 +2933,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hscd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hscd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hscd_ctx_tc->mpm_type].Prepare(sh->mpm_hscd_ctx_tc);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hscd_ctx_tc, 0);
                  }
              }
          }
@@ -2821,8 +2943,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_huad_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_huad_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_huad_ctx_ts->mpm_type].Prepare(sh->mpm_huad_ctx_ts);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_huad_ctx_ts, 0);
                  }
              }
          }
@@ -2832,8 +2953,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_huad_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_huad_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_huad_ctx_tc->mpm_type].Prepare(sh->mpm_huad_ctx_tc);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_huad_ctx_tc, 0);
                  }
              }
          }
@@ -2843,8 +2963,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hhhd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hhhd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hhhd_ctx_ts->mpm_type].Prepare(sh->mpm_hhhd_ctx_ts);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hhhd_ctx_ts, 0);
                  }
              }
          }
@@ -2854,8 +2973,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hhhd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hhhd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hhhd_ctx_tc->mpm_type].Prepare(sh->mpm_hhhd_ctx_tc);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hhhd_ctx_tc, 0);
                  }
              }
          }
@@ -2865,8 +2983,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hrhhd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hrhhd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hrhhd_ctx_ts->mpm_type].Prepare(sh->mpm_hrhhd_ctx_ts);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hrhhd_ctx_ts, 0);
                  }
              }
          }
@@ -2876,8 +2993,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hrhhd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hrhhd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hrhhd_ctx_tc->mpm_type].Prepare(sh->mpm_hrhhd_ctx_tc);
+                     PatternMatchPrepareMpmCtx(de_ctx, sh->mpm_hrhhd_ctx_tc, 0);
                  }
              }
          }
@@ -3359,10 +3475,148 @@ typedef struct DetectFPAndItsId_ {
     uint8_t *content;
 } DetectFPAndItsId;
 
+/* size of the fast pattern id hash */
+#define DETECT_FP_ID_HASH_SIZE 4096
+
+static uint32_t DetectFPIdHashFunc(HashListTable *ht, void *data, uint16_t datalen)
+{
+    DetectFPAndItsId *fp = (DetectFPAndItsId *)data;
+    uint32_t hash = (uint32_t)fp->sm_list;
+    uint16_t i;
+
+    for (i = 0; i < fp->content_len; i++)
+        hash = ((hash << 5) + hash) + fp->content[i];
+
+    return hash % ht->array_size;
+}
+
+static char DetectFPIdCompareFunc(void *data1, uint16_t len1, void *data2,
+                                  uint16_t len2)
+{
+    DetectFPAndItsId *fp1 = (DetectFPAndItsId *)data1;
+    DetectFPAndItsId *fp2 = (DetectFPAndItsId *)data2;
+
+    if (fp1->content_len != fp2->content_len ||
+        fp1->sm_list != fp2->sm_list ||
+        SCMemcmp(fp1->content, fp2->content, fp1->content_len) != 0)
+        return 0;
+
+    return 1;
+}
+
+static void DetectFPIdFreeFunc(void *data)
+{
+    SCFree(data);
+}
+
+/**
+ * \internal
+ * \brief Give every fast pattern its id.
+ *
+ * \param prev fast pattern id hash of the engine being replaced, or NULL.
+ *             Fast patterns in it keep their id, new ones get ids after
+ *             its highest.
+ * \param prev_max max_fp_id of the engine being replaced.
+ *
+ * \retval hash of the fast patterns, NULL on error or if the ids of prev
+ *         can't be kept
+ */
+static HashListTable *DetectSetFastPatternIds(DetectEngineCtx *de_ctx,
+                                              HashListTable *prev,
+                                              uint32_t prev_max)
+{
+    Signature *s = NULL;
+    uint32_t next_id = prev_max;
+    uint32_t unique = 0, kept = 0;
+
+    HashListTable *hash = HashListTableInit(DETECT_FP_ID_HASH_SIZE,
+            DetectFPIdHashFunc, DetectFPIdCompareFunc, DetectFPIdFreeFunc);
+    if (hash == NULL)
+        return NULL;
+
+    for (s = de_ctx->sig_list; s != NULL; s = s->next) {
+        if (s->mpm_sm == NULL)
+            continue;
+
+        int sm_list = SigMatchListSMBelongsTo(s, s->mpm_sm);
+        BUG_ON(sm_list == -1);
+        DetectContentData *cd = (DetectContentData *)s->mpm_sm->ctx;
+
+        DetectFPAndItsId lookup;
+        lookup.content_len = cd->content_len;
+        lookup.sm_list = sm_list;
+        lookup.content = cd->content;
+
+        DetectFPAndItsId *fp = HashListTableLookup(hash, &lookup, 0);
+        if (fp != NULL) {
+            cd->id = fp->id;
+            continue;
+        }
+
+        fp = SCMalloc(sizeof(DetectFPAndItsId) + cd->content_len);
+        if (fp == NULL)
+            goto error;
+        memset(fp, 0, sizeof(DetectFPAndItsId));
+        fp->content_len = cd->content_len;
+        fp->sm_list = sm_list;
+        fp->content = (uint8_t *)(fp + 1);
+        memcpy(fp->content, cd->content, cd->content_len);
+
+        DetectFPAndItsId *pfp = NULL;
+        if (prev != NULL)
+            pfp = HashListTableLookup(prev, &lookup, 0);
+        if (pfp != NULL) {
+            fp->id = pfp->id;
+            kept++;
+        } else {
+            /* max_fp_id is a uint16_t and one past the highest id */
+            if (next_id >= 0xFFFF) {
+                if (prev == NULL) {
+                    SCLogError(SC_ERR_FATAL, "more than %u unique fast "
+                               "patterns", 0xFFFF);
+                }
+                SCFree(fp);
+                goto error;
+            }
+            fp->id = next_id++;
+        }
+        unique++;
+
+        if (HashListTableAdd(hash, fp, 0) != 0) {
+            SCFree(fp);
+            goto error;
+        }
+        cd->id = fp->id;
+    }
+
+    /* don't let the ids of removed patterns pile up over reloads */
+    if (prev != NULL && next_id > 2 * unique + 1024) {
+        SCLogInfo("%"PRIu32" fast pattern ids in use for %"PRIu32" patterns, "
+                  "renumbering", next_id, unique);
+        goto error;
+    }
+
+    if (prev != NULL) {
+        SCLogInfo("%"PRIu32" of %"PRIu32" fast patterns kept their id",
+                  kept, unique);
+    }
+    de_ctx->max_fp_id = next_id;
+    return hash;
+
+error:
+    HashListTableFree(hash);
+    return NULL;
+}
+
 /**
  * \brief Figured out the FP and their respective content ids for all the
  *        sigs in the engine.
  *
+ * On a rule reload (de_ctx->prev_de_ctx set) the fast patterns of the old
+ * engine keep their ids. The sig groups that didn't change then get the
+ * same patterns with the same ids, so mpms that share tables by pattern
+ * set (ac-compact) can reuse the tables of the old engine.
+ *
  * \param de_ctx Detection engine context.
  *
  * \retval  0 On success.
@@ -3370,61 +3624,28 @@ typedef struct DetectFPAndItsId_ {
  */
 int DetectSetFastPatternAndItsId(DetectEngineCtx *de_ctx)
 {
-    uint32_t struct_total_size = 0;
-    uint32_t content_total_size = 0;
     Signature *s = NULL;
 
     for (s = de_ctx->sig_list; s != NULL; s = s->next) {
         s->mpm_sm = RetrieveFPForSigV2(s);
-        if (s->mpm_sm != NULL) {
-            DetectContentData *cd = (DetectContentData *)s->mpm_sm->ctx;
-            struct_total_size += sizeof(DetectFPAndItsId);
-            content_total_size += cd->content_len;
-        }
     }
 
-    /* array hash buffer - i've run out of ideas to name it */
-    uint8_t *ahb = SCMalloc(sizeof(uint8_t) * (struct_total_size + content_total_size));
-    if (ahb == NULL)
-        return -1;
-
-    PatIntId max_id = 0;
-    DetectFPAndItsId *struct_offset = (DetectFPAndItsId *)ahb;
-    uint8_t *content_offset = ahb + struct_total_size;
-    for (s = de_ctx->sig_list; s != NULL; s = s->next) {
-        if (s->mpm_sm != NULL) {
-            int sm_list = SigMatchListSMBelongsTo(s, s->mpm_sm);
-            BUG_ON(sm_list == -1);
-            DetectContentData *cd = (DetectContentData *)s->mpm_sm->ctx;
-            DetectFPAndItsId *dup = (DetectFPAndItsId *)ahb;
-            for (; dup != struct_offset; dup++) {
-                if (dup->content_len != cd->content_len ||
-                    dup->sm_list != sm_list ||
-                    SCMemcmp(dup->content, cd->content, dup->content_len) != 0) {
-                    continue;
-                }
-
-                break;
-            }
-            if (dup != struct_offset) {
-                cd->id = dup->id;
-                continue;
-            }
-
-            struct_offset->id = max_id++;
-            cd->id = struct_offset->id;
-            struct_offset->content_len = cd->content_len;
-            struct_offset->sm_list = sm_list;
-            struct_offset->content = content_offset;
-            content_offset += cd->content_len;
-            memcpy(struct_offset->content, cd->content, cd->content_len);
-
-            struct_offset++;
-        } /* if (s->mpm_sm != NULL) */
-    } /* for */
+    if (de_ctx->fp_id_hash != NULL) {
+        HashListTableFree(de_ctx->fp_id_hash);
+        de_ctx->fp_id_hash = NULL;
+    }
 
-    de_ctx->max_fp_id = max_id;
+    /* stable ids keep the pattern sets of unchanged sgh's identical, which
+     * only saves work with ac-compact: it is the only mpm that shares its
+     * tables between engines. The others build them again anyway. */
+    if (de_ctx->prev_de_ctx != NULL && de_ctx->prev_de_ctx->fp_id_hash != NULL) {
+        de_ctx->fp_id_hash = DetectSetFastPatternIds(de_ctx,
+                de_ctx->prev_de_ctx->fp_id_hash, de_ctx->prev_de_ctx->max_fp_id);
+    }
+    if (de_ctx->fp_id_hash == NULL)
+        de_ctx->fp_id_hash = DetectSetFastPatternIds(de_ctx, NULL, 0);
+    if (de_ctx->fp_id_hash == NULL)
+        return -1;
 
-    SCFree(ahb);
     return 0;
 }
@@ -57,6 +57,8 @@ void StreamPatternCleanup(ThreadVars *t, DetectEngineThreadCtx *det_ctx, StreamM
 
 void PatternMatchPrepare(MpmCtx *, uint16_t);
 void PatternMatchThreadPrepare(ThreadVars *, MpmThreadCtx *, uint16_t type, uint32_t max_id);
+void PatternMatchPrepareMpmCtx(DetectEngineCtx *, MpmCtx *, uint8_t);
+int PatternMatchPrepareQueueRun(DetectEngineCtx *);
 
 void PatternMatchDestroy(MpmCtx *, uint16_t);
 void PatternMatchThreadDestroy(MpmThreadCtx *mpm_thread_ctx, uint16_t);
@@ -717,7 +717,7 @@ int DeStateDetectContinueDetection(ThreadVars *tv, DetectEngineCtx *de_ctx, Dete
             else if ((flags & STREAM_TOCLIENT) && !(s->flags & SIG_FLAG_TOCLIENT))
                 continue;
 
-            RULE_PROFILING_START;
+            RULE_PROFILING_START(det_ctx);
 
             /* let's continue detection */
 
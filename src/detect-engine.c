@@ -71,6 +71,8 @@
 #include "util-error.h"
 #include "util-hash.h"
 #include "util-byte.h"
+#include "util-cpu.h"
+#include "util-spm.h"
 #include "util-debug.h"
 #include "util-unittest.h"
 #include "util-action.h"
@@ -358,6 +360,35 @@ void DetectEngineRegisterAppInspectionEngine(uint16_t alproto,
     return;
 }
 
+/**
+ * \internal
+ * \brief Get the de_ctx the detect threads currently use.
+ */
+static DetectEngineCtx *DetectEngineGetCurrentDeCtx(void)
+{
+    DetectEngineCtx *de_ctx = NULL;
+
+    SCMutexLock(&tv_root_lock);
+    ThreadVars *tv = tv_root[TVT_PPT];
+    for ( ; tv != NULL && de_ctx == NULL; tv = tv->next) {
+        TmSlot *slots = tv->tm_slots;
+        for ( ; slots != NULL; slots = slots->slot_next) {
+            TmModule *tm = TmModuleGetById(slots->tm_id);
+            if (!(tm->flags & TM_FLAG_DETECT_TM))
+                continue;
+
+            DetectEngineThreadCtx *det_ctx = SC_ATOMIC_GET(slots->slot_data);
+            if (det_ctx != NULL) {
+                de_ctx = det_ctx->de_ctx;
+                break;
+            }
+        }
+    }
+    SCMutexUnlock(&tv_root_lock);
+
+    return de_ctx;
+}
+
 static void *DetectEngineLiveRuleSwap(void *arg)
 {
     SCEnter();
@@ -417,7 +448,14 @@ static void *DetectEngineLiveRuleSwap(void *arg)
         exit(EXIT_FAILURE);
     }
 
-    if (SigLoadSignatures(de_ctx, NULL, FALSE) < 0) {
+    /* the old engine stays in use until the swap below and is only
+     * freed by this thread, so the new one can look at it while it's
+     * built */
+    de_ctx->prev_de_ctx = DetectEngineGetCurrentDeCtx();
+
+    int r = SigLoadSignatures(de_ctx, NULL, FALSE);
+    de_ctx->prev_de_ctx = NULL;
+    if (r < 0) {
         SCLogError(SC_ERR_NO_RULES_LOADED, "Loading signatures failed.");
         if (de_ctx->failure_fatal)
             exit(EXIT_FAILURE);
@@ -705,6 +743,7 @@ DetectEngineCtx *DetectEngineCtxInit(void) {
                de_ctx->inspection_recursion_limit);
 
     de_ctx->mpm_matcher = PatternMatchDefaultMatcher();
+    de_ctx->spm_matcher = SinglePatternMatchDefaultMatcher();
     DetectEngineCtxLoadConf(de_ctx);
 
     SigGroupHeadHashInit(de_ctx);
@@ -785,7 +824,13 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx) {
         MpmFactoryDeRegisterAllMpmCtxProfiles(de_ctx);
     }
 
+    if (de_ctx->mpm_prepare_queue != NULL)
+        SCFree(de_ctx->mpm_prepare_queue);
+    if (de_ctx->fp_id_hash != NULL)
+        HashListTableFree(de_ctx->fp_id_hash);
+
     DetectEngineCtxFreeThreadKeywordData(de_ctx);
+    SRepTableFree(de_ctx->srep_table);
     SCFree(de_ctx);
     //DetectAddressGroupPrintMemory();
     //DetectSigGroupPrintMemory();
@@ -812,6 +857,7 @@ static uint8_t DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx) {
     const char *max_uniq_toserver_dp_groups_str = NULL;
 
     char *sgh_mpm_context = NULL;
+    char *build_threads = NULL;
 
     ConfNode *de_ctx_custom = ConfGetNode("detect-engine");
     ConfNode *opt = NULL;
@@ -822,6 +868,8 @@ static uint8_t DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx) {
                 de_ctx_profile = opt->head.tqh_first->val;
             } else if (strcmp(opt->val, "sgh-mpm-context") == 0) {
                 sgh_mpm_context = opt->head.tqh_first->val;
+            } else if (strcmp(opt->val, "build-threads") == 0) {
+                build_threads = opt->head.tqh_first->val;
             }
         }
     }
@@ -868,8 +916,22 @@ static uint8_t DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx) {
         }
     }
 
+    /* detect-engine.build-threads option parsing */
+    if (build_threads == NULL || strcmp(build_threads, "auto") == 0) {
+        de_ctx->build_threads = UtilCpuGetNumProcessorsOnline();
+    } else if (ByteExtractStringUint16(&de_ctx->build_threads, 10,
+                (uint16_t)strlen(build_threads), build_threads) <= 0) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "You have supplied an "
+                   "invalid conf value for detect-engine.build-threads-"
+                   "%s", build_threads);
+        exit(EXIT_FAILURE);
+    }
+    if (de_ctx->build_threads == 0)
+        de_ctx->build_threads = 1;
+
     if (run_mode == RUNMODE_UNITTEST) {
         de_ctx->sgh_mpm_context = ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL;
+        de_ctx->build_threads = 1;
     }
 
     opt = NULL;
@@ -1782,6 +1844,86 @@ int DetectEngineTest07(void)
     return result;
 }
 
+/** \internal
+ *  \brief id of the fast pattern of the sig with sid, -1 if not found */
+static int DetectEngineTestFPId(DetectEngineCtx *de_ctx, uint32_t sid)
+{
+    Signature *s;
+
+    for (s = de_ctx->sig_list; s != NULL; s = s->next) {
+        if (s->id == sid && s->mpm_sm != NULL)
+            return ((DetectContentData *)s->mpm_sm->ctx)->id;
+    }
+    return -1;
+}
+
+/** \test fast patterns keep their id when an engine is built to replace
+ *        another, new ones get ids after the old ones */
+static int DetectEngineTest08(void)
+{
+    DetectEngineCtx *de_ctx1 = NULL;
+    DetectEngineCtx *de_ctx2 = NULL;
+    int result = 0;
+
+    de_ctx1 = DetectEngineCtxInit();
+    if (de_ctx1 == NULL)
+        goto end;
+    de_ctx1->flags |= DE_QUIET;
+    if (DetectEngineAppendSig(de_ctx1, "alert tcp any any -> any any "
+                "(content:\"aaaa\"; sid:1;)") == NULL ||
+        DetectEngineAppendSig(de_ctx1, "alert tcp any any -> any any "
+                "(content:\"bbbb\"; sid:2;)") == NULL ||
+        DetectEngineAppendSig(de_ctx1, "alert tcp any any -> any any "
+                "(content:\"cccc\"; sid:3;)") == NULL)
+        goto end;
+    SigGroupBuild(de_ctx1);
+
+    /* drop sid 2, add sid 4, and a new sid with the pattern of sid 3 */
+    de_ctx2 = DetectEngineCtxInit();
+    if (de_ctx2 == NULL)
+        goto end;
+    de_ctx2->flags |= DE_QUIET;
+    de_ctx2->prev_de_ctx = de_ctx1;
+    if (DetectEngineAppendSig(de_ctx2, "alert tcp any any -> any any "
+                "(content:\"dddd\"; sid:4;)") == NULL ||
+        DetectEngineAppendSig(de_ctx2, "alert tcp any any -> any any "
+                "(content:\"cccc\"; sid:5;)") == NULL ||
+        DetectEngineAppendSig(de_ctx2, "alert tcp any any -> any any "
+                "(content:\"cccc\"; sid:3;)") == NULL ||
+        DetectEngineAppendSig(de_ctx2, "alert tcp any any -> any any "
+                "(content:\"aaaa\"; sid:1;)") == NULL)
+        goto end;
+    SigGroupBuild(de_ctx2);
+    de_ctx2->prev_de_ctx = NULL;
+
+    if (DetectEngineTestFPId(de_ctx2, 1) != DetectEngineTestFPId(de_ctx1, 1) ||
+        DetectEngineTestFPId(de_ctx2, 3) != DetectEngineTestFPId(de_ctx1, 3) ||
+        DetectEngineTestFPId(de_ctx2, 5) != DetectEngineTestFPId(de_ctx1, 3)) {
+        printf("ids of unchanged patterns changed: ");
+        goto end;
+    }
+    if (DetectEngineTestFPId(de_ctx2, 4) != de_ctx1->max_fp_id ||
+        de_ctx2->max_fp_id != de_ctx1->max_fp_id + 1) {
+        printf("new pattern id %d, max_fp_id %u: ",
+               DetectEngineTestFPId(de_ctx2, 4), de_ctx2->max_fp_id);
+        goto end;
+    }
+
+    result = 1;
+ end:
+    if (de_ctx2 != NULL) {
+        SigGroupCleanup(de_ctx2);
+        SigCleanSignatures(de_ctx2);
+        DetectEngineCtxFree(de_ctx2);
+    }
+    if (de_ctx1 != NULL) {
+        SigGroupCleanup(de_ctx1);
+        SigCleanSignatures(de_ctx1);
+        DetectEngineCtxFree(de_ctx1);
+    }
+    return result;
+}
+
 #endif
 
 void DetectEngineRegisterTests()
@@ -1795,6 +1937,7 @@ void DetectEngineRegisterTests()
     UtRegisterTest("DetectEngineTest05", DetectEngineTest05, 1);
     UtRegisterTest("DetectEngineTest06", DetectEngineTest06, 1);
     UtRegisterTest("DetectEngineTest07", DetectEngineTest07, 1);
+    UtRegisterTest("DetectEngineTest08", DetectEngineTest08, 1);
 #endif
 
     return;
@@ -87,81 +87,16 @@ error:
     return;
 }
 
-static uint8_t GetHostRepSrc(Packet *p, uint8_t cat, uint32_t version) {
-    uint8_t val = 0;
-    Host *h = NULL;
-
-    if (p->flags & PKT_HOST_SRC_LOOKED_UP && p->host_src == NULL) {
-        return 0;
-    } else if (p->host_src != NULL) {
-        h = (Host *)p->host_src;
-        HostLock(h);
-    } else {
-        h = HostLookupHostFromHash(&(p->src));
-
-        p->flags |= PKT_HOST_SRC_LOOKED_UP;
-
-        if (h == NULL)
-            return 0;
-
-        HostReference(&p->host_src, h);
-    }
-
-    if (h->iprep == NULL) {
-        HostRelease(h);
-        return 0;
-    }
-
-    SReputation *r = (SReputation *)h->iprep;
-
-    /* allow higher versions as this happens during
-     * rule reload */
-    if (r->version >= version)
-        val = r->rep[cat];
-    else
-        SCLogDebug("version mismatch %u != %u", r->version, version);
-
-    HostRelease(h);
-    return val;
-}
-
-static uint8_t GetHostRepDst(Packet *p, uint8_t cat, uint32_t version) {
-    uint8_t val = 0;
-    Host *h = NULL;
-
-    if (p->flags & PKT_HOST_DST_LOOKED_UP && p->host_dst == NULL) {
+/** \brief reputation of an address for a category, 0 if none */
+static inline uint8_t GetRep(const SRepTable *t, Address *a, uint8_t cat) {
+    if (a->family != AF_INET)
         return 0;
-    } else if (p->host_dst != NULL) {
-        h = (Host *)p->host_dst;
-        HostLock(h);
-    } else {
-        h = HostLookupHostFromHash(&(p->dst));
-
-        p->flags |= PKT_HOST_DST_LOOKED_UP;
 
-        if (h == NULL) {
-            return 0;
-        }
-
-        HostReference(&p->host_dst, h);
-    }
-
-    if (h->iprep == NULL) {
-        HostRelease(h);
+    const SReputation *r = SRepTableLookupIPV4(t, a->addr_data32[0]);
+    if (r == NULL)
         return 0;
-    }
-
-    SReputation *r = (SReputation *)h->iprep;
-
-    /* allow higher versions as this happens during
-     * rule reload */
-    if (r->version >= version)
-        val = r->rep[cat];
-    else
-        SCLogDebug("version mismatch %u != %u", r->version, version);
 
-    HostRelease(h);
-    return val;
+    return r->rep[cat];
 }
 
 static inline int RepMatch(uint8_t op, uint8_t val1, uint8_t val2) {
@@ -186,18 +121,20 @@ int DetectIPRepMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
     if (rd == NULL)
         return 0;
 
-    uint32_t version = det_ctx->de_ctx->srep_version;
+    /* the table of our de_ctx, only freed after all threads moved
+     * on to a new de_ctx, so it can be used without locking */
+    const SRepTable *srep = det_ctx->de_ctx->srep_table;
     uint8_t val = 0;
 
     SCLogDebug("rd->cmd %u", rd->cmd);
     switch(rd->cmd) {
         case DETECT_IPREP_CMD_ANY:
-            val = GetHostRepSrc(p, rd->cat, version);
+            val = GetRep(srep, &p->src, rd->cat);
             if (val > 0) {
                 if (RepMatch(rd->op, val, rd->val) == 1)
                     return 1;
             }
-            val = GetHostRepDst(p, rd->cat, version);
+            val = GetRep(srep, &p->dst, rd->cat);
             if (val > 0) {
                 return RepMatch(rd->op, val, rd->val);
             }
@@ -205,7 +142,7 @@ int DetectIPRepMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
 
         case DETECT_IPREP_CMD_SRC:
             SCLogDebug("checking src");
-            val = GetHostRepSrc(p, rd->cat, version);
+            val = GetRep(srep, &p->src, rd->cat);
             if (val > 0) {
                 return RepMatch(rd->op, val, rd->val);
             }
@@ -213,17 +150,17 @@ int DetectIPRepMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
 
         case DETECT_IPREP_CMD_DST:
             SCLogDebug("checking dst");
-            val = GetHostRepDst(p, rd->cat, version);
+            val = GetRep(srep, &p->dst, rd->cat);
             if (val > 0) {
                 return RepMatch(rd->op, val, rd->val);
             }
             break;
 
         case DETECT_IPREP_CMD_BOTH:
-            val = GetHostRepSrc(p, rd->cat, version);
+            val = GetRep(srep, &p->src, rd->cat);
             if (val == 0 || RepMatch(rd->op, val, rd->val) == 0)
                 return 0;
-            val = GetHostRepDst(p, rd->cat, version);
+            val = GetRep(srep, &p->dst, rd->cat);
             if (val > 0) {
                 return RepMatch(rd->op, val, rd->val);
             }
@@ -185,6 +185,7 @@
 #include "util-hashlist.h"
 #include "util-cuda-handlers.h"
 #include "util-mpm-b2g-cuda.h"
+#include "util-mpm-ac-compact.h"
 #include "util-cuda.h"
 #include "util-privs.h"
 #include "util-profiling.h"
@@ -1178,6 +1179,7 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
 
     p->alerts.cnt = 0;
     det_ctx->filestore_cnt = 0;
+    RULE_PROFILING_SAMPLE(det_ctx, p);
 
     /* No need to perform any detection on this packet, if the the given flag is set.*/
     if (p->flags & PKT_NOPACKET_INSPECTION) {
@@ -1388,7 +1390,7 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
     PACKET_PROFILING_DETECT_START(p, PROF_DETECT_RULES);
     /* inspect the sigs against the packet */
     for (idx = 0; idx < det_ctx->match_array_cnt; idx++) {
-        RULE_PROFILING_START;
+        RULE_PROFILING_START(det_ctx);
 #ifdef PROFILING
         smatch = 0;
 #endif
@@ -3915,6 +3917,10 @@ int SigAddressPrepareStage3(DetectEngineCtx *de_ctx) {
         }
     }
 
+    /* prepare the mpm ctxs the sig group heads queued */
+    if (PatternMatchPrepareQueueRun(de_ctx) < 0)
+        goto error;
+
     /* prepare the decoder event sgh */
     DetectEngineBuildDecoderEventSgh(de_ctx);
 
@@ -3938,6 +3944,11 @@ int SigAddressPrepareStage3(DetectEngineCtx *de_ctx) {
             de_ctx->mpm_memory_size + ((de_ctx->mpm_unique + de_ctx->mpm_uri_unique) * (uintmax_t)sizeof(MpmCtx)),
             de_ctx->mpm_memory_size, ((de_ctx->mpm_unique + de_ctx->mpm_uri_unique) * (uintmax_t)sizeof(MpmCtx)),
             de_ctx->mpm_unique ? de_ctx->mpm_memory_size / de_ctx->mpm_unique: 0);
+        /* ac-compact tables are shared between ctxs, and engines, so they
+         * are not in the ctx memory above */
+        if (de_ctx->mpm_matcher == MPM_AC_COMPACT)
+            SCLogDebug("MPM ac-compact tables %" PRIu64 " (all engines)",
+                    SCACCompactTablesMemuse());
 
         SCLogDebug("max sig id %" PRIu32 ", array size %" PRIu32 "", DetectEngineGetMaxSigId(de_ctx), DetectEngineGetMaxSigId(de_ctx) / 8 + 1);
         SCLogDebug("signature group heads: unique %" PRIu32 ", copies %" PRIu32 ".", de_ctx->gh_unique, de_ctx->gh_reuse);
@@ -4469,170 +4480,113 @@ int SigGroupBuild(DetectEngineCtx *de_ctx)
     if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
         MpmCtx *mpm_ctx = NULL;
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_tcp_packet, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_tcp_packet, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("packet- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_udp_packet, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_udp_packet, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("packet- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_other_packet, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("packet- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_uri, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_uri, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("uri- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hcbd, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hcbd, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("hcbd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hhd, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hhd, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("hhd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hrhd, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hrhd, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("hrhd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hmd, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hmd, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("hmd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hcd, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hcd, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("hcd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hrud, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hrud, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("hrud- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_stream, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_stream, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("stream- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hsmd, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("hsmd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hsmd, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("hsmd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hscd, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("hscd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hscd, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("hscd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_huad, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("huad- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_huad, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("huad- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hhhd, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("hhhd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hhhd, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("hhhd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hrhhd, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("hrhhd- %d\n", mpm_ctx->pattern_cnt);
 
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_hrhhd, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        PatternMatchPrepareMpmCtx(de_ctx, mpm_ctx, 0);
         //printf("hrhhd- %d\n", mpm_ctx->pattern_cnt);
+
+        if (PatternMatchPrepareQueueRun(de_ctx) < 0) {
+            SCLogError(SC_ERR_DETECT_PREPARE, "initializing the detection engine failed");
+            exit(EXIT_FAILURE);
+        }
     }
 
 //    SigAddressPrepareStage5(de_ctx);
@@ -10575,6 +10529,104 @@ end:
     return result;
 }
 
+/**
+ * \internal
+ * \brief build a rule set with build_threads threads preparing the mpm
+ *        ctxs, and run a packet per rule through it.
+ *
+ * \param alerts bitmask of the packets that alerted
+ */
+static int SigTestBuildThreadsReal(uint16_t build_threads, uint32_t *mem,
+                                   uint32_t *mpm_unique, uint32_t *gh_unique,
+                                   uint32_t *alerts)
+{
+    Packet *p = NULL;
+    ThreadVars tv;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    char sig[256];
+    char payload[32];
+    int result = 0;
+    int i;
+
+    memset(&tv, 0, sizeof(tv));
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL) {
+        goto end;
+    }
+
+    de_ctx->mpm_matcher = MPM_B2G;
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->build_threads = build_threads;
+
+    /* a port per rule gives every rule its own sig group head */
+    for (i = 0; i < 16; i++) {
+        snprintf(sig, sizeof(sig), "alert tcp any any -> any %d "
+                "(content:\"pattern%02d\"; content:\"common\"; sid:%d;)",
+                1000 + i, i, i + 1);
+        if (DetectEngineAppendSig(de_ctx, sig) == NULL)
+            goto end;
+    }
+
+    SigGroupBuild(de_ctx);
+    tv.name = "detect_test";
+    DetectEngineThreadCtxInit(&tv, de_ctx, (void *)&det_ctx);
+
+    *mem = de_ctx->mpm_memory_size;
+    *mpm_unique = de_ctx->mpm_unique;
+    *gh_unique = de_ctx->gh_unique;
+    *alerts = 0;
+
+    /* packet i carries the pattern of rule i, on the port of rule i + i % 2,
+     * so only the even ones alert */
+    for (i = 0; i < 16; i++) {
+        snprintf(payload, sizeof(payload), "xx common pattern%02d xx", i);
+        p = UTHBuildPacketSrcDstPorts((uint8_t *)payload, strlen(payload),
+                IPPROTO_TCP, 41424, 1000 + i + (i % 2));
+        if (p == NULL)
+            goto end;
+        SigMatchSignatures(&tv, de_ctx, det_ctx, p);
+        if (PacketAlertCheck(p, i + 1))
+            *alerts |= (1 << i);
+        UTHFreePackets(&p, 1);
+    }
+
+    result = 1;
+end:
+    if (de_ctx != NULL) {
+        SigGroupCleanup(de_ctx);
+        SigCleanSignatures(de_ctx);
+        if (det_ctx != NULL)
+            DetectEngineThreadCtxDeinit(&tv, (void *)det_ctx);
+        DetectEngineCtxFree(de_ctx);
+    }
+    return result;
+}
+
+/** \test preparing the mpm ctxs on several threads builds the same
+ *        engine as preparing them serially */
+static int SigTestBuildThreads01(void)
+{
+    uint32_t mem1, mpm_unique1, gh_unique1, alerts1;
+    uint32_t mem4, mpm_unique4, gh_unique4, alerts4;
+
+    if (!SigTestBuildThreadsReal(1, &mem1, &mpm_unique1, &gh_unique1, &alerts1))
+        return 0;
+    if (!SigTestBuildThreadsReal(4, &mem4, &mpm_unique4, &gh_unique4, &alerts4))
+        return 0;
+
+    if (mem1 != mem4 || mpm_unique1 != mpm_unique4 || gh_unique1 != gh_unique4) {
+        printf("mem %u/%u mpm_unique %u/%u gh_unique %u/%u: ", mem1, mem4,
+                mpm_unique1, mpm_unique4, gh_unique1, gh_unique4);
+        return 0;
+    }
+    if (alerts1 != 0x5555 || alerts4 != alerts1) {
+        printf("alerts %04x/%04x: ", alerts1, alerts4);
+        return 0;
+    }
+    return 1;
+}
+
 /** \test test if the engine set flag to drop pkts of a flow that
  *        triggered a drop action on IPS mode */
 static int SigTestDropFlow01(void)
@@ -11617,6 +11669,7 @@ void SigRegisterTests(void) {
     UtRegisterTest("SigTestDepthOffset01Wm", SigTestDepthOffset01Wm, 1);
 
     UtRegisterTest("SigTestDetectAlertCounter", SigTestDetectAlertCounter, 1);
+    UtRegisterTest("SigTestBuildThreads01", SigTestBuildThreads01, 1);
 
     UtRegisterTest("SigTestDropFlow01", SigTestDropFlow01, 1);
     UtRegisterTest("SigTestDropFlow02", SigTestDropFlow02, 1);
@@ -554,6 +554,15 @@ typedef struct DetectEngineThreadKeywordCtxItem_ {
     const char *name; /* keyword name, for error printing */
 } DetectEngineThreadKeywordCtxItem;
 
+/** mpm ctx queued to be prepared by the build threads */
+typedef struct DetectMpmPrepareItem_ {
+    struct MpmCtx_ *mpm_ctx;
+    /** memory_size of the ctx when it was queued */
+    uint32_t memory_size;
+    /** 1 if the ctx counts towards DetectEngineCtx::mpm_memory_size */
+    uint8_t account;
+} DetectMpmPrepareItem;
+
 /** \brief main detection engine ctx */
 typedef struct DetectEngineCtx_ {
     uint8_t flags;
@@ -564,6 +573,8 @@ typedef struct DetectEngineCtx_ {
 
     /* version of the srep data */
     uint32_t srep_version;
+    /* ip reputation loaded for this ctx */
+    struct SRepTable_ *srep_table;
 
     Signature **sig_array;
     uint32_t sig_array_size; /* size in bytes */
@@ -617,6 +628,7 @@ typedef struct DetectEngineCtx_ {
     ThresholdCtx ths_ctx;
 
     uint16_t mpm_matcher; /**< mpm matcher this ctx uses */
+    uint8_t spm_matcher;  /**< spm used for content inspection, SPM_* */
 
 #ifdef __SC_CUDA_SUPPORT__
     /* cuda rules content module handle.  Holds the handler serivice's
@@ -651,10 +663,23 @@ typedef struct DetectEngineCtx_ {
     /* specify the configuration for mpm context factory */
     uint8_t sgh_mpm_context;
 
+    /** number of threads preparing the mpm ctxs in SigGroupBuild */
+    uint16_t build_threads;
+    /** mpm ctxs waiting to be prepared by the build threads */
+    struct DetectMpmPrepareItem_ *mpm_prepare_queue;
+    uint32_t mpm_prepare_queue_cnt;
+    uint32_t mpm_prepare_queue_size;
+
     /** hash table for looking up patterns for
      *  id sharing and id tracking. */
     MpmPatternIdStore *mpm_pattern_id_store;
     uint16_t max_fp_id;
+    /** fast pattern to id hash. Kept after the build, so that a rule
+     *  reload can give the fast patterns that didn't change their old id */
+    HashListTable *fp_id_hash;
+    /** engine being replaced by a rule reload. Only set while this one
+     *  is built. */
+    struct DetectEngineCtx_ *prev_de_ctx;
 
     MpmCtxFactoryContainer *mpm_ctx_factory_container;
 
@@ -737,6 +762,8 @@ enum {
 };
 
 typedef struct HttpReassembledBody_ {
+    uint8_t *data;          /**< data to inspect, either buffer or the data
+                                 of a body page if it's in a single page */
     uint8_t *buffer;
     uint32_t buffer_size;   /**< size of the buffer itself */
     uint32_t buffer_len;    /**< data len in the buffer */
@@ -857,6 +884,8 @@ typedef struct DetectionEngineThreadCtx_ {
 #ifdef PROFILING
     struct SCProfileData_ *rule_perf_data;
     int rule_perf_data_size;
+    /** sample weight of the packet being inspected */
+    uint32_t rule_perf_weight;
 #endif
 } DetectEngineThreadCtx;
 
@@ -42,6 +42,13 @@
 
 #include "util-hash-lookup3.h"
 
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define FLOW_DEFAULT_FLOW_PRUNE 5
 
 SC_ATOMIC_EXTERN(unsigned int, flow_prune_idx);
@@ -51,7 +58,19 @@ SC_ATOMIC_EXTERN(unsigned int, flow_flags);
 SC_ATOMIC_EXTERN(unsigned char, flow_flags);
 #endif
 
-static Flow *FlowGetUsedFlow(void);
+static Flow *FlowGetUsedFlow(FlowBucket *);
+static Flow *FlowGetUsedFlowFromPartition(FlowPartition *, FlowBucket *);
+
+/* buckets of a thread local partition are only touched by their owner */
+#define FLOW_BUCKET_LOCK(fp, fb) do {       \
+        if ((fp) == NULL)                   \
+            FBLOCK_LOCK((fb));              \
+    } while (0)
+
+#define FLOW_BUCKET_UNLOCK(fp, fb) do {     \
+        if ((fp) == NULL)                   \
+            FBLOCK_UNLOCK((fb));            \
+    } while (0)
 
 #ifdef FLOW_DEBUG_STATS
 #define FLOW_DEBUG_STATS_PROTO_ALL      0
@@ -193,7 +212,8 @@ typedef struct FlowHashKey6_ {
     };
 } FlowHashKey6;
 
-/* calculate the hash key for this packet
+/* calculate the hash for this packet, the hash key (bucket index) is the
+ * hash modulo the hash size.
  *
  * we're using:
  *  hash_rand -- set at init time
@@ -206,7 +226,7 @@ typedef struct FlowHashKey6_ {
  *
  *  For ICMP we only consider UNREACHABLE errors atm.
  */
-static inline uint32_t FlowGetKey(Packet *p) {
+static inline uint32_t FlowGetHash(Packet *p) {
     uint32_t key;
 
     if (p->ip4h != NULL) {
@@ -252,7 +272,7 @@ static inline uint32_t FlowGetKey(Packet *p) {
             fhk.recur = (uint16_t)p->recursion_level;
 
             uint32_t hash = hashword(fhk.u32, 4, flow_config.hash_rand);
-            key = hash % flow_config.hash_size;
+            key = hash;
 
 #endif // OLDHASH
         } else if (ICMPV4_DEST_UNREACH_IS_VALID(p)) {
@@ -277,7 +297,7 @@ static inline uint32_t FlowGetKey(Packet *p) {
             fhk.recur = (uint16_t)p->recursion_level;
 
             uint32_t hash = hashword(fhk.u32, 4, flow_config.hash_rand);
-            key = hash % flow_config.hash_size;
+            key = hash;
 
         } else {
 
@@ -333,7 +353,7 @@ static inline uint32_t FlowGetKey(Packet *p) {
             fhk.recur = (uint16_t)p->recursion_level;
 
             uint32_t hash = hashword(fhk.u32, 4, flow_config.hash_rand);
-            key = hash % flow_config.hash_size;
+            key = hash;
         }
     } else if (p->ip6h != NULL) {
         FlowHashKey6 fhk;
@@ -367,7 +387,7 @@ static inline uint32_t FlowGetKey(Packet *p) {
         fhk.recur = (uint16_t)p->recursion_level;
 
         uint32_t hash = hashword(fhk.u32, 10, flow_config.hash_rand);
-        key = hash % flow_config.hash_size;
+        key = hash;
 #endif // OLDHASH
     } else
         key = 0;
@@ -466,9 +486,12 @@ static inline int FlowCreateCheck(Packet *p) {
  *  Get a new flow. We're checking memcap first and will try to make room
  *  if the memcap is reached.
  *
+ *  \param fp thread local partition or NULL for the global hash
+ *  \param fb bucket the new flow will be added to
+ *
  *  \retval f *LOCKED* flow on succes, NULL on error.
  */
-static Flow *FlowGetNew(Packet *p) {
+static Flow *FlowGetNew(FlowPartition *fp, FlowBucket *fb, Packet *p) {
     Flow *f = NULL;
 
 
@@ -477,7 +500,7 @@ static Flow *FlowGetNew(Packet *p) {
     }
 
     /* get a flow from the spare queue */
-    f = FlowDequeue(&flow_spare_q);
+    f = FlowDequeue(fp != NULL ? &fp->spare_q : &flow_spare_q);
     if (f == NULL) {
         /* If we reached the max memcap, we get a used flow */
         if (!(FLOW_CHECK_MEMCAP(sizeof(Flow)))) {
@@ -491,7 +514,10 @@ static Flow *FlowGetNew(Packet *p) {
                 FlowWakeupFlowManagerThread();
             }
 
-            f = FlowGetUsedFlow();
+            if (fp != NULL)
+                f = FlowGetUsedFlowFromPartition(fp, fb);
+            else
+                f = FlowGetUsedFlow(fb);
             if (f == NULL) {
                 /* very rare, but we can fail. Just giving up */
                 return NULL;
@@ -517,7 +543,7 @@ static Flow *FlowGetNew(Packet *p) {
     return f;
 }
 
-/* FlowGetFlowFromHash
+/* FlowGetFlowFromBucket
  *
  * Hash retrieval function for flows. Looks up the hash bucket containing the
  * flow pointer. Then compares the packet with the found flow to see if it is
@@ -527,18 +553,22 @@ static Flow *FlowGetNew(Packet *p) {
  * the queue. FlowDequeue() will alloc new flows as long as we stay within our
  * memcap limit.
  *
+ * If fp is not NULL the lookup is done in the thread local partition fp,
+ * which is owned by the calling thread, so the bucket is not locked.
+ *
  * returns a *LOCKED* flow or NULL
  */
-Flow *FlowGetFlowFromHash (Packet *p)
+static inline Flow *FlowGetFlowFromBucket(FlowPartition *fp, Packet *p)
 {
     Flow *f = NULL;
     FlowHashCountInit;
 
     /* get the key to our bucket */
-    uint32_t key = FlowGetKey(p);
+    uint32_t hash = FlowGetHash(p);
+    uint32_t key = hash % flow_config.hash_size;
     /* get our hash bucket and lock it */
-    FlowBucket *fb = &flow_hash[key];
-    FBLOCK_LOCK(fb);
+    FlowBucket *fb = (fp != NULL) ? &fp->hash[key] : &flow_hash[key];
+    FLOW_BUCKET_LOCK(fp, fb);
 
     SCLogDebug("fb %p fb->head %p", fb, fb->head);
 
@@ -546,14 +576,15 @@ Flow *FlowGetFlowFromHash (Packet *p)
 
     /* see if the bucket already has a flow */
     if (fb->head == NULL) {
-        f = FlowGetNew(p);
+        f = FlowGetNew(fp, fb, p);
         if (f == NULL) {
-            FBLOCK_UNLOCK(fb);
+            FLOW_BUCKET_UNLOCK(fp, fb);
             FlowHashCountUpdate;
             return NULL;
         }
 
         /* flow is locked */
+        f->fhash = hash;
         fb->head = f;
         fb->tail = f;
 
@@ -562,8 +593,10 @@ Flow *FlowGetFlowFromHash (Packet *p)
         /* got one, now lock, initialize and return */
         FlowInit(f,p);
         f->fb = fb;
+        if (fp == NULL)
+            FlowWheelInsert(f, &p->ts);
 
-        FBLOCK_UNLOCK(fb);
+        FLOW_BUCKET_UNLOCK(fp, fb);
         FlowHashCountUpdate;
         return f;
     }
@@ -582,9 +615,9 @@ Flow *FlowGetFlowFromHash (Packet *p)
             f = f->hnext;
 
             if (f == NULL) {
-                f = pf->hnext = FlowGetNew(p);
+                f = pf->hnext = FlowGetNew(fp, fb, p);
                 if (f == NULL) {
-                    FBLOCK_UNLOCK(fb);
+                    FLOW_BUCKET_UNLOCK(fp, fb);
                     FlowHashCountUpdate;
                     return NULL;
                 }
@@ -592,6 +625,7 @@ Flow *FlowGetFlowFromHash (Packet *p)
 
                 /* flow is locked */
 
+                f->fhash = hash;
                 f->hprev = pf;
 
                 FlowReference(&p->flow, f);
@@ -599,8 +633,10 @@ Flow *FlowGetFlowFromHash (Packet *p)
                 /* initialize and return */
                 FlowInit(f,p);
                 f->fb = fb;
+                if (fp == NULL)
+                    FlowWheelInsert(f, &p->ts);
 
-                FBLOCK_UNLOCK(fb);
+                FLOW_BUCKET_UNLOCK(fp, fb);
                 FlowHashCountUpdate;
                 return f;
             }
@@ -627,7 +663,7 @@ Flow *FlowGetFlowFromHash (Packet *p)
 
                 /* found our flow, lock & return */
                 FLOWLOCK_WRLOCK(f);
-                FBLOCK_UNLOCK(fb);
+                FLOW_BUCKET_UNLOCK(fp, fb);
                 FlowHashCountUpdate;
                 return f;
             }
@@ -637,11 +673,291 @@ Flow *FlowGetFlowFromHash (Packet *p)
     /* lock & return */
     FlowReference(&p->flow, f);
     FLOWLOCK_WRLOCK(f);
-    FBLOCK_UNLOCK(fb);
+    FLOW_BUCKET_UNLOCK(fp, fb);
+    FlowHashCountUpdate;
+    return f;
+}
+
+/**
+ *  \brief Allocate zeroed, cache line aligned tag lines for a flow hash of
+ *         flow_config.hash_size buckets
+ *
+ *  \retval lines or NULL on error
+ */
+FlowBucketLine *FlowHashLinesAlloc(void)
+{
+    size_t size = flow_config.hash_size * sizeof(FlowBucketLine);
+#if defined(__SSE2__)
+    FlowBucketLine *lines = SCMallocAligned(size, 64);
+#else
+    FlowBucketLine *lines = SCMalloc(size);
+#endif
+    if (lines == NULL)
+        return NULL;
+
+    memset(lines, 0, size);
+    return lines;
+}
+
+void FlowHashLinesFree(FlowBucketLine *lines)
+{
+#if defined(__SSE2__)
+    SCFreeAligned(lines);
+#else
+    SCFree(lines);
+#endif
+}
+
+/**
+ *  \brief Get the tag line of a bucket
+ *
+ *  \param fp partition the bucket belongs to, NULL for the global hash
+ *  \param fb bucket
+ *
+ *  \retval line or NULL if the hash doesn't use the tagged layout
+ */
+FlowBucketLine *FlowHashGetLine(FlowPartition *fp, FlowBucket *fb)
+{
+    if (fp != NULL) {
+        if (fp->lines == NULL)
+            return NULL;
+        return &fp->lines[fb - fp->hash];
+    }
+
+    if (flow_hash_lines == NULL)
+        return NULL;
+    return &flow_hash_lines[fb - flow_hash];
+}
+
+/**
+ *  \brief Remove a flow from a tag line
+ *
+ *  Has to be called while the flow is still linked in the bucket, as the
+ *  first flow after the line in the chain is pulled into the line.
+ *
+ *  \param line tag line of the flow's bucket, may be NULL
+ *  \param f flow about to be removed from the bucket
+ */
+void FlowHashLineRemove(FlowBucketLine *line, Flow *f)
+{
+    uint32_t slot;
+
+    if (line == NULL)
+        return;
+
+    for (slot = 0; slot < line->cnt; slot++) {
+        if (line->flow[slot] == f)
+            break;
+    }
+    /* not in the line, so it's further down the chain */
+    if (slot == line->cnt)
+        return;
+
+    /* the flow following the last one in the line takes the free spot */
+    Flow *refill = NULL;
+    if (line->cnt == FLOW_BUCKET_LINE_SLOTS)
+        refill = line->flow[FLOW_BUCKET_LINE_SLOTS - 1]->hnext;
+
+    for ( ; slot + 1 < line->cnt; slot++) {
+        line->tag[slot] = line->tag[slot + 1];
+        line->flow[slot] = line->flow[slot + 1];
+    }
+
+    if (refill != NULL) {
+        line->tag[slot] = refill->fhash;
+        line->flow[slot] = refill;
+    } else {
+        line->tag[slot] = 0;
+        line->flow[slot] = NULL;
+        line->cnt--;
+    }
+}
+
+/** \internal
+ *  \brief Move a flow to the front of a tag line, like we do in the chain.
+ *
+ *  \param slot slot of the flow, FLOW_BUCKET_LINE_SLOTS if it's not in
+ *               the line (in which case the last flow drops out)
+ */
+static inline void FlowHashLineMoveFront(FlowBucketLine *line, uint32_t slot, Flow *f)
+{
+    if (slot >= FLOW_BUCKET_LINE_SLOTS)
+        slot = FLOW_BUCKET_LINE_SLOTS - 1;
+
+    for ( ; slot > 0; slot--) {
+        line->tag[slot] = line->tag[slot - 1];
+        line->flow[slot] = line->flow[slot - 1];
+    }
+    line->tag[0] = f->fhash;
+    line->flow[0] = f;
+}
+
+/** \internal
+ *  \brief Compare a hash against all tags of a line
+ *
+ *  \retval mask bit per slot that has a matching tag
+ */
+static inline uint32_t FlowHashLineMatch(FlowBucketLine *line, uint32_t hash)
+{
+#if defined(__SSE2__) && FLOW_BUCKET_LINE_SLOTS == 4
+    __m128i tags = _mm_load_si128((const __m128i *)line->tag);
+    __m128i cmp = _mm_cmpeq_epi32(tags, _mm_set1_epi32((int)hash));
+    uint32_t mask = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(cmp));
+#else
+    uint32_t mask = 0;
+    uint32_t slot;
+    for (slot = 0; slot < FLOW_BUCKET_LINE_SLOTS; slot++) {
+        if (line->tag[slot] == hash)
+            mask |= (1 << slot);
+    }
+#endif
+    /* unused slots may have a matching (zero) tag */
+    return mask & ((1 << line->cnt) - 1);
+}
+
+/* FlowGetFlowFromLine
+ *
+ * Hash retrieval function for the tagged layout. Instead of comparing the
+ * packet to every flow in the chain, the hash tags in the bucket's line are
+ * compared first and only flows with the same hash are compared to the
+ * packet. Flows that didn't fit in the line are still found by walking the
+ * rest of the chain, where the tag stored in the flow is checked first.
+ *
+ * returns a *LOCKED* flow or NULL
+ */
+static inline Flow *FlowGetFlowFromLine(FlowPartition *fp, Packet *p)
+{
+    Flow *f = NULL;
+    uint32_t slot = FLOW_BUCKET_LINE_SLOTS;
+    FlowHashCountInit;
+
+    /* get the key to our bucket */
+    uint32_t hash = FlowGetHash(p);
+    uint32_t key = hash % flow_config.hash_size;
+    /* get our hash bucket and lock it */
+    FlowBucket *fb;
+    FlowBucketLine *line;
+    if (fp != NULL) {
+        fb = &fp->hash[key];
+        line = &fp->lines[key];
+    } else {
+        fb = &flow_hash[key];
+        line = &flow_hash_lines[key];
+    }
+    FLOW_BUCKET_LOCK(fp, fb);
+
+    FlowHashCountIncr;
+
+    uint32_t mask = FlowHashLineMatch(line, hash);
+    while (mask != 0) {
+        slot = __builtin_ctz(mask);
+        f = line->flow[slot];
+        if (FlowCompare(f, p) != 0)
+            goto found;
+
+        FlowHashCountIncr;
+        mask &= mask - 1;
+    }
+
+    /* walk the flows that didn't fit in the line */
+    slot = FLOW_BUCKET_LINE_SLOTS;
+    if (line->cnt == FLOW_BUCKET_LINE_SLOTS) {
+        f = line->flow[FLOW_BUCKET_LINE_SLOTS - 1]->hnext;
+        for ( ; f != NULL; f = f->hnext) {
+            FlowHashCountIncr;
+            if (f->fhash == hash && FlowCompare(f, p) != 0)
+                goto found;
+        }
+    }
+
+    /* not found, add a new flow to the tail of the chain */
+    f = FlowGetNew(fp, fb, p);
+    if (f == NULL) {
+        FLOW_BUCKET_UNLOCK(fp, fb);
+        FlowHashCountUpdate;
+        return NULL;
+    }
+
+    /* flow is locked */
+    f->fhash = hash;
+    f->hnext = NULL;
+    f->hprev = fb->tail;
+    if (fb->tail != NULL)
+        fb->tail->hnext = f;
+    else
+        fb->head = f;
+    fb->tail = f;
+
+    if (line->cnt < FLOW_BUCKET_LINE_SLOTS) {
+        line->tag[line->cnt] = hash;
+        line->flow[line->cnt] = f;
+        line->cnt++;
+    }
+
+    FlowReference(&p->flow, f);
+
+    /* initialize and return */
+    FlowInit(f,p);
+    f->fb = fb;
+    if (fp == NULL)
+        FlowWheelInsert(f, &p->ts);
+
+    FLOW_BUCKET_UNLOCK(fp, fb);
+    FlowHashCountUpdate;
+    return f;
+
+found:
+    /* put it on top of the hash list -- this rewards active flows */
+    if (f != fb->head) {
+        if (f->hnext) {
+            f->hnext->hprev = f->hprev;
+        }
+        f->hprev->hnext = f->hnext;
+        if (f == fb->tail) {
+            fb->tail = f->hprev;
+        }
+
+        f->hnext = fb->head;
+        f->hprev = NULL;
+        fb->head->hprev = f;
+        fb->head = f;
+
+        FlowHashLineMoveFront(line, slot, f);
+    }
+
+    FlowReference(&p->flow, f);
+
+    /* found our flow, lock & return */
+    FLOWLOCK_WRLOCK(f);
+    FLOW_BUCKET_UNLOCK(fp, fb);
     FlowHashCountUpdate;
     return f;
 }
 
+Flow *FlowGetFlowFromHash (Packet *p)
+{
+    if (flow_config.hash_layout == FLOW_HASH_LAYOUT_TAGGED)
+        return FlowGetFlowFromLine(NULL, p);
+
+    return FlowGetFlowFromBucket(NULL, p);
+}
+
+/**
+ *  \brief Get the flow for a packet from a thread local partition.
+ *
+ *  \param fp partition owned by the calling thread
+ *  \param p packet
+ *
+ *  \retval f *LOCKED* flow or NULL
+ */
+Flow *FlowGetFlowFromPartition(FlowPartition *fp, Packet *p)
+{
+    if (flow_config.hash_layout == FLOW_HASH_LAYOUT_TAGGED)
+        return FlowGetFlowFromLine(fp, p);
+
+    return FlowGetFlowFromBucket(fp, p);
+}
+
 /** \internal
  *  \brief Get a flow from the hash directly.
  *
@@ -652,12 +968,21 @@ Flow *FlowGetFlowFromHash (Packet *p)
  *  top each time since that would clear the top of the hash leading to longer
  *  and longer search times under high pressure (observed).
  *
+ *  With the timer wheel enabled the flows closest to their timeout are tried
+ *  first, the hash is only walked if none of them can be used.
+ *
+ *  \param skip bucket locked by the caller
+ *
  *  \retval f flow or NULL
  */
-static Flow *FlowGetUsedFlow(void) {
+static Flow *FlowGetUsedFlow(FlowBucket *skip) {
     uint32_t idx = SC_ATOMIC_GET(flow_prune_idx) % flow_config.hash_size;
     uint32_t cnt = flow_config.hash_size;
 
+    Flow *f = FlowWheelGetUsedFlow(skip);
+    if (f != NULL)
+        return f;
+
     while (cnt--) {
         if (++idx >= flow_config.hash_size)
             idx = 0;
@@ -669,7 +994,7 @@ static Flow *FlowGetUsedFlow(void) {
         if (FBLOCK_TRYLOCK(fb) != 0)
             continue;
 
-        Flow *f = fb->tail;
+        f = fb->tail;
         if (f == NULL) {
             FBLOCK_UNLOCK(fb);
             continue;
@@ -688,7 +1013,9 @@ static Flow *FlowGetUsedFlow(void) {
             continue;
         }
 
-        /* remove from the hash */
+        /* remove from the timer wheel and the hash */
+        FlowWheelRemove(f);
+        FlowHashLineRemove(FlowHashGetLine(NULL, fb), f);
         if (f->hprev != NULL)
             f->hprev->hnext = f->hnext;
         if (f->hnext != NULL)
@@ -713,3 +1040,258 @@ static Flow *FlowGetUsedFlow(void) {
 
     return NULL;
 }
+
+/** \internal
+ *  \brief Get a flow from a thread local partition directly.
+ *
+ *  Partition counterpart of FlowGetUsedFlow(). Only called by the thread
+ *  owning the partition, so no bucket locks are needed. The flow itself
+ *  may still be in use by a later stage in another thread (autofp), so
+ *  it is trylocked and use_cnt is adhered to.
+ *
+ *  \param fp partition owned by the calling thread
+ *  \param skip bucket the caller is working on, it's not locked so we
+ *               have to leave it alone
+ *
+ *  \retval f flow or NULL
+ */
+static Flow *FlowGetUsedFlowFromPartition(FlowPartition *fp, FlowBucket *skip) {
+    uint32_t idx = fp->prune_idx % flow_config.hash_size;
+    uint32_t cnt = flow_config.hash_size;
+
+    while (cnt--) {
+        if (++idx >= flow_config.hash_size)
+            idx = 0;
+
+        FlowBucket *fb = &fp->hash[idx];
+        if (fb == skip)
+            continue;
+
+        Flow *f = fb->tail;
+        if (f == NULL)
+            continue;
+
+        if (FLOWLOCK_TRYWRLOCK(f) != 0)
+            continue;
+
+        /** never prune a flow that is used by a packet or stream msg
+         *  we are currently processing in one of the threads */
+        if (SC_ATOMIC_GET(f->use_cnt) > 0) {
+            FLOWLOCK_UNLOCK(f);
+            continue;
+        }
+
+        /* remove from the hash */
+        FlowHashLineRemove(FlowHashGetLine(fp, fb), f);
+        if (f->hprev != NULL)
+            f->hprev->hnext = f->hnext;
+        if (f->hnext != NULL)
+            f->hnext->hprev = f->hprev;
+        if (fb->head == f)
+            fb->head = f->hnext;
+        if (fb->tail == f)
+            fb->tail = f->hprev;
+
+        f->hnext = NULL;
+        f->hprev = NULL;
+        f->fb = NULL;
+
+        FlowClearMemory (f, f->protomap);
+
+        FLOWLOCK_UNLOCK(f);
+
+        fp->prune_idx = idx;
+        return f;
+    }
+
+    return NULL;
+}
+
+#ifdef UNITTESTS
+#include "conf.h"
+#include "util-clock.h"
+
+/** Uncomment to run the lookup benchmark of the chained vs the tagged
+ *  layout. It allocates up to 16M flows, so it needs a lot of memory.
+ *  #define FLOW_HASH_BENCH 1
+ */
+
+/** \test tagged layout: line holds the first flows of the chain, active
+ *        flows are moved to the front and removed flows are refilled
+ *        from the chain. */
+static int FlowHashTest01(void)
+{
+    int result = 0;
+    Packet *p[6];
+    Flow *f[6];
+    int i;
+
+    memset(p, 0, sizeof(p));
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("flow.hash-layout", "tagged", 1);
+    ConfSet("flow.hash-size", "1", 1);
+    FlowInitConfig(FLOW_QUIET);
+
+    if (flow_config.hash_layout != FLOW_HASH_LAYOUT_TAGGED ||
+        flow_hash_lines == NULL) {
+        printf("tagged layout not set up: ");
+        goto end;
+    }
+
+    /* all flows end up in the single bucket */
+    for (i = 0; i < 6; i++) {
+        p[i] = UTHBuildPacketReal(NULL, 0, IPPROTO_UDP, "1.2.3.4", "5.6.7.8",
+                1024 + i, 53);
+        if (p[i] == NULL)
+            goto end;
+
+        f[i] = FlowGetFlowFromHash(p[i]);
+        if (f[i] == NULL) {
+            printf("no flow for packet %d: ", i);
+            goto end;
+        }
+        FLOWLOCK_UNLOCK(f[i]);
+    }
+
+    FlowBucketLine *line = FlowHashGetLine(NULL, &flow_hash[0]);
+    if (line == NULL || line->cnt != FLOW_BUCKET_LINE_SLOTS) {
+        printf("expected a full line: ");
+        goto end;
+    }
+    for (i = 0; i < FLOW_BUCKET_LINE_SLOTS; i++) {
+        if (line->flow[i] != f[i] || line->tag[i] != f[i]->fhash) {
+            printf("slot %d doesn't hold flow %d: ", i, i);
+            goto end;
+        }
+    }
+
+    /* lookup of a flow beyond the line moves it to the front */
+    FlowDeReference(&p[5]->flow);
+    if (FlowGetFlowFromHash(p[5]) != f[5]) {
+        printf("lookup returned another flow: ");
+        goto end;
+    }
+    FLOWLOCK_UNLOCK(f[5]);
+    if (flow_hash[0].head != f[5] || line->flow[0] != f[5] ||
+        line->flow[1] != f[0] || line->flow[3] != f[2]) {
+        printf("flow not moved to the front: ");
+        goto end;
+    }
+
+    /* removing a flow from the line pulls in the next flow of the chain */
+    FlowHashLineRemove(line, f[0]);
+    if (line->cnt != FLOW_BUCKET_LINE_SLOTS || line->flow[1] != f[1] ||
+        line->flow[3] != f[3] || line->tag[3] != f[3]->fhash) {
+        printf("line not refilled: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    for (i = 0; i < 6; i++) {
+        if (p[i] != NULL) {
+            FlowDeReference(&p[i]->flow);
+            UTHFreePacket(p[i]);
+        }
+    }
+    /* f[0] is still in the chain, so the shutdown frees it */
+    FlowShutdown();
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    return result;
+}
+
+#ifdef FLOW_HASH_BENCH
+/** \internal
+ *  \brief time looking up flows in random order in a hash of nflows flows */
+static double FlowHashBenchLookup(char *layout, uint32_t nflows)
+{
+    double secs = -1;
+    uint32_t i;
+    char hash_size[16];
+
+    snprintf(hash_size, sizeof(hash_size), "%"PRIu32, nflows);
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("flow.hash-layout", layout, 1);
+    ConfSet("flow.hash-size", hash_size, 1);
+    ConfSet("flow.prealloc", "0", 1);
+    ConfSet("flow.memcap", "16gb", 1);
+    FlowInitConfig(FLOW_QUIET);
+
+    Packet *p = UTHBuildPacket(NULL, 0, IPPROTO_UDP);
+    if (p == NULL)
+        goto end;
+
+    for (i = 0; i < nflows; i++) {
+        p->sp = 1024 + (i & 0xfff);
+        p->dp = 1024 + (i >> 12);
+        Flow *f = FlowGetFlowFromHash(p);
+        if (f == NULL)
+            goto end;
+        FLOWLOCK_UNLOCK(f);
+        FlowDeReference(&p->flow);
+    }
+
+    unsigned int seed = 1;
+    CLOCK_INIT;
+    CLOCK_START;
+    for (i = 0; i < nflows; i++) {
+        uint32_t r = rand_r(&seed) % nflows;
+        p->sp = 1024 + (r & 0xfff);
+        p->dp = 1024 + (r >> 12);
+        Flow *f = FlowGetFlowFromHash(p);
+        if (f == NULL)
+            goto end;
+        FLOWLOCK_UNLOCK(f);
+        FlowDeReference(&p->flow);
+    }
+    CLOCK_END;
+    secs = (clo2 - clo1) / (double)CLOCKS_PER_SEC;
+
+end:
+    if (p != NULL) {
+        FlowDeReference(&p->flow);
+        UTHFreePacket(p);
+    }
+    FlowShutdown();
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    return secs;
+}
+
+/** \test lookup cost of the chained vs the tagged layout at 1M, 4M and 16M
+ *        flows, with as many buckets as flows */
+static int FlowHashBench01(void)
+{
+    uint32_t sizes[] = { 1 << 20, 1 << 22, 1 << 24 };
+    uint32_t i;
+
+    printf("\n");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        double chained = FlowHashBenchLookup("chained", sizes[i]);
+        double tagged = FlowHashBenchLookup("tagged", sizes[i]);
+        if (chained < 0 || tagged < 0)
+            return 0;
+
+        printf("%"PRIu32" flows: chained %.1f ns/lookup, tagged %.1f ns/lookup\n",
+                sizes[i], chained * 1000000000 / sizes[i],
+                tagged * 1000000000 / sizes[i]);
+    }
+    return 1;
+}
+#endif /* FLOW_HASH_BENCH */
+#endif /* UNITTESTS */
+
+void FlowHashRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowHashTest01 -- tagged hash layout", FlowHashTest01, 1);
+#ifdef FLOW_HASH_BENCH
+    UtRegisterTest("FlowHashBench01 -- chained vs tagged lookups", FlowHashBench01, 1);
+#endif /* FLOW_HASH_BENCH */
+#endif /* UNITTESTS */
+}
@@ -54,6 +54,29 @@ typedef struct FlowBucket_ {
 } FlowBucket;
 #endif
 
+/** hash layouts, selected by flow.hash-layout */
+enum {
+    /** plain chained buckets */
+    FLOW_HASH_LAYOUT_CHAINED = 0,
+    /** chained buckets with an inline line of hash tags in front */
+    FLOW_HASH_LAYOUT_TAGGED,
+};
+
+#define FLOW_BUCKET_LINE_SLOTS 4
+
+/* tag line of a flow hash bucket, used with FLOW_HASH_LAYOUT_TAGGED.
+ *
+ * Holds the full hash and pointer of the first FLOW_BUCKET_LINE_SLOTS flows
+ * of the bucket's chain, in chain order. Lookups compare the packet's hash
+ * against all tags at once and only touch flows that have a matching tag,
+ * so a lookup costs one cache line for the tags plus normally a single
+ * Flow. The line is protected by the bucket lock. */
+typedef struct FlowBucketLine_ {
+    uint32_t tag[FLOW_BUCKET_LINE_SLOTS];
+    struct Flow_ *flow[FLOW_BUCKET_LINE_SLOTS];
+    uint32_t cnt;
+} __attribute__((aligned(64))) FlowBucketLine;
+
 #ifdef FBLOCK_SPIN
     #define FBLOCK_INIT(fb) SCSpinInit(&(fb)->s, 0)
     #define FBLOCK_DESTROY(fb) SCSpinDestroy(&(fb)->s)
@@ -73,6 +96,13 @@ typedef struct FlowBucket_ {
 /* prototypes */
 
 Flow *FlowGetFlowFromHash(Packet *);
+struct FlowPartition_;
+Flow *FlowGetFlowFromPartition(struct FlowPartition_ *, Packet *);
+FlowBucketLine *FlowHashLinesAlloc(void);
+void FlowHashLinesFree(FlowBucketLine *);
+FlowBucketLine *FlowHashGetLine(struct FlowPartition_ *, FlowBucket *);
+void FlowHashLineRemove(FlowBucketLine *, Flow *);
+void FlowHashRegisterTests(void);
 
 /** enable to print stats on hash lookups in flow-debug.log */
 //#define FLOW_DEBUG_STATS
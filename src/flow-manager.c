@@ -77,6 +77,9 @@ SC_ATOMIC_EXTERN(unsigned int, flow_flags);
 SC_ATOMIC_EXTERN(unsigned char, flow_flags);
 #endif
 
+/* buckets of a thread local partition checked per packet */
+#define FLOW_PARTITION_SWEEP_BATCH 64
+
 /* 1 seconds */
 #define FLOW_NORMAL_MODE_UPDATE_DELAY_SEC 1
 #define FLOW_NORMAL_MODE_UPDATE_DELAY_NSEC 0
@@ -248,6 +251,82 @@ static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts) {
     return 1;
 }
 
+/** \internal
+ *  \brief remove a flow from its hash row
+ *
+ *  \param fp partition the row belongs to, NULL for the global hash
+ *  \param f *LOCKED* flow, its bucket is locked as well
+ */
+static inline void FlowManagerHashRemove(FlowPartition *fp, Flow *f)
+{
+    FlowHashLineRemove(FlowHashGetLine(fp, f->fb), f);
+    if (f->hprev != NULL)
+        f->hprev->hnext = f->hnext;
+    if (f->hnext != NULL)
+        f->hnext->hprev = f->hprev;
+    if (f->fb->head == f)
+        f->fb->head = f->hnext;
+    if (f->fb->tail == f)
+        f->fb->tail = f->hprev;
+
+    f->hnext = NULL;
+    f->hprev = NULL;
+}
+
+/** \internal
+ *  \brief put a flow that is out of the hash back in the spare queue
+ *
+ *  \param fp partition the flow belongs to, NULL for the global hash
+ *  \param f *LOCKED* flow, unlocked on return. No longer in the hash.
+ *  \param state flow state the timeout was based on
+ *  \param counters ptr to FlowTimeoutCounters structure
+ */
+static void FlowManagerFlowRecycle(FlowPartition *fp, Flow *f, int state,
+        FlowTimeoutCounters *counters)
+{
+    FlowClearMemory (f, f->protomap);
+
+    /* no one is referring to this flow, use_cnt 0, removed from hash
+     * so we can unlock it and move it back to the spare queue. */
+    FLOWLOCK_UNLOCK(f);
+
+    /* move to spare list */
+    if (fp != NULL)
+        FlowEnqueue(&fp->spare_q, f);
+    else
+        FlowMoveToSpare(f);
+
+    switch (state) {
+        case FLOW_STATE_NEW:
+        default:
+            counters->new++;
+            break;
+        case FLOW_STATE_ESTABLISHED:
+            counters->est++;
+            break;
+        case FLOW_STATE_CLOSED:
+            counters->clo++;
+            break;
+    }
+}
+
+/** \internal
+ *  \brief remove a fully timed out flow from the hash and put it back in
+ *         the spare queue
+ *
+ *  \param fp partition the flow belongs to, NULL for the global hash
+ *  \param f *LOCKED* flow, unlocked on return. Its bucket is locked as well
+ *            and stays locked.
+ *  \param state flow state the timeout was based on
+ *  \param counters ptr to FlowTimeoutCounters structure
+ */
+static void FlowManagerFlowRelease(FlowPartition *fp, Flow *f, int state,
+        FlowTimeoutCounters *counters)
+{
+    FlowManagerHashRemove(fp, f);
+    FlowManagerFlowRecycle(fp, f, state, counters);
+}
+
 /**
  *  \internal
  *
@@ -257,11 +336,12 @@ static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts) {
  *  \param ts timestamp
  *  \param emergency bool indicating emergency mode
  *  \param counters ptr to FlowTimeoutCounters structure
+ *  \param fp partition the row belongs to, NULL for the global hash
  *
  *  \retval cnt timed out flows
  */
 static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
-        int emergency, FlowTimeoutCounters *counters)
+        int emergency, FlowTimeoutCounters *counters, FlowPartition *fp)
 {
     uint32_t cnt = 0;
 
@@ -285,42 +365,10 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
         /* check if the flow is fully timed out and
          * ready to be discarded. */
         if (FlowManagerFlowTimedOut(f, ts) == 1) {
-            /* remove from the hash */
-            if (f->hprev != NULL)
-                f->hprev->hnext = f->hnext;
-            if (f->hnext != NULL)
-                f->hnext->hprev = f->hprev;
-            if (f->fb->head == f)
-                f->fb->head = f->hnext;
-            if (f->fb->tail == f)
-                f->fb->tail = f->hprev;
-
-            f->hnext = NULL;
-            f->hprev = NULL;
-
-            FlowClearMemory (f, f->protomap);
-
-            /* no one is referring to this flow, use_cnt 0, removed from hash
-             * so we can unlock it and move it back to the spare queue. */
-            FLOWLOCK_UNLOCK(f);
-
-            /* move to spare list */
-            FlowMoveToSpare(f);
-
+            if (fp == NULL)
+                FlowWheelRemove(f);
+            FlowManagerFlowRelease(fp, f, state, counters);
             cnt++;
-
-            switch (state) {
-                case FLOW_STATE_NEW:
-                default:
-                    counters->new++;
-                    break;
-                case FLOW_STATE_ESTABLISHED:
-                    counters->est++;
-                    break;
-                case FLOW_STATE_CLOSED:
-                    counters->clo++;
-                    break;
-            }
         } else {
             FLOWLOCK_UNLOCK(f);
         }
@@ -361,7 +409,7 @@ uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt, FlowTimeoutCounte
             goto next;
 
         /* we have a flow, or more than one */
-        cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters);
+        cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters, NULL);
 
 next:
         FBLOCK_UNLOCK(fb);
@@ -373,6 +421,713 @@ next:
     return cnt;
 }
 
+/*
+ * Timer wheel
+ *
+ * With flow.timer-wheel enabled the flows of the global hash are kept on a
+ * timer wheel, keyed on the second they time out at. Every second the flow
+ * manager only checks the flows in the slot of that second, instead of
+ * walking the whole hash.
+ *
+ * The wheel has two levels. Level 0 has a slot per second for the next
+ * FLOW_WHEEL_SLOTS seconds, level 1 a slot per FLOW_WHEEL_SLOTS seconds for
+ * the flows timing out later than that. Whenever level 0 wraps, the next
+ * level 1 slot is moved down into level 0. Expiries beyond the reach of
+ * level 1 go into its last slot and are moved down and back up until they
+ * are in reach.
+ *
+ * Packet threads only put a flow on the wheel when they create it. Packets
+ * updating the flow don't move it: when the manager finds a flow in its slot
+ * that was active in the mean time, it puts it in the slot of its new
+ * expiry. So a flow is checked about once per timeout period, whatever its
+ * packet rate.
+ *
+ * The wheel is split into shards by hash bucket, each with its own lock, so
+ * packet threads creating flows don't all contend on the same lock. Lock
+ * order is bucket, flow, shard. The manager holds the shard lock while
+ * checking flows, so it only trylocks buckets and flows. Flows that timed
+ * out are only taken out of the hash under the shard lock: they are cleared
+ * and put back in the spare queue after the lock is dropped.
+ *
+ * Engine time can go back, e.g. when the next pcap file of a -r list is
+ * older than the previous one. The wheel is then re-based on the new time
+ * like after a jump forward.
+ */
+
+#define FLOW_WHEEL_BITS         8
+#define FLOW_WHEEL_SLOTS        (1 << FLOW_WHEEL_BITS)
+#define FLOW_WHEEL_MASK         (FLOW_WHEEL_SLOTS - 1)
+#define FLOW_WHEEL_SHARDS       16
+/* slots ahead of the current second: level 0 and level 1 but the current
+ * level 1 slot, see FlowWheelSlotAt() */
+#define FLOW_WHEEL_AHEAD        (2 * FLOW_WHEEL_SLOTS - 1)
+/* flows a packet thread checks per shard when looking for a flow to reuse */
+#define FLOW_WHEEL_VICTIM_CHECKS 64
+/* slots taken off a shard per lock hold when checking all of its flows */
+#define FLOW_WHEEL_TAKE_BATCH   16
+
+typedef struct FlowWheel_ {
+    SCMutex m;
+    /** last second that was processed */
+    uint32_t sec;
+    /** flows on this shard */
+    uint32_t cnt;
+    /** level 0 slots followed by level 1 slots */
+    Flow *slot[2 * FLOW_WHEEL_SLOTS];
+} FlowWheel;
+
+static FlowWheel *flow_wheel = NULL;
+
+static inline FlowWheel *FlowWheelGetShard(Flow *f)
+{
+    return &flow_wheel[(uint32_t)(f->fb - flow_hash) % FLOW_WHEEL_SHARDS];
+}
+
+/** \internal
+ *  \brief put a flow in the slot of the second it times out at
+ *
+ *  \param w *LOCKED* shard
+ *  \param f flow, not on the wheel
+ *  \param exp second the flow times out at
+ */
+static void FlowWheelLink(FlowWheel *w, Flow *f, uint32_t exp)
+{
+    uint32_t slot;
+
+    /* due already, or time went back and the manager didn't re-base the
+     * shard yet: check it on the next second */
+    if ((int32_t)(exp - w->sec) <= 0)
+        exp = w->sec + 1;
+
+    if (exp - w->sec < FLOW_WHEEL_SLOTS) {
+        slot = exp & FLOW_WHEEL_MASK;
+    } else {
+        uint32_t hi = exp >> FLOW_WHEEL_BITS;
+        if (hi - (w->sec >> FLOW_WHEEL_BITS) > FLOW_WHEEL_MASK)
+            hi = (w->sec >> FLOW_WHEEL_BITS) + FLOW_WHEEL_MASK;
+        slot = FLOW_WHEEL_SLOTS + (hi & FLOW_WHEEL_MASK);
+    }
+
+    f->wprev = NULL;
+    f->wnext = w->slot[slot];
+    if (f->wnext != NULL)
+        f->wnext->wprev = f;
+    w->slot[slot] = f;
+    f->wslot = (uint16_t)slot;
+    w->cnt++;
+}
+
+/** \internal
+ *  \brief take a flow off the wheel
+ *
+ *  \param w *LOCKED* shard
+ *  \param f flow on the wheel
+ */
+static void FlowWheelUnlink(FlowWheel *w, Flow *f)
+{
+    if (f->wprev != NULL)
+        f->wprev->wnext = f->wnext;
+    else
+        w->slot[f->wslot] = f->wnext;
+    if (f->wnext != NULL)
+        f->wnext->wprev = f->wprev;
+
+    f->wnext = NULL;
+    f->wprev = NULL;
+    f->wslot = FLOW_WHEEL_NONE;
+    w->cnt--;
+}
+
+/** \internal
+ *  \brief get the slot that is a number of steps ahead of the current second
+ *
+ *  \param w *LOCKED* shard
+ *  \param ahead 1 to FLOW_WHEEL_AHEAD. Up to FLOW_WHEEL_MASK are level 0
+ *               slots, the rest level 1 slots.
+ */
+static inline uint32_t FlowWheelSlotAt(FlowWheel *w, uint32_t ahead)
+{
+    if (ahead < FLOW_WHEEL_SLOTS)
+        return (w->sec + ahead) & FLOW_WHEEL_MASK;
+
+    ahead -= FLOW_WHEEL_MASK;
+    return FLOW_WHEEL_SLOTS +
+        (((w->sec >> FLOW_WHEEL_BITS) + ahead) & FLOW_WHEEL_MASK);
+}
+
+/** \internal
+ *  \brief empty a slot, adding its flows to a list linked through wnext
+ */
+static void FlowWheelTake(FlowWheel *w, uint32_t slot, Flow **list)
+{
+    Flow *f = w->slot[slot];
+    while (f != NULL) {
+        Flow *next = f->wnext;
+        f->wnext = *list;
+        f->wprev = NULL;
+        f->wslot = FLOW_WHEEL_NONE;
+        *list = f;
+        w->cnt--;
+        f = next;
+    }
+    w->slot[slot] = NULL;
+}
+
+/** \internal
+ *  \brief check the flows taken off the wheel. Take them out of the hash if
+ *         they timed out or put them back in the slot of their current
+ *         expiry.
+ *
+ *  \param w *LOCKED* shard
+ *  \param list flows linked through wnext
+ *  \param ts timestamp
+ *  \param emergency bool indicating emergency mode
+ *  \param expired list the timed out flows are added to, linked through
+ *                 wnext. They are out of the hash and still locked.
+ */
+static void FlowWheelCheckList(FlowWheel *w, Flow *list, struct timeval *ts,
+        int emergency, Flow **expired)
+{
+    uint32_t now = (uint32_t)ts->tv_sec;
+
+    while (list != NULL) {
+        Flow *f = list;
+        list = f->wnext;
+        f->wnext = NULL;
+
+        FlowBucket *fb = f->fb;
+        if (FBLOCK_TRYLOCK(fb) != 0) {
+            FlowWheelLink(w, f, now + 1);
+            continue;
+        }
+        if (FLOWLOCK_TRYWRLOCK(f) != 0) {
+            FlowWheelLink(w, f, now + 1);
+            FBLOCK_UNLOCK(fb);
+            continue;
+        }
+
+        int state = FlowGetFlowState(f);
+        uint32_t timeout = FlowGetFlowTimeout(f, state, emergency);
+
+        if ((int32_t)(f->lastts_sec + timeout) >= ts->tv_sec) {
+            /* seen since it was put on the wheel */
+            FlowWheelLink(w, f, (uint32_t)f->lastts_sec + timeout + 1);
+        } else if (FlowManagerFlowTimedOut(f, ts) == 0) {
+            /* in use or waiting for its reassembly, try again next second */
+            FlowWheelLink(w, f, now + 1);
+        } else {
+            /* no one can find it anymore, so it's ours until recycled */
+            FlowManagerHashRemove(NULL, f);
+            FBLOCK_UNLOCK(fb);
+            f->wnext = *expired;
+            *expired = f;
+            continue;
+        }
+
+        FLOWLOCK_UNLOCK(f);
+        FBLOCK_UNLOCK(fb);
+    }
+}
+
+/** \internal
+ *  \brief recycle the flows collected by FlowWheelCheckList() and
+ *         FlowWheelEvict(). Called without the shard lock.
+ *
+ *  \param expired *LOCKED* flows linked through wnext, out of the hash
+ *  \param counters ptr to FlowTimeoutCounters structure
+ *
+ *  \retval cnt recycled flows
+ */
+static uint32_t FlowWheelRecycle(Flow *expired, FlowTimeoutCounters *counters)
+{
+    uint32_t cnt = 0;
+
+    while (expired != NULL) {
+        Flow *f = expired;
+        expired = f->wnext;
+        f->wnext = NULL;
+
+        FlowManagerFlowRecycle(NULL, f, FlowGetFlowState(f), counters);
+        cnt++;
+    }
+
+    return cnt;
+}
+
+/** \internal
+ *  \brief check all flows of a shard, after it was re-based on a new second
+ *
+ *  The slots are taken FLOW_WHEEL_TAKE_BATCH at a time, so packet threads
+ *  putting new flows on the shard don't wait for the whole pass.
+ *
+ *  \retval cnt timed out flows
+ */
+static uint32_t FlowWheelCheckAll(FlowWheel *w, struct timeval *ts,
+        int emergency, FlowTimeoutCounters *counters)
+{
+    uint32_t cnt = 0;
+    uint32_t s, u;
+
+    for (s = 0; s < 2 * FLOW_WHEEL_SLOTS; s += FLOW_WHEEL_TAKE_BATCH) {
+        Flow *list = NULL;
+        Flow *expired = NULL;
+
+        SCMutexLock(&w->m);
+        for (u = s; u < s + FLOW_WHEEL_TAKE_BATCH; u++)
+            FlowWheelTake(w, u, &list);
+        FlowWheelCheckList(w, list, ts, emergency, &expired);
+        SCMutexUnlock(&w->m);
+
+        cnt += FlowWheelRecycle(expired, counters);
+    }
+
+    return cnt;
+}
+
+/** \internal
+ *  \brief process the slots of a shard up to the current second
+ *
+ *  The shard is locked per second processed. The flows that timed out are
+ *  recycled after the lock is dropped.
+ *
+ *  \retval cnt timed out flows
+ */
+static uint32_t FlowWheelAdvance(FlowWheel *w, struct timeval *ts,
+        int emergency, FlowTimeoutCounters *counters)
+{
+    uint32_t now = (uint32_t)ts->tv_sec;
+    uint32_t cnt = 0;
+
+    SCMutexLock(&w->m);
+    int32_t diff = (int32_t)(now - w->sec);
+    if (diff == 0) {
+        SCMutexUnlock(&w->m);
+        return 0;
+    }
+
+    /* the first time we get here, after a jump in time or when time went
+     * back, the slots no longer match the seconds. Re-base on the current
+     * second and check all flows, putting them in the right slots again. */
+    if (diff < 0 || diff >= FLOW_WHEEL_SLOTS) {
+        if (diff < 0) {
+            SCLogDebug("engine time went back %"PRId32"s, re-basing the "
+                    "flow timer wheel", -diff);
+        }
+        w->sec = now;
+        SCMutexUnlock(&w->m);
+        return FlowWheelCheckAll(w, ts, emergency, counters);
+    }
+
+    while (w->sec != now) {
+        Flow *list = NULL;
+        Flow *expired = NULL;
+
+        w->sec++;
+
+        /* level 0 wrapped, move the next level 1 slot down */
+        if ((w->sec & FLOW_WHEEL_MASK) == 0) {
+            FlowWheelTake(w, FLOW_WHEEL_SLOTS +
+                    ((w->sec >> FLOW_WHEEL_BITS) & FLOW_WHEEL_MASK), &list);
+        }
+        FlowWheelTake(w, w->sec & FLOW_WHEEL_MASK, &list);
+        FlowWheelCheckList(w, list, ts, emergency, &expired);
+
+        if (expired != NULL) {
+            SCMutexUnlock(&w->m);
+            cnt += FlowWheelRecycle(expired, counters);
+            SCMutexLock(&w->m);
+        }
+    }
+    SCMutexUnlock(&w->m);
+
+    return cnt;
+}
+
+/**
+ *  \brief time out flows from the timer wheel
+ *
+ *  Only the flows that are due are checked.
+ *
+ *  \param ts timestamp
+ *  \param counters ptr to FlowTimeoutCounters structure
+ *
+ *  \retval cnt number of timed out flows
+ */
+static uint32_t FlowWheelTimeout(struct timeval *ts, FlowTimeoutCounters *counters)
+{
+    uint32_t cnt = 0;
+    int emergency = 0;
+    uint32_t u;
+
+    if (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)
+        emergency = 1;
+
+    for (u = 0; u < FLOW_WHEEL_SHARDS; u++) {
+        cnt += FlowWheelAdvance(&flow_wheel[u], ts, emergency, counters);
+    }
+
+    return cnt;
+}
+
+/**
+ *  \brief evict flows that timed out under the emergency timeouts
+ *
+ *  The flows are checked in the order of their normal expiry, so the least
+ *  recently seen flows come first, and we stop as soon as enough flows are
+ *  evicted. Flows that are not timed out stay where they are.
+ *
+ *  \param ts timestamp
+ *  \param max number of flows to evict
+ *  \param counters ptr to FlowTimeoutCounters structure
+ *
+ *  \retval cnt number of evicted flows
+ */
+static uint32_t FlowWheelEvict(struct timeval *ts, uint32_t max,
+        FlowTimeoutCounters *counters)
+{
+    uint32_t cnt = 0;
+    uint32_t ahead, u;
+
+    for (ahead = 1; ahead <= FLOW_WHEEL_AHEAD && cnt < max; ahead++) {
+        for (u = 0; u < FLOW_WHEEL_SHARDS && cnt < max; u++) {
+            FlowWheel *w = &flow_wheel[u];
+
+            Flow *expired = NULL;
+
+            SCMutexLock(&w->m);
+            Flow *f = w->slot[FlowWheelSlotAt(w, ahead)];
+            while (f != NULL && cnt < max) {
+                Flow *next = f->wnext;
+                FlowBucket *fb = f->fb;
+
+                if (FBLOCK_TRYLOCK(fb) != 0) {
+                    f = next;
+                    continue;
+                }
+                if (FLOWLOCK_TRYWRLOCK(f) != 0) {
+                    FBLOCK_UNLOCK(fb);
+                    f = next;
+                    continue;
+                }
+
+                int state = FlowGetFlowState(f);
+                if (FlowManagerFlowTimeout(f, state, ts, 1) == 1 &&
+                    FlowManagerFlowTimedOut(f, ts) == 1)
+                {
+                    FlowWheelUnlink(w, f);
+                    FlowManagerHashRemove(NULL, f);
+                    f->wnext = expired;
+                    expired = f;
+                    cnt++;
+                } else {
+                    FLOWLOCK_UNLOCK(f);
+                }
+                FBLOCK_UNLOCK(fb);
+
+                f = next;
+            }
+            SCMutexUnlock(&w->m);
+
+            FlowWheelRecycle(expired, counters);
+        }
+    }
+
+    return cnt;
+}
+
+/** \internal
+ *  \brief number of flows to evict to get out of emergency mode
+ */
+static uint32_t FlowWheelEvictCount(void)
+{
+    uint32_t want = flow_config.prealloc * flow_config.emergency_recovery / 100 + 1;
+    uint32_t len;
+
+    FQLOCK_LOCK(&flow_spare_q);
+    len = flow_spare_q.len;
+    FQLOCK_UNLOCK(&flow_spare_q);
+
+    return (len < want) ? want - len : 0;
+}
+
+/**
+ *  \brief put a new flow of the global hash on the timer wheel
+ *
+ *  \param f *LOCKED* flow, its bucket is locked and f->fb is set
+ *  \param ts timestamp of the packet creating the flow
+ */
+void FlowWheelInsert(Flow *f, struct timeval *ts)
+{
+    if (flow_wheel == NULL)
+        return;
+
+    FlowWheel *w = FlowWheelGetShard(f);
+
+    SCMutexLock(&w->m);
+    FlowWheelLink(w, f, (uint32_t)ts->tv_sec +
+            flow_proto[f->protomap].new_timeout + 1);
+    SCMutexUnlock(&w->m);
+}
+
+/**
+ *  \brief take a flow of the global hash off the timer wheel
+ *
+ *  \param f *LOCKED* flow, its bucket is locked and f->fb is still set
+ */
+void FlowWheelRemove(Flow *f)
+{
+    if (flow_wheel == NULL)
+        return;
+
+    FlowWheel *w = FlowWheelGetShard(f);
+
+    SCMutexLock(&w->m);
+    if (f->wslot != FLOW_WHEEL_NONE)
+        FlowWheelUnlink(w, f);
+    SCMutexUnlock(&w->m);
+}
+
+/**
+ *  \brief get a flow to reuse from the timer wheel
+ *
+ *  Called by a packet thread when the spare queue is empty and the memcap is
+ *  reached. Takes the first unused flow of the slots that expire next, so the
+ *  least recently seen flows are reused first. Timeouts are disregarded.
+ *
+ *  \param skip bucket locked by the caller, its shard is tried last
+ *
+ *  \retval f unlocked flow, removed from the hash, or NULL
+ */
+Flow *FlowWheelGetUsedFlow(FlowBucket *skip)
+{
+    uint32_t start = (uint32_t)(skip - flow_hash) + 1;
+    uint32_t u, ahead;
+
+    if (flow_wheel == NULL)
+        return NULL;
+
+    for (u = 0; u < FLOW_WHEEL_SHARDS; u++) {
+        FlowWheel *w = &flow_wheel[(start + u) % FLOW_WHEEL_SHARDS];
+        uint32_t checks = FLOW_WHEEL_VICTIM_CHECKS;
+
+        if (SCMutexTrylock(&w->m) != 0)
+            continue;
+
+        for (ahead = 1; ahead <= FLOW_WHEEL_AHEAD && checks > 0; ahead++) {
+            Flow *f = w->slot[FlowWheelSlotAt(w, ahead)];
+
+            for ( ; f != NULL && checks > 0; f = f->wnext, checks--) {
+                FlowBucket *fb = f->fb;
+
+                if (FBLOCK_TRYLOCK(fb) != 0)
+                    continue;
+                if (FLOWLOCK_TRYWRLOCK(f) != 0) {
+                    FBLOCK_UNLOCK(fb);
+                    continue;
+                }
+                /** never prune a flow that is used by a packet or stream msg
+                 *  we are currently processing in one of the threads */
+                if (SC_ATOMIC_GET(f->use_cnt) > 0) {
+                    FLOWLOCK_UNLOCK(f);
+                    FBLOCK_UNLOCK(fb);
+                    continue;
+                }
+
+                FlowWheelUnlink(w, f);
+                SCMutexUnlock(&w->m);
+
+                FlowManagerHashRemove(NULL, f);
+                f->fb = NULL;
+                FBLOCK_UNLOCK(fb);
+
+                FlowClearMemory (f, f->protomap);
+
+                FLOWLOCK_UNLOCK(f);
+                return f;
+            }
+        }
+        SCMutexUnlock(&w->m);
+    }
+
+    return NULL;
+}
+
+/** \brief set up the timer wheel if flow.timer-wheel is enabled
+ *  \warning Not thread safe */
+void FlowWheelInit(void)
+{
+    uint32_t u;
+
+    if (!flow_config.timer_wheel || flow_wheel != NULL)
+        return;
+
+    flow_wheel = SCMalloc(FLOW_WHEEL_SHARDS * sizeof(FlowWheel));
+    if (unlikely(flow_wheel == NULL)) {
+        SCLogError(SC_ERR_FATAL, "Fatal error encountered in FlowWheelInit. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+    memset(flow_wheel, 0, FLOW_WHEEL_SHARDS * sizeof(FlowWheel));
+
+    for (u = 0; u < FLOW_WHEEL_SHARDS; u++) {
+        SCMutexInit(&flow_wheel[u].m, NULL);
+    }
+}
+
+/** \brief free the timer wheel. The flows on it are freed with the hash.
+ *  \warning Not thread safe */
+void FlowWheelShutdown(void)
+{
+    uint32_t u;
+
+    if (flow_wheel == NULL)
+        return;
+
+    for (u = 0; u < FLOW_WHEEL_SHARDS; u++) {
+        SCMutexDestroy(&flow_wheel[u].m);
+    }
+    SCFree(flow_wheel);
+    flow_wheel = NULL;
+}
+
+/**
+ *  \brief time out flows from a thread local partition
+ *
+ *  Called by the thread owning the partition for every packet. Each call
+ *  checks at most FLOW_PARTITION_SWEEP_BATCH buckets, and every second a new
+ *  pass over the partition is started, so the owner does the same work the
+ *  flow manager does for the global hash, spread out over its packets. In
+ *  emergency mode a new pass starts as soon as the previous one is done.
+ *
+ *  \param fp partition owned by the calling thread
+ *  \param ts timestamp of the current packet
+ *
+ *  \retval cnt number of timed out flows
+ */
+uint32_t FlowTimeoutPartition(FlowPartition *fp, struct timeval *ts) {
+    uint32_t cnt = 0;
+    int emergency = 0;
+
+    if (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)
+        emergency = 1;
+
+    if (fp->sweep_sec != (int32_t)ts->tv_sec ||
+        (emergency && fp->sweep_left == 0))
+    {
+        fp->sweep_sec = (int32_t)ts->tv_sec;
+        fp->sweep_left = flow_config.hash_size;
+    }
+    if (fp->sweep_left == 0)
+        return 0;
+
+    uint32_t batch = FLOW_PARTITION_SWEEP_BATCH;
+    if (batch > fp->sweep_left)
+        batch = fp->sweep_left;
+    fp->sweep_left -= batch;
+
+    FlowTimeoutCounters counters = { 0, 0, 0, };
+    while (batch--) {
+        FlowBucket *fb = &fp->hash[fp->sweep_idx];
+        if (++fp->sweep_idx >= flow_config.hash_size)
+            fp->sweep_idx = 0;
+
+        if (fb->tail == NULL)
+            continue;
+
+        cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, &counters, fp);
+    }
+
+    if (cnt > 0) {
+        fp->pruned_new += counters.new;
+        fp->pruned_est += counters.est;
+        fp->pruned_clo += counters.clo;
+
+        FlowPartitionUpdateSpareFlows(fp);
+    }
+    return cnt;
+}
+
+/** seconds without packets after which the flow manager takes over
+ *  timing out a partition from its owner */
+#define FLOW_PARTITION_IDLE_SEC 2
+
+/**
+ *  \brief time out the flows of partitions whose owner went idle
+ *
+ *  Owners only time out their partition when they get packets. For an
+ *  owner that didn't get any for FLOW_PARTITION_IDLE_SEC we do a full
+ *  pass ourselves. The owner's seq has to be unchanged for that long in
+ *  our time, and we only take partitions the owner isn't working on.
+ *
+ *  \param ts timestamp
+ */
+static void FlowTimeoutIdlePartitions(struct timeval *ts)
+{
+    int emergency = 0;
+
+    if (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)
+        emergency = 1;
+
+    SCMutexLock(&flow_partitions_lock);
+    FlowPartition *fp = flow_partitions;
+    for ( ; fp != NULL; fp = fp->next) {
+        if (SCHandoffSweepTry(&fp->handoff, (uint32_t)ts->tv_sec,
+                    FLOW_PARTITION_IDLE_SEC) == 0)
+            continue;
+
+        FlowTimeoutCounters counters = { 0, 0, 0, };
+        uint32_t cnt = 0;
+        uint32_t idx;
+        for (idx = 0; idx < flow_config.hash_size; idx++) {
+            FlowBucket *fb = &fp->hash[idx];
+            if (fb->tail == NULL)
+                continue;
+
+            cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, &counters, fp);
+        }
+
+        if (cnt > 0) {
+            fp->pruned_new += counters.new;
+            fp->pruned_est += counters.est;
+            fp->pruned_clo += counters.clo;
+
+            FlowPartitionUpdateSpareFlows(fp);
+        }
+        SCHandoffSweepDone(&fp->handoff);
+    }
+    SCMutexUnlock(&flow_partitions_lock);
+}
+
+/**
+ *  \brief sum up the stats of the thread local partitions
+ *
+ *  The partitions are owned by the packet threads, so we only read the
+ *  stats here. The values may be slightly stale but never torn in a way
+ *  that matters for stats and emergency handling.
+ *
+ *  \param pruned ptr to FlowTimeoutCounters to store the totals in
+ *  \param spare ptr to store the total number of spare flows in
+ *
+ *  \retval cnt number of partitions
+ */
+static uint32_t FlowPartitionsGetStats(FlowTimeoutCounters *pruned, uint32_t *spare)
+{
+    uint32_t cnt = 0;
+
+    SCMutexLock(&flow_partitions_lock);
+    FlowPartition *fp = flow_partitions;
+    while (fp != NULL) {
+        pruned->new += (uint32_t)fp->pruned_new;
+        pruned->est += (uint32_t)fp->pruned_est;
+        pruned->clo += (uint32_t)fp->pruned_clo;
+        *spare += fp->spare_q.len;
+        cnt++;
+        fp = fp->next;
+    }
+    SCMutexUnlock(&flow_partitions_lock);
+
+    return cnt;
+}
+
 /** \brief Thread that manages the flow table and times out flows.
  *
  *  \param td ThreadVars casted to void ptr
@@ -390,6 +1145,7 @@ void *FlowManagerThread(void *td)
     int emerg = FALSE;
     int prev_emerg = FALSE;
     uint32_t last_sec = 0;
+    FlowTimeoutCounters part_last = { 0, 0, 0, };
     struct timespec cond_time;
     int flow_update_delay_sec = FLOW_NORMAL_MODE_UPDATE_DELAY_SEC;
     int flow_update_delay_nsec = FLOW_NORMAL_MODE_UPDATE_DELAY_NSEC;
@@ -481,12 +1237,36 @@ void *FlowManagerThread(void *td)
             last_sec = (uint32_t)ts.tv_sec;
         }
 
-        /* see if we still have enough spare flows */
-        FlowUpdateSpareFlows();
+        /* see if we still have enough spare flows, partitions manage
+         * their own spare flows */
+        if (!flow_config.thread_local)
+            FlowUpdateSpareFlows();
 
         /* try to time out flows */
         FlowTimeoutCounters counters = { 0, 0, 0, };
-        FlowTimeoutHash(&ts, 0 /* check all */, &counters);
+        if (flow_wheel != NULL) {
+            FlowWheelTimeout(&ts, &counters);
+            if (emerg == TRUE)
+                FlowWheelEvict(&ts, FlowWheelEvictCount(), &counters);
+        } else {
+            FlowTimeoutHash(&ts, 0 /* check all */, &counters);
+        }
+
+        /* flows in thread local partitions are timed out by their owners,
+         * we only step in for idle owners and collect what they did */
+        uint32_t part_spare = 0;
+        uint32_t part_cnt = 0;
+        if (flow_config.thread_local) {
+            FlowTimeoutIdlePartitions(&ts);
+
+            FlowTimeoutCounters part_total = { 0, 0, 0, };
+            part_cnt = FlowPartitionsGetStats(&part_total, &part_spare);
+
+            counters.new += part_total.new - part_last.new;
+            counters.est += part_total.est - part_last.est;
+            counters.clo += part_total.clo - part_last.clo;
+            part_last = part_total;
+        }
 
 
         DefragTimeoutHash(&ts);
@@ -509,17 +1289,23 @@ void *FlowManagerThread(void *td)
         FQLOCK_LOCK(&flow_spare_q);
         len = flow_spare_q.len;
         FQLOCK_UNLOCK(&flow_spare_q);
+        len += part_spare;
         SCPerfCounterSetUI64(flow_mgr_spare, th_v->sc_perf_pca, (uint64_t)len);
 
+        /* every partition preallocates on its own */
+        uint32_t prealloc = flow_config.prealloc;
+        if (flow_config.thread_local && part_cnt > 0)
+            prealloc = flow_config.prealloc * part_cnt;
+
         /* Don't fear, FlowManagerThread is here...
          * clear emergency bit if we have at least xx flows pruned. */
         if (emerg == TRUE) {
             SCLogDebug("flow_sparse_q.len = %"PRIu32" prealloc: %"PRIu32
                        "flow_spare_q status: %"PRIu32"%% flows at the queue",
-                       len, flow_config.prealloc, len * 100 / flow_config.prealloc);
+                       len, prealloc, len * 100 / prealloc);
             /* only if we have pruned this "emergency_recovery" percentage
              * of flows, we will unset the emergency bit */
-            if (len * 100 / flow_config.prealloc > flow_config.emergency_recovery) {
+            if (len * 100 / prealloc > flow_config.emergency_recovery) {
                 SC_ATOMIC_AND(flow_flags, ~FLOW_EMERGENCY);
 
                 emerg = FALSE;
@@ -531,7 +1317,7 @@ void *FlowManagerThread(void *td)
                           " FLOW_EMERGENCY bit (ts.tv_sec: %"PRIuMAX", "
                           "ts.tv_usec:%"PRIuMAX") flow_spare_q status(): %"PRIu32
                           "%% flows at the queue", (uintmax_t)ts.tv_sec,
-                          (uintmax_t)ts.tv_usec, len * 100 / flow_config.prealloc);
+                          (uintmax_t)ts.tv_usec, len * 100 / prealloc);
 
                 SCPerfCounterIncr(flow_emerg_mode_over, th_v->sc_perf_pca);
             } else {
@@ -865,6 +1651,317 @@ static int FlowMgrTest05 (void) {
 
     return result;
 }
+/** \brief number of flows on the timer wheel */
+static uint32_t FlowWheelTestCount(void)
+{
+    uint32_t cnt = 0, u;
+
+    for (u = 0; u < FLOW_WHEEL_SHARDS; u++)
+        cnt += flow_wheel[u].cnt;
+    return cnt;
+}
+
+/**
+ *  \test   Test timing out flows from the timer wheel
+ *
+ *  \retval On success it returns 1 and on failure 0.
+ */
+
+static int FlowMgrTest06 (void) {
+    int result = 0;
+    struct timeval ts;
+    FlowTimeoutCounters counters = { 0, 0, 0, };
+
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.timer_wheel = 1;
+    FlowWheelInit();
+
+    UTHBuildPacketOfFlows(0, 100, 0);
+    uint32_t spare = flow_spare_q.len;
+    if (FlowWheelTestCount() != 100)
+        goto end;
+
+    TimeGet(&ts);
+    /* first run checks all flows, none is timed out yet */
+    if (FlowWheelTimeout(&ts, &counters) != 0)
+        goto end;
+
+    ts.tv_sec += flow_proto[FLOW_PROTO_TCP].new_timeout;
+    if (FlowWheelTimeout(&ts, &counters) != 0)
+        goto end;
+
+    ts.tv_sec++;
+    if (FlowWheelTimeout(&ts, &counters) != 100 || counters.new != 100)
+        goto end;
+
+    if (FlowWheelTestCount() != 0 || flow_spare_q.len != spare + 100)
+        goto end;
+
+    result = 1;
+end:
+    FlowShutdown();
+    return result;
+}
+
+/**
+ *  \test   Test that flows timing out beyond level 0 of the timer wheel are
+ *          moved down and timed out in the right second
+ *
+ *  \retval On success it returns 1 and on failure 0.
+ */
+
+static int FlowMgrTest07 (void) {
+    int result = 0;
+    struct timeval ts;
+    FlowTimeoutCounters counters = { 0, 0, 0, };
+
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.timer_wheel = 1;
+    FlowWheelInit();
+
+    uint32_t timeout = flow_proto[FLOW_PROTO_TCP].new_timeout;
+    flow_proto[FLOW_PROTO_TCP].new_timeout = 1000;
+
+    UTHBuildPacketOfFlows(0, 10, 0);
+
+    TimeGet(&ts);
+    if (FlowWheelTimeout(&ts, &counters) != 0)
+        goto end;
+
+    uint32_t i;
+    for (i = 0; i < 1000; i++) {
+        ts.tv_sec++;
+        if (FlowWheelTimeout(&ts, &counters) != 0) {
+            printf("flows timed out %u seconds early: ", 1000 - i);
+            goto end;
+        }
+    }
+
+    ts.tv_sec++;
+    if (FlowWheelTimeout(&ts, &counters) != 10)
+        goto end;
+
+    if (FlowWheelTestCount() != 0)
+        goto end;
+
+    result = 1;
+end:
+    flow_proto[FLOW_PROTO_TCP].new_timeout = timeout;
+    FlowShutdown();
+    return result;
+}
+
+/**
+ *  \test   Test evicting flows from the timer wheel under the emergency
+ *          timeouts
+ *
+ *  \retval On success it returns 1 and on failure 0.
+ */
+
+static int FlowMgrTest08 (void) {
+    int result = 0;
+    struct timeval ts;
+    FlowTimeoutCounters counters = { 0, 0, 0, };
+
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.timer_wheel = 1;
+    FlowWheelInit();
+
+    UTHBuildPacketOfFlows(0, 100, 0);
+
+    TimeGet(&ts);
+    if (FlowWheelTimeout(&ts, &counters) != 0)
+        goto end;
+
+    /* not timed out under the emergency timeouts yet */
+    ts.tv_sec += flow_proto[FLOW_PROTO_TCP].emerg_new_timeout;
+    if (FlowWheelEvict(&ts, 100, &counters) != 0)
+        goto end;
+
+    ts.tv_sec++;
+    if (FlowWheelEvict(&ts, 10, &counters) != 10 || FlowWheelTestCount() != 90)
+        goto end;
+
+    if (FlowWheelEvict(&ts, 1000, &counters) != 90 || FlowWheelTestCount() != 0)
+        goto end;
+
+    if (counters.new != 100)
+        goto end;
+
+    result = 1;
+end:
+    FlowShutdown();
+    return result;
+}
+/**
+ *  \test   Test reusing flows from the timer wheel when the memcap is
+ *          reached
+ *
+ *  \retval On success it returns 1 and on failure 0.
+ */
+
+static int FlowMgrTest09 (void) {
+    int result = 0;
+
+    FlowInitConfig(FLOW_QUIET);
+    FlowConfig backup;
+    memcpy(&backup, &flow_config, sizeof(FlowConfig));
+    flow_config.timer_wheel = 1;
+    FlowWheelInit();
+
+    uint32_t ini = 0;
+    uint32_t end = flow_spare_q.len;
+    flow_config.memcap = 10000;
+    flow_config.prealloc = 100;
+
+    /* Let's get the flow_spare_q empty */
+    UTHBuildPacketOfFlows(ini, end, 0);
+
+    /* And now let's try to reach the memcap val */
+    while (FLOW_CHECK_MEMCAP(sizeof(Flow))) {
+        ini = end + 1;
+        end = end + 2;
+        UTHBuildPacketOfFlows(ini, end, 0);
+    }
+    uint32_t cnt = FlowWheelTestCount();
+
+    /* these can only be created by reusing flows */
+    ini = end + 1;
+    end = end + 11;
+    UTHBuildPacketOfFlows(ini, end, 0);
+
+    if (!(SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY))
+        goto end;
+
+    /* every flow in the hash is on the wheel exactly once */
+    uint32_t u, hashed = 0;
+    for (u = 0; u < flow_config.hash_size; u++) {
+        Flow *f;
+        for (f = flow_hash[u].head; f != NULL; f = f->hnext) {
+            if (f->wslot == FLOW_WHEEL_NONE)
+                goto end;
+            hashed++;
+        }
+    }
+    if (hashed != cnt || FlowWheelTestCount() != cnt)
+        goto end;
+
+    result = 1;
+end:
+    SC_ATOMIC_AND(flow_flags, ~FLOW_EMERGENCY);
+    memcpy(&flow_config, &backup, sizeof(FlowConfig));
+    FlowShutdown();
+    return result;
+}
+
+/**
+ *  \test   Test the flow manager timing out the flows of a partition
+ *          whose owner went idle, and releasing the partition
+ *
+ *  \retval On success it returns 1 and on failure 0.
+ */
+
+static int FlowMgrTest10 (void) {
+    int result = 0;
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.thread_local = 1;
+    flow_config.prealloc = 10;
+
+    Packet *p = UTHBuildPacket(NULL, 0, IPPROTO_UDP);
+    if (p == NULL)
+        goto end;
+
+    FlowHandlePacket(&tv, p);
+    FlowPartition *fp = tv.flow_part;
+    if (fp == NULL || p->flow == NULL)
+        goto end;
+    FlowDeReference(&p->flow);
+
+    /* owner not seen idle yet: the manager leaves the partition alone */
+    struct timeval ts;
+    memset(&ts, 0, sizeof(ts));
+    ts.tv_sec = p->ts.tv_sec;
+    FlowTimeoutIdlePartitions(&ts);
+    if (fp->pruned_new != 0)
+        goto end;
+
+    /* owner still in the partition: not taken over */
+    SCHandoffOwnerEnter(&fp->handoff);
+    ts.tv_sec = p->ts.tv_sec + 5000;
+    FlowTimeoutIdlePartitions(&ts);
+    SCHandoffOwnerLeave(&fp->handoff);
+    if (fp->pruned_new != 0)
+        goto end;
+
+    /* owner idle and the flow timed out */
+    ts.tv_sec = p->ts.tv_sec + 5000;
+    FlowTimeoutIdlePartitions(&ts);
+    if (fp->pruned_new != 0)
+        goto end;
+    ts.tv_sec = p->ts.tv_sec + 5000 + FLOW_PARTITION_IDLE_SEC;
+    FlowTimeoutIdlePartitions(&ts);
+    if (fp->pruned_new != 1 || fp->spare_q.len != 10)
+        goto end;
+
+    /* the partition goes away with its thread */
+    FlowPartitionRelease(fp);
+    tv.flow_part = NULL;
+    if (flow_partitions != NULL)
+        goto end;
+
+    result = 1;
+end:
+    if (p != NULL)
+        UTHFreePacket(p);
+    FlowShutdown();
+    return result;
+}
+
+/**
+ *  \test   Test that the timer wheel is re-based when engine time goes
+ *          back, like between two pcap files
+ *
+ *  \retval On success it returns 1 and on failure 0.
+ */
+
+static int FlowMgrTest11 (void) {
+    int result = 0;
+    struct timeval ts, past;
+    FlowTimeoutCounters counters = { 0, 0, 0, };
+
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.timer_wheel = 1;
+    FlowWheelInit();
+
+    TimeGet(&past);
+    ts = past;
+    ts.tv_sec += 10000;
+    if (FlowWheelTimeout(&ts, &counters) != 0)
+        goto end;
+
+    /* flows of the older file */
+    UTHBuildPacketOfFlows(0, 100, 0);
+    if (FlowWheelTestCount() != 100)
+        goto end;
+
+    if (FlowWheelTimeout(&past, &counters) != 0)
+        goto end;
+
+    past.tv_sec += flow_proto[FLOW_PROTO_TCP].new_timeout + 1;
+    if (FlowWheelTimeout(&past, &counters) != 100 || counters.new != 100)
+        goto end;
+
+    if (FlowWheelTestCount() != 0)
+        goto end;
+
+    result = 1;
+end:
+    FlowShutdown();
+    return result;
+}
 #endif /* UNITTESTS */
 
 /**
@@ -877,5 +1974,11 @@ void FlowMgrRegisterTests (void) {
     UtRegisterTest("FlowMgrTest03 -- Timeout a flow in emergency having fresh TcpSession", FlowMgrTest03, 1);
     UtRegisterTest("FlowMgrTest04 -- Timeout a flow in emergency having TcpSession with segments", FlowMgrTest04, 1);
     UtRegisterTest("FlowMgrTest05 -- Test flow Allocations when it reach memcap", FlowMgrTest05, 1);
+    UtRegisterTest("FlowMgrTest06 -- Timeout flows from the timer wheel", FlowMgrTest06, 1);
+    UtRegisterTest("FlowMgrTest07 -- Timeout flows from level 1 of the timer wheel", FlowMgrTest07, 1);
+    UtRegisterTest("FlowMgrTest08 -- Evict flows from the timer wheel in emergency", FlowMgrTest08, 1);
+    UtRegisterTest("FlowMgrTest09 -- Reuse flows from the timer wheel at memcap", FlowMgrTest09, 1);
+    UtRegisterTest("FlowMgrTest10 -- Timeout flows of idle thread partitions", FlowMgrTest10, 1);
+    UtRegisterTest("FlowMgrTest11 -- Re-base the timer wheel when time goes back", FlowMgrTest11, 1);
 #endif /* UNITTESTS */
 }
@@ -32,6 +32,17 @@ SCPtMutex flow_manager_mutex;
 //SCMutex flow_manager_mutex;
 #define FlowWakeupFlowManagerThread() SCCondSignal(&flow_manager_cond)
 
+struct FlowPartition_;
+uint32_t FlowTimeoutPartition(struct FlowPartition_ *, struct timeval *);
+
+void FlowWheelInit(void);
+void FlowWheelShutdown(void);
+struct Flow_;
+struct FlowBucket_;
+void FlowWheelInsert(struct Flow_ *, struct timeval *);
+void FlowWheelRemove(struct Flow_ *);
+struct Flow_ *FlowWheelGetUsedFlow(struct FlowBucket_ *);
+
 void FlowManagerThreadSpawn(void);
 void FlowKillFlowManagerThread(void);
 void FlowMgrRegisterTests (void);
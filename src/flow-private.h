@@ -28,6 +28,7 @@
 #include "flow-queue.h"
 
 #include "util-atomic.h"
+#include "util-handoff.h"
 
 /* global flow flags */
 
@@ -79,8 +80,43 @@ FlowProto flow_proto[FLOW_PROTO_MAX];
 FlowQueue flow_spare_q;
 
 FlowBucket *flow_hash;
+/** tag lines of flow_hash, only used with FLOW_HASH_LAYOUT_TAGGED */
+FlowBucketLine *flow_hash_lines;
 FlowConfig flow_config;
 
+/** \brief private flow hash partition of a single packet thread
+ *
+ *  Used when flow.thread-local is enabled. The capture method is expected
+ *  to hash packets per flow, so every flow is only ever looked up by one
+ *  thread. The owner thread looks up, creates and times out the flows in
+ *  its partition without taking bucket locks, or any other lock. Only
+ *  when the owner went idle the flow manager takes the partition over
+ *  through the handoff to time out the flows itself. */
+typedef struct FlowPartition_ {
+    SCHandoff handoff;      /**< owner vs flow manager, see util-handoff.h */
+
+    FlowBucket *hash;       /**< flow_config.hash_size buckets */
+    FlowBucketLine *lines;  /**< tag lines of hash, if tagged layout */
+    FlowQueue spare_q;      /**< spare flows of this partition */
+
+    uint32_t sweep_idx;     /**< next bucket to check for timeouts */
+    uint32_t sweep_left;    /**< buckets left to check this second */
+    int32_t sweep_sec;      /**< second the current sweep was started */
+    uint32_t prune_idx;     /**< where FlowGetUsedFlow left off */
+
+    /* stats, written by whoever has the partition, read by the flow manager */
+    uint64_t pruned_new;
+    uint64_t pruned_est;
+    uint64_t pruned_clo;
+
+    uint16_t id;
+    struct FlowPartition_ *next;
+} FlowPartition;
+
+/** list of the registered partitions */
+FlowPartition *flow_partitions;
+SCMutex flow_partitions_lock;
+
 /** flow memuse counter (atomic), for enforcing memcap limit */
 SC_ATOMIC_DECLARE(long long unsigned int, flow_memuse);
 
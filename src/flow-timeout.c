@@ -490,9 +490,14 @@ int FlowForceReassemblyForFlowV2(Flow *f, int server, int client)
  * - be robust in case of future changes
  * - locking overhead if neglectable when no other thread fights us
  *
- * \param q The queue to process flows from.
+ * \param hash The buckets to process flows from.
+ * \param reassemble_p packet used for the reassembly
+ *
+ * \retval 0 ok
+ * \retval -1 failed to get a pseudo packet
  */
-static inline void FlowForceReassemblyForHash(void)
+static inline int FlowForceReassemblyForBuckets(FlowBucket *hash,
+                                                Packet *reassemble_p)
 {
     Flow *f;
     TcpSession *ssn;
@@ -502,13 +507,8 @@ static inline void FlowForceReassemblyForHash(void)
 
     uint32_t idx = 0;
 
-    /* We use this packet just for reassembly purpose */
-    Packet *reassemble_p = PacketGetFromAlloc();
-    if (reassemble_p == NULL)
-        return;
-
     for (idx = 0; idx < flow_config.hash_size; idx++) {
-        FlowBucket *fb = &flow_hash[idx];
+        FlowBucket *fb = &hash[idx];
         if (fb == NULL)
             continue;
         FBLOCK_LOCK(fb);
@@ -584,9 +584,8 @@ static inline void FlowForceReassemblyForHash(void)
                 FLOWLOCK_UNLOCK(f);
 
                 if (p == NULL) {
-                    TmqhOutputPacketpool(NULL, reassemble_p);
                     FBLOCK_UNLOCK(fb);
-                    return;
+                    return -1;
                 }
                 PKT_SET_SRC(p, PKT_SRC_FFR_SHUTDOWN);
 
@@ -617,9 +616,8 @@ static inline void FlowForceReassemblyForHash(void)
                 FLOWLOCK_UNLOCK(f);
 
                 if (p == NULL) {
-                    TmqhOutputPacketpool(NULL, reassemble_p);
                     FBLOCK_UNLOCK(fb);
-                    return;
+                    return -1;
                 }
                 PKT_SET_SRC(p, PKT_SRC_FFR_SHUTDOWN);
 
@@ -650,6 +648,36 @@ static inline void FlowForceReassemblyForHash(void)
         FBLOCK_UNLOCK(fb);
     }
 
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Forces reassembly for the flows in the global hash and in the
+ *        thread local partitions.
+ */
+static inline void FlowForceReassemblyForHash(void)
+{
+    /* We use this packet just for reassembly purpose */
+    Packet *reassemble_p = PacketGetFromAlloc();
+    if (reassemble_p == NULL)
+        return;
+
+    if (FlowForceReassemblyForBuckets(flow_hash, reassemble_p) < 0) {
+        TmqhOutputPacketpool(NULL, reassemble_p);
+        return;
+    }
+
+    /* partitions are only modified by their (now idle) owner threads */
+    FlowPartition *fp = flow_partitions;
+    while (fp != NULL) {
+        if (FlowForceReassemblyForBuckets(fp->hash, reassemble_p) < 0) {
+            TmqhOutputPacketpool(NULL, reassemble_p);
+            return;
+        }
+        fp = fp->next;
+    }
+
     PKT_SET_SRC(reassemble_p, PKT_SRC_FFR_SHUTDOWN);
     TmqhOutputPacketpool(NULL, reassemble_p);
     return;
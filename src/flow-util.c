@@ -37,6 +37,7 @@
 
 #include "detect.h"
 #include "detect-engine-state.h"
+#include "util-profiling.h"
 
 #ifdef __tile__
 #define FLOW_ALLOC_CACHE
@@ -183,6 +184,7 @@ void FlowInit(Flow *f, Packet *p)
     COPY_TIMESTAMP(&p->ts, &f->startts);
 
     f->protomap = FlowGetProtoMapping(f->proto);
+    FLOW_PROFILING_SAMPLE(f);
 
     SCReturn;
 }
@@ -48,6 +48,10 @@
         SC_ATOMIC_INIT((f)->use_cnt); \
         (f)->probing_parser_toserver_al_proto_masks = 0; \
         (f)->probing_parser_toclient_al_proto_masks = 0; \
+        (f)->alproto_ts_inspected = 0; \
+        (f)->alproto_tc_inspected = 0; \
+        (f)->alproto_detect_passes = 0; \
+        (f)->alproto_detect_ticks = 0; \
         (f)->flags = 0; \
         (f)->lastts_sec = 0; \
         FLOWLOCK_INIT((f)); \
@@ -64,10 +68,15 @@
         SCMutexInit(&(f)->de_state_m, NULL); \
         (f)->hnext = NULL; \
         (f)->hprev = NULL; \
+        (f)->wnext = NULL; \
+        (f)->wprev = NULL; \
+        (f)->wslot = FLOW_WHEEL_NONE; \
         (f)->lnext = NULL; \
         (f)->lprev = NULL; \
         SC_ATOMIC_INIT((f)->autofp_tmqh_flow_qid);  \
         (void) SC_ATOMIC_SET((f)->autofp_tmqh_flow_qid, -1);  \
+        SC_ATOMIC_INIT((f)->autofp_load); \
+        SC_ATOMIC_INIT((f)->autofp_rate); \
         RESET_COUNTERS((f)); \
     } while (0)
 
@@ -82,6 +91,10 @@
         SC_ATOMIC_RESET((f)->use_cnt); \
         (f)->probing_parser_toserver_al_proto_masks = 0; \
         (f)->probing_parser_toclient_al_proto_masks = 0; \
+        (f)->alproto_ts_inspected = 0; \
+        (f)->alproto_tc_inspected = 0; \
+        (f)->alproto_detect_passes = 0; \
+        (f)->alproto_detect_ticks = 0; \
         (f)->flags = 0; \
         (f)->lastts_sec = 0; \
         (f)->protoctx = NULL; \
@@ -102,6 +115,8 @@
         if (SC_ATOMIC_GET((f)->autofp_tmqh_flow_qid) != -1) {   \
             (void) SC_ATOMIC_SET((f)->autofp_tmqh_flow_qid, -1);   \
         }                                       \
+        SC_ATOMIC_RESET((f)->autofp_load); \
+        SC_ATOMIC_RESET((f)->autofp_rate); \
         RESET_COUNTERS((f)); \
     } while(0)
 
@@ -117,6 +132,8 @@
         GenericVarFree((f)->flowvar); \
         SCMutexDestroy(&(f)->de_state_m); \
         SC_ATOMIC_DESTROY((f)->autofp_tmqh_flow_qid);   \
+        SC_ATOMIC_DESTROY((f)->autofp_load); \
+        SC_ATOMIC_DESTROY((f)->autofp_rate); \
         (f)->tag_list = NULL; \
     } while(0)
 
@@ -60,6 +60,7 @@
 #include "stream.h"
 
 #include "app-layer-parser.h"
+#include "util-profiling.h"
 
 #define FLOW_DEFAULT_EMERGENCY_RECOVERY 30
 
@@ -260,13 +261,37 @@ static inline int FlowUpdateSeenFlag(Packet *p)
  */
 void FlowHandlePacket (ThreadVars *tv, Packet *p)
 {
+    Flow *f;
+
     /* Get this packet's flow from the hash. FlowHandlePacket() will setup
      * a new flow if nescesary. If we get NULL, we're out of flow memory.
      * The returned flow is locked. */
-    Flow *f = FlowGetFlowFromHash(p);
+    if (flow_config.thread_local && tv != NULL) {
+        if (unlikely(tv->flow_part == NULL && !tv->flow_part_failed)) {
+            tv->flow_part = FlowPartitionRegister();
+            /* don't retry for every packet, stick to the global hash */
+            if (tv->flow_part == NULL)
+                tv->flow_part_failed = 1;
+        }
+    }
+
+    if (tv != NULL && tv->flow_part != NULL) {
+        FlowPartition *fp = tv->flow_part;
+
+        /* we own the partition, so we time out its flows ourselves */
+        SCHandoffOwnerEnter(&fp->handoff);
+        FlowTimeoutPartition(fp, &p->ts);
+
+        f = FlowGetFlowFromPartition(fp, p);
+        SCHandoffOwnerLeave(&fp->handoff);
+    } else {
+        f = FlowGetFlowFromHash(p);
+    }
     if (f == NULL)
         return;
 
+    PACKET_PROFILING_FLOW_SAMPLE(p, f);
+
     /* update the last seen timestamp of this flow */
     f->lastts_sec = p->ts.tv_sec;
 
@@ -314,6 +339,18 @@ void FlowHandlePacket (ThreadVars *tv, Packet *p)
     return;
 }
 
+/** \internal
+ *  \brief memory used by a flow hash of flow_config.hash_size buckets,
+ *         including the tag lines if the tagged layout is used */
+static uint64_t FlowHashMemSize(void)
+{
+    uint64_t size = sizeof(FlowBucket);
+    if (flow_config.hash_layout == FLOW_HASH_LAYOUT_TAGGED)
+        size += sizeof(FlowBucketLine);
+
+    return (uint64_t)flow_config.hash_size * size;
+}
+
 /** \brief initialize the configuration
  *  \warning Not thread safe */
 void FlowInitConfig(char quiet)
@@ -333,6 +370,8 @@ void FlowInitConfig(char quiet)
     flow_config.hash_size   = FLOW_DEFAULT_HASHSIZE;
     flow_config.memcap      = FLOW_DEFAULT_MEMCAP;
     flow_config.prealloc    = FLOW_DEFAULT_PREALLOC;
+    flow_config.thread_local = 0;
+    flow_config.hash_layout = FLOW_HASH_LAYOUT_CHAINED;
 
     /* If we have specific config, overwrite the defaults with them,
      * otherwise, leave the default values */
@@ -349,8 +388,37 @@ void FlowInitConfig(char quiet)
         flow_config.emergency_recovery = FLOW_DEFAULT_EMERGENCY_RECOVERY;
     }
 
+    int thread_local = 0;
+    if (ConfGetBool("flow.thread-local", &thread_local) == 1 && thread_local) {
+        flow_config.thread_local = 1;
+    }
+
+    int timer_wheel = 0;
+    if (ConfGetBool("flow.timer-wheel", &timer_wheel) == 1 && timer_wheel) {
+        if (flow_config.thread_local) {
+            SCLogInfo("flow.timer-wheel is not used with flow.thread-local, "
+                    "partitions are timed out by their owner threads");
+        } else {
+            flow_config.timer_wheel = 1;
+        }
+    }
+
     /* Check if we have memcap and hash_size defined at config */
     char *conf_val;
+
+    if ((ConfGet("flow.hash-layout", &conf_val)) == 1)
+    {
+        if (strcasecmp(conf_val, "tagged") == 0) {
+            flow_config.hash_layout = FLOW_HASH_LAYOUT_TAGGED;
+        } else if (strcasecmp(conf_val, "chained") == 0) {
+            flow_config.hash_layout = FLOW_HASH_LAYOUT_CHAINED;
+        } else {
+            SCLogError(SC_ERR_INVALID_VALUE, "flow.hash-layout \"%s\" is "
+                    "invalid, must be \"chained\" or \"tagged\". Using "
+                    "\"chained\".", conf_val);
+            flow_config.hash_layout = FLOW_HASH_LAYOUT_CHAINED;
+        }
+    }
     uint32_t configval = 0;
 
     /** set config values for memcap, prealloc and hash_size */
@@ -382,7 +450,7 @@ void FlowInitConfig(char quiet)
                flow_config.hash_size, flow_config.prealloc);
 
     /* alloc hash memory */
-    uint64_t hash_size = flow_config.hash_size * sizeof(FlowBucket);
+    uint64_t hash_size = FlowHashMemSize();
     if (!(FLOW_CHECK_MEMCAP(hash_size))) {
         SCLogError(SC_ERR_FLOW_INIT, "allocating flow hash failed: "
                 "max flow memcap is smaller than projected hash size. "
@@ -403,7 +471,16 @@ void FlowInitConfig(char quiet)
     for (i = 0; i < flow_config.hash_size; i++) {
         FBLOCK_INIT(&flow_hash[i]);
     }
-    (void) SC_ATOMIC_ADD(flow_memuse, (flow_config.hash_size * sizeof(FlowBucket)));
+
+    if (flow_config.hash_layout == FLOW_HASH_LAYOUT_TAGGED) {
+        flow_hash_lines = FlowHashLinesAlloc();
+        if (unlikely(flow_hash_lines == NULL)) {
+            SCLogError(SC_ERR_FATAL, "Fatal error encountered in FlowInitConfig. Exiting...");
+            exit(EXIT_FAILURE);
+        }
+    }
+    FlowWheelInit();
+    (void) SC_ATOMIC_ADD(flow_memuse, hash_size);
 
     if (quiet == FALSE) {
         SCLogInfo("allocated %llu bytes of memory for the flow hash... "
@@ -415,8 +492,12 @@ void FlowInitConfig(char quiet)
 #ifdef __tile__
     FlowAllocPoolInit();
 #endif
-    /* pre allocate flows */
-    for (i = 0; i < flow_config.prealloc; i++) {
+    flow_partitions = NULL;
+    SCMutexInit(&flow_partitions_lock, NULL);
+
+    /* pre allocate flows, with thread local tables the partitions
+     * take care of this themselves. */
+    for (i = 0; !flow_config.thread_local && i < flow_config.prealloc; i++) {
         if (!(FLOW_CHECK_MEMCAP(sizeof(Flow)))) {
             SCLogError(SC_ERR_FLOW_INIT, "preallocating flows failed: "
                     "max flow memcap reached. Memcap %"PRIu64", "
@@ -435,6 +516,19 @@ void FlowInitConfig(char quiet)
     }
 
     if (quiet == FALSE) {
+        if (flow_config.hash_layout == FLOW_HASH_LAYOUT_TAGGED) {
+            SCLogInfo("tagged flow hash layout enabled: %" PRIuMAX " bytes "
+                    "of tag lines per bucket", (uintmax_t)sizeof(FlowBucketLine));
+        }
+        if (flow_config.timer_wheel) {
+            SCLogInfo("flow timer wheel enabled");
+        }
+        if (flow_config.thread_local) {
+            SCLogInfo("thread local flow tables enabled: every packet thread "
+                    "uses its own hash of %" PRIu32 " buckets and %" PRIu32
+                    " preallocated flows", flow_config.hash_size,
+                    flow_config.prealloc);
+        }
         SCLogInfo("preallocated %" PRIu32 " flows of size %" PRIuMAX "",
                 flow_spare_q.len, (uintmax_t)sizeof(Flow));
         SCLogInfo("flow memory usage: %llu bytes, maximum: %"PRIu64,
@@ -446,6 +540,152 @@ void FlowInitConfig(char quiet)
     return;
 }
 
+/** \brief Set up a thread local flow hash partition
+ *
+ *  Called by a packet thread on its first packet when flow.thread-local
+ *  is enabled. The partition uses flow.hash-size buckets and preallocates
+ *  flow.prealloc flows, so both settings are per thread in this mode.
+ *
+ *  \retval fp partition or NULL if the memcap doesn't allow it
+ */
+FlowPartition *FlowPartitionRegister(void)
+{
+    uint64_t hash_size = FlowHashMemSize();
+    if (!(FLOW_CHECK_MEMCAP(sizeof(FlowPartition) + hash_size))) {
+        SCLogError(SC_ERR_FLOW_INIT, "allocating thread local flow hash "
+                "failed: max flow memcap reached. Memcap %"PRIu64", "
+                "Memuse %"PRIu64". Falling back to the global flow hash.",
+                flow_config.memcap, ((uint64_t)SC_ATOMIC_GET(flow_memuse) +
+                sizeof(FlowPartition) + hash_size));
+        return NULL;
+    }
+
+    FlowPartition *fp = SCMalloc(sizeof(FlowPartition));
+    if (unlikely(fp == NULL))
+        return NULL;
+    memset(fp, 0, sizeof(FlowPartition));
+
+    fp->hash = SCCalloc(flow_config.hash_size, sizeof(FlowBucket));
+    if (unlikely(fp->hash == NULL)) {
+        SCFree(fp);
+        return NULL;
+    }
+
+    if (flow_config.hash_layout == FLOW_HASH_LAYOUT_TAGGED) {
+        fp->lines = FlowHashLinesAlloc();
+        if (unlikely(fp->lines == NULL)) {
+            SCFree(fp->hash);
+            SCFree(fp);
+            return NULL;
+        }
+    }
+
+    uint32_t i = 0;
+    for (i = 0; i < flow_config.hash_size; i++) {
+        FBLOCK_INIT(&fp->hash[i]);
+    }
+    FlowQueueInit(&fp->spare_q);
+    SCHandoffInit(&fp->handoff);
+    (void) SC_ATOMIC_ADD(flow_memuse, (sizeof(FlowPartition) + hash_size));
+
+    for (i = 0; i < flow_config.prealloc; i++) {
+        if (!(FLOW_CHECK_MEMCAP(sizeof(Flow))))
+            break;
+
+        Flow *f = FlowAlloc();
+        if (f == NULL)
+            break;
+
+        FlowEnqueue(&fp->spare_q, f);
+    }
+
+    SCMutexLock(&flow_partitions_lock);
+    fp->id = (flow_partitions != NULL) ? flow_partitions->id + 1 : 0;
+    fp->next = flow_partitions;
+    flow_partitions = fp;
+    SCMutexUnlock(&flow_partitions_lock);
+
+    SCLogInfo("flow partition %"PRIu16" set up, %"PRIu32" flows preallocated",
+            fp->id, fp->spare_q.len);
+    return fp;
+}
+
+/** \brief Make sure a partition doesn't hold on to too many spare flows.
+ *
+ *  Partition counterpart of FlowUpdateSpareFlows(). Only to be called by
+ *  the thread owning the partition.
+ */
+void FlowPartitionUpdateSpareFlows(FlowPartition *fp)
+{
+    while (fp->spare_q.len > flow_config.prealloc) {
+        Flow *f = FlowDequeue(&fp->spare_q);
+        if (f == NULL)
+            break;
+
+        FlowFree(f);
+    }
+}
+
+/** \brief free a partition and all flows in it
+ *  \warning Not thread safe */
+static void FlowPartitionFree(FlowPartition *fp)
+{
+    Flow *f;
+    uint32_t u;
+
+    while ((f = FlowDequeue(&fp->spare_q))) {
+        FlowFree(f);
+    }
+
+    for (u = 0; u < flow_config.hash_size; u++) {
+        f = fp->hash[u].head;
+        while (f) {
+#ifdef DEBUG_VALIDATION
+            BUG_ON(SC_ATOMIC_GET(f->use_cnt) != 0);
+#endif
+            Flow *n = f->hnext;
+            uint8_t proto_map = FlowGetProtoMapping(f->proto);
+            FlowClearMemory(f, proto_map);
+            FlowFree(f);
+            f = n;
+        }
+
+        FBLOCK_DESTROY(&fp->hash[u]);
+    }
+    SCFree(fp->hash);
+    if (fp->lines != NULL)
+        FlowHashLinesFree(fp->lines);
+    FlowQueueDestroy(&fp->spare_q);
+    SCHandoffDestroy(&fp->handoff);
+    (void) SC_ATOMIC_SUB(flow_memuse, (sizeof(FlowPartition) + FlowHashMemSize()));
+    SCFree(fp);
+}
+
+/** \brief Release the partition of a thread that is being freed
+ *
+ *  The thread must have exited, so nothing uses its flows anymore. If the
+ *  flow engine was shut down before, the partition is already gone and
+ *  we do nothing.
+ */
+void FlowPartitionRelease(FlowPartition *fp)
+{
+    FlowPartition **pfp;
+    int found = 0;
+
+    SCMutexLock(&flow_partitions_lock);
+    for (pfp = &flow_partitions; *pfp != NULL; pfp = &(*pfp)->next) {
+        if (*pfp == fp) {
+            *pfp = fp->next;
+            found = 1;
+            break;
+        }
+    }
+    SCMutexUnlock(&flow_partitions_lock);
+
+    if (found)
+        FlowPartitionFree(fp);
+}
+
 /** \brief print some flow stats
  *  \warning Not thread safe */
 static void FlowPrintStats (void)
@@ -492,9 +732,22 @@ void FlowShutdown(void)
         SCFree(flow_hash);
         flow_hash = NULL;
     }
-    (void) SC_ATOMIC_SUB(flow_memuse, flow_config.hash_size * sizeof(FlowBucket));
+    if (flow_hash_lines != NULL) {
+        FlowHashLinesFree(flow_hash_lines);
+        flow_hash_lines = NULL;
+    }
+    FlowWheelShutdown();
+    (void) SC_ATOMIC_SUB(flow_memuse, FlowHashMemSize());
     FlowQueueDestroy(&flow_spare_q);
 
+    /* free the thread local partitions */
+    while (flow_partitions != NULL) {
+        FlowPartition *fp = flow_partitions;
+        flow_partitions = fp->next;
+        FlowPartitionFree(fp);
+    }
+    SCMutexDestroy(&flow_partitions_lock);
+
     SC_ATOMIC_DESTROY(flow_prune_idx);
     SC_ATOMIC_DESTROY(flow_memuse);
     SC_ATOMIC_DESTROY(flow_flags);
@@ -1074,6 +1327,80 @@ static int FlowTest09 (void) {
     return result;
 }
 
+
+/**
+ *  \test   Test that with thread local flow tables the flow is set up in
+ *          the partition of the thread and timed out by that thread.
+ *
+ *  \retval On success it returns 1 and on failure 0.
+ */
+
+static int FlowTest10 (void) {
+    int result = 0;
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.thread_local = 1;
+    flow_config.prealloc = 10;
+
+    Packet *p = UTHBuildPacket(NULL, 0, IPPROTO_UDP);
+    if (p == NULL)
+        goto end;
+
+    FlowHandlePacket(&tv, p);
+    if (tv.flow_part == NULL || p->flow == NULL) {
+        printf("no partition or no flow: ");
+        goto end;
+    }
+
+    FlowPartition *fp = tv.flow_part;
+    if (p->flow->fb < fp->hash || p->flow->fb >= fp->hash + flow_config.hash_size) {
+        printf("flow not in the thread's partition: ");
+        goto end;
+    }
+    if (fp->spare_q.len != 9) {
+        printf("expected 9 spare flows in the partition, got %"PRIu32": ",
+                fp->spare_q.len);
+        goto end;
+    }
+
+    /* flows in use are never timed out */
+    Flow *f = p->flow;
+    f->lastts_sec -= 5000;
+    struct timeval ts;
+    TimeGet(&ts);
+    fp->sweep_sec = 0;
+    fp->sweep_idx = 0;
+    while (fp->sweep_left > 0 || fp->sweep_sec != ts.tv_sec) {
+        if (FlowTimeoutPartition(fp, &ts) != 0) {
+            printf("flow in use was timed out: ");
+            goto end;
+        }
+    }
+
+    FlowDeReference(&p->flow);
+    uint32_t cnt = 0;
+    fp->sweep_sec = 0;
+    do {
+        cnt += FlowTimeoutPartition(fp, &ts);
+    } while (fp->sweep_left > 0);
+
+    if (cnt != 1 || fp->pruned_new != 1 || fp->spare_q.len != 10) {
+        printf("expected the flow to be timed out to the partition spare "
+                "queue: cnt %"PRIu32", spare %"PRIu32": ", cnt, fp->spare_q.len);
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (p != NULL) {
+        FlowDeReference(&p->flow);
+        UTHFreePacket(p);
+    }
+    FlowShutdown();
+    return result;
+}
 #endif /* UNITTESTS */
 
 /**
@@ -1086,6 +1413,7 @@ void FlowRegisterTests (void) {
     UtRegisterTest("FlowTest07 -- Test flow Allocations when it reach memcap", FlowTest07, 1);
     UtRegisterTest("FlowTest08 -- Test flow Allocations when it reach memcap", FlowTest08, 1);
     UtRegisterTest("FlowTest09 -- Test flow Allocations when it reach memcap", FlowTest09, 1);
+    UtRegisterTest("FlowTest10 -- Test thread local flow partitions", FlowTest10, 1);
 
     FlowMgrRegisterTests();
 #endif /* UNITTESTS */
@@ -210,6 +210,9 @@
     #error Enable FLOWLOCK_RWLOCK or FLOWLOCK_MUTEX
 #endif
 
+/** Flow::wslot of a flow that is not on the timer wheel */
+#define FLOW_WHEEL_NONE 0xffff
+
 /* global flow config */
 typedef struct FlowCnf_
 {
@@ -226,6 +229,14 @@ typedef struct FlowCnf_
     uint32_t emerg_timeout_est;
     uint32_t emergency_recovery;
 
+    /** give each packet thread a private hash partition (flow.thread-local) */
+    uint8_t thread_local;
+    /** bucket layout of the hash, FLOW_HASH_LAYOUT_* (flow.hash-layout) */
+    uint8_t hash_layout;
+    /** time out flows of the global hash from a timer wheel instead of
+     *  scanning the hash (flow.timer-wheel) */
+    uint8_t timer_wheel;
+
 } FlowConfig;
 
 /* Hash key for the flow hash */
@@ -301,9 +312,26 @@ typedef struct Flow_
     /** flow queue id, used with autofp */
     SC_ATOMIC_DECLARE(int, autofp_tmqh_flow_qid);
 
+    /** bytes of the flow in the current second and in the second before,
+     *  used by the autofp "load-balance" scheduler. Written by the capture
+     *  threads without the flow lock. autofp_load has the second in the
+     *  high 32 bits and its bytes in the low 32 bits, so that both change
+     *  in one CAS. */
+    SC_ATOMIC_DECLARE(uint64_t, autofp_load);
+    SC_ATOMIC_DECLARE(uint32_t, autofp_rate);
+
     uint32_t probing_parser_toserver_al_proto_masks;
     uint32_t probing_parser_toclient_al_proto_masks;
 
+    /** bytes from the start of the stream already inspected by the app
+     *  layer proto detection, per direction */
+    uint16_t alproto_ts_inspected;
+    uint16_t alproto_tc_inspected;
+    /** number of proto detection passes run on this flow */
+    uint16_t alproto_detect_passes;
+    /** cpu ticks spent in those passes */
+    uint32_t alproto_detect_ticks;
+
     uint32_t flags;
 
     /* ts of flow init and last update */
@@ -356,11 +384,20 @@ typedef struct Flow_
 
     SCMutex de_state_m;          /**< mutex lock for the de_state object */
 
+    /** full hash value of the flow, used as tag by the tagged hash layout */
+    uint32_t fhash;
+
     /** hash list pointers, protected by fb->s */
     struct Flow_ *hnext; /* hash list */
     struct Flow_ *hprev;
     struct FlowBucket_ *fb;
 
+    /** timer wheel list pointers and slot, protected by the wheel shard
+     *  lock. wslot is FLOW_WHEEL_NONE if the flow is not on the wheel. */
+    struct Flow_ *wnext;
+    struct Flow_ *wprev;
+    uint16_t wslot;
+
     /** queue list pointers, protected by queue mutex */
     struct Flow_ *lnext; /* list */
     struct Flow_ *lprev;
@@ -370,6 +407,10 @@ typedef struct Flow_
     uint32_t tosrcpktcnt;
     uint64_t bytecnt;
 #endif
+#ifdef PROFILING
+    /** profile weight of the flow's packets with profiling.sample-flows */
+    uint32_t profile_weight;
+#endif
 } Flow;
 
 enum {
@@ -410,6 +451,11 @@ struct FlowQueue_;
 
 int FlowUpdateSpareFlows(void);
 
+struct FlowPartition_;
+struct FlowPartition_ *FlowPartitionRegister(void);
+void FlowPartitionRelease(struct FlowPartition_ *);
+void FlowPartitionUpdateSpareFlows(struct FlowPartition_ *);
+
 static inline void FlowLockSetNoPacketInspectionFlag(Flow *);
 static inline void FlowSetNoPacketInspectionFlag(Flow *);
 static inline void FlowLockSetNoPayloadInspectionFlag(Flow *);
@@ -37,6 +37,7 @@
 #include "conf.h"
 #include "detect.h"
 #include "reputation.h"
+#include "util-fmemopen.h"
 
 /** effective reputation version, atomic as the host
  *  time out code will use it to check if a host's
@@ -290,18 +291,189 @@ int SRepLoadCatFile(char *filename) {
     return 0;
 }
 
-static int SRepLoadFile(char *filename) {
-    char line[8192] = "";
-    Address a;
-    memset(&a, 0x00, sizeof(a));
-    a.family = AF_INET;
+/** \brief line of a reputation file, collected until all files are read */
+typedef struct SRepLoadEntry_ {
+    uint32_t ip;
+    uint8_t cat;
+    uint8_t value;
+} SRepLoadEntry;
+
+/** \brief lines of all reputation files of a (re)load */
+typedef struct SRepLoadCtx_ {
+    SRepLoadEntry *entries;
+    uint32_t cnt;
+    uint32_t size;
+} SRepLoadCtx;
+
+static int SRepLoadAddEntry(SRepLoadCtx *lctx, uint32_t ip, uint8_t cat, uint8_t value) {
+    if (lctx->cnt == lctx->size) {
+        uint32_t size = lctx->size ? lctx->size * 2 : 4096;
+        SRepLoadEntry *entries = SCRealloc(lctx->entries, size * sizeof(SRepLoadEntry));
+        if (entries == NULL)
+            return -1;
+        lctx->entries = entries;
+        lctx->size = size;
+    }
 
-    FILE *fp = fopen(filename, "r");
-    if (fp == NULL) {
-        SCLogError(SC_ERR_OPENING_RULE_FILE, "opening ip rep file \"%s\": %s", filename, strerror(errno));
+    SRepLoadEntry *e = &lctx->entries[lctx->cnt++];
+    e->ip = ip;
+    e->cat = cat;
+    e->value = value;
+    return 0;
+}
+
+/** \brief sort the entries by ip. Radix sort, which is stable, so for
+ *         an ip the entries stay in the order of the files. */
+static int SRepLoadSort(SRepLoadCtx *lctx) {
+    if (lctx->cnt < 2)
+        return 0;
+
+    SRepLoadEntry *tmp = SCMalloc(lctx->cnt * sizeof(SRepLoadEntry));
+    if (tmp == NULL)
         return -1;
+
+    SRepLoadEntry *src = lctx->entries;
+    SRepLoadEntry *dst = tmp;
+    uint32_t count[257];
+    uint32_t i;
+    int shift;
+
+    for (shift = 0; shift < 32; shift += 8) {
+        memset(count, 0x00, sizeof(count));
+        for (i = 0; i < lctx->cnt; i++)
+            count[((src[i].ip >> shift) & 0xff) + 1]++;
+        for (i = 0; i < 256; i++)
+            count[i + 1] += count[i];
+        for (i = 0; i < lctx->cnt; i++)
+            dst[count[(src[i].ip >> shift) & 0xff]++] = src[i];
+
+        SRepLoadEntry *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    /* even number of passes, so the result is in lctx->entries */
+    SCFree(tmp);
+    return 0;
+}
+
+static uint32_t SRepHashRep(const SReputation *r) {
+    uint32_t hash = 5381;
+    int i;
+    for (i = 0; i < SREP_MAX_CATS; i++)
+        hash = ((hash << 5) + hash) + r->rep[i];
+    return hash * 2654435761U;
+}
+
+void SRepTableFree(SRepTable *t) {
+    if (t == NULL)
+        return;
+
+    if (t->slots != NULL)
+        SCFree(t->slots);
+    if (t->reps != NULL)
+        SCFree(t->reps);
+    SCFree(t);
+}
+
+/** \brief compile the loaded entries into a lookup table
+ *
+ *  For an ip listed more than once, the categories add up and for
+ *  a category listed more than once, the last value counts.
+ *
+ *  \retval t table or NULL on memory error */
+static SRepTable *SRepTableBuild(SRepLoadCtx *lctx, uint32_t version) {
+    uint32_t *dedup = NULL;
+    uint32_t reps_size = 16;
+    uint32_t hosts = 0;
+    uint32_t bits = 4;
+    uint32_t i, j;
+
+    SRepTable *t = SCMalloc(sizeof(SRepTable));
+    if (t == NULL)
+        return NULL;
+    memset(t, 0x00, sizeof(SRepTable));
+    t->version = version;
+
+    if (SRepLoadSort(lctx) < 0)
+        goto error;
+
+    for (i = 0; i < lctx->cnt; i++) {
+        if (i == 0 || lctx->entries[i].ip != lctx->entries[i - 1].ip)
+            hosts++;
     }
 
+    /* power of 2 slots, at most 3/4 of them used */
+    while (((uint64_t)1 << bits) * 3 < (uint64_t)hosts * 4)
+        bits++;
+    t->shift = 32 - bits;
+    t->mask = (1U << bits) - 1;
+
+    t->slots = SCMalloc(sizeof(SRepTableSlot) << bits);
+    if (t->slots == NULL)
+        goto error;
+    memset(t->slots, 0x00, sizeof(SRepTableSlot) << bits);
+
+    /* reps hash for finding hosts with the same reputation */
+    dedup = SCMalloc(sizeof(uint32_t) << bits);
+    if (dedup == NULL)
+        goto error;
+    memset(dedup, 0x00, sizeof(uint32_t) << bits);
+
+    t->reps = SCMalloc(reps_size * sizeof(SReputation));
+    if (t->reps == NULL)
+        goto error;
+    memset(&t->reps[0], 0x00, sizeof(SReputation));
+    t->rep_cnt = 1;
+
+    for (i = 0; i < lctx->cnt; i = j) {
+        uint32_t ip = lctx->entries[i].ip;
+        SReputation rep;
+
+        memset(&rep, 0x00, sizeof(rep));
+        rep.version = version;
+        for (j = i; j < lctx->cnt && lctx->entries[j].ip == ip; j++)
+            rep.rep[lctx->entries[j].cat] = lctx->entries[j].value;
+
+        uint32_t idx = SRepHashRep(&rep) >> t->shift;
+        while (dedup[idx] != 0 &&
+               memcmp(t->reps[dedup[idx]].rep, rep.rep, sizeof(rep.rep)) != 0)
+        {
+            idx = (idx + 1) & t->mask;
+        }
+        if (dedup[idx] == 0) {
+            if (t->rep_cnt == reps_size) {
+                SReputation *reps = SCRealloc(t->reps, reps_size * 2 * sizeof(SReputation));
+                if (reps == NULL)
+                    goto error;
+                t->reps = reps;
+                reps_size *= 2;
+            }
+            t->reps[t->rep_cnt] = rep;
+            dedup[idx] = t->rep_cnt++;
+        }
+
+        uint32_t slot = SRepTableHash(t, ip);
+        while (t->slots[slot].rep != 0)
+            slot = (slot + 1) & t->mask;
+        t->slots[slot].ip = ip;
+        t->slots[slot].rep = dedup[idx];
+        t->hosts++;
+    }
+
+    SCFree(dedup);
+    return t;
+
+error:
+    if (dedup != NULL)
+        SCFree(dedup);
+    SRepTableFree(t);
+    return NULL;
+}
+
+static int SRepLoadFileFromFD(SRepLoadCtx *lctx, FILE *fp) {
+    char line[8192] = "";
+
     while(fgets(line, (int)sizeof(line), fp) != NULL) {
         size_t len = strlen(line);
         if (len == 0)
@@ -328,49 +500,29 @@ static int SRepLoadFile(char *filename) {
         if (r < 0) {
             SCLogError(SC_ERR_NO_REPUTATION, "bad line \"%s\"", line);
         } else if (r == 0) {
-            char ipstr[16];
-            PrintInet(AF_INET, (const void *)&ip, ipstr, sizeof(ipstr));
-            SCLogDebug("%s %u %u", ipstr, cat, value);
-
-            a.addr_data32[0] = ip;
-            Host *h = HostGetHostFromHash(&a);
-            if (h == NULL) {
-                SCLogError(SC_ERR_NO_REPUTATION, "failed to get a host, increase host.memcap");
-                break;
-            } else {
-                //SCLogInfo("host %p", h);
-
-                if (h->iprep == NULL) {
-                    h->iprep = SCMalloc(sizeof(SReputation));
-                    if (h->iprep != NULL) {
-                        memset(h->iprep, 0x00, sizeof(SReputation));
-
-                        HostIncrUsecnt(h);
-                    }
-                }
-                if (h->iprep != NULL) {
-                    SReputation *rep = h->iprep;
-
-                    /* if version is 0, it has been used before, so
-                     * clear it */
-                    if (rep->version != 0) {
-                        memset(rep, 0x00, sizeof(SReputation));
-                    }
-
-                    rep->version = SRepGetVersion();
-                    rep->rep[cat] = value;
-                }
-
-                HostRelease(h);
+            if (SRepLoadAddEntry(lctx, ip, cat, value) < 0) {
+                SCLogError(SC_ERR_MEM_ALLOC, "failed to store reputation "
+                        "of %u hosts", lctx->cnt);
+                return -1;
             }
         }
     }
-    fclose(fp);
-    fp = NULL;
 
     return 0;
 }
 
+static int SRepLoadFile(SRepLoadCtx *lctx, char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_OPENING_RULE_FILE, "opening ip rep file \"%s\": %s", filename, strerror(errno));
+        return -1;
+    }
+
+    int r = SRepLoadFileFromFD(lctx, fp);
+    fclose(fp);
+    return r;
+}
+
 /**
  *  \brief Create the path if default-rule-path was specified
  *  \param sig_file The name of the file
@@ -466,13 +618,16 @@ int SRepInit(DetectEngineCtx *de_ctx) {
     de_ctx->srep_version = SRepIncrVersion();
     SCLogDebug("Reputation version %u", de_ctx->srep_version);
 
+    SRepLoadCtx lctx;
+    memset(&lctx, 0x00, sizeof(lctx));
+
     /* ok, let's load signature files from the general config */
     if (files != NULL) {
         TAILQ_FOREACH(file, &files->head, next) {
             sfile = SRepCompleteFilePath(file->val);
             SCLogInfo("Loading reputation file: %s", sfile);
 
-            r = SRepLoadFile(sfile);
+            r = SRepLoadFile(&lctx, sfile);
             if (r < 0){
                 if (de_ctx->failure_fatal == 1) {
                     exit(EXIT_FAILURE);
@@ -482,13 +637,25 @@ int SRepInit(DetectEngineCtx *de_ctx) {
         }
     }
 
+    de_ctx->srep_table = SRepTableBuild(&lctx, de_ctx->srep_version);
+    if (lctx.entries != NULL)
+        SCFree(lctx.entries);
+    if (de_ctx->srep_table == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to build the reputation table");
+        return -1;
+    }
+    SCLogInfo("IP reputation for %u hosts, %u distinct reputations, "
+            "table size %"PRIuMAX" bytes", de_ctx->srep_table->hosts,
+            de_ctx->srep_table->rep_cnt - 1,
+            (uintmax_t)((de_ctx->srep_table->mask + 1) * sizeof(SRepTableSlot) +
+                de_ctx->srep_table->rep_cnt * sizeof(SReputation)));
+
     /* Set effective rep version.
      * On live reload we will handle this after de_ctx has been swapped */
     if (init) {
         SRepInitComplete();
     }
 
-    HostPrintStats();
     return 0;
 }
 
@@ -552,6 +719,125 @@ static int SRepTest03(void) {
     return 1;
 }
 
+/** \test build a table, hosts listed more than once */
+static int SRepTest04(void) {
+    char buffer[] = "ip,cat,value\n"
+                    "1.2.3.4,1,2\n"
+                    "1.2.3.5,1,2\n"
+                    "1.2.3.4,2,20\n"
+                    "# comment\n"
+                    "10.0.0.1,1,2\n"
+                    "1.2.3.4,1,3\n";
+    SRepLoadCtx lctx;
+    SRepTable *t = NULL;
+    uint32_t ip;
+    int result = 0;
+
+    memset(&lctx, 0x00, sizeof(lctx));
+
+    FILE *fp = SCFmemopen((void *)buffer, strlen(buffer), "r");
+    if (fp == NULL)
+        goto end;
+    if (SRepLoadFileFromFD(&lctx, fp) < 0) {
+        fclose(fp);
+        goto end;
+    }
+    fclose(fp);
+
+    t = SRepTableBuild(&lctx, 1);
+    if (t == NULL)
+        goto end;
+
+    if (t->hosts != 3 || t->rep_cnt != 3) {
+        printf("hosts %u reps %u: ", t->hosts, t->rep_cnt);
+        goto end;
+    }
+
+    /* categories add up, the last value counts */
+    inet_pton(AF_INET, "1.2.3.4", &ip);
+    const SReputation *r = SRepTableLookupIPV4(t, ip);
+    if (r == NULL || r->rep[1] != 3 || r->rep[2] != 20 || r->version != 1) {
+        printf("1.2.3.4: ");
+        goto end;
+    }
+
+    /* shared reputation */
+    inet_pton(AF_INET, "1.2.3.5", &ip);
+    r = SRepTableLookupIPV4(t, ip);
+    inet_pton(AF_INET, "10.0.0.1", &ip);
+    if (r == NULL || r->rep[1] != 2 || r->rep[2] != 0 ||
+        r != SRepTableLookupIPV4(t, ip)) {
+        printf("1.2.3.5/10.0.0.1: ");
+        goto end;
+    }
+
+    inet_pton(AF_INET, "1.2.3.6", &ip);
+    if (SRepTableLookupIPV4(t, ip) != NULL)
+        goto end;
+
+    if (SRepTableLookupIPV4(NULL, ip) != NULL)
+        goto end;
+
+    result = 1;
+end:
+    if (lctx.entries != NULL)
+        SCFree(lctx.entries);
+    SRepTableFree(t);
+    return result;
+}
+
+/** \test table with many hosts, all have to be found */
+static int SRepTest05(void) {
+    SRepLoadCtx lctx;
+    SRepTable *t = NULL;
+    uint32_t i;
+    int result = 0;
+
+    memset(&lctx, 0x00, sizeof(lctx));
+
+    /* 10.0.0.0/12 in steps of 3, in reverse and with a duplicate */
+    for (i = 0; i < 100000; i++) {
+        uint32_t ip = htonl(0x0a000000 + (100000 - i) * 3);
+        if (SRepLoadAddEntry(&lctx, ip, i % 4, 1 + i % 100) < 0)
+            goto end;
+    }
+    if (SRepLoadAddEntry(&lctx, htonl(0x0a000000 + 3), 5, 50) < 0)
+        goto end;
+
+    t = SRepTableBuild(&lctx, 2);
+    if (t == NULL)
+        goto end;
+
+    if (t->hosts != 100000 || t->hosts > (t->mask + 1) / 4 * 3) {
+        printf("hosts %u slots %u: ", t->hosts, t->mask + 1);
+        goto end;
+    }
+
+    for (i = 0; i < 100000; i++) {
+        uint32_t ip = htonl(0x0a000000 + (100000 - i) * 3);
+        const SReputation *r = SRepTableLookupIPV4(t, ip);
+        if (r == NULL || r->rep[i % 4] != 1 + i % 100) {
+            printf("entry %u: ", i);
+            goto end;
+        }
+        if (SRepTableLookupIPV4(t, htonl(ntohl(ip) + 1)) != NULL) {
+            printf("entry %u + 1: ", i);
+            goto end;
+        }
+    }
+
+    const SReputation *r = SRepTableLookupIPV4(t, htonl(0x0a000000 + 3));
+    if (r == NULL || r->rep[5] != 50 || r->rep[99999 % 4] != 1 + 99999 % 100)
+        goto end;
+
+    result = 1;
+end:
+    if (lctx.entries != NULL)
+        SCFree(lctx.entries);
+    SRepTableFree(t);
+    return result;
+}
+
 
 #endif
 
@@ -1977,6 +2263,8 @@ void SCReputationRegisterTests(void)
     UtRegisterTest("SRepTest01", SRepTest01, 1);
     UtRegisterTest("SRepTest02", SRepTest02, 1);
     UtRegisterTest("SRepTest03", SRepTest03, 1);
+    UtRegisterTest("SRepTest04", SRepTest04, 1);
+    UtRegisterTest("SRepTest05", SRepTest05, 1);
 #endif /* UNITTESTS */
 }
 
@@ -35,6 +35,59 @@ typedef struct SReputation_ {
     uint8_t rep[SREP_MAX_CATS];
 } SReputation;
 
+/** \brief slot of the ipv4 lookup table */
+typedef struct SRepTableSlot_ {
+    uint32_t ip;        /**< ipv4 address, network order */
+    uint32_t rep;       /**< index in SRepTable::reps, 0 if the slot is empty */
+} SRepTableSlot;
+
+/** \brief ipv4 reputation lookup table
+ *
+ *  Compiled from the reputation files by SRepInit and never modified
+ *  after that, so lookups need no locking. Open addressing with linear
+ *  probing, at most 3/4 full, so a lookup is typically one cache line.
+ *  Hosts with the same reputation share an entry in reps, as feeds
+ *  only use a handful of categories and values.
+ *
+ *  A table belongs to the detection engine ctx it was loaded for and is
+ *  freed with it. On a live reload, the packet threads keep using the
+ *  old table until they switch to the new ctx. */
+typedef struct SRepTable_ {
+    uint32_t version;           /**< srep version the table was loaded as */
+    uint32_t shift;             /**< 32 - log2 of the number of slots */
+    uint32_t mask;              /**< number of slots - 1 */
+    uint32_t hosts;             /**< number of ip addresses */
+    SRepTableSlot *slots;
+
+    uint32_t rep_cnt;           /**< number of reps, the first is unused */
+    SReputation *reps;
+} SRepTable;
+
+static inline uint32_t SRepTableHash(const SRepTable *t, uint32_t ip) {
+    return (ip * 2654435761U) >> t->shift;
+}
+
+/** \brief look up the reputation of an ipv4 address
+ *  \param t table, may be NULL
+ *  \param ip ipv4 address in network order
+ *  \retval rep reputation or NULL if the address has none */
+static inline const SReputation *SRepTableLookupIPV4(const SRepTable *t, uint32_t ip) {
+    if (t == NULL)
+        return NULL;
+
+    uint32_t idx = SRepTableHash(t, ip);
+    while (1) {
+        const SRepTableSlot *slot = &t->slots[idx];
+        if (slot->rep == 0)
+            return NULL;
+        if (slot->ip == ip)
+            return &t->reps[slot->rep];
+        idx = (idx + 1) & t->mask;
+    }
+}
+
+void SRepTableFree(SRepTable *);
+
 uint8_t SRepCatGetByShortname(char *shortname);
 int SRepInit(DetectEngineCtx *de_ctx);
 void SRepReloadComplete(void);
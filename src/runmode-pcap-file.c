@@ -20,6 +20,7 @@
 #include "conf.h"
 #include "runmodes.h"
 #include "runmode-pcap-file.h"
+#include "source-pcap-file.h"
 #include "log-httplog.h"
 #include "output.h"
 #include "cuda-packet-batcher.h"
@@ -63,6 +64,31 @@ void RunModeFilePcapRegister(void)
     return;
 }
 
+/**
+ * \brief Number of files to read in parallel, from pcap-file.readers.
+ *        "auto" means one reader per cpu.
+ */
+static uint16_t RunModeFilePcapReaders(void)
+{
+    char *readers = NULL;
+
+    if (ConfGet("pcap-file.readers", &readers) != 1)
+        return 1;
+
+    if (strcmp(readers, "auto") == 0) {
+        uint16_t ncpus = UtilCpuGetNumProcessorsOnline();
+        return (ncpus > 0) ? ncpus : 1;
+    }
+
+    int n = atoi(readers);
+    if (n < 1 || n > UINT16_MAX) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid pcap-file.readers "
+                "value %s, using 1 reader", readers);
+        return 1;
+    }
+    return (uint16_t)n;
+}
+
 /**
  * \brief Single thread version of the Pcap file processing.
  */
@@ -77,6 +103,8 @@ int RunModeFilePcapSingle(DetectEngineCtx *de_ctx)
     RunModeInitialize();
     TimeModeSetOffline();
 
+    PcapFileSetupFiles(file, 1);
+
     /* create the threads */
     ThreadVars *tv = TmThreadCreatePacketHandler("PcapFile",
                                                  "packetpool", "packetpool",
@@ -165,6 +193,8 @@ int RunModeFilePcapAuto(DetectEngineCtx *de_ctx)
 
     TimeModeSetOffline();
 
+    PcapFileSetupFiles(file, 1);
+
 #if defined(__SC_CUDA_SUPPORT__)
     if (PatternMatchDefaultMatcher() == MPM_B2G_CUDA) {
         cuda = 1;
@@ -360,7 +390,7 @@ int RunModeFilePcapAuto(DetectEngineCtx *de_ctx)
 
 /**
  * \brief RunModeFilePcapAutoFp set up the following thread packet handlers:
- *        - Receive thread (from pcap file)
+ *        - Receive threads (from pcap files, see pcap-file.readers)
  *        - Decode thread
  *        - Stream thread
  *        - Detect: If we have only 1 cpu, it will setup one Detect thread
@@ -419,35 +449,55 @@ int RunModeFilePcapAutoFp(DetectEngineCtx *de_ctx)
 
     TimeModeSetOffline();
 
+    /* files are read in parallel, each reader feeding the flow queues so
+     * the packets of a flow in a file stay in order */
+    uint16_t readers = PcapFileSetupFiles(file, RunModeFilePcapReaders());
+    TmModule *tm_module;
+    uint16_t reader;
+
     /* create the threads */
-    ThreadVars *tv_receivepcap =
-        TmThreadCreatePacketHandler("ReceivePcapFile",
-                                    "packetpool", "packetpool",
-                                    queues, "flow",
-                                    "pktacqloop");
-    if (tv_receivepcap == NULL) {
-        printf("ERROR: TmThreadsCreate failed\n");
-        exit(EXIT_FAILURE);
-    }
-    TmModule *tm_module = TmModuleGetByName("ReceivePcapFile");
-    if (tm_module == NULL) {
-        printf("ERROR: TmModuleGetByName failed for ReceivePcap\n");
-        exit(EXIT_FAILURE);
-    }
-    TmSlotSetFuncAppend(tv_receivepcap, tm_module, file);
+    for (reader = 0; reader < readers; reader++) {
+        char rname[32];
+        if (readers == 1)
+            snprintf(rname, sizeof(rname), "ReceivePcapFile");
+        else
+            snprintf(rname, sizeof(rname), "ReceivePcapFile%"PRIu16, reader+1);
 
-    tm_module = TmModuleGetByName("DecodePcapFile");
-    if (tm_module == NULL) {
-        printf("ERROR: TmModuleGetByName DecodePcap failed\n");
-        exit(EXIT_FAILURE);
-    }
-    TmSlotSetFuncAppend(tv_receivepcap, tm_module, NULL);
+        char *reader_name = SCStrdup(rname);
+        if (unlikely(reader_name == NULL)) {
+            printf("ERROR: Can not strdup thread name\n");
+            exit(EXIT_FAILURE);
+        }
+
+        ThreadVars *tv_receivepcap =
+            TmThreadCreatePacketHandler(reader_name,
+                                        "packetpool", "packetpool",
+                                        queues, "flow",
+                                        "pktacqloop");
+        if (tv_receivepcap == NULL) {
+            printf("ERROR: TmThreadsCreate failed\n");
+            exit(EXIT_FAILURE);
+        }
+        tm_module = TmModuleGetByName("ReceivePcapFile");
+        if (tm_module == NULL) {
+            printf("ERROR: TmModuleGetByName failed for ReceivePcap\n");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_receivepcap, tm_module, file);
 
-    TmThreadSetCPU(tv_receivepcap, RECEIVE_CPU_SET);
+        tm_module = TmModuleGetByName("DecodePcapFile");
+        if (tm_module == NULL) {
+            printf("ERROR: TmModuleGetByName DecodePcap failed\n");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_receivepcap, tm_module, NULL);
 
-    if (TmThreadSpawn(tv_receivepcap) != TM_ECODE_OK) {
-        printf("ERROR: TmThreadSpawn failed\n");
-        exit(EXIT_FAILURE);
+        TmThreadSetCPU(tv_receivepcap, RECEIVE_CPU_SET);
+
+        if (TmThreadSpawn(tv_receivepcap) != TM_ECODE_OK) {
+            printf("ERROR: TmThreadSpawn failed\n");
+            exit(EXIT_FAILURE);
+        }
     }
 
     for (thread = 0; thread < thread_max; thread++) {
@@ -51,6 +51,7 @@
 #include "util-optimize.h"
 #include "util-checksum.h"
 #include "util-ioctl.h"
+#include "util-profiling.h"
 #include "tmqh-packetpool.h"
 #include "source-af-packet.h"
 #include "runmodes.h"
@@ -144,6 +145,11 @@ TmEcode NoAFPSupportExit(ThreadVars *tv, void *initdata, void **data)
 #define TP_STATUS_USER_BUSY (1 << 31)
 #endif
 
+#ifndef TP_STATUS_CSUM_VALID
+/* set by kernels >= 3.16 if the nic verified the checksum */
+#define TP_STATUS_CSUM_VALID (1 << 7)
+#endif
+
 /** protect pfring_set_bpf_filter, as it is not thread safe */
 static SCMutex afpacket_bpf_set_filter_lock = PTHREAD_MUTEX_INITIALIZER;
 
@@ -218,6 +224,11 @@ typedef struct AFPThreadVars_
     unsigned int frame_offset;
     int ring_size;
 
+    /** ring packets not yet handed to the slots, used if batch-size
+     *  is more than 1 */
+    Packet *batch[TM_BATCH_SIZE_MAX];
+    uint16_t batch_cnt;
+
 } AFPThreadVars;
 
 TmEcode ReceiveAFP(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
@@ -227,7 +238,9 @@ TmEcode ReceiveAFPThreadDeinit(ThreadVars *, void *);
 TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot);
 
 TmEcode DecodeAFPThreadInit(ThreadVars *, void *, void **);
+TmEcode DecodeAFPThreadDeinit(ThreadVars *, void *);
 TmEcode DecodeAFP(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
+TmEcode DecodeAFPBatch(ThreadVars *, Packet **, uint32_t, void *, PacketQueue *, PacketQueue *);
 
 TmEcode AFPSetBPFFilter(AFPThreadVars *ptv);
 static int AFPGetIfnumByDev(int fd, const char *ifname, int verbose);
@@ -458,8 +471,9 @@ void TmModuleDecodeAFPRegister (void) {
     tmm_modules[TMM_DECODEAFP].name = "DecodeAFP";
     tmm_modules[TMM_DECODEAFP].ThreadInit = DecodeAFPThreadInit;
     tmm_modules[TMM_DECODEAFP].Func = DecodeAFP;
+    tmm_modules[TMM_DECODEAFP].FuncBatch = DecodeAFPBatch;
     tmm_modules[TMM_DECODEAFP].ThreadExitPrintStats = NULL;
-    tmm_modules[TMM_DECODEAFP].ThreadDeinit = NULL;
+    tmm_modules[TMM_DECODEAFP].ThreadDeinit = DecodeAFPThreadDeinit;
     tmm_modules[TMM_DECODEAFP].RegisterTests = NULL;
     tmm_modules[TMM_DECODEAFP].cap_flags = 0;
     tmm_modules[TMM_DECODEAFP].flags = TM_FLAG_DECODE_TM;
@@ -595,7 +609,9 @@ int AFPRead(AFPThreadVars *ptv)
 
         aux = (struct tpacket_auxdata *)CMSG_DATA(cmsg);
 
-        if (aux_checksum && (aux->tp_status & TP_STATUS_CSUMNOTREADY)) {
+        /* no checksum yet (locally sent) or already verified by the nic */
+        if (aux_checksum &&
+                (aux->tp_status & (TP_STATUS_CSUMNOTREADY|TP_STATUS_CSUM_VALID))) {
             p->flags |= PKT_IGNORE_CHECKSUM;
         }
         break;
@@ -676,6 +692,22 @@ cleanup:
     return ret;
 }
 
+/**
+ * \brief Hand the batched ring packets to the slots
+ *
+ * \retval TM_ECODE_FAILED if one of the slots failed
+ */
+static TmEcode AFPFlushBatch(AFPThreadVars *ptv)
+{
+    uint16_t cnt = ptv->batch_cnt;
+
+    if (cnt == 0)
+        return TM_ECODE_OK;
+
+    ptv->batch_cnt = 0;
+    return TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, ptv->batch, cnt);
+}
+
 /**
  * \brief AF packet read function for ring
  *
@@ -812,7 +844,8 @@ int AFPReadFromRing(AFPThreadVars *ptv)
                 p->flags |= PKT_IGNORE_CHECKSUM;
             }
         } else {
-            if (h.h2->tp_status & TP_STATUS_CSUMNOTREADY) {
+            /* no checksum yet (locally sent) or already verified by the nic */
+            if (h.h2->tp_status & (TP_STATUS_CSUMNOTREADY|TP_STATUS_CSUM_VALID)) {
                 p->flags |= PKT_IGNORE_CHECKSUM;
             }
         }
@@ -826,6 +859,18 @@ int AFPReadFromRing(AFPThreadVars *ptv)
             h.h2->tp_status = TP_STATUS_KERNEL;
         }
 
+        if (tm_batch_size > 1) {
+            ptv->batch[ptv->batch_cnt++] = p;
+            if (ptv->batch_cnt >= tm_batch_size &&
+                    AFPFlushBatch(ptv) != TM_ECODE_OK) {
+                if (++ptv->frame_offset >= ptv->req.tp_frame_nr) {
+                    ptv->frame_offset = 0;
+                }
+                SCReturnInt(AFP_FAILURE);
+            }
+            goto next_frame;
+        }
+
         if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
             h.h2->tp_status = TP_STATUS_KERNEL;
             if (++ptv->frame_offset >= ptv->req.tp_frame_nr) {
@@ -1028,6 +1073,9 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
         } else if (r > 0) {
             if (ptv->flags & AFP_RING_MODE) {
                 r = AFPReadFromRing(ptv);
+                /* the ring read leaves a partial batch behind */
+                if (AFPFlushBatch(ptv) != TM_ECODE_OK)
+                    r = AFP_FAILURE;
             } else {
                 /* AFPRead will call TmThreadsSlotProcessPkt on read packets */
                 r = AFPRead(ptv);
@@ -1645,6 +1693,8 @@ TmEcode DecodeAFP(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, Packet
 
     SCPerfCounterAddUI64(dtv->counter_avg_pkt_size, tv->sc_perf_pca, GET_PKT_LEN(p));
     SCPerfCounterSetUI64(dtv->counter_max_pkt_size, tv->sc_perf_pca, GET_PKT_LEN(p));
+    PacketPoolUpdateCounters(tv, dtv->counter_pkt_pool_depth,
+                             dtv->counter_pkt_pool_starved);
 
     /* call the decoder */
     switch(p->datalink) {
@@ -1668,6 +1718,29 @@ TmEcode DecodeAFP(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, Packet
     SCReturnInt(TM_ECODE_OK);
 }
 
+/**
+ * \brief Decode a batch of packets
+ *
+ * Same as DecodeAFP, but fetches the data of the next packet into the
+ * cache while the current one is decoded.
+ */
+TmEcode DecodeAFPBatch(ThreadVars *tv, Packet **pkts, uint32_t cnt, void *data, PacketQueue *pq, PacketQueue *postpq)
+{
+    SCEnter();
+    uint32_t i;
+
+    for (i = 0; i < cnt; i++) {
+        if (i + 1 < cnt)
+            __builtin_prefetch(GET_PKT_DATA(pkts[i + 1]));
+
+        PACKET_PROFILING_TMM_START(pkts[i], TMM_DECODEAFP);
+        DecodeAFP(tv, pkts[i], data, pq, postpq);
+        PACKET_PROFILING_TMM_END(pkts[i], TMM_DECODEAFP);
+    }
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
 TmEcode DecodeAFPThreadInit(ThreadVars *tv, void *initdata, void **data)
 {
     SCEnter();
@@ -1685,6 +1758,13 @@ TmEcode DecodeAFPThreadInit(ThreadVars *tv, void *initdata, void **data)
     SCReturnInt(TM_ECODE_OK);
 }
 
+TmEcode DecodeAFPThreadDeinit(ThreadVars *tv, void *data)
+{
+    if (data != NULL)
+        DecodeThreadVarsFree(tv, data);
+    SCReturnInt(TM_ECODE_OK);
+}
+
 #endif /* HAVE_AF_PACKET */
 /* eof */
 /**
@@ -156,6 +156,11 @@ typedef struct MpipeThreadVars_
     uint16_t counter_no_buffers_7;
     uint16_t counter_capture_overrun;
 
+    /** packets not yet handed to the slots, used if batch-size is more
+     *  than 1 */
+    Packet *batch[TM_BATCH_SIZE_MAX];
+    uint16_t batch_cnt;
+
 } MpipeThreadVars;
 
 TmEcode ReceiveMpipeLoop(ThreadVars *tv, void *data, void *slot);
@@ -164,6 +169,7 @@ TmEcode ReceiveMpipeThreadInit(ThreadVars *, void *, void **);
 void ReceiveMpipeThreadExitStats(ThreadVars *, void *);
 
 TmEcode DecodeMpipeThreadInit(ThreadVars *, void *, void **);
+TmEcode DecodeMpipeThreadDeinit(ThreadVars *, void *);
 TmEcode DecodeMpipe(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
 
 #define PIPELINES 6       /* fix this. look elsewhere */
@@ -275,7 +281,7 @@ void TmModuleDecodeMpipeRegister (void) {
     tmm_modules[TMM_DECODEMPIPE].ThreadInit = DecodeMpipeThreadInit;
     tmm_modules[TMM_DECODEMPIPE].Func = DecodeMpipe;
     tmm_modules[TMM_DECODEMPIPE].ThreadExitPrintStats = NULL;
-    tmm_modules[TMM_DECODEMPIPE].ThreadDeinit = NULL;
+    tmm_modules[TMM_DECODEMPIPE].ThreadDeinit = DecodeMpipeThreadDeinit;
     tmm_modules[TMM_DECODEMPIPE].RegisterTests = NULL;
     tmm_modules[TMM_DECODEMPIPE].cap_flags = 0;
     tmm_modules[TMM_DECODEMPIPE].flags = TM_FLAG_DECODE_TM;
@@ -368,6 +374,21 @@ drop:
 #endif
 }
 
+/**
+ * \brief Check if the classifier already verified the l4 checksum
+ *
+ *  With idesc->cs set, csum_seed_val holds the 16 bit ones' complement
+ *  sum of the l4 packet, seeded with the pseudo header. For a valid
+ *  checksum that sum is 0xFFFF, negative zero. 0 is accepted too in case
+ *  the classifier returns the complemented sum: a real sum can't be 0 as
+ *  the pseudo header isn't all zeros.
+ */
+static inline int MpipeChecksumVerified(gxio_mpipe_idesc_t *idesc)
+{
+    return (idesc->cs &&
+            (idesc->csum_seed_val == 0xFFFF || idesc->csum_seed_val == 0));
+}
+
 /**
  * \brief Mpipe Packet Process function.
  *
@@ -384,6 +405,7 @@ static inline Packet *MpipeProcessPacket(MpipeThreadVars *ptv, gxio_mpipe_idesc_
     Packet *p = (Packet *)(pkt - sizeof(Packet) - headroom/*2*/);
 
     PACKET_RECYCLE(p);
+    PACKET_PROFILING_START(p);
 
     ptv->bytes += caplen;
     ptv->pkts++;
@@ -423,6 +445,8 @@ static inline Packet *MpipeProcessPacket(MpipeThreadVars *ptv, gxio_mpipe_idesc_
 
     if (ptv->checksum_mode == CHECKSUM_VALIDATION_DISABLE)
         p->flags |= PKT_IGNORE_CHECKSUM;
+    else if (MpipeChecksumVerified(idesc))
+        p->flags |= PKT_IGNORE_CHECKSUM;
 
     return p;
 }
@@ -433,6 +457,7 @@ static inline Packet *MpipePrepPacket(MpipeThreadVars *ptv, gxio_mpipe_idesc_t *
     Packet *p = (Packet *)(pkt - sizeof(Packet) - headroom/*2*/);
 
     PACKET_RECYCLE(p);
+    PACKET_PROFILING_START(p);
 
     ptv->bytes += caplen;
     ptv->pkts++;
@@ -468,6 +493,8 @@ static inline Packet *MpipePrepPacket(MpipeThreadVars *ptv, gxio_mpipe_idesc_t *
 
     if (ptv->checksum_mode == CHECKSUM_VALIDATION_DISABLE)
         p->flags |= PKT_IGNORE_CHECKSUM;
+    else if (MpipeChecksumVerified(idesc))
+        p->flags |= PKT_IGNORE_CHECKSUM;
 
     return p;
 }
@@ -521,6 +548,37 @@ static uint16_t xlate_stack(MpipeThreadVars *ptv, int stack_idx) {
     }
     return counter;
 }
+/**
+ * \brief Hand the batched packets to the slots
+ */
+static inline void MpipeFlushBatch(MpipeThreadVars *ptv)
+{
+    uint16_t cnt = ptv->batch_cnt;
+
+    if (cnt == 0)
+        return;
+
+    ptv->batch_cnt = 0;
+    TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, ptv->batch, cnt);
+}
+
+/**
+ * \brief Hand a packet to the slots, or add it to the batch
+ *
+ * The idesc can be consumed right after: the packet data stays in its
+ * mpipe buffer until the packet is released.
+ */
+static inline void MpipeProcessOrBatch(MpipeThreadVars *ptv, Packet *p)
+{
+    if (tm_batch_size > 1) {
+        ptv->batch[ptv->batch_cnt++] = p;
+        if (ptv->batch_cnt >= tm_batch_size)
+            MpipeFlushBatch(ptv);
+    } else {
+        TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p);
+    }
+}
+
 /**
  * \brief Receives packets from an interface via gxio mpipe.
  */
@@ -570,7 +628,7 @@ TmEcode ReceiveMpipeLoop(ThreadVars *tv, void *data, void *slot) {
                     if (likely(!idesc->be)) {
                         p = MpipeProcessPacket(ptv, idesc, (timestamp == ts_linux) ? &timeval : NULL);
                         p->mpipe_v.pool = rank;
-                        TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p);
+                        MpipeProcessOrBatch(ptv, p);
                         r = 1;
 #ifdef LATE_MPIPE_CREDIT
                         gxio_mpipe_iqueue_advance(iqueue, 1);
@@ -586,6 +644,8 @@ TmEcode ReceiveMpipeLoop(ThreadVars *tv, void *data, void *slot) {
                         SCPerfCounterIncr(xlate_stack(ptv, idesc->stack_idx), tv->sc_perf_pca);
                     }
                 }
+                /* don't keep a partial batch waiting for the next peek */
+                MpipeFlushBatch(ptv);
             } else {
                 if (timestamp == ts_linux) {
                     tilera_fast_gettimeofday(&timeval);
@@ -652,7 +712,8 @@ static TmEcode ReceiveMpipePollPair(ThreadVars *tv, MpipeThreadVars *ptv,
                 t += n;
 
                 //SCLogInfo("Got %d packets for pool %d", n, pool);
-                m = min(n, 4);
+                /* take a full batch per peek if batching */
+                m = min(n, max(4, (int)tm_batch_size));
 
                 /* Prefetch the idescs (64 bytes each). */
                 for (j = 0; j < m; j++) {
@@ -671,7 +732,7 @@ static TmEcode ReceiveMpipePollPair(ThreadVars *tv, MpipeThreadVars *ptv,
                     if (likely(!idesc->be)) {
                         p = MpipeProcessPacket(ptv, idesc, (timestamp == ts_linux) ? &timeval : NULL);
                         p->mpipe_v.pool = pool;
-                        TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p);
+                        MpipeProcessOrBatch(ptv, p);
 #ifdef LATE_MPIPE_CREDIT
                         gxio_mpipe_iqueue_advance(iqueue, 1);
 #ifdef LATE_MPIPE_BUCKET_CREDIT
@@ -685,6 +746,8 @@ static TmEcode ReceiveMpipePollPair(ThreadVars *tv, MpipeThreadVars *ptv,
                         SCPerfCounterIncr(xlate_stack(ptv, idesc->stack_idx), tv->sc_perf_pca);
                     }
                 }
+                /* don't keep a partial batch waiting for the next poll */
+                MpipeFlushBatch(ptv);
             }
         }
         SCPerfSyncCountersIfSignalled(tv, 0);
@@ -1565,6 +1628,13 @@ TmEcode DecodeMpipeThreadInit(ThreadVars *tv, void *initdata, void **data)
 
 }
 
+TmEcode DecodeMpipeThreadDeinit(ThreadVars *tv, void *data)
+{
+    if (data != NULL)
+        DecodeThreadVarsFree(tv, data);
+    SCReturnInt(TM_ECODE_OK);
+}
+
 TmEcode DecodeMpipe(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postq)
 {
     SCEnter()
@@ -92,6 +92,7 @@ TmEcode ReceiveNetioThreadInit(ThreadVars *, void *, void **);
 void ReceiveNetioThreadExitStats(ThreadVars *, void *);
 
 TmEcode DecodeNetioThreadInit(ThreadVars *, void *, void **);
+TmEcode DecodeNetioThreadDeinit(ThreadVars *, void *);
 TmEcode DecodeNetio(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
 
 /*
@@ -141,7 +142,7 @@ void TmModuleDecodeNetioRegister (void) {
     tmm_modules[TMM_DECODENETIO].ThreadInit = DecodeNetioThreadInit;
     tmm_modules[TMM_DECODENETIO].Func = DecodeNetio;
     tmm_modules[TMM_DECODENETIO].ThreadExitPrintStats = NULL;
-    tmm_modules[TMM_DECODENETIO].ThreadDeinit = NULL;
+    tmm_modules[TMM_DECODENETIO].ThreadDeinit = DecodeNetioThreadDeinit;
     tmm_modules[TMM_DECODENETIO].RegisterTests = NULL;
     tmm_modules[TMM_DECODENETIO].cap_flags = 0;
 }
@@ -458,6 +459,13 @@ TmEcode DecodeNetioThreadInit(ThreadVars *tv, void *initdata, void **data)
 
 }
 
+TmEcode DecodeNetioThreadDeinit(ThreadVars *tv, void *data)
+{
+    if (data != NULL)
+        DecodeThreadVarsFree(tv, data);
+    SCReturnInt(TM_ECODE_OK);
+}
+
 TmEcode DecodeNetio(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postq)
 {
     SCEnter()
@@ -21,6 +21,19 @@
  * \author Victor Julien <victor@inliniac.net>
  *
  * File based pcap packet acquisition support
+ *
+ * The -r argument can be a file, a comma separated list of files or a
+ * directory. The files are handed out to the reader threads one at a
+ * time, so with more than one reader several files are read at once.
+ *
+ * Unless a bpf filter is set, pcap and pcapng files are mmap'd and parsed
+ * here instead of read through libpcap. The kernel is asked to read ahead
+ * of the read position, and the pages that were read are dropped again.
+ *
+ * With pcap-file.merge a single reader opens all files and merges their
+ * packets by timestamp, using a heap of the files ordered by the time of
+ * their next packet. Captures of several links taken at the same time are
+ * then seen as one stream, and the engine time follows the merged stream.
  */
 
 #include "suricata-common.h"
@@ -39,22 +52,153 @@
 #include "tmqh-packetpool.h"
 #include "tm-threads.h"
 #include "util-optimize.h"
+#include "flow.h"
 #include "flow-manager.h"
 #include "util-profiling.h"
+#include "util-byte.h"
+#include "util-misc.h"
+#include "util-unittest.h"
 #include "runmode-unix-socket.h"
+#include "host.h"
+#include "pkt-var.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 extern uint8_t suricata_ctl_flags;
 extern int max_pending_packets;
 
 //static int pcap_max_read_packets = 0;
 
+/** max reader threads */
+#define PCAP_FILE_MAX_READERS       64
+/** max interfaces in a pcapng section */
+#define PCAP_FILE_NG_MAX_IFACES     32
+/** larger captured lengths mean the file is corrupt, same limit as libpcap */
+#define PCAP_FILE_MAX_CAPLEN        262144
+#define PCAP_FILE_READAHEAD_DEFAULT (8 * 1024 * 1024)
+
+#define PCAP_FILE_MAGIC             0xa1b2c3d4
+#define PCAP_FILE_MAGIC_NSEC        0xa1b23c4d
+#define PCAP_FILE_MAGIC_SWAPPED     0xd4c3b2a1
+#define PCAP_FILE_MAGIC_NSEC_SWAPPED 0x4d3cb2a1
+#define PCAP_FILE_HDR_LEN           24
+#define PCAP_FILE_REC_LEN           16
+
+#define PCAPNG_BLOCK_SHB            0x0A0D0D0A
+#define PCAPNG_BLOCK_IDB            0x00000001
+#define PCAPNG_BLOCK_PB             0x00000002
+#define PCAPNG_BLOCK_SPB            0x00000003
+#define PCAPNG_BLOCK_EPB            0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC     0x1A2B3C4D
+#define PCAPNG_OPT_IF_TSRESOL       9
+
+/** linktype of raw ip in files, DLT_RAW differs per platform */
+#define PCAP_FILE_LINKTYPE_RAW      101
+
+typedef void (*PcapFileDecoder)(ThreadVars *, DecodeThreadVars *, Packet *,
+        uint8_t *, uint16_t, PacketQueue *);
+
 typedef struct PcapFileGlobalVars_ {
-    pcap_t *pcap_handle;
-    void (*Decoder)(ThreadVars *, DecodeThreadVars *, Packet *, u_int8_t *, u_int16_t, PacketQueue *);
+    SC_ATOMIC_DECLARE(uint64_t, cnt); /** packet counter */
+
+    /** files to read, handed out to the readers in order */
+    char **files;
+    uint32_t files_cnt;
+    uint32_t files_next;
+    SCMutex files_lock;
+
+    /** reader threads set up by the runmode */
+    uint16_t readers;
+    SC_ATOMIC_DECLARE(uint16_t, readers_id);
+    SC_ATOMIC_DECLARE(uint16_t, readers_running);
+
+    /** trace second each reader is at, 0 if unknown or done. With more
+     *  than one reader the engine time follows the slowest one. */
+    uint32_t readers_ts[PCAP_FILE_MAX_READERS];
+    /** readers that passed their first second, or are done. The time is
+     *  only set once all of them did. */
+    uint16_t readers_ts_cnt;
+    uint32_t ts_set;
+    SCMutex ts_lock;
+
+    int mmap;
+    int merge;
+    uint64_t readahead;
+    uint64_t page_size;
+} PcapFileGlobalVars;
+
+/** pcapng interface */
+typedef struct PcapFileNgIface_ {
+    int datalink;
+    uint32_t snaplen;
+    uint64_t units;                 /**< timestamp units per second */
+} PcapFileNgIface;
+
+/** pcap or pcapng file mapped in memory */
+typedef struct PcapFileMap_ {
+    uint8_t *map;
+    uint64_t len;
+    uint64_t off;                   /**< offset of the next record or block */
+    uint64_t advised;               /**< end of the range read ahead */
+    uint64_t released;              /**< start of the range not dropped yet */
+
+    uint8_t swapped;                /**< file is in the other byte order */
+    uint8_t pcapng;
+    uint8_t nsec;                   /**< pcap with nanosecond timestamps */
+
+    /** pcap file header */
+    int datalink;
+    uint32_t snaplen;
+
+    /** interfaces of the current pcapng section */
+    PcapFileNgIface ifaces[PCAP_FILE_NG_MAX_IFACES];
+    uint32_t ifaces_cnt;
+    /** timestamp for simple packet blocks, which have none */
+    struct timeval last_ts;
+} PcapFileMap;
+
+/** packet record, data points into the file or libpcap's buffer */
+typedef struct PcapFileRecord_ {
+    struct timeval ts;
+    uint32_t caplen;
     int datalink;
+    uint8_t *data;
+} PcapFileRecord;
+
+/** file being read, through mmap or libpcap */
+typedef struct PcapFileSource_ {
+    char *filename;
+
+    uint8_t use_map;
+    uint8_t error;
+    PcapFileMap map;
+
+    pcap_t *pcap_handle;
     struct bpf_program filter;
-    uint64_t cnt; /** packet counter */
-} PcapFileGlobalVars;
+    uint8_t filter_set;
+    int datalink;
+} PcapFileSource;
+
+/** files merged by packet timestamp */
+typedef struct PcapFileMerge_ {
+    PcapFileSource *srcs;
+    /** next packet of each file */
+    PcapFileRecord *recs;
+    uint32_t cnt;
+
+    /** files that have a next packet, the oldest one on top */
+    uint32_t *heap;
+    uint32_t heap_cnt;
+
+    /** the packet on top was returned, the file has to move to its next
+     *  packet before the heap is used again */
+    uint8_t top_used;
+} PcapFileMerge;
 
 /** max packets < 65536 */
 //#define PCAP_FILE_MAX_PKTS 256
@@ -64,6 +208,7 @@ typedef struct PcapFileThreadVars_
     /* counters */
     uint32_t pkts;
     uint64_t bytes;
+    uint32_t files;
 
     ThreadVars *tv;
     TmSlot *slot;
@@ -73,48 +218,1009 @@ typedef struct PcapFileThreadVars_
 
     uint8_t done;
     uint32_t errs;
+
+    /** packets read but not yet handed to the slots, used if
+     *  batch-size is more than 1 */
+    Packet *batch[TM_BATCH_SIZE_MAX];
+    uint16_t batch_cnt;
+
+    PcapFileSource src;
+    /** set if the files are merged, src is not used then */
+    PcapFileMerge *merge;
+
+    uint16_t reader_id;
+    /** last trace second passed to PcapFileSetReaderTime */
+    uint32_t ts_sec;
+    /** set once the reader is counted in pcap_g.readers_ts_cnt */
+    uint8_t ts_counted;
+    /** trace time the flow manager was last woken up at */
+    double prev_signaled_ts;
+    /** packets skipped because their datalink isn't supported */
+    uint32_t unsupported;
 } PcapFileThreadVars;
 
 static PcapFileGlobalVars pcap_g;
 
-TmEcode ReceivePcapFileLoop(ThreadVars *, void *, void *);
+TmEcode ReceivePcapFileLoop(ThreadVars *, void *, void *);
+
+TmEcode ReceivePcapFileThreadInit(ThreadVars *, void *, void **);
+void ReceivePcapFileThreadExitStats(ThreadVars *, void *);
+TmEcode ReceivePcapFileThreadDeinit(ThreadVars *, void *);
+
+TmEcode DecodePcapFile(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
+TmEcode DecodePcapFileBatch(ThreadVars *, Packet **, uint32_t, void *, PacketQueue *, PacketQueue *);
+TmEcode DecodePcapFileThreadInit(ThreadVars *, void *, void **);
+TmEcode DecodePcapFileThreadDeinit(ThreadVars *, void *);
+
+static void PcapFileSourceClose(PcapFileSource *);
+static void PcapFileRegisterTests(void);
+
+void TmModuleReceivePcapFileRegister (void) {
+    memset(&pcap_g, 0x00, sizeof(pcap_g));
+    SC_ATOMIC_INIT(pcap_g.cnt);
+    SC_ATOMIC_INIT(pcap_g.readers_id);
+    SC_ATOMIC_INIT(pcap_g.readers_running);
+    SCMutexInit(&pcap_g.files_lock, NULL);
+    SCMutexInit(&pcap_g.ts_lock, NULL);
+    pcap_g.mmap = 1;
+    pcap_g.readahead = PCAP_FILE_READAHEAD_DEFAULT;
+    long page_size = sysconf(_SC_PAGESIZE);
+    pcap_g.page_size = (page_size > 0) ? (uint64_t)page_size : 4096;
+
+    tmm_modules[TMM_RECEIVEPCAPFILE].name = "ReceivePcapFile";
+    tmm_modules[TMM_RECEIVEPCAPFILE].ThreadInit = ReceivePcapFileThreadInit;
+    tmm_modules[TMM_RECEIVEPCAPFILE].Func = NULL;
+    tmm_modules[TMM_RECEIVEPCAPFILE].PktAcqLoop = ReceivePcapFileLoop;
+    tmm_modules[TMM_RECEIVEPCAPFILE].ThreadExitPrintStats = ReceivePcapFileThreadExitStats;
+    tmm_modules[TMM_RECEIVEPCAPFILE].ThreadDeinit = ReceivePcapFileThreadDeinit;
+    tmm_modules[TMM_RECEIVEPCAPFILE].RegisterTests = PcapFileRegisterTests;
+    tmm_modules[TMM_RECEIVEPCAPFILE].cap_flags = 0;
+    tmm_modules[TMM_RECEIVEPCAPFILE].flags = TM_FLAG_RECEIVE_TM;
+}
+
+void TmModuleDecodePcapFileRegister (void) {
+    tmm_modules[TMM_DECODEPCAPFILE].name = "DecodePcapFile";
+    tmm_modules[TMM_DECODEPCAPFILE].ThreadInit = DecodePcapFileThreadInit;
+    tmm_modules[TMM_DECODEPCAPFILE].Func = DecodePcapFile;
+    tmm_modules[TMM_DECODEPCAPFILE].FuncBatch = DecodePcapFileBatch;
+    tmm_modules[TMM_DECODEPCAPFILE].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_DECODEPCAPFILE].ThreadDeinit = DecodePcapFileThreadDeinit;
+    tmm_modules[TMM_DECODEPCAPFILE].RegisterTests = NULL;
+    tmm_modules[TMM_DECODEPCAPFILE].cap_flags = 0;
+    tmm_modules[TMM_DECODEPCAPFILE].flags = TM_FLAG_DECODE_TM;
+}
+
+static PcapFileDecoder PcapFileGetDecoder(int datalink)
+{
+    switch (datalink) {
+        case LINKTYPE_LINUX_SLL:
+            return DecodeSll;
+        case LINKTYPE_ETHERNET:
+            return DecodeEthernet;
+        case LINKTYPE_PPP:
+            return DecodePPP;
+        case LINKTYPE_RAW:
+            return DecodeRaw;
+        default:
+            return NULL;
+    }
+}
+
+/** \brief map a linktype from a file to the DLT libpcap would report */
+static int PcapFileLinktypeToDlt(uint32_t linktype)
+{
+    if (linktype == PCAP_FILE_LINKTYPE_RAW)
+        return DLT_RAW;
+    return (int)linktype;
+}
+
+/**
+ * \brief Free the list of files to read.
+ */
+static void PcapFileFreeFiles(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < pcap_g.files_cnt; i++) {
+        SCFree(pcap_g.files[i]);
+    }
+    if (pcap_g.files != NULL)
+        SCFree(pcap_g.files);
+    pcap_g.files = NULL;
+    pcap_g.files_cnt = 0;
+    pcap_g.files_next = 0;
+}
+
+static int PcapFileAddFile(const char *name, size_t len)
+{
+    char **files = SCRealloc(pcap_g.files,
+            (pcap_g.files_cnt + 1) * sizeof(char *));
+    if (unlikely(files == NULL))
+        return -1;
+    pcap_g.files = files;
+
+    char *file = SCMalloc(len + 1);
+    if (unlikely(file == NULL))
+        return -1;
+    memcpy(file, name, len);
+    file[len] = '\0';
+
+    pcap_g.files[pcap_g.files_cnt++] = file;
+    return 0;
+}
+
+static int PcapFileCompareNames(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * \brief Add the regular files in a directory, in name order. Names
+ *        starting with a dot are skipped.
+ */
+static int PcapFileAddDir(const char *dir)
+{
+    char path[PATH_MAX];
+    struct dirent *de;
+    struct stat st;
+    uint32_t first = pcap_g.files_cnt;
+
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open pcap directory %s: %s",
+                dir, strerror(errno));
+        return -1;
+    }
+
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        if (PcapFileAddFile(path, strlen(path)) < 0) {
+            closedir(d);
+            return -1;
+        }
+    }
+    closedir(d);
+
+    qsort(pcap_g.files + first, pcap_g.files_cnt - first, sizeof(char *),
+            PcapFileCompareNames);
+    return 0;
+}
+
+/**
+ * \brief Build the list of files to read and pick the number of readers.
+ *        Has to be called by the runmode before the readers start.
+ *
+ * \param path file, comma separated list of files or directory
+ * \param readers reader threads wanted
+ *
+ * \retval readers reader threads to set up, at least 1 and at most the
+ *         number of files
+ */
+uint16_t PcapFileSetupFiles(const char *path, uint16_t readers)
+{
+    struct stat st;
+    char *readahead = NULL;
+
+    PcapFileFreeFiles();
+
+    if (ConfGetBool("pcap-file.mmap", &pcap_g.mmap) != 1)
+        pcap_g.mmap = 1;
+    if (ConfGetBool("pcap-file.merge", &pcap_g.merge) != 1)
+        pcap_g.merge = 0;
+#ifndef HAVE_SYS_MMAN_H
+    pcap_g.mmap = 0;
+#endif
+
+    pcap_g.readahead = PCAP_FILE_READAHEAD_DEFAULT;
+    if (ConfGet("pcap-file.readahead", &readahead) == 1) {
+        if (ParseSizeStringU64(readahead, &pcap_g.readahead) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "invalid pcap-file.readahead "
+                    "value %s, using the default", readahead);
+            pcap_g.readahead = PCAP_FILE_READAHEAD_DEFAULT;
+        }
+    }
+
+    /* a path that exists is used as is, even if it has a ',' in it */
+    if (stat(path, &st) == 0) {
+        if (S_ISDIR(st.st_mode))
+            PcapFileAddDir(path);
+        else
+            PcapFileAddFile(path, strlen(path));
+    } else {
+        const char *p = path;
+        while (*p != '\0') {
+            size_t len = strcspn(p, ",");
+            if (len > 0)
+                PcapFileAddFile(p, len);
+            p += len;
+            if (*p == ',')
+                p++;
+        }
+    }
+
+    /* merging is done by a single reader */
+    if (RunModeUnixSocketIsActive() || pcap_g.merge)
+        readers = 1;
+    if (readers > pcap_g.files_cnt)
+        readers = pcap_g.files_cnt;
+    if (readers > PCAP_FILE_MAX_READERS)
+        readers = PCAP_FILE_MAX_READERS;
+    if (readers == 0)
+        readers = 1;
+
+    pcap_g.readers = readers;
+    SC_ATOMIC_RESET(pcap_g.readers_id);
+    SC_ATOMIC_RESET(pcap_g.readers_running);
+    memset(pcap_g.readers_ts, 0x00, sizeof(pcap_g.readers_ts));
+    pcap_g.readers_ts_cnt = 0;
+    pcap_g.ts_set = 0;
+
+    if (pcap_g.files_cnt > 1 && pcap_g.merge) {
+        SCLogInfo("merging %" PRIu32 " pcap files by packet timestamp",
+                pcap_g.files_cnt);
+    } else if (pcap_g.files_cnt > 1) {
+        SCLogInfo("reading %" PRIu32 " pcap files with %" PRIu16 " reader(s)",
+                pcap_g.files_cnt, readers);
+    }
+    return readers;
+}
+
+/**
+ * \brief Take the next file from the list.
+ *
+ * \retval file name or NULL if all files were handed out
+ */
+static char *PcapFileNextFile(void)
+{
+    char *file = NULL;
+
+    SCMutexLock(&pcap_g.files_lock);
+    if (pcap_g.files_next < pcap_g.files_cnt)
+        file = pcap_g.files[pcap_g.files_next++];
+    SCMutexUnlock(&pcap_g.files_lock);
+    return file;
+}
+
+/**
+ * \brief Publish the trace second a reader is at. With more than one
+ *        reader the engine time follows the reader furthest behind, so
+ *        the flows of the files it reads aren't timed out early. Nothing
+ *        is set until every reader got its first packet or is done, so a
+ *        fast reader doesn't set a time the others are far behind of. The
+ *        time is never moved back.
+ *
+ * \param sec trace second of the reader, 0 if the reader is done
+ */
+static void PcapFileSetReaderTime(PcapFileThreadVars *ptv, uint32_t sec)
+{
+    uint32_t min = 0;
+    uint16_t i;
+
+    ptv->ts_sec = sec;
+
+    SCMutexLock(&pcap_g.ts_lock);
+    pcap_g.readers_ts[ptv->reader_id] = sec;
+    if (!ptv->ts_counted) {
+        ptv->ts_counted = 1;
+        pcap_g.readers_ts_cnt++;
+    }
+    if (pcap_g.readers_ts_cnt < pcap_g.readers) {
+        SCMutexUnlock(&pcap_g.ts_lock);
+        return;
+    }
+    for (i = 0; i < pcap_g.readers; i++) {
+        uint32_t t = pcap_g.readers_ts[i];
+        if (t != 0 && (min == 0 || t < min))
+            min = t;
+    }
+    if (min > pcap_g.ts_set) {
+        struct timeval tv;
+        tv.tv_sec = min;
+        tv.tv_usec = 0;
+        pcap_g.ts_set = min;
+        TimeSet(&tv);
+    }
+    SCMutexUnlock(&pcap_g.ts_lock);
+}
+
+static inline uint16_t PcapFileMapU16(const PcapFileMap *m, const uint8_t *ptr)
+{
+    uint16_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return m->swapped ? SCByteSwap16(v) : v;
+}
+
+static inline uint32_t PcapFileMapU32(const PcapFileMap *m, const uint8_t *ptr)
+{
+    uint32_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return m->swapped ? SCByteSwap32(v) : v;
+}
+
+/**
+ * \brief Parse the file header of a mapped file.
+ *
+ * \retval 0 pcap or pcapng file
+ * \retval -1 not a file we can parse
+ */
+static int PcapFileMapInit(PcapFileMap *m)
+{
+    uint32_t magic;
+
+    if (m->len < sizeof(magic))
+        return -1;
+    memcpy(&magic, m->map, sizeof(magic));
+
+    switch (magic) {
+        case PCAPNG_BLOCK_SHB:
+            /* the section header is parsed like any other block */
+            m->pcapng = 1;
+            m->off = 0;
+            return 0;
+        case PCAP_FILE_MAGIC:
+            break;
+        case PCAP_FILE_MAGIC_NSEC:
+            m->nsec = 1;
+            break;
+        case PCAP_FILE_MAGIC_SWAPPED:
+            m->swapped = 1;
+            break;
+        case PCAP_FILE_MAGIC_NSEC_SWAPPED:
+            m->swapped = 1;
+            m->nsec = 1;
+            break;
+        default:
+            return -1;
+    }
+
+    if (m->len < PCAP_FILE_HDR_LEN)
+        return -1;
+
+    m->snaplen = PcapFileMapU32(m, m->map + 16);
+    /* the upper bits hold the fcs length */
+    m->datalink = PcapFileLinktypeToDlt(PcapFileMapU32(m, m->map + 20) & 0x03FFFFFF);
+    m->off = PCAP_FILE_HDR_LEN;
+    return 0;
+}
+
+static void PcapFileMapTruncated(PcapFileMap *m)
+{
+    SCLogWarning(SC_ERR_PCAP_DISPATCH, "truncated pcap file, ignoring the "
+            "last %" PRIu64 " bytes", m->len - m->off);
+    m->off = m->len;
+}
+
+static int PcapFileMapNextPcap(PcapFileMap *m, PcapFileRecord *rec)
+{
+    if (m->off == m->len)
+        return 0;
+    if (m->len - m->off < PCAP_FILE_REC_LEN) {
+        PcapFileMapTruncated(m);
+        return 0;
+    }
+
+    uint8_t *hdr = m->map + m->off;
+    uint32_t caplen = PcapFileMapU32(m, hdr + 8);
+    if (caplen > PCAP_FILE_MAX_CAPLEN) {
+        SCLogError(SC_ERR_PCAP_DISPATCH, "bogus captured length %" PRIu32
+                " at offset %" PRIu64, caplen, m->off);
+        return -1;
+    }
+    if (m->len - m->off - PCAP_FILE_REC_LEN < caplen) {
+        PcapFileMapTruncated(m);
+        return 0;
+    }
+
+    rec->ts.tv_sec = PcapFileMapU32(m, hdr);
+    rec->ts.tv_usec = PcapFileMapU32(m, hdr + 4);
+    if (m->nsec)
+        rec->ts.tv_usec /= 1000;
+    rec->caplen = caplen;
+    rec->datalink = m->datalink;
+    rec->data = hdr + PCAP_FILE_REC_LEN;
+
+    m->off += PCAP_FILE_REC_LEN + caplen;
+    return 1;
+}
+
+/**
+ * \brief Parse an interface description block.
+ */
+static int PcapFileMapAddIface(PcapFileMap *m, uint8_t *blk, uint32_t blen)
+{
+    if (blen < 20) {
+        SCLogError(SC_ERR_PCAP_DISPATCH, "pcapng interface block too short");
+        return -1;
+    }
+    if (m->ifaces_cnt == PCAP_FILE_NG_MAX_IFACES) {
+        SCLogError(SC_ERR_PCAP_DISPATCH, "more than %d interfaces in pcapng "
+                "section", PCAP_FILE_NG_MAX_IFACES);
+        return -1;
+    }
+
+    PcapFileNgIface *iface = &m->ifaces[m->ifaces_cnt];
+    iface->datalink = PcapFileLinktypeToDlt(PcapFileMapU16(m, blk + 8));
+    iface->snaplen = PcapFileMapU32(m, blk + 12);
+    iface->units = 1000000;
+
+    uint8_t *opt = blk + 16;
+    uint8_t *end = blk + blen - 4;
+    while (opt + 4 <= end) {
+        uint16_t code = PcapFileMapU16(m, opt);
+        uint16_t olen = PcapFileMapU16(m, opt + 2);
+        if (code == 0 || opt + 4 + olen > end)
+            break;
+
+        if (code == PCAPNG_OPT_IF_TSRESOL && olen >= 1) {
+            uint8_t res = opt[4];
+            uint64_t units = 1;
+            if (res & 0x80) {
+                if ((res & 0x7f) > 63)
+                    goto bad_res;
+                units <<= (res & 0x7f);
+            } else {
+                if (res > 19)
+                    goto bad_res;
+                while (res-- > 0)
+                    units *= 10;
+            }
+            iface->units = units;
+        }
+        opt += 4 + ((olen + 3) & ~3);
+    }
+
+    m->ifaces_cnt++;
+    return 0;
+
+bad_res:
+    SCLogError(SC_ERR_PCAP_DISPATCH, "unsupported pcapng timestamp "
+            "resolution %02x", opt[4]);
+    return -1;
+}
+
+static void PcapFileMapNgTime(const PcapFileNgIface *iface, uint64_t ts,
+        struct timeval *tv)
+{
+    uint64_t frac = ts % iface->units;
+
+    tv->tv_sec = ts / iface->units;
+    if (iface->units <= 1000000000000ULL)
+        tv->tv_usec = frac * 1000000 / iface->units;
+    else
+        tv->tv_usec = frac / (iface->units / 1000000);
+}
+
+static int PcapFileMapNextPcapng(PcapFileMap *m, PcapFileRecord *rec)
+{
+    while (m->off < m->len) {
+        uint8_t *blk = m->map + m->off;
+        uint64_t avail = m->len - m->off;
+        uint32_t type;
+
+        if (avail < 12) {
+            PcapFileMapTruncated(m);
+            return 0;
+        }
+
+        memcpy(&type, blk, sizeof(type));
+        if (type == PCAPNG_BLOCK_SHB) {
+            /* a new section can switch the byte order */
+            uint32_t bom;
+            if (avail < 28) {
+                PcapFileMapTruncated(m);
+                return 0;
+            }
+            memcpy(&bom, blk + 8, sizeof(bom));
+            if (bom == PCAPNG_BYTE_ORDER_MAGIC) {
+                m->swapped = 0;
+            } else if (SCByteSwap32(bom) == PCAPNG_BYTE_ORDER_MAGIC) {
+                m->swapped = 1;
+            } else {
+                SCLogError(SC_ERR_PCAP_DISPATCH, "bad pcapng byte order "
+                        "magic at offset %" PRIu64, m->off);
+                return -1;
+            }
+            m->ifaces_cnt = 0;
+        } else {
+            type = PcapFileMapU32(m, blk);
+        }
+
+        uint32_t blen = PcapFileMapU32(m, blk + 4);
+        if (blen < 12 || (blen & 3)) {
+            SCLogError(SC_ERR_PCAP_DISPATCH, "bad pcapng block length %"
+                    PRIu32 " at offset %" PRIu64, blen, m->off);
+            return -1;
+        }
+        if (blen > avail) {
+            PcapFileMapTruncated(m);
+            return 0;
+        }
+        m->off += blen;
+
+        PcapFileNgIface *iface;
+        uint32_t caplen;
+        uint32_t id;
+        uint64_t ts;
+
+        switch (type) {
+            case PCAPNG_BLOCK_IDB:
+                if (PcapFileMapAddIface(m, blk, blen) < 0)
+                    return -1;
+                continue;
+
+            case PCAPNG_BLOCK_EPB:
+            case PCAPNG_BLOCK_PB:
+                if (blen < 32)
+                    goto bad_block;
+                if (type == PCAPNG_BLOCK_EPB)
+                    id = PcapFileMapU32(m, blk + 8);
+                else
+                    id = PcapFileMapU16(m, blk + 8);
+                caplen = PcapFileMapU32(m, blk + 20);
+                if (id >= m->ifaces_cnt || caplen > blen - 32 ||
+                        caplen > PCAP_FILE_MAX_CAPLEN)
+                    goto bad_block;
+
+                iface = &m->ifaces[id];
+                ts = ((uint64_t)PcapFileMapU32(m, blk + 12) << 32) |
+                    PcapFileMapU32(m, blk + 16);
+                PcapFileMapNgTime(iface, ts, &m->last_ts);
+
+                rec->ts = m->last_ts;
+                rec->caplen = caplen;
+                rec->datalink = iface->datalink;
+                rec->data = blk + 28;
+                return 1;
+
+            case PCAPNG_BLOCK_SPB:
+                if (blen < 16 || m->ifaces_cnt == 0)
+                    goto bad_block;
+
+                iface = &m->ifaces[0];
+                caplen = PcapFileMapU32(m, blk + 8);
+                if (iface->snaplen != 0 && caplen > iface->snaplen)
+                    caplen = iface->snaplen;
+                if (caplen > blen - 16)
+                    caplen = blen - 16;
+                if (caplen > PCAP_FILE_MAX_CAPLEN)
+                    goto bad_block;
+
+                rec->ts = m->last_ts;
+                rec->caplen = caplen;
+                rec->datalink = iface->datalink;
+                rec->data = blk + 12;
+                return 1;
+
+            default:
+                /* section header, statistics, name resolution, ... */
+                continue;
+        }
+
+bad_block:
+        SCLogError(SC_ERR_PCAP_DISPATCH, "bad pcapng packet block at offset %"
+                PRIu64, m->off - blen);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Get the next packet from a mapped file.
+ *
+ * \retval 1 packet
+ * \retval 0 end of file
+ * \retval -1 corrupt file
+ */
+static int PcapFileMapNext(PcapFileMap *m, PcapFileRecord *rec)
+{
+    if (m->pcapng)
+        return PcapFileMapNextPcapng(m, rec);
+    return PcapFileMapNextPcap(m, rec);
+}
+
+#ifdef HAVE_SYS_MMAN_H
+/**
+ * \brief Have the kernel read ahead of the read position, and drop the
+ *        pages that were read. The packet data was copied out of them.
+ */
+static void PcapFileMapAdvise(PcapFileMap *m)
+{
+    uint64_t window = pcap_g.readahead;
+    uint64_t page_mask = ~(pcap_g.page_size - 1);
+
+    if (window == 0)
+        return;
+
+    if (m->advised < m->len && m->off + window / 2 >= m->advised) {
+        uint64_t start = m->advised & page_mask;
+        uint64_t end = m->off + window;
+        if (end > m->len)
+            end = m->len;
+        (void)madvise(m->map + start, (size_t)(end - start), MADV_WILLNEED);
+        m->advised = end;
+    }
+
+    uint64_t done = m->off & page_mask;
+    if (done >= m->released + window) {
+        (void)madvise(m->map + m->released, (size_t)(done - m->released),
+                MADV_DONTNEED);
+        m->released = done;
+    }
+}
+
+/**
+ * \retval 0 file mapped
+ * \retval -1 file can't be mapped or isn't a pcap or pcapng file, it
+ *         should be read through libpcap
+ */
+static int PcapFileMapOpen(PcapFileMap *m, const char *filename)
+{
+    struct stat st;
+
+    memset(m, 0x00, sizeof(*m));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+            (uint64_t)st.st_size > (uint64_t)SIZE_MAX) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        SCLogDebug("mmap of %s failed: %s", filename, strerror(errno));
+        return -1;
+    }
+    m->map = map;
+    m->len = (uint64_t)st.st_size;
+
+    if (PcapFileMapInit(m) < 0) {
+        munmap(m->map, (size_t)m->len);
+        m->map = NULL;
+        return -1;
+    }
+
+    (void)madvise(m->map, (size_t)m->len, MADV_SEQUENTIAL);
+    PcapFileMapAdvise(m);
+    return 0;
+}
+
+static void PcapFileMapClose(PcapFileMap *m)
+{
+    if (m->map != NULL)
+        munmap(m->map, (size_t)m->len);
+    m->map = NULL;
+}
+#endif /* HAVE_SYS_MMAN_H */
+
+/**
+ * \brief Open a file, through mmap if possible.
+ */
+static TmEcode PcapFileSourceOpen(PcapFileSource *src, char *filename)
+{
+    char *tmpbpfstring = NULL;
+    int have_bpf = (ConfGet("bpf-filter", &tmpbpfstring) == 1);
+
+    memset(src, 0x00, sizeof(*src));
+    src->filename = filename;
+
+#ifdef HAVE_SYS_MMAN_H
+    /* a bpf filter needs libpcap */
+    if (pcap_g.mmap && !have_bpf) {
+        if (PcapFileMapOpen(&src->map, filename) == 0) {
+            src->use_map = 1;
+            if (!src->map.pcapng) {
+                src->datalink = src->map.datalink;
+                goto check_datalink;
+            }
+            return TM_ECODE_OK;
+        }
+        SCLogDebug("%s can't be mapped, reading it through libpcap", filename);
+    }
+#endif
+
+    char errbuf[PCAP_ERRBUF_SIZE] = "";
+    src->pcap_handle = pcap_open_offline(filename, errbuf);
+    if (src->pcap_handle == NULL) {
+        SCLogError(SC_ERR_FOPEN, "%s\n", errbuf);
+        return TM_ECODE_FAILED;
+    }
+
+    if (!have_bpf) {
+        SCLogDebug("could not get bpf or none specified");
+    } else {
+        SCLogInfo("using bpf-filter \"%s\"", tmpbpfstring);
+
+        if(pcap_compile(src->pcap_handle,&src->filter,tmpbpfstring,1,0) < 0) {
+            SCLogError(SC_ERR_BPF,"bpf compilation error %s",pcap_geterr(src->pcap_handle));
+            goto error;
+        }
+        src->filter_set = 1;
+
+        if(pcap_setfilter(src->pcap_handle,&src->filter) < 0) {
+            SCLogError(SC_ERR_BPF,"could not set bpf filter %s",pcap_geterr(src->pcap_handle));
+            goto error;
+        }
+    }
+
+    src->datalink = pcap_datalink(src->pcap_handle);
+
+#ifdef HAVE_SYS_MMAN_H
+check_datalink:
+#endif
+    SCLogDebug("datalink %" PRId32 "", src->datalink);
+
+    if (PcapFileGetDecoder(src->datalink) == NULL) {
+        SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
+                  "(yet) supported in module PcapFile.\n", src->datalink);
+        goto error;
+    }
+
+    return TM_ECODE_OK;
+
+error:
+    PcapFileSourceClose(src);
+    return TM_ECODE_FAILED;
+}
+
+static void PcapFileSourceClose(PcapFileSource *src)
+{
+#ifdef HAVE_SYS_MMAN_H
+    if (src->use_map)
+        PcapFileMapClose(&src->map);
+#endif
+    if (src->pcap_handle != NULL)
+        pcap_close(src->pcap_handle);
+    if (src->filter_set)
+        pcap_freecode(&src->filter);
+
+    src->pcap_handle = NULL;
+    src->filter_set = 0;
+    src->use_map = 0;
+    src->filename = NULL;
+}
+
+/**
+ * \brief Get the next packet from a file.
+ *
+ * \retval 1 packet
+ * \retval 0 end of file
+ * \retval -1 error, the file can't be read any further
+ */
+static int PcapFileSourceNext(PcapFileSource *src, PcapFileRecord *rec)
+{
+    if (unlikely(src->error))
+        return -1;
+
+    if (src->use_map) {
+        int r = PcapFileMapNext(&src->map, rec);
+        if (unlikely(r < 0))
+            src->error = 1;
+        return r;
+    }
+
+    struct pcap_pkthdr *h;
+    const u_char *pkt;
+    int r = pcap_next_ex(src->pcap_handle, &h, &pkt);
+    if (likely(r == 1)) {
+        rec->ts.tv_sec = h->ts.tv_sec;
+        rec->ts.tv_usec = h->ts.tv_usec;
+        rec->caplen = h->caplen;
+        rec->datalink = src->datalink;
+        rec->data = (uint8_t *)pkt;
+        return 1;
+    } else if (r == -2) {
+        return 0;
+    }
+
+    SCLogError(SC_ERR_PCAP_DISPATCH, "error code %" PRId32 " %s",
+               r, pcap_geterr(src->pcap_handle));
+    src->error = 1;
+    return -1;
+}
+
+/**
+ * \brief Does file a have to go before file b. Files with packets of the
+ *        same time are taken in the order they were given.
+ */
+static inline int PcapFileMergeBefore(const PcapFileMerge *mg, uint32_t a,
+        uint32_t b)
+{
+    const struct timeval *ta = &mg->recs[a].ts;
+    const struct timeval *tb = &mg->recs[b].ts;
+
+    if (ta->tv_sec != tb->tv_sec)
+        return ta->tv_sec < tb->tv_sec;
+    if (ta->tv_usec != tb->tv_usec)
+        return ta->tv_usec < tb->tv_usec;
+    return a < b;
+}
+
+static void PcapFileMergeSiftDown(PcapFileMerge *mg, uint32_t pos)
+{
+    uint32_t file = mg->heap[pos];
+
+    while (1) {
+        uint32_t child = 2 * pos + 1;
+        if (child >= mg->heap_cnt)
+            break;
+        if (child + 1 < mg->heap_cnt &&
+                PcapFileMergeBefore(mg, mg->heap[child + 1], mg->heap[child]))
+            child++;
+        if (!PcapFileMergeBefore(mg, mg->heap[child], file))
+            break;
+
+        mg->heap[pos] = mg->heap[child];
+        pos = child;
+    }
+    mg->heap[pos] = file;
+}
+
+static void PcapFileMergeFree(PcapFileThreadVars *ptv)
+{
+    PcapFileMerge *mg = ptv->merge;
+    uint32_t i;
+
+    if (mg == NULL)
+        return;
+
+    for (i = 0; i < mg->cnt; i++) {
+        PcapFileSourceClose(&mg->srcs[i]);
+    }
+    if (mg->srcs != NULL)
+        SCFree(mg->srcs);
+    if (mg->recs != NULL)
+        SCFree(mg->recs);
+    if (mg->heap != NULL)
+        SCFree(mg->heap);
+    SCFree(mg);
+    ptv->merge = NULL;
+}
+
+/**
+ * \brief Open all files that are left in the list and read their first
+ *        packet. Files that can't be opened are skipped.
+ */
+static TmEcode PcapFileMergeOpen(PcapFileThreadVars *ptv)
+{
+    uint32_t max = pcap_g.files_cnt;
+    uint32_t i;
+    char *file;
+
+    PcapFileMerge *mg = SCMalloc(sizeof(PcapFileMerge));
+    if (unlikely(mg == NULL))
+        return TM_ECODE_FAILED;
+    memset(mg, 0x00, sizeof(PcapFileMerge));
+    ptv->merge = mg;
+
+    mg->srcs = SCMalloc(max * sizeof(PcapFileSource));
+    mg->recs = SCMalloc(max * sizeof(PcapFileRecord));
+    mg->heap = SCMalloc(max * sizeof(uint32_t));
+    if (unlikely(mg->srcs == NULL || mg->recs == NULL || mg->heap == NULL))
+        goto error;
+    memset(mg->srcs, 0x00, max * sizeof(PcapFileSource));
+
+    while (mg->cnt < max && (file = PcapFileNextFile()) != NULL) {
+        PcapFileSource *src = &mg->srcs[mg->cnt];
+
+        SCLogInfo("reading pcap file %s", file);
+        if (PcapFileSourceOpen(src, file) != TM_ECODE_OK)
+            continue;
+        ptv->files++;
+
+        int r = PcapFileSourceNext(src, &mg->recs[mg->cnt]);
+        if (r < 0) {
+            SCLogError(SC_ERR_PCAP_DISPATCH, "error reading pcap file %s",
+                    file);
+            mg->cnt++;
+            goto error;
+        }
+        if (r == 1)
+            mg->heap[mg->heap_cnt++] = mg->cnt;
+        mg->cnt++;
+    }
+
+    if (mg->cnt == 0)
+        goto error;
+
+    for (i = mg->heap_cnt / 2; i > 0; i--) {
+        PcapFileMergeSiftDown(mg, i - 1);
+    }
+    return TM_ECODE_OK;
+
+error:
+    PcapFileMergeFree(ptv);
+    return TM_ECODE_FAILED;
+}
+
+/**
+ * \brief Get the oldest packet of the merged files. The packet stays in
+ *        the file's buffer until the next call.
+ *
+ * \retval 1 packet
+ * \retval 0 all files were read
+ * \retval -1 error, the file on top of the heap can't be read further
+ */
+static int PcapFileMergeNext(PcapFileMerge *mg, PcapFileRecord *rec)
+{
+    if (mg->top_used) {
+        uint32_t file = mg->heap[0];
+        PcapFileSource *src = &mg->srcs[file];
+
+        int r = PcapFileSourceNext(src, &mg->recs[file]);
+        if (unlikely(r < 0))
+            return -1;
 
-TmEcode ReceivePcapFileThreadInit(ThreadVars *, void *, void **);
-void ReceivePcapFileThreadExitStats(ThreadVars *, void *);
-TmEcode ReceivePcapFileThreadDeinit(ThreadVars *, void *);
+        if (r == 0) {
+            SCLogInfo("pcap file %s end of file reached", src->filename);
+            PcapFileSourceClose(src);
+            mg->heap[0] = mg->heap[--mg->heap_cnt];
+        }
+        if (mg->heap_cnt > 0)
+            PcapFileMergeSiftDown(mg, 0);
+        mg->top_used = 0;
+    }
 
-TmEcode DecodePcapFile(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
-TmEcode DecodePcapFileThreadInit(ThreadVars *, void *, void **);
+    if (mg->heap_cnt == 0)
+        return 0;
 
-void TmModuleReceivePcapFileRegister (void) {
-    memset(&pcap_g, 0x00, sizeof(pcap_g));
+    *rec = mg->recs[mg->heap[0]];
+    mg->top_used = 1;
+    return 1;
+}
 
-    tmm_modules[TMM_RECEIVEPCAPFILE].name = "ReceivePcapFile";
-    tmm_modules[TMM_RECEIVEPCAPFILE].ThreadInit = ReceivePcapFileThreadInit;
-    tmm_modules[TMM_RECEIVEPCAPFILE].Func = NULL;
-    tmm_modules[TMM_RECEIVEPCAPFILE].PktAcqLoop = ReceivePcapFileLoop;
-    tmm_modules[TMM_RECEIVEPCAPFILE].ThreadExitPrintStats = ReceivePcapFileThreadExitStats;
-    tmm_modules[TMM_RECEIVEPCAPFILE].ThreadDeinit = ReceivePcapFileThreadDeinit;
-    tmm_modules[TMM_RECEIVEPCAPFILE].RegisterTests = NULL;
-    tmm_modules[TMM_RECEIVEPCAPFILE].cap_flags = 0;
-    tmm_modules[TMM_RECEIVEPCAPFILE].flags = TM_FLAG_RECEIVE_TM;
+/**
+ * \brief Name of the file being read, for the log messages.
+ */
+static const char *PcapFileCurrentName(PcapFileThreadVars *ptv)
+{
+    if (ptv->merge != NULL) {
+        if (ptv->merge->heap_cnt > 0)
+            return ptv->merge->srcs[ptv->merge->heap[0]].filename;
+        return "(merged)";
+    }
+    return ptv->src.filename ? ptv->src.filename : "(none)";
 }
 
-void TmModuleDecodePcapFileRegister (void) {
-    tmm_modules[TMM_DECODEPCAPFILE].name = "DecodePcapFile";
-    tmm_modules[TMM_DECODEPCAPFILE].ThreadInit = DecodePcapFileThreadInit;
-    tmm_modules[TMM_DECODEPCAPFILE].Func = DecodePcapFile;
-    tmm_modules[TMM_DECODEPCAPFILE].ThreadExitPrintStats = NULL;
-    tmm_modules[TMM_DECODEPCAPFILE].ThreadDeinit = NULL;
-    tmm_modules[TMM_DECODEPCAPFILE].RegisterTests = NULL;
-    tmm_modules[TMM_DECODEPCAPFILE].cap_flags = 0;
-    tmm_modules[TMM_DECODEPCAPFILE].flags = TM_FLAG_DECODE_TM;
+/**
+ *  \brief Hand the batched packets to the slots.
+ */
+static void PcapFileFlushBatch(PcapFileThreadVars *ptv)
+{
+    if (ptv->batch_cnt == 0)
+        return;
+
+    if (TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, ptv->batch,
+                ptv->batch_cnt) != TM_ECODE_OK) {
+        ptv->cb_result = TM_ECODE_FAILED;
+    }
+    ptv->batch_cnt = 0;
 }
 
-void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt) {
+static void PcapFileProcessPacket(PcapFileThreadVars *ptv, PcapFileRecord *rec)
+{
     SCEnter();
 
-    PcapFileThreadVars *ptv = (PcapFileThreadVars *)user;
+    /* only pcapng files can switch the datalink half way */
+    if (unlikely(PcapFileGetDecoder(rec->datalink) == NULL)) {
+        if (ptv->unsupported++ == 0) {
+            SCLogWarning(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
+                    "(yet) supported in module PcapFile, skipping its "
+                    "packets", rec->datalink);
+        }
+        SCReturn;
+    }
+
 #ifdef __tile__
     Packet *p = PacketGetFromQueueOrAlloc(0);
 #else
@@ -127,30 +1233,126 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt) {
     PACKET_PROFILING_TMM_START(p, TMM_RECEIVEPCAPFILE);
 
     PKT_SET_SRC(p, PKT_SRC_WIRE);
-    p->ts.tv_sec = h->ts.tv_sec;
-    p->ts.tv_usec = h->ts.tv_usec;
+    p->ts.tv_sec = rec->ts.tv_sec;
+    p->ts.tv_usec = rec->ts.tv_usec;
     SCLogDebug("p->ts.tv_sec %"PRIuMAX"", (uintmax_t)p->ts.tv_sec);
-    p->datalink = pcap_g.datalink;
-    p->pcap_cnt = ++pcap_g.cnt;
+    p->datalink = rec->datalink;
+    p->pcap_cnt = SC_ATOMIC_ADD(pcap_g.cnt, 1);
+
+    if (pcap_g.readers > 1 && (uint32_t)p->ts.tv_sec != ptv->ts_sec)
+        PcapFileSetReaderTime(ptv, (uint32_t)p->ts.tv_sec);
+
+    double curr_ts = p->ts.tv_sec + p->ts.tv_usec / 1000.0;
+    if (curr_ts < ptv->prev_signaled_ts || (curr_ts - ptv->prev_signaled_ts) > 60.0) {
+        ptv->prev_signaled_ts = curr_ts;
+        FlowWakeupFlowManagerThread();
+    }
 
     ptv->pkts++;
-    ptv->bytes += h->caplen;
+    ptv->bytes += rec->caplen;
 
-    if (unlikely(PacketCopyData(p, pkt, h->caplen))) {
+    if (unlikely(PacketCopyData(p, rec->data, rec->caplen))) {
         TmqhOutputPacketpool(ptv->tv, p);
         PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
         SCReturn;
     }
     PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
 
+    if (tm_batch_size > 1) {
+        ptv->batch[ptv->batch_cnt++] = p;
+        if (ptv->batch_cnt >= tm_batch_size)
+            PcapFileFlushBatch(ptv);
+        SCReturn;
+    }
+
     if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
-        pcap_breakloop(pcap_g.pcap_handle);
         ptv->cb_result = TM_ECODE_FAILED;
     }
 
     SCReturn;
 }
 
+/**
+ * \brief Read up to cnt packets from the current file.
+ *
+ * \retval packets read, 0 at the end of the file, -1 on error
+ */
+static int PcapFileRead(PcapFileThreadVars *ptv, int cnt)
+{
+    PcapFileRecord rec;
+    int n = 0;
+
+    while (n < cnt && ptv->cb_result != TM_ECODE_FAILED) {
+        int r;
+        if (ptv->merge != NULL)
+            r = PcapFileMergeNext(ptv->merge, &rec);
+        else
+            r = PcapFileSourceNext(&ptv->src, &rec);
+        if (r == 0)
+            break;
+        if (unlikely(r < 0))
+            return (n > 0) ? n : -1;
+
+        PcapFileProcessPacket(ptv, &rec);
+        n++;
+    }
+
+#ifdef HAVE_SYS_MMAN_H
+    if (ptv->merge != NULL) {
+        uint32_t i;
+        for (i = 0; i < ptv->merge->cnt; i++) {
+            if (ptv->merge->srcs[i].use_map)
+                PcapFileMapAdvise(&ptv->merge->srcs[i].map);
+        }
+    } else if (ptv->src.use_map) {
+        PcapFileMapAdvise(&ptv->src.map);
+    }
+#endif
+    return n;
+}
+
+/**
+ * \brief Open the next file from the list, skipping the ones that
+ *        can't be read.
+ */
+static TmEcode PcapFileOpenNext(PcapFileThreadVars *ptv)
+{
+    char *file;
+
+    while ((file = PcapFileNextFile()) != NULL) {
+        SCLogInfo("reading pcap file %s", file);
+
+        if (PcapFileSourceOpen(&ptv->src, file) == TM_ECODE_OK) {
+            ptv->files++;
+            return TM_ECODE_OK;
+        }
+    }
+    return TM_ECODE_FAILED;
+}
+
+/**
+ * \brief The reader ran out of files. The last reader to finish stops
+ *        the engine, the others just end their loop.
+ */
+static TmEcode PcapFileReaderDone(PcapFileThreadVars *ptv)
+{
+    ptv->done = 1;
+
+    if (RunModeUnixSocketIsActive()) {
+        UnixSocketPcapFile(TM_ECODE_DONE);
+        return TM_ECODE_DONE;
+    }
+
+    if (pcap_g.readers > 1)
+        PcapFileSetReaderTime(ptv, 0);
+
+    if (SC_ATOMIC_SUB(pcap_g.readers_running, 1) == 0) {
+        EngineStop();
+        return TM_ECODE_OK;
+    }
+    return TM_ECODE_DONE;
+}
+
 /**
  *  \brief Main PCAP file reading Loop function
  */
@@ -166,6 +1368,11 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
     ptv->slot = s->slot_next;
     ptv->cb_result = TM_ECODE_OK;
 
+    if (ptv->done) {
+        /* reader that got no file to read */
+        SCReturnInt(PcapFileReaderDone(ptv));
+    }
+
     while (1) {
         if (suricata_ctl_flags & (SURICATA_STOP | SURICATA_KILL)) {
             SCReturnInt(TM_ECODE_OK);
@@ -187,41 +1394,43 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
 #endif
         } while (packet_q_len == 0);
 
-        /* Right now we just support reading packets one at a time. */
-        r = pcap_dispatch(pcap_g.pcap_handle, (int)packet_q_len,
-                          (pcap_handler)PcapFileCallbackLoop, (u_char *)ptv);
+        r = PcapFileRead(ptv, (int)packet_q_len);
+        /* don't keep a partial batch waiting for the next read */
+        PcapFileFlushBatch(ptv);
         if (unlikely(r == -1)) {
-            SCLogError(SC_ERR_PCAP_DISPATCH, "error code %" PRId32 " %s",
-                       r, pcap_geterr(pcap_g.pcap_handle));
+            SCLogError(SC_ERR_PCAP_DISPATCH, "error reading pcap file %s",
+                       PcapFileCurrentName(ptv));
+            PcapFileSourceClose(&ptv->src);
+            PcapFileMergeFree(ptv);
             if (! RunModeUnixSocketIsActive()) {
                 /* in the error state we just kill the engine */
                 EngineKill();
                 SCReturnInt(TM_ECODE_FAILED);
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
         } else if (unlikely(r == 0)) {
-            SCLogInfo("pcap file end of file reached (pcap err code %" PRId32 ")", r);
-            if (! RunModeUnixSocketIsActive()) {
-                EngineStop();
+            if (ptv->merge != NULL) {
+                SCLogInfo("end of the merged pcap files reached");
+                PcapFileMergeFree(ptv);
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
-                UnixSocketPcapFile(TM_ECODE_DONE);
-                SCReturnInt(TM_ECODE_DONE);
+                SCLogInfo("pcap file %s end of file reached", ptv->src.filename);
+                PcapFileSourceClose(&ptv->src);
             }
-            break;
+            if (PcapFileOpenNext(ptv) == TM_ECODE_OK)
+                continue;
+
+            SCReturnInt(PcapFileReaderDone(ptv));
         } else if (ptv->cb_result == TM_ECODE_FAILED) {
-            SCLogError(SC_ERR_PCAP_DISPATCH, "Pcap callback PcapFileCallbackLoop failed");
+            SCLogError(SC_ERR_PCAP_DISPATCH, "processing the packets of pcap "
+                       "file %s failed", PcapFileCurrentName(ptv));
+            PcapFileSourceClose(&ptv->src);
+            PcapFileMergeFree(ptv);
             if (! RunModeUnixSocketIsActive()) {
                 EngineKill();
                 SCReturnInt(TM_ECODE_FAILED);
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -234,80 +1443,49 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
 
 TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data) {
     SCEnter();
-    char *tmpbpfstring = NULL;
     if (initdata == NULL) {
         SCLogError(SC_ERR_INVALID_ARGUMENT, "error: initdata == NULL");
         SCReturnInt(TM_ECODE_FAILED);
     }
 
-    SCLogInfo("reading pcap file %s", (char *)initdata);
-
     PcapFileThreadVars *ptv = SCMalloc(sizeof(PcapFileThreadVars));
     if (unlikely(ptv == NULL))
         SCReturnInt(TM_ECODE_FAILED);
     memset(ptv, 0, sizeof(PcapFileThreadVars));
 
-    char errbuf[PCAP_ERRBUF_SIZE] = "";
-    pcap_g.pcap_handle = pcap_open_offline((char *)initdata, errbuf);
-    if (pcap_g.pcap_handle == NULL) {
-        SCLogError(SC_ERR_FOPEN, "%s\n", errbuf);
-        SCFree(ptv);
-        if (! RunModeUnixSocketIsActive()) {
-            return TM_ECODE_FAILED;
-        } else {
-            UnixSocketPcapFile(TM_ECODE_FAILED);
-            SCReturnInt(TM_ECODE_DONE);
-        }
+    /* runmodes that don't set up the file list read just the one file */
+    if (SC_ATOMIC_GET(pcap_g.readers_id) == 0 && pcap_g.files == NULL) {
+        PcapFileSetupFiles((char *)initdata, 1);
     }
 
-    if (ConfGet("bpf-filter", &tmpbpfstring) != 1) {
-        SCLogDebug("could not get bpf or none specified");
-    } else {
-        SCLogInfo("using bpf-filter \"%s\"", tmpbpfstring);
-
-        if(pcap_compile(pcap_g.pcap_handle,&pcap_g.filter,tmpbpfstring,1,0) < 0) {
-            SCLogError(SC_ERR_BPF,"bpf compilation error %s",pcap_geterr(pcap_g.pcap_handle));
-            SCFree(ptv);
-            return TM_ECODE_FAILED;
-        }
-
-        if(pcap_setfilter(pcap_g.pcap_handle,&pcap_g.filter) < 0) {
-            SCLogError(SC_ERR_BPF,"could not set bpf filter %s",pcap_geterr(pcap_g.pcap_handle));
-            SCFree(ptv);
-            return TM_ECODE_FAILED;
-        }
+    ptv->reader_id = SC_ATOMIC_ADD(pcap_g.readers_id, 1) - 1;
+    if (ptv->reader_id >= PCAP_FILE_MAX_READERS) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "more than %d pcap file readers",
+                PCAP_FILE_MAX_READERS);
+        SCFree(ptv);
+        SCReturnInt(TM_ECODE_FAILED);
     }
 
-    pcap_g.datalink = pcap_datalink(pcap_g.pcap_handle);
-    SCLogDebug("datalink %" PRId32 "", pcap_g.datalink);
-
-    switch(pcap_g.datalink) {
-        case LINKTYPE_LINUX_SLL:
-            pcap_g.Decoder = DecodeSll;
-            break;
-        case LINKTYPE_ETHERNET:
-            pcap_g.Decoder = DecodeEthernet;
-            break;
-        case LINKTYPE_PPP:
-            pcap_g.Decoder = DecodePPP;
-            break;
-        case LINKTYPE_RAW:
-            pcap_g.Decoder = DecodeRaw;
-            break;
-
-        default:
-            SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
-                      "(yet) supported in module PcapFile.\n", pcap_g.datalink);
+    TmEcode r;
+    if (pcap_g.merge && pcap_g.files_cnt > 1)
+        r = PcapFileMergeOpen(ptv);
+    else
+        r = PcapFileOpenNext(ptv);
+    if (r != TM_ECODE_OK) {
+        if (ptv->reader_id > 0) {
+            /* the other readers took the remaining files */
+            ptv->done = 1;
+        } else {
             SCFree(ptv);
             if (! RunModeUnixSocketIsActive()) {
                 SCReturnInt(TM_ECODE_FAILED);
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
-                UnixSocketPcapFile(TM_ECODE_DONE);
+                UnixSocketPcapFile(TM_ECODE_FAILED);
                 SCReturnInt(TM_ECODE_DONE);
             }
+        }
     }
+    SC_ATOMIC_ADD(pcap_g.readers_running, 1);
 
     ptv->tv = tv;
     *data = (void *)ptv;
@@ -318,7 +1496,12 @@ void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data) {
     SCEnter();
     PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
 
-    SCLogInfo("Pcap-file module read %" PRIu32 " packets, %" PRIu64 " bytes", ptv->pkts, ptv->bytes);
+    SCLogInfo("Pcap-file module read %" PRIu32 " packets, %" PRIu64 " bytes "
+            "from %" PRIu32 " file(s)", ptv->pkts, ptv->bytes, ptv->files);
+    if (ptv->unsupported > 0) {
+        SCLogInfo("Pcap-file module skipped %" PRIu32 " packets with an "
+                "unsupported datalink", ptv->unsupported);
+    }
     return;
 }
 
@@ -326,13 +1509,13 @@ TmEcode ReceivePcapFileThreadDeinit(ThreadVars *tv, void *data) {
     SCEnter();
     PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
     if (ptv) {
+        PcapFileSourceClose(&ptv->src);
+        PcapFileMergeFree(ptv);
         SCFree(ptv);
     }
     SCReturnInt(TM_ECODE_OK);
 }
 
-double prev_signaled_ts = 0;
-
 TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
 {
     SCEnter();
@@ -350,19 +1533,43 @@ TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, P
 #endif
     SCPerfCounterAddUI64(dtv->counter_avg_pkt_size, tv->sc_perf_pca, GET_PKT_LEN(p));
     SCPerfCounterSetUI64(dtv->counter_max_pkt_size, tv->sc_perf_pca, GET_PKT_LEN(p));
-
-    double curr_ts = p->ts.tv_sec + p->ts.tv_usec / 1000.0;
-    if (curr_ts < prev_signaled_ts || (curr_ts - prev_signaled_ts) > 60.0) {
-        prev_signaled_ts = curr_ts;
-        FlowWakeupFlowManagerThread();
-    }
+#ifndef __tile__
+    PacketPoolUpdateCounters(tv, dtv->counter_pkt_pool_depth,
+                             dtv->counter_pkt_pool_starved);
+#endif
 
     /* update the engine time representation based on the timestamp
-     * of the packet. */
-    TimeSet(&p->ts);
+     * of the packet. With more than one reader the readers set it. */
+    if (pcap_g.readers <= 1)
+        TimeSet(&p->ts);
 
     /* call the decoder */
-    pcap_g.Decoder(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+    PcapFileDecoder Decoder = PcapFileGetDecoder(p->datalink);
+    if (likely(Decoder != NULL))
+        Decoder(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ *  \brief Decode a batch of packets
+ *
+ *  Same as DecodePcapFile, but fetches the data of the next packet into
+ *  the cache while the current one is decoded.
+ */
+TmEcode DecodePcapFileBatch(ThreadVars *tv, Packet **pkts, uint32_t cnt, void *data, PacketQueue *pq, PacketQueue *postpq)
+{
+    SCEnter();
+    uint32_t i;
+
+    for (i = 0; i < cnt; i++) {
+        if (i + 1 < cnt)
+            __builtin_prefetch(GET_PKT_DATA(pkts[i + 1]));
+
+        PACKET_PROFILING_TMM_START(pkts[i], TMM_DECODEPCAPFILE);
+        DecodePcapFile(tv, pkts[i], data, pq, postpq);
+        PACKET_PROFILING_TMM_END(pkts[i], TMM_DECODEPCAPFILE);
+    }
 
     SCReturnInt(TM_ECODE_OK);
 }
@@ -383,5 +1590,503 @@ TmEcode DecodePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data)
     SCReturnInt(TM_ECODE_OK);
 }
 
+TmEcode DecodePcapFileThreadDeinit(ThreadVars *tv, void *data)
+{
+    if (data != NULL)
+        DecodeThreadVarsFree(tv, data);
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+static void PcapFileTestPut16(uint8_t *buf, uint16_t v, int swap)
+{
+    if (swap)
+        v = SCByteSwap16(v);
+    memcpy(buf, &v, sizeof(v));
+}
+
+static void PcapFileTestPut32(uint8_t *buf, uint32_t v, int swap)
+{
+    if (swap)
+        v = SCByteSwap32(v);
+    memcpy(buf, &v, sizeof(v));
+}
+
+/** \test pcap files in both byte orders, with micro and nanosecond
+ *        timestamps, and a truncated last record */
+static int PcapFileMapTest01(void)
+{
+    uint8_t buf[PCAP_FILE_HDR_LEN + 3 * (PCAP_FILE_REC_LEN + 8)];
+    PcapFileRecord rec;
+    PcapFileMap m;
+    int swap, nsec;
+
+    for (swap = 0; swap < 2; swap++) {
+        for (nsec = 0; nsec < 2; nsec++) {
+            memset(buf, 0x00, sizeof(buf));
+            PcapFileTestPut32(buf, nsec ? PCAP_FILE_MAGIC_NSEC : PCAP_FILE_MAGIC, swap);
+            PcapFileTestPut32(buf + 16, 65535, swap);
+            PcapFileTestPut32(buf + 20, PCAP_FILE_LINKTYPE_RAW, swap);
+
+            uint8_t *r = buf + PCAP_FILE_HDR_LEN;
+            int i;
+            for (i = 0; i < 3; i++) {
+                PcapFileTestPut32(r, 1000 + i, swap);
+                PcapFileTestPut32(r + 4, nsec ? 5000 : 5, swap);
+                PcapFileTestPut32(r + 8, 8, swap);
+                PcapFileTestPut32(r + 12, 8, swap);
+                memset(r + PCAP_FILE_REC_LEN, 'a' + i, 8);
+                r += PCAP_FILE_REC_LEN + 8;
+            }
+
+            memset(&m, 0x00, sizeof(m));
+            m.map = buf;
+            /* cut the last record short */
+            m.len = sizeof(buf) - 2;
+
+            if (PcapFileMapInit(&m) != 0 || m.datalink != DLT_RAW ||
+                    m.snaplen != 65535) {
+                printf("header swap %d nsec %d: ", swap, nsec);
+                return 0;
+            }
+            for (i = 0; i < 2; i++) {
+                if (PcapFileMapNext(&m, &rec) != 1 ||
+                        rec.ts.tv_sec != 1000 + i || rec.ts.tv_usec != 5 ||
+                        rec.caplen != 8 || rec.datalink != DLT_RAW ||
+                        rec.data[0] != 'a' + i) {
+                    printf("record %d swap %d nsec %d: ", i, swap, nsec);
+                    return 0;
+                }
+            }
+            if (PcapFileMapNext(&m, &rec) != 0 || m.off != m.len) {
+                printf("truncated record swap %d nsec %d: ", swap, nsec);
+                return 0;
+            }
+        }
+    }
+
+    /* not a pcap file */
+    memset(buf, 0x00, sizeof(buf));
+    memset(&m, 0x00, sizeof(m));
+    m.map = buf;
+    m.len = sizeof(buf);
+    if (PcapFileMapInit(&m) != -1)
+        return 0;
+
+    /* bogus captured length */
+    PcapFileTestPut32(buf, PCAP_FILE_MAGIC, 0);
+    PcapFileTestPut32(buf + 20, LINKTYPE_ETHERNET, 0);
+    PcapFileTestPut32(buf + PCAP_FILE_HDR_LEN + 8, PCAP_FILE_MAX_CAPLEN + 1, 0);
+    if (PcapFileMapInit(&m) != 0 || PcapFileMapNext(&m, &rec) != -1)
+        return 0;
+
+    return 1;
+}
+
+static uint8_t *PcapFileTestNgBlock(uint8_t *b, uint32_t type, uint32_t len,
+        int swap)
+{
+    PcapFileTestPut32(b, type, swap);
+    PcapFileTestPut32(b + 4, len, swap);
+    PcapFileTestPut32(b + len - 4, len, swap);
+    return b + len;
+}
+
+/** \test pcapng sections in both byte orders, with interfaces of
+ *        different link types and timestamp resolutions */
+static int PcapFileMapTest02(void)
+{
+    uint8_t buf[512];
+    PcapFileRecord rec;
+    PcapFileMap m;
+    int swap;
+
+    for (swap = 0; swap < 2; swap++) {
+        uint8_t *b = buf;
+        memset(buf, 0x00, sizeof(buf));
+
+        /* section header */
+        PcapFileTestPut32(b + 8, PCAPNG_BYTE_ORDER_MAGIC, swap);
+        PcapFileTestPut16(b + 12, 1, swap);
+        memset(b + 16, 0xff, 8);
+        b = PcapFileTestNgBlock(b, PCAPNG_BLOCK_SHB, 28, swap);
+
+        /* ethernet interface, microseconds */
+        PcapFileTestPut16(b + 8, LINKTYPE_ETHERNET, swap);
+        PcapFileTestPut32(b + 12, 65535, swap);
+        b = PcapFileTestNgBlock(b, PCAPNG_BLOCK_IDB, 20, swap);
+
+        /* raw interface, nanoseconds, snaplen 4 */
+        PcapFileTestPut16(b + 8, PCAP_FILE_LINKTYPE_RAW, swap);
+        PcapFileTestPut32(b + 12, 4, swap);
+        PcapFileTestPut16(b + 16, PCAPNG_OPT_IF_TSRESOL, swap);
+        PcapFileTestPut16(b + 18, 1, swap);
+        b[20] = 9;
+        b = PcapFileTestNgBlock(b, PCAPNG_BLOCK_IDB, 32, swap);
+
+        /* unknown block */
+        b = PcapFileTestNgBlock(b, 0x00000bad, 16, swap);
+
+        /* enhanced packet block on the raw interface */
+        uint64_t ts = 1500000000ULL * 1000000000ULL + 123456789ULL;
+        PcapFileTestPut32(b + 8, 1, swap);
+        PcapFileTestPut32(b + 12, (uint32_t)(ts >> 32), swap);
+        PcapFileTestPut32(b + 16, (uint32_t)ts, swap);
+        PcapFileTestPut32(b + 20, 4, swap);
+        PcapFileTestPut32(b + 24, 4, swap);
+        memcpy(b + 28, "\x45\x00\x00\x14", 4);
+        b = PcapFileTestNgBlock(b, PCAPNG_BLOCK_EPB, 36, swap);
+
+        /* enhanced packet block on the ethernet interface */
+        ts = 1500000001ULL * 1000000ULL + 42;
+        PcapFileTestPut32(b + 12, (uint32_t)(ts >> 32), swap);
+        PcapFileTestPut32(b + 16, (uint32_t)ts, swap);
+        PcapFileTestPut32(b + 20, 6, swap);
+        PcapFileTestPut32(b + 24, 6, swap);
+        memset(b + 28, 0xee, 6);
+        b = PcapFileTestNgBlock(b, PCAPNG_BLOCK_EPB, 40, swap);
+
+        /* simple packet block, uses interface 0 and the last timestamp */
+        PcapFileTestPut32(b + 8, 8, swap);
+        memset(b + 12, 0xdd, 8);
+        b = PcapFileTestNgBlock(b, PCAPNG_BLOCK_SPB, 24, swap);
+
+        /* packet block on an interface that doesn't exist */
+        PcapFileTestPut16(b + 8, 5, swap);
+        b = PcapFileTestNgBlock(b, PCAPNG_BLOCK_PB, 32, swap);
+
+        memset(&m, 0x00, sizeof(m));
+        m.map = buf;
+        m.len = (uint64_t)(b - buf);
+
+        if (PcapFileMapInit(&m) != 0 || !m.pcapng)
+            return 0;
+
+        if (PcapFileMapNext(&m, &rec) != 1 || rec.datalink != DLT_RAW ||
+                rec.caplen != 4 || rec.ts.tv_sec != 1500000000 ||
+                rec.ts.tv_usec != 123456 || rec.data[0] != 0x45) {
+            printf("raw epb swap %d: ", swap);
+            return 0;
+        }
+        if (PcapFileMapNext(&m, &rec) != 1 ||
+                rec.datalink != LINKTYPE_ETHERNET || rec.caplen != 6 ||
+                rec.ts.tv_sec != 1500000001 || rec.ts.tv_usec != 42 ||
+                rec.data[0] != 0xee) {
+            printf("ethernet epb swap %d: ", swap);
+            return 0;
+        }
+        if (PcapFileMapNext(&m, &rec) != 1 ||
+                rec.datalink != LINKTYPE_ETHERNET || rec.caplen != 8 ||
+                rec.ts.tv_sec != 1500000001 || rec.data[7] != 0xdd) {
+            printf("spb swap %d: ", swap);
+            return 0;
+        }
+        if (PcapFileMapNext(&m, &rec) != -1) {
+            printf("bad interface swap %d: ", swap);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/** \test building the file list from a comma separated list and from a
+ *        directory, and the number of readers */
+static int PcapFileSetupFilesTest01(void)
+{
+    char dir[] = "/tmp/suricata-pcap-file-XXXXXX";
+    char path[PATH_MAX];
+    int result = 0;
+    int i;
+
+    if (PcapFileSetupFiles("a.pcap,,b.pcap,c.pcap", 8) != 3 ||
+            pcap_g.files_cnt != 3 || strcmp(pcap_g.files[1], "b.pcap") != 0)
+        goto end;
+    if (PcapFileSetupFiles("a.pcap", 8) != 1 || pcap_g.files_cnt != 1)
+        goto end;
+    if (PcapFileSetupFiles("a.pcap,b.pcap", 1) != 1 || pcap_g.files_cnt != 2)
+        goto end;
+
+    if (mkdtemp(dir) == NULL)
+        goto end;
+    const char *names[] = { "3.pcap", "1.pcap", ".hidden", "2.pcap" };
+    for (i = 0; i < 4; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        FILE *fp = fopen(path, "w");
+        if (fp == NULL)
+            goto cleanup;
+        fclose(fp);
+    }
+    snprintf(path, sizeof(path), "%s/sub", dir);
+    if (mkdir(path, 0700) != 0)
+        goto cleanup;
+
+    if (PcapFileSetupFiles(dir, 2) != 2 || pcap_g.files_cnt != 3)
+        goto cleanup;
+    for (i = 0; i < 3; i++) {
+        snprintf(path, sizeof(path), "%s/%d.pcap", dir, i + 1);
+        if (strcmp(pcap_g.files[i], path) != 0)
+            goto cleanup;
+    }
+    if (strcmp(PcapFileNextFile(), pcap_g.files[0]) != 0 ||
+            strcmp(PcapFileNextFile(), pcap_g.files[1]) != 0 ||
+            strcmp(PcapFileNextFile(), pcap_g.files[2]) != 0 ||
+            PcapFileNextFile() != NULL)
+        goto cleanup;
+
+    /* an existing file with a ',' in its name isn't split */
+    snprintf(path, sizeof(path), "%s/a,b.pcap", dir);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        goto cleanup;
+    fclose(fp);
+    if (PcapFileSetupFiles(path, 2) != 1 || pcap_g.files_cnt != 1 ||
+            strcmp(pcap_g.files[0], path) != 0)
+        goto cleanup;
+
+    result = 1;
+cleanup:
+    for (i = 0; i < 4; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/a,b.pcap", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/sub", dir);
+    rmdir(path);
+    rmdir(dir);
+end:
+    PcapFileFreeFiles();
+    pcap_g.readers = 0;
+    return result;
+}
+
+/** \test with more than one reader the time is only set once every reader
+ *        has a first timestamp, and then follows the slowest reader */
+static int PcapFileReaderTimeTest01(void)
+{
+    PcapFileThreadVars ptv[2];
+    int result = 0;
+
+    memset(&ptv, 0x00, sizeof(ptv));
+    ptv[1].reader_id = 1;
+
+    pcap_g.readers = 2;
+    memset(pcap_g.readers_ts, 0x00, sizeof(pcap_g.readers_ts));
+    pcap_g.readers_ts_cnt = 0;
+    pcap_g.ts_set = 0;
+
+    PcapFileSetReaderTime(&ptv[0], 1000);
+    if (pcap_g.ts_set != 0)
+        goto end;
+    PcapFileSetReaderTime(&ptv[1], 900);
+    if (pcap_g.ts_set != 900)
+        goto end;
+    PcapFileSetReaderTime(&ptv[1], 1100);
+    if (pcap_g.ts_set != 1000)
+        goto end;
+    /* reader 0 is done, reader 1 is the only one left */
+    PcapFileSetReaderTime(&ptv[0], 0);
+    if (pcap_g.ts_set != 1100)
+        goto end;
+    /* never back */
+    PcapFileSetReaderTime(&ptv[1], 1050);
+    if (pcap_g.ts_set != 1100)
+        goto end;
+
+    result = 1;
+end:
+    pcap_g.readers = 0;
+    pcap_g.readers_ts_cnt = 0;
+    pcap_g.ts_set = 0;
+    return result;
+}
+
+/** \brief write a pcap file with a one byte packet per timestamp */
+static int PcapFileTestWrite(const char *path, const uint32_t *ts, int cnt,
+        uint8_t marker)
+{
+    uint8_t hdr[PCAP_FILE_HDR_LEN];
+    uint8_t rec[PCAP_FILE_REC_LEN + 1];
+    int i;
+
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        return -1;
+
+    memset(hdr, 0x00, sizeof(hdr));
+    PcapFileTestPut32(hdr, PCAP_FILE_MAGIC, 0);
+    PcapFileTestPut32(hdr + 16, 65535, 0);
+    PcapFileTestPut32(hdr + 20, PCAP_FILE_LINKTYPE_RAW, 0);
+    if (fwrite(hdr, sizeof(hdr), 1, fp) != 1)
+        goto error;
+
+    for (i = 0; i < cnt; i++) {
+        PcapFileTestPut32(rec, ts[i] / 1000, 0);
+        PcapFileTestPut32(rec + 4, ts[i] % 1000, 0);
+        PcapFileTestPut32(rec + 8, 1, 0);
+        PcapFileTestPut32(rec + 12, 1, 0);
+        rec[PCAP_FILE_REC_LEN] = marker;
+        if (fwrite(rec, sizeof(rec), 1, fp) != 1)
+            goto error;
+    }
+    fclose(fp);
+    return 0;
+
+error:
+    fclose(fp);
+    return -1;
+}
+
+/** \test merging files by timestamp, packets of the same time are taken
+ *        in file order and an empty file is skipped */
+static int PcapFileMergeTest01(void)
+{
+    char dir[] = "/tmp/suricata-pcap-merge-XXXXXX";
+    char path[PATH_MAX];
+    PcapFileThreadVars ptv;
+    PcapFileRecord rec;
+    int result = 0;
+    int i;
+
+    /* timestamps in ms: sec * 1000 + usec */
+    uint32_t ts_a[] = { 1000, 3000, 3000, 7005 };
+    uint32_t ts_b[] = { 2000, 3000, 4000, 5000, 9000 };
+    uint32_t ts_c[] = { 1, 6999 };
+    const char *expect = "cabaabbbcab";
+
+    memset(&ptv, 0x00, sizeof(ptv));
+
+    if (mkdtemp(dir) == NULL)
+        return 0;
+
+    snprintf(path, sizeof(path), "%s/a.pcap", dir);
+    if (PcapFileTestWrite(path, ts_a, 4, 'a') < 0)
+        goto cleanup;
+    snprintf(path, sizeof(path), "%s/b.pcap", dir);
+    if (PcapFileTestWrite(path, ts_b, 5, 'b') < 0)
+        goto cleanup;
+    snprintf(path, sizeof(path), "%s/c.pcap", dir);
+    if (PcapFileTestWrite(path, ts_c, 2, 'c') < 0)
+        goto cleanup;
+    snprintf(path, sizeof(path), "%s/d.pcap", dir);
+    if (PcapFileTestWrite(path, NULL, 0, 'd') < 0)
+        goto cleanup;
+
+    PcapFileSetupFiles(dir, 4);
+    pcap_g.merge = 1;
+
+    if (PcapFileMergeOpen(&ptv) != TM_ECODE_OK || ptv.files != 4 ||
+            ptv.merge->heap_cnt != 3)
+        goto cleanup;
+
+    struct timeval last = { 0, 0 };
+    for (i = 0; expect[i] != '\0'; i++) {
+        if (PcapFileMergeNext(ptv.merge, &rec) != 1 || rec.caplen != 1 ||
+                rec.data[0] != (uint8_t)expect[i]) {
+            printf("packet %d: ", i);
+            goto cleanup;
+        }
+        if (timercmp(&rec.ts, &last, <)) {
+            printf("packet %d out of order: ", i);
+            goto cleanup;
+        }
+        last = rec.ts;
+    }
+    if (PcapFileMergeNext(ptv.merge, &rec) != 0)
+        goto cleanup;
+
+    result = 1;
+cleanup:
+    PcapFileMergeFree(&ptv);
+    PcapFileFreeFiles();
+    pcap_g.readers = 0;
+    pcap_g.merge = 0;
+    const char *names[] = { "a.pcap", "b.pcap", "c.pcap", "d.pcap" };
+    for (i = 0; i < 4; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+    return result;
+}
+
+/** \test the batch decoder decodes every packet of the batch like the
+ *        per packet one */
+static int PcapFileBatchTest01(void)
+{
+    /* IPv4/UDP 10.0.0.1:1024 -> 10.0.0.2:53, 4 bytes of payload */
+    uint8_t raw[] = {
+        0x45, 0x00, 0x00, 0x20, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02, 0x04, 0x00, 0x00, 0x35,
+        0x00, 0x0c, 0x00, 0x00, 'a', 'b', 'c', 'd' };
+    Packet *pkts[3] = { NULL, NULL, NULL };
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+    int result = 0;
+    int i;
+
+    memset(&tv, 0, sizeof(tv));
+    memset(&dtv, 0, sizeof(dtv));
+    memset(&pq, 0, sizeof(pq));
+
+    FlowInitConfig(FLOW_QUIET);
+
+    for (i = 0; i < 3; i++) {
+        pkts[i] = PacketGetFromAlloc();
+        if (pkts[i] == NULL)
+            goto end;
+        /* a different source port per packet */
+        raw[21] = (uint8_t)i;
+        if (PacketCopyData(pkts[i], raw, sizeof(raw)) != 0)
+            goto end;
+        pkts[i]->datalink = LINKTYPE_RAW;
+        pkts[i]->ts.tv_sec = 1000 + i;
+    }
+
+    if (DecodePcapFileBatch(&tv, pkts, 3, &dtv, &pq, NULL) != TM_ECODE_OK)
+        goto end;
+
+    for (i = 0; i < 3; i++) {
+        if (!PKT_IS_IPV4(pkts[i]) || !PKT_IS_UDP(pkts[i]) ||
+                pkts[i]->sp != 1024 + i || pkts[i]->dp != 53 ||
+                pkts[i]->payload_len != 4 || pkts[i]->flow == NULL) {
+            printf("packet %d: ", i);
+            goto end;
+        }
+    }
+
+    result = 1;
+end:
+    for (i = 0; i < 3; i++) {
+        if (pkts[i] != NULL) {
+            PACKET_RECYCLE(pkts[i]);
+            PACKET_CLEANUP(pkts[i]);
+            SCFree(pkts[i]);
+        }
+    }
+    FlowShutdown();
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+static void PcapFileRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PcapFileMapTest01", PcapFileMapTest01, 1);
+    UtRegisterTest("PcapFileMapTest02", PcapFileMapTest02, 1);
+    UtRegisterTest("PcapFileSetupFilesTest01", PcapFileSetupFilesTest01, 1);
+    UtRegisterTest("PcapFileReaderTimeTest01", PcapFileReaderTimeTest01, 1);
+    UtRegisterTest("PcapFileMergeTest01", PcapFileMergeTest01, 1);
+    UtRegisterTest("PcapFileBatchTest01", PcapFileBatchTest01, 1);
+#endif /* UNITTESTS */
+}
+
 /* eof */
 
@@ -27,5 +27,7 @@
 void TmModuleReceivePcapFileRegister (void);
 void TmModuleDecodePcapFileRegister (void);
 
+uint16_t PcapFileSetupFiles(const char *, uint16_t);
+
 #endif /* __SOURCE_PCAP_FILE_H__ */
 
@@ -80,6 +80,11 @@ typedef struct TcpStream_ {
     TcpSegment *seg_list;           /**< list of TCP segments that are not yet (fully) used in reassembly */
     TcpSegment *seg_list_tail;      /**< Last segment in the reassembled stream seg list*/
 
+    /* zero copy reassembly (stream.reassembly.zero-copy) */
+    uint8_t *sbuf;                  /**< contiguous buffer holding the payload of the SEGMENTTCP_FLAG_SBUF segments */
+    uint32_t sbuf_size;             /**< allocated size of sbuf */
+    uint32_t sbuf_len;              /**< used size of sbuf */
+
     StreamTcpSackRecord *sack_head; /**< head of list of SACK records */
     StreamTcpSackRecord *sack_tail; /**< tail of list of SACK records */
 } TcpStream;
@@ -172,6 +177,9 @@ enum
 #define SEGMENTTCP_FLAG_RAW_PROCESSED       0x01
 /** App Layer reassembly code is done with this segment */
 #define SEGMENTTCP_FLAG_APPLAYER_PROCESSED  0x02
+/** Segment payload lives in the stream's sbuf, the segment itself is not
+ *  from the segment pools */
+#define SEGMENTTCP_FLAG_SBUF                0x04
 
 #define PAWS_24DAYS         2073600         /**< 24 days in seconds */
 
@@ -212,6 +220,8 @@ typedef struct TcpSession_ {
     struct StreamMsg_ *toclient_smsg_tail;  /**< list of stream msgs (for detection inspection) */
 
     TcpStateQueue *queue;                   /**< list of SYN/ACK candidates */
+
+    struct TcpSession_ *next;               /**< next free session in a thread cache */
 } TcpSession;
 
 #endif /* __STREAM_TCP_PRIVATE_H__ */
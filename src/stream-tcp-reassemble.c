@@ -72,7 +72,7 @@ static uint64_t segment_pool_memcnt = 0;
  * payloads. We do this to prevent having to do an SCMalloc call for every
  * data segment we receive, which would be a large performance penalty.
  * The cost is in memory of course. */
-#define segment_pool_num 8
+#define segment_pool_num STREAM_TCP_SEGMENT_POOLS
 static uint16_t segment_pool_pktsizes[segment_pool_num] = {4, 16, 112, 248, 512,
                                                            768, 1448, 0xffff};
 //static uint16_t segment_pool_poolsizes[segment_pool_num] = {2048, 3072, 3072,
@@ -92,6 +92,17 @@ static uint64_t segment_pool_cnt = 0;
 #endif
 /* index to the right pool for all packet sizes. */
 static uint16_t segment_pool_idx[65536]; /* O(1) lookups of the pool */
+
+/* Per thread segment caches are refilled from and flushed to the global
+ * pools this many segments at a time, and hold at most twice as many. */
+#define STREAM_SEGMENT_CACHE_BATCH  32
+
+/* Zero copy mode: in order data is appended to a per stream buffer instead
+ * of being copied into pool segments. The buffer starts at the min size and
+ * doubles up to the max size, after which new data goes to the pools again
+ * until the buffer has room. */
+#define STREAM_SBUF_MIN_SIZE    4096
+#define STREAM_SBUF_MAX_SIZE    262144
 static int check_overlap_different_data = 0;
 
 /* Memory use counter */
@@ -236,6 +247,14 @@ void StreamTcpSegmentReturntoPool(TcpSegment *seg)
     seg->next = NULL;
     seg->prev = NULL;
 
+    /* sbuf segments only own the segment, the payload lives in the
+     * stream buffer */
+    if (seg->flags & SEGMENTTCP_FLAG_SBUF) {
+        StreamTcpReassembleDecrMemuse((uint32_t)sizeof(TcpSegment));
+        SCFree(seg);
+        return;
+    }
+
     uint16_t idx = segment_pool_idx[seg->pool_size];
     SCMutexLock(&segment_pool_mutex[idx]);
     PoolReturn(segment_pool[idx], (void *) seg);
@@ -250,6 +269,107 @@ void StreamTcpSegmentReturntoPool(TcpSegment *seg)
 #endif
 }
 
+/**
+ *  \internal
+ *  \brief Return up to cnt segments of a thread cache to the global pool
+ *
+ *  \param cache the thread cache
+ *  \param idx pool index of the cache
+ *  \param cnt number of segments to return
+ */
+static void StreamTcpSegmentCacheFlush(TcpSegmentCache *cache, uint16_t idx,
+        uint32_t cnt)
+{
+    uint32_t u = 0;
+
+    SCMutexLock(&segment_pool_mutex[idx]);
+    for ( ; u < cnt && cache->list != NULL; u++) {
+        TcpSegment *seg = cache->list;
+        cache->list = seg->next;
+        cache->len--;
+
+        seg->next = NULL;
+        PoolReturn(segment_pool[idx], (void *) seg);
+    }
+    SCMutexUnlock(&segment_pool_mutex[idx]);
+
+#ifdef DEBUG
+    SCMutexLock(&segment_pool_cnt_mutex);
+    segment_pool_cnt -= u;
+    SCMutexUnlock(&segment_pool_cnt_mutex);
+#endif
+}
+
+/**
+ *  \internal
+ *  \brief Take a batch of segments from the global pool into a thread cache
+ *
+ *  Only the first segment may be newly allocated, the rest of the batch is
+ *  taken from the segments that are free in the pool, so that refilling
+ *  doesn't make the pool grow.
+ *
+ *  \retval cnt number of segments added to the cache
+ */
+static uint32_t StreamTcpSegmentCacheRefill(TcpSegmentCache *cache, uint16_t idx)
+{
+    uint32_t u = 0;
+
+    SCMutexLock(&segment_pool_mutex[idx]);
+    for ( ; u < STREAM_SEGMENT_CACHE_BATCH; u++) {
+        if (u > 0 && segment_pool[idx]->alloc_list_size == 0)
+            break;
+
+        TcpSegment *seg = (TcpSegment *) PoolGet(segment_pool[idx]);
+        if (seg == NULL)
+            break;
+
+        seg->next = cache->list;
+        cache->list = seg;
+        cache->len++;
+    }
+    SCMutexUnlock(&segment_pool_mutex[idx]);
+
+#ifdef DEBUG
+    SCMutexLock(&segment_pool_cnt_mutex);
+    segment_pool_cnt += u;
+    SCMutexUnlock(&segment_pool_cnt_mutex);
+#endif
+    return u;
+}
+
+/**
+ *  \brief Return a segment to the thread's segment cache
+ *
+ *  Falls back to StreamTcpSegmentReturntoPool() if there is no thread
+ *  context. If the cache is over its limit, a batch is returned to the
+ *  global pool.
+ *
+ *  \param ra_ctx reassembly thread ctx, may be NULL
+ *  \param seg Segment which will be returned.
+ */
+void StreamTcpSegmentReturntoCache(TcpReassemblyThreadCtx *ra_ctx, TcpSegment *seg)
+{
+    if (seg == NULL)
+        return;
+
+    if (ra_ctx == NULL || (seg->flags & SEGMENTTCP_FLAG_SBUF)) {
+        StreamTcpSegmentReturntoPool(seg);
+        return;
+    }
+
+    uint16_t idx = segment_pool_idx[seg->pool_size];
+    TcpSegmentCache *cache = &ra_ctx->seg_cache[idx];
+
+    seg->prev = NULL;
+    seg->next = cache->list;
+    cache->list = seg;
+    cache->len++;
+
+    if (cache->len > 2 * STREAM_SEGMENT_CACHE_BATCH) {
+        StreamTcpSegmentCacheFlush(cache, idx, STREAM_SEGMENT_CACHE_BATCH);
+    }
+}
+
 /**
  *  \brief return all segments in this stream into the pool(s)
  *
@@ -260,6 +380,14 @@ void StreamTcpReturnStreamSegments (TcpStream *stream)
     TcpSegment *seg = stream->seg_list;
     TcpSegment *next_seg;
 
+    if (stream->sbuf != NULL) {
+        StreamTcpReassembleDecrMemuse(stream->sbuf_size);
+        SCFree(stream->sbuf);
+        stream->sbuf = NULL;
+        stream->sbuf_size = 0;
+        stream->sbuf_len = 0;
+    }
+
     if (seg == NULL)
         return;
 
@@ -273,6 +401,135 @@ void StreamTcpReturnStreamSegments (TcpStream *stream)
     stream->seg_list_tail = NULL;
 }
 
+/**
+ *  \internal
+ *  \brief Point the sbuf segments of a stream to a moved buffer
+ *
+ *  \param stream the stream
+ *  \param old_buf start of the data before the move
+ *  \param new_buf start of the data after the move
+ */
+static void StreamTcpSbufRebase(TcpStream *stream, uint8_t *old_buf,
+        uint8_t *new_buf)
+{
+    TcpSegment *seg = stream->seg_list;
+    for ( ; seg != NULL; seg = seg->next) {
+        if (seg->flags & SEGMENTTCP_FLAG_SBUF) {
+            seg->payload = new_buf + (seg->payload - old_buf);
+        }
+    }
+}
+
+/**
+ *  \internal
+ *  \brief Make room in the stream buffer for len more bytes
+ *
+ *  Drops the data of segments that are no longer in the list by moving
+ *  the data still in use to the start of the buffer, then grows the buffer
+ *  if that is not enough.
+ *
+ *  \retval 1 room for len bytes at stream->sbuf + stream->sbuf_len
+ *  \retval 0 no room, caller should fall back to a pool segment
+ */
+static int StreamTcpSbufReserve(TcpStream *stream, uint16_t len)
+{
+    if (stream->sbuf_size - stream->sbuf_len >= len)
+        return 1;
+
+    /* sbuf segments are only ever appended to the list tail, so in list
+     * order their data is ordered in the buffer as well. */
+    TcpSegment *first = NULL, *last = NULL, *seg;
+    for (seg = stream->seg_list; seg != NULL; seg = seg->next) {
+        if (seg->flags & SEGMENTTCP_FLAG_SBUF) {
+            if (first == NULL)
+                first = seg;
+            last = seg;
+        }
+    }
+
+    uint32_t used = 0;
+    if (first != NULL) {
+        used = (last->payload + last->payload_len) - first->payload;
+        if (first->payload != stream->sbuf) {
+            uint8_t *old_start = first->payload;
+            memmove(stream->sbuf, old_start, used);
+            StreamTcpSbufRebase(stream, old_start, stream->sbuf);
+        }
+    }
+    stream->sbuf_len = used;
+
+    if (stream->sbuf_size - stream->sbuf_len >= len)
+        return 1;
+
+    uint32_t new_size = stream->sbuf_size ? stream->sbuf_size : STREAM_SBUF_MIN_SIZE;
+    while (new_size - stream->sbuf_len < len && new_size < STREAM_SBUF_MAX_SIZE)
+        new_size *= 2;
+    if (new_size - stream->sbuf_len < len)
+        return 0;
+
+    uint32_t grow = new_size - stream->sbuf_size;
+    if (StreamTcpReassembleCheckMemcap(grow) == 0)
+        return 0;
+
+    uint8_t *old_buf = stream->sbuf;
+    uint8_t *new_buf = SCRealloc(stream->sbuf, new_size);
+    if (unlikely(new_buf == NULL))
+        return 0;
+
+    if (old_buf != NULL && new_buf != old_buf)
+        StreamTcpSbufRebase(stream, old_buf, new_buf);
+
+    stream->sbuf = new_buf;
+    stream->sbuf_size = new_size;
+    StreamTcpReassembleIncrMemuse(grow);
+    return 1;
+}
+
+/**
+ *  \internal
+ *  \brief Get a segment for in order data in zero copy mode
+ *
+ *  Only used for data that will be appended to the list tail, so that the
+ *  data of the sbuf segments is laid out in sequence order in the buffer.
+ *  Out of order data and overlaps keep using the segment pools.
+ *
+ *  \param stream the stream
+ *  \param seq sequence number of the data
+ *  \param data the data
+ *  \param len length of the data
+ *
+ *  \retval seg segment with its payload in the stream buffer
+ *  \retval NULL if the data can't be stored in the stream buffer
+ */
+static TcpSegment *StreamTcpSbufGetSegment(TcpStream *stream, uint32_t seq,
+        uint8_t *data, uint16_t len)
+{
+    if (stream->seg_list_tail != NULL &&
+        SEQ_LT(seq, (stream->seg_list_tail->seq + stream->seg_list_tail->payload_len)))
+        return NULL;
+
+    if (StreamTcpReassembleCheckMemcap((uint32_t)sizeof(TcpSegment)) == 0)
+        return NULL;
+
+    if (StreamTcpSbufReserve(stream, len) == 0)
+        return NULL;
+
+    TcpSegment *seg = SCMalloc(sizeof(TcpSegment));
+    if (unlikely(seg == NULL))
+        return NULL;
+    StreamTcpReassembleIncrMemuse((uint32_t)sizeof(TcpSegment));
+
+    memset(seg, 0, sizeof(TcpSegment));
+    seg->flags = SEGMENTTCP_FLAG_SBUF;
+    seg->payload = stream->sbuf + stream->sbuf_len;
+    seg->payload_len = len;
+    seg->seq = seq;
+
+    memcpy(seg->payload, data, len);
+    stream->sbuf_len += len;
+    return seg;
+}
+
 int StreamTcpReassembleInit(char quiet)
 {
     StreamMsgQueuesInit();
@@ -386,6 +643,13 @@ void StreamTcpReassembleFreeThreadCtx(TcpReassemblyThreadCtx *ra_ctx)
     }
 
     ra_ctx->stream_q = NULL;
+
+    uint16_t u16;
+    for (u16 = 0; u16 < segment_pool_num; u16++) {
+        StreamTcpSegmentCacheFlush(&ra_ctx->seg_cache[u16], u16,
+                ra_ctx->seg_cache[u16].len);
+    }
+
     AlpProtoDeFinalize2Thread(&ra_ctx->dp_ctx);
     SCFree(ra_ctx);
     SCReturn;
@@ -680,7 +944,7 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
 
 end:
     if (return_seg == TRUE && seg != NULL) {
-        StreamTcpSegmentReturntoPool(seg);
+        StreamTcpSegmentReturntoCache(ra_ctx, seg);
     }
 
 #ifdef DEBUG
@@ -864,7 +1128,7 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
             if (stream->seg_list_tail == list_seg)
                 stream->seg_list_tail = new_seg;
 
-            StreamTcpSegmentReturntoPool(list_seg);
+            StreamTcpSegmentReturntoCache(ra_ctx, list_seg);
             list_seg = new_seg;
             if (new_seg->prev != NULL) {
                 new_seg->prev->next = new_seg;
@@ -927,7 +1191,7 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                 if (stream->seg_list_tail == list_seg)
                     stream->seg_list_tail = new_seg;
 
-                StreamTcpSegmentReturntoPool(list_seg);
+                StreamTcpSegmentReturntoCache(ra_ctx, list_seg);
                 list_seg = new_seg;
                 if (new_seg->prev != NULL) {
                     new_seg->prev->next = new_seg;
@@ -999,7 +1263,7 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                     if (stream->seg_list_tail == list_seg)
                         stream->seg_list_tail = new_seg;
 
-                    StreamTcpSegmentReturntoPool(list_seg);
+                    StreamTcpSegmentReturntoCache(ra_ctx, list_seg);
                     list_seg = new_seg;
                     return_after = TRUE;
                 }
@@ -1067,7 +1331,7 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                 if (stream->seg_list_tail == list_seg)
                     stream->seg_list_tail = new_seg;
 
-                StreamTcpSegmentReturntoPool(list_seg);
+                StreamTcpSegmentReturntoCache(ra_ctx, list_seg);
                 list_seg = new_seg;
                 return_after = TRUE;
             }
@@ -1655,17 +1919,24 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
         size = p->payload_len;
 #endif
 
-    TcpSegment *seg = StreamTcpGetSegment(tv, ra_ctx, size);
+    TcpSegment *seg = NULL;
+    if (stream_config.flags & STREAMTCP_INIT_FLAG_ZERO_COPY) {
+        seg = StreamTcpSbufGetSegment(stream, TCP_GET_SEQ(p), p->payload, size);
+    }
+
     if (seg == NULL) {
-        SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[size]);
+        seg = StreamTcpGetSegment(tv, ra_ctx, size);
+        if (seg == NULL) {
+            SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[size]);
 
-        StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
-        SCReturnInt(-1);
-    }
+            StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
+            SCReturnInt(-1);
+        }
 
-    memcpy(seg->payload, p->payload, size);
-    seg->payload_len = size;
-    seg->seq = TCP_GET_SEQ(p);
+        memcpy(seg->payload, p->payload, size);
+        seg->payload_len = size;
+        seg->seq = TCP_GET_SEQ(p);
+    }
 
     if (StreamTcpReassembleInsertSegment(tv, ra_ctx, stream, seg, p) != 0) {
         SCLogDebug("StreamTcpReassembleInsertSegment failed");
@@ -1896,7 +2167,7 @@ static int StreamTcpReassembleInlineAppLayer (ThreadVars *tv,
 
                 TcpSegment *next_seg = seg->next;
                 StreamTcpRemoveSegmentFromStream(stream, seg);
-                StreamTcpSegmentReturntoPool(seg);
+                StreamTcpSegmentReturntoCache(ra_ctx, seg);
                 seg = next_seg;
                 continue;
             } else {
@@ -1912,7 +2183,7 @@ static int StreamTcpReassembleInlineAppLayer (ThreadVars *tv,
                     " so return it to pool", seg, seg->payload_len);
             TcpSegment *next_seg = seg->next;
             StreamTcpRemoveSegmentFromStream(stream, seg);
-            StreamTcpSegmentReturntoPool(seg);
+            StreamTcpSegmentReturntoCache(ra_ctx, seg);
             seg = next_seg;
             continue;
         }
@@ -2227,7 +2498,7 @@ static int StreamTcpReassembleInlineRaw (TcpReassemblyThreadCtx *ra_ctx,
             if (StreamTcpAppLayerSegmentProcessed(stream, seg)) {
                 TcpSegment *next_seg = seg->next;
                 StreamTcpRemoveSegmentFromStream(stream, seg);
-                StreamTcpSegmentReturntoPool(seg);
+                StreamTcpSegmentReturntoCache(ra_ctx, seg);
                 seg = next_seg;
             /* otherwise, just flag it for removal */
             } else {
@@ -2249,7 +2520,7 @@ static int StreamTcpReassembleInlineRaw (TcpReassemblyThreadCtx *ra_ctx,
                     " so return it to pool", seg, seg->payload_len);
             TcpSegment *next_seg = seg->next;
             StreamTcpRemoveSegmentFromStream(stream, seg);
-            StreamTcpSegmentReturntoPool(seg);
+            StreamTcpSegmentReturntoCache(ra_ctx, seg);
             seg = next_seg;
             continue;
         }
@@ -2433,7 +2704,7 @@ static int StreamTcpReassembleInlineRaw (TcpReassemblyThreadCtx *ra_ctx,
             if (seg->flags & SEGMENTTCP_FLAG_APPLAYER_PROCESSED) {
                 StreamTcpRemoveSegmentFromStream(stream, seg);
                 SCLogDebug("removing seg %p, seg->next %p", seg, seg->next);
-                StreamTcpSegmentReturntoPool(seg);
+                StreamTcpSegmentReturntoCache(ra_ctx, seg);
             } else {
                 seg->flags |= SEGMENTTCP_FLAG_RAW_PROCESSED;
             }
@@ -2460,7 +2731,7 @@ static int StreamTcpReassembleInlineRaw (TcpReassemblyThreadCtx *ra_ctx,
         if (StreamTcpAppLayerSegmentProcessed(stream, seg)) {
             TcpSegment *next_seg = seg->next;
             StreamTcpRemoveSegmentFromStream(stream, seg);
-            StreamTcpSegmentReturntoPool(seg);
+            StreamTcpSegmentReturntoCache(ra_ctx, seg);
             seg = next_seg;
         } else {
             break;
@@ -2570,6 +2841,27 @@ void StreamTcpPruneSession(Flow *f, uint8_t flags) {
  *
  *  \todo this function is too long, we need to break it up. It needs it BAD
  */
+/**
+ *  \internal
+ *  \brief Pass a slice of the stream buffer to the app layer
+ *
+ *  Used in zero copy mode to hand out in order data straight from the
+ *  stream buffer instead of copying it into the reassembly buffer first.
+ */
+static inline void StreamTcpReassembleAppLayerSlice(TcpReassemblyThreadCtx *ra_ctx,
+        TcpSession *ssn, TcpStream *stream, Packet *p, uint8_t *slice,
+        uint32_t slice_len)
+{
+    uint8_t flags = 0;
+
+    SCLogDebug("zero copy slice %p len %"PRIu32, slice, slice_len);
+
+    STREAM_SET_FLAGS(ssn, stream, p, flags);
+    AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn,
+            slice, slice_len, flags);
+    PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
+}
+
 static int StreamTcpReassembleAppLayer (ThreadVars *tv,
         TcpReassemblyThreadCtx *ra_ctx, TcpSession *ssn, TcpStream *stream,
         Packet *p)
@@ -2622,6 +2914,9 @@ static int StreamTcpReassembleAppLayer (ThreadVars *tv,
     uint16_t payload_offset = 0;
     uint16_t payload_len = 0;
     uint32_t next_seq = ra_base_seq + 1;
+    /* zero copy: in order data from the stream buffer */
+    uint8_t *slice = NULL;
+    uint32_t slice_len = 0;
 
     SCLogDebug("ra_base_seq %"PRIu32", last_ack %"PRIu32", next_seq %"PRIu32,
             ra_base_seq, stream->last_ack, next_seq);
@@ -2642,7 +2937,7 @@ static int StreamTcpReassembleAppLayer (ThreadVars *tv,
 
                 TcpSegment *next_seg = seg->next;
                 StreamTcpRemoveSegmentFromStream(stream, seg);
-                StreamTcpSegmentReturntoPool(seg);
+                StreamTcpSegmentReturntoCache(ra_ctx, seg);
                 seg = next_seg;
                 continue;
             } else {
@@ -2664,7 +2959,7 @@ static int StreamTcpReassembleAppLayer (ThreadVars *tv,
 
             TcpSegment *next_seg = seg->next;
             StreamTcpRemoveSegmentFromStream(stream, seg);
-            StreamTcpSegmentReturntoPool(seg);
+            StreamTcpSegmentReturntoCache(ra_ctx, seg);
             seg = next_seg;
             continue;
         }
@@ -2693,6 +2988,11 @@ static int StreamTcpReassembleAppLayer (ThreadVars *tv,
         if (SEQ_GT(seg->seq, next_seq)) {
 
             /* first, pass on data before the gap */
+            if (slice_len > 0) {
+                StreamTcpReassembleAppLayerSlice(ra_ctx, ssn, stream, p,
+                        slice, slice_len);
+                slice_len = 0;
+            }
             if (data_len > 0) {
                 SCLogDebug("pre GAP data");
 
@@ -2804,6 +3104,42 @@ static int StreamTcpReassembleAppLayer (ThreadVars *tv,
                 break;
             }
 
+            /* zero copy: extend or start a slice of the stream buffer. Not
+             * done before the app layer protocol is known, as until then
+             * the data is handed to the protocol detection again and again
+             * from the start of the stream. */
+            if ((seg->flags & SEGMENTTCP_FLAG_SBUF) &&
+                (ssn->flags & STREAMTCP_FLAG_APPPROTO_DETECTION_COMPLETED))
+            {
+                if (data_len > 0) {
+                    STREAM_SET_FLAGS(ssn, stream, p, flags);
+                    AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn,
+                            data, data_len, flags);
+                    PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
+                    data_len = 0;
+                }
+
+                if (slice_len > 0 &&
+                    slice + slice_len != seg->payload + payload_offset)
+                {
+                    StreamTcpReassembleAppLayerSlice(ra_ctx, ssn, stream, p,
+                            slice, slice_len);
+                    slice_len = 0;
+                }
+                if (slice_len == 0)
+                    slice = seg->payload + payload_offset;
+
+                slice_len += payload_len;
+                ra_base_seq += payload_len;
+                goto segment_handled;
+            }
+
+            if (slice_len > 0) {
+                StreamTcpReassembleAppLayerSlice(ra_ctx, ssn, stream, p,
+                        slice, slice_len);
+                slice_len = 0;
+            }
+
             /* copy the data into the smsg */
             uint16_t copy_size = sizeof(data) - data_len;
             if (copy_size > payload_len) {
@@ -2912,9 +3248,10 @@ static int StreamTcpReassembleAppLayer (ThreadVars *tv,
             }
         }
 
+segment_handled:
         /* done with this segment, return it to the pool */
-        TcpSegment *next_seg = seg->next;
         next_seq = seg->seq + seg->payload_len;
+        TcpSegment *next_seg = seg->next;
         if (partial == FALSE) {
             SCLogDebug("fully done with segment in app layer reassembly");
             seg->flags |= SEGMENTTCP_FLAG_APPLAYER_PROCESSED;
@@ -2924,6 +3261,11 @@ static int StreamTcpReassembleAppLayer (ThreadVars *tv,
         seg = next_seg;
     }
 
+    if (slice_len > 0) {
+        StreamTcpReassembleAppLayerSlice(ra_ctx, ssn, stream, p,
+                slice, slice_len);
+    }
+
     /* put the partly filled smsg in the queue to the l7 handler */
     if (data_len > 0) {
         SCLogDebug("data_len > 0, %u", data_len);
@@ -3021,7 +3363,7 @@ static int StreamTcpReassembleRaw (TcpReassemblyThreadCtx *ra_ctx,
 
             TcpSegment *next_seg = seg->next;
             StreamTcpRemoveSegmentFromStream(stream, seg);
-            StreamTcpSegmentReturntoPool(seg);
+            StreamTcpSegmentReturntoCache(ra_ctx, seg);
             seg = next_seg;
             continue;
         }
@@ -3560,14 +3902,22 @@ TcpSegment* StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     SCLogDebug("segment_pool_idx %" PRIu32 " for payload_len %" PRIu32 "",
                 idx, len);
 
-    SCMutexLock(&segment_pool_mutex[idx]);
-    TcpSegment *seg = (TcpSegment *) PoolGet(segment_pool[idx]);
+    TcpSegmentCache *cache = &ra_ctx->seg_cache[idx];
+    if (cache->list != NULL) {
+        SCPerfCounterIncr(ra_ctx->counter_tcp_segment_cache_hit, tv->sc_perf_pca);
+    } else {
+        SCPerfCounterIncr(ra_ctx->counter_tcp_segment_cache_miss, tv->sc_perf_pca);
 
-    SCLogDebug("segment_pool[%u]->empty_list_size %u, segment_pool[%u]->alloc_"
-               "list_size %u, alloc %u", idx, segment_pool[idx]->empty_list_size,
-               idx, segment_pool[idx]->alloc_list_size,
-               segment_pool[idx]->allocated);
-    SCMutexUnlock(&segment_pool_mutex[idx]);
+        if (StreamTcpSegmentCacheRefill(cache, idx) > 0) {
+            SCPerfCounterIncr(ra_ctx->counter_tcp_segment_cache_refill, tv->sc_perf_pca);
+        }
+        SCLogDebug("segment_pool[%u]->empty_list_size %u, segment_pool[%u]->alloc_"
+                   "list_size %u, alloc %u", idx, segment_pool[idx]->empty_list_size,
+                   idx, segment_pool[idx]->alloc_list_size,
+                   segment_pool[idx]->allocated);
+    }
+
+    TcpSegment *seg = cache->list;
 
     SCLogDebug("seg we return is %p", seg);
     if (seg == NULL) {
@@ -3578,17 +3928,14 @@ TcpSegment* StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
            segment request due to memcap limit */
         SCPerfCounterIncr(ra_ctx->counter_tcp_segment_memcap, tv->sc_perf_pca);
     } else {
+        cache->list = seg->next;
+        cache->len--;
+
         seg->flags = 0;
         seg->next = NULL;
         seg->prev = NULL;
     }
 
-#ifdef DEBUG
-    SCMutexLock(&segment_pool_cnt_mutex);
-    segment_pool_cnt++;
-    SCMutexUnlock(&segment_pool_cnt_mutex);
-#endif
-
     return seg;
 }
 
@@ -8681,6 +9028,162 @@ end:
     return ret;
 }
 
+/** \test zero copy mode: in order data ends up contiguous in the stream
+ *        buffer, out of order data uses the pools and the buffer is
+ *        compacted once segments are gone.
+ */
+static int StreamTcpReassembleZeroCopyTest01(void) {
+    int ret = 0;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    Packet *p = NULL;
+    uint8_t payload[5];
+    uint32_t seqs[] = { 2, 7, 17, 12 };
+    uint8_t bytes[] = { 'A', 'B', 'D', 'C' };
+    int i;
+
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    stream_config.flags |= STREAMTCP_INIT_FLAG_ZERO_COPY;
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+
+    uint64_t memuse = SC_ATOMIC_GET(ra_memuse);
+
+    for (i = 0; i < 4; i++) {
+        memset(payload, bytes[i], sizeof(payload));
+        p = UTHBuildPacketReal(payload, sizeof(payload), IPPROTO_TCP,
+                "1.1.1.1", "2.2.2.2", 1024, 80);
+        if (p == NULL) {
+            printf("couldn't get a packet: ");
+            goto end;
+        }
+        p->tcph->th_seq = htonl(seqs[i]);
+
+        if (StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn,
+                    &ssn.client, p) != 0) {
+            printf("failed to add segment %d: ", i);
+            goto end;
+        }
+        UTHFreePacket(p);
+        p = NULL;
+    }
+
+    /* A, B, C (pool), D */
+    TcpSegment *a = ssn.client.seg_list;
+    TcpSegment *b = a->next;
+    TcpSegment *c = b->next;
+    TcpSegment *d = c->next;
+    if (!(a->flags & SEGMENTTCP_FLAG_SBUF) || !(b->flags & SEGMENTTCP_FLAG_SBUF) ||
+        (c->flags & SEGMENTTCP_FLAG_SBUF) || !(d->flags & SEGMENTTCP_FLAG_SBUF)) {
+        printf("unexpected segment types: ");
+        goto end;
+    }
+    if (a->payload != ssn.client.sbuf || b->payload != a->payload + 5 ||
+        memcmp(ssn.client.sbuf, "AAAAABBBBBDDDDD", 15) != 0) {
+        printf("in order data is not contiguous: ");
+        goto end;
+    }
+
+    StreamTcpRemoveSegmentFromStream(&ssn.client, a);
+    StreamTcpSegmentReturntoPool(a);
+    StreamTcpRemoveSegmentFromStream(&ssn.client, b);
+    StreamTcpSegmentReturntoPool(b);
+
+    /* doesn't fit, so D is moved to the start and the buffer grows */
+    if (StreamTcpSbufReserve(&ssn.client, STREAM_SBUF_MIN_SIZE) != 1) {
+        printf("couldn't reserve space: ");
+        goto end;
+    }
+    if (d->payload != ssn.client.sbuf || ssn.client.sbuf_len != 5 ||
+        ssn.client.sbuf_size != 2 * STREAM_SBUF_MIN_SIZE ||
+        memcmp(d->payload, "DDDDD", 5) != 0) {
+        printf("buffer not compacted: ");
+        goto end;
+    }
+
+    StreamTcpUTClearSession(&ssn);
+    if (SC_ATOMIC_GET(ra_memuse) != memuse) {
+        printf("memuse %"PRIu64", expected %"PRIu64": ",
+                (uint64_t)SC_ATOMIC_GET(ra_memuse), memuse);
+        goto end;
+    }
+
+    ret = 1;
+end:
+    if (p != NULL)
+        UTHFreePacket(p);
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    return ret;
+}
+
+/** \test segments are served from and returned to the thread cache, which
+ *        is refilled and flushed in batches.
+ */
+static int StreamTcpReassembleSegmentCacheTest01(void) {
+    int ret = 0;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSegment *segs[3 * STREAM_SEGMENT_CACHE_BATCH];
+    int i;
+
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+
+    uint16_t idx = segment_pool_idx[5];
+    uint32_t pool_free = segment_pool[idx]->alloc_list_size;
+    TcpSegmentCache *cache = &ra_ctx->seg_cache[idx];
+
+    TcpSegment *seg = StreamTcpGetSegment(&tv, ra_ctx, 5);
+    if (seg == NULL || cache->len != STREAM_SEGMENT_CACHE_BATCH - 1 ||
+        segment_pool[idx]->alloc_list_size != pool_free - STREAM_SEGMENT_CACHE_BATCH) {
+        printf("cache not refilled with a batch: ");
+        goto end;
+    }
+
+    StreamTcpSegmentReturntoCache(ra_ctx, seg);
+    if (StreamTcpGetSegment(&tv, ra_ctx, 5) != seg) {
+        printf("returned segment not reused: ");
+        goto end;
+    }
+    segs[0] = seg;
+
+    for (i = 1; i < 3 * STREAM_SEGMENT_CACHE_BATCH; i++) {
+        segs[i] = StreamTcpGetSegment(&tv, ra_ctx, 5);
+        if (segs[i] == NULL) {
+            printf("no segment %d: ", i);
+            goto end;
+        }
+    }
+    for (i = 0; i < 3 * STREAM_SEGMENT_CACHE_BATCH; i++) {
+        StreamTcpSegmentReturntoCache(ra_ctx, segs[i]);
+        if (cache->len > 2 * STREAM_SEGMENT_CACHE_BATCH) {
+            printf("cache not flushed: ");
+            goto end;
+        }
+    }
+
+    /* freeing the thread ctx returns everything to the pool */
+    StreamTcpReassembleFreeThreadCtx(ra_ctx);
+    ra_ctx = NULL;
+    if (segment_pool[idx]->alloc_list_size != pool_free) {
+        printf("pool has %"PRIu32" free segments, expected %"PRIu32": ",
+                segment_pool[idx]->alloc_list_size, pool_free);
+        goto end;
+    }
+
+    ret = 1;
+end:
+    if (ra_ctx != NULL)
+        StreamTcpReassembleFreeThreadCtx(ra_ctx);
+    StreamTcpFreeConfig(TRUE);
+    return ret;
+}
+
 #endif /* UNITTESTS */
 
 /** \brief  The Function Register the Unit tests to test the reassembly engine
@@ -8752,6 +9255,9 @@ void StreamTcpReassembleRegisterTests(void) {
     UtRegisterTest("StreamTcpReassembleInsertTest02 -- insert with overlap", StreamTcpReassembleInsertTest02, 1);
     UtRegisterTest("StreamTcpReassembleInsertTest03 -- insert with overlap", StreamTcpReassembleInsertTest03, 1);
 
+    UtRegisterTest("StreamTcpReassembleZeroCopyTest01 -- zero copy stream buffer", StreamTcpReassembleZeroCopyTest01, 1);
+    UtRegisterTest("StreamTcpReassembleSegmentCacheTest01 -- thread segment cache", StreamTcpReassembleSegmentCacheTest01, 1);
+
     StreamTcpInlineRegisterTests();
     StreamTcpUtilRegisterTests();
 #endif /* UNITTESTS */
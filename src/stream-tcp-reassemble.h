@@ -51,8 +51,20 @@ enum
     OS_POLICY_LAST
 };
 
+/** number of segment pools, one per payload size class */
+#define STREAM_TCP_SEGMENT_POOLS    8
+
+/** per thread cache of free segments of one pool size class */
+typedef struct TcpSegmentCache_ {
+    struct TcpSegment_ *list;       /**< free segments, linked by next */
+    uint32_t len;
+} TcpSegmentCache;
+
 typedef struct TcpReassemblyThreadCtx_ {
     StreamMsgQueue *stream_q;
+    /** segments are taken from and returned to these caches, which are
+     *  refilled from and flushed to the global pools in batches */
+    TcpSegmentCache seg_cache[STREAM_TCP_SEGMENT_POOLS];
     AlpProtoDetectThreadCtx dp_ctx;   /**< proto detection thread data */
     /** TCP segments which are not being reassembled due to memcap was reached */
     uint16_t counter_tcp_segment_memcap;
@@ -62,6 +74,12 @@ typedef struct TcpReassemblyThreadCtx_ {
     uint16_t counter_tcp_reass_memuse;
     /** count number of streams with a unrecoverable stream gap (missing pkts) */
     uint16_t counter_tcp_reass_gap;
+    /** segment requests served from the thread's segment cache */
+    uint16_t counter_tcp_segment_cache_hit;
+    /** segment requests that found the thread's segment cache empty */
+    uint16_t counter_tcp_segment_cache_miss;
+    /** batches taken from the global segment pools */
+    uint16_t counter_tcp_segment_cache_refill;
 } TcpReassemblyThreadCtx;
 
 #define OS_POLICY_DEFAULT   OS_POLICY_BSD
@@ -88,6 +106,7 @@ TcpSegment* StreamTcpGetSegment(ThreadVars *, TcpReassemblyThreadCtx *, uint16_t
 
 void StreamTcpReturnStreamSegments(TcpStream *);
 void StreamTcpSegmentReturntoPool(TcpSegment *);
+void StreamTcpSegmentReturntoCache(TcpReassemblyThreadCtx *, TcpSegment *);
 
 void StreamTcpReassembleTriggerRawReassembly(TcpSession *);
 
@@ -110,6 +110,14 @@ static SCMutex ssn_pool_mutex;
 static uint64_t ssn_pool_cnt = 0; /** counts ssns, protected by ssn_pool_mutex */
 #endif
 
+/* Per thread session caches are refilled from and flushed to ssn_pool
+ * this many sessions at a time, and hold at most twice as many. */
+#define STREAM_SSN_CACHE_BATCH  32
+
+/** session cache of the calling stream thread. NULL in threads without
+ *  one, like the flow manager, which use ssn_pool directly. */
+static __thread StreamTcpSessionCache *ssn_cache = NULL;
+
 extern uint8_t engine_mode;
 
 SC_ATOMIC_DECLARE(uint64_t, st_memuse);
@@ -157,6 +165,78 @@ int StreamTcpCheckMemcap(uint64_t size) {
     return 0;
 }
 
+/**
+ *  \internal
+ *  \brief Return up to cnt sessions of a thread cache to ssn_pool
+ */
+static void StreamTcpSessionCacheFlush(StreamTcpSessionCache *cache, uint32_t cnt)
+{
+    uint32_t u = 0;
+
+    SCMutexLock(&ssn_pool_mutex);
+    for ( ; u < cnt && cache->list != NULL; u++) {
+        TcpSession *ssn = cache->list;
+        cache->list = ssn->next;
+        cache->len--;
+
+        ssn->next = NULL;
+        PoolReturn(ssn_pool, ssn);
+    }
+#ifdef DEBUG
+    ssn_pool_cnt -= u;
+#endif
+    SCMutexUnlock(&ssn_pool_mutex);
+}
+
+/**
+ *  \internal
+ *  \brief Take a batch of sessions from ssn_pool into a thread cache
+ *
+ *  Only the first session may be newly allocated, the rest of the batch
+ *  is taken from the free sessions of the pool, so refilling doesn't
+ *  make the pool grow. The pool still enforces max-sessions, as cached
+ *  sessions count as in use.
+ *
+ *  \retval cnt number of sessions added to the cache
+ */
+static uint32_t StreamTcpSessionCacheRefill(StreamTcpSessionCache *cache)
+{
+    uint32_t u = 0;
+
+    SCMutexLock(&ssn_pool_mutex);
+    for ( ; u < STREAM_SSN_CACHE_BATCH; u++) {
+        if (u > 0 && ssn_pool->alloc_list_size == 0)
+            break;
+
+        TcpSession *ssn = (TcpSession *)PoolGet(ssn_pool);
+        if (ssn == NULL)
+            break;
+
+        ssn->next = cache->list;
+        cache->list = ssn;
+        cache->len++;
+    }
+#ifdef DEBUG
+    ssn_pool_cnt += u;
+#endif
+    SCMutexUnlock(&ssn_pool_mutex);
+
+    cache->steal += u;
+    return u;
+}
+
+/**
+ *  \brief Update the session cache counters of a stream thread
+ */
+static inline void StreamTcpSessionCacheCounters(ThreadVars *tv, StreamTcpThread *stt) {
+    SCPerfCounterSetUI64(stt->counter_tcp_ssn_cache_alloc, tv->sc_perf_pca,
+            stt->ssn_cache.alloc);
+    SCPerfCounterSetUI64(stt->counter_tcp_ssn_cache_free, tv->sc_perf_pca,
+            stt->ssn_cache.free);
+    SCPerfCounterSetUI64(stt->counter_tcp_ssn_cache_steal, tv->sc_perf_pca,
+            stt->ssn_cache.steal);
+}
+
 /**
  *  \brief Function to return the stream back to the pool. It returns the
  *         segments in the stream to the segment pool.
@@ -210,6 +290,19 @@ void StreamTcpSessionClear(void *ssnptr)
     ssn->toclient_smsg_head = NULL;
 
     memset(ssn, 0, sizeof(TcpSession));
+
+    StreamTcpSessionCache *cache = ssn_cache;
+    if (cache != NULL) {
+        ssn->next = cache->list;
+        cache->list = ssn;
+        cache->len++;
+        cache->free++;
+
+        if (cache->len > 2 * STREAM_SSN_CACHE_BATCH)
+            StreamTcpSessionCacheFlush(cache, STREAM_SSN_CACHE_BATCH);
+        SCReturn;
+    }
+
     SCMutexLock(&ssn_pool_mutex);
     PoolReturn(ssn_pool, ssn);
 #ifdef DEBUG
@@ -478,6 +571,18 @@ void StreamTcpInitConfig(char quiet)
         SCLogInfo("stream.reassembly \"depth\": %"PRIu32"", stream_config.reassembly_depth);
     }
 
+    int zero_copy = 0;
+    if ((ConfGetBool("stream.reassembly.zero-copy", &zero_copy)) == 1 &&
+            zero_copy == 1) {
+        stream_config.flags |= STREAMTCP_INIT_FLAG_ZERO_COPY;
+    }
+
+    if (!quiet) {
+        SCLogInfo("stream.reassembly \"zero-copy\": %s",
+                stream_config.flags & STREAMTCP_INIT_FLAG_ZERO_COPY ?
+                "enabled" : "disabled");
+    }
+
     int randomize = 0;
     if ((ConfGetBool("stream.reassembly.randomize-chunk-size", &randomize)) == 0) {
         /* randomize by default if value not set
@@ -616,13 +721,28 @@ TcpSession *StreamTcpNewSession (Packet *p)
     TcpSession *ssn = (TcpSession *)p->flow->protoctx;
 
     if (ssn == NULL) {
-        SCMutexLock(&ssn_pool_mutex);
-        p->flow->protoctx = PoolGet(ssn_pool);
+        StreamTcpSessionCache *cache = ssn_cache;
+        if (cache != NULL) {
+            if (cache->list == NULL)
+                (void)StreamTcpSessionCacheRefill(cache);
+
+            ssn = cache->list;
+            if (ssn != NULL) {
+                cache->list = ssn->next;
+                cache->len--;
+                cache->alloc++;
+                ssn->next = NULL;
+            }
+            p->flow->protoctx = ssn;
+        } else {
+            SCMutexLock(&ssn_pool_mutex);
+            p->flow->protoctx = PoolGet(ssn_pool);
 #ifdef DEBUG
-        if (p->flow->protoctx != NULL)
-            ssn_pool_cnt++;
+            if (p->flow->protoctx != NULL)
+                ssn_pool_cnt++;
 #endif
-        SCMutexUnlock(&ssn_pool_mutex);
+            SCMutexUnlock(&ssn_pool_mutex);
+        }
 
         ssn = (TcpSession *)p->flow->protoctx;
         if (ssn == NULL) {
@@ -4190,6 +4310,7 @@ static int StreamTcpPacket (ThreadVars *tv, Packet *p, StreamTcpThread *stt,
     }
 
     StreamTcpMemuseCounter(tv, stt);
+    StreamTcpSessionCacheCounters(tv, stt);
     SCReturnInt(0);
 
 error:
@@ -4222,11 +4343,6 @@ error:
  */
 static inline int StreamTcpValidateChecksum(Packet *p)
 {
-
-#ifdef __tile__
-    //return (p->idesc.cs && p->idesc.csum_seed_val == 0);
-    return (p->mpipe_v.idesc.cs) ? 1 : 0;
-#else
     int ret = 1;
 
     if (p->flags & PKT_IGNORE_CHECKSUM)
@@ -4254,7 +4370,6 @@ static inline int StreamTcpValidateChecksum(Packet *p)
         }
     }
     return ret;
-#endif
 }
 
 TmEcode StreamTcp (ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
@@ -4280,6 +4395,7 @@ TmEcode StreamTcp (ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, Packe
     }
 
     PACKET_PROFILING_APP_RESET(&stt->ra_ctx->dp_ctx);
+    PACKET_PROFILING_APP_SAMPLE(&stt->ra_ctx->dp_ctx, p);
 
     FLOWLOCK_WRLOCK(p->flow);
     ret = StreamTcpPacket(tv, p, stt, pq);
@@ -4332,6 +4448,15 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
     stt->counter_tcp_rst = SCPerfTVRegisterCounter("tcp.rst", tv,
                                                         SC_PERF_TYPE_UINT64,
                                                         "NULL");
+    stt->counter_tcp_ssn_cache_alloc = SCPerfTVRegisterCounter("tcp.ssn_cache_alloc", tv,
+                                                        SC_PERF_TYPE_UINT64,
+                                                        "NULL");
+    stt->counter_tcp_ssn_cache_free = SCPerfTVRegisterCounter("tcp.ssn_cache_free", tv,
+                                                        SC_PERF_TYPE_UINT64,
+                                                        "NULL");
+    stt->counter_tcp_ssn_cache_steal = SCPerfTVRegisterCounter("tcp.ssn_cache_steal", tv,
+                                                        SC_PERF_TYPE_UINT64,
+                                                        "NULL");
 
     /* init reassembly ctx */
     stt->ra_ctx = StreamTcpReassembleInitThreadCtx(tv);
@@ -4350,10 +4475,22 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
     stt->ra_ctx->counter_tcp_reass_gap = SCPerfTVRegisterCounter("tcp.reassembly_gap", tv,
                                                         SC_PERF_TYPE_UINT64,
                                                         "NULL");
+    stt->ra_ctx->counter_tcp_segment_cache_hit = SCPerfTVRegisterCounter("tcp.segment_cache_hit", tv,
+                                                        SC_PERF_TYPE_UINT64,
+                                                        "NULL");
+    stt->ra_ctx->counter_tcp_segment_cache_miss = SCPerfTVRegisterCounter("tcp.segment_cache_miss", tv,
+                                                        SC_PERF_TYPE_UINT64,
+                                                        "NULL");
+    stt->ra_ctx->counter_tcp_segment_cache_refill = SCPerfTVRegisterCounter("tcp.segment_cache_refill", tv,
+                                                        SC_PERF_TYPE_UINT64,
+                                                        "NULL");
 
     tv->sc_perf_pca = SCPerfGetAllCountersArray(tv, &tv->sc_perf_pctx);
     SCPerfAddToClubbedTMTable(tv->name, &tv->sc_perf_pctx);
 
+    /* sessions this thread gets or frees go through its cache */
+    ssn_cache = &stt->ssn_cache;
+
     SCLogDebug("StreamTcp thread specific ctx online at %p, reassembly ctx %p",
                 stt, stt->ra_ctx);
     SCReturnInt(TM_ECODE_OK);
@@ -4369,6 +4506,10 @@ TmEcode StreamTcpThreadDeinit(ThreadVars *tv, void *data)
 
     /* XXX */
 
+    if (ssn_cache == &stt->ssn_cache)
+        ssn_cache = NULL;
+    StreamTcpSessionCacheFlush(&stt->ssn_cache, stt->ssn_cache.len);
+
     /* free reassembly ctx */
     StreamTcpReassembleFreeThreadCtx(stt->ra_ctx);
 
@@ -5256,6 +5397,82 @@ end:
     return ret;
 }
 
+/**
+ *  \test   sessions are served from and returned to the thread cache,
+ *          which is refilled from and flushed to ssn_pool in batches.
+ */
+static int StreamTcpSessionCacheTest01 (void) {
+    StreamTcpThread stt;
+    TcpSession *ssns[3 * STREAM_SSN_CACHE_BATCH];
+    Flow f;
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    if (unlikely(p == NULL))
+        return 0;
+    memset(p, 0, SIZE_OF_PACKET);
+    p->pkt = (uint8_t *)(p + 1);
+    memset(&f, 0, sizeof(Flow));
+    memset(&stt, 0, sizeof(stt));
+    p->flow = &f;
+    int ret = 0;
+    int i;
+
+    StreamTcpInitConfig(TRUE);
+    ssn_cache = &stt.ssn_cache;
+
+    uint32_t pool_free = ssn_pool->alloc_list_size;
+
+    TcpSession *ssn = StreamTcpNewSession(p);
+    if (ssn == NULL || stt.ssn_cache.len != STREAM_SSN_CACHE_BATCH - 1 ||
+        stt.ssn_cache.steal != STREAM_SSN_CACHE_BATCH ||
+        ssn_pool->alloc_list_size != pool_free - STREAM_SSN_CACHE_BATCH) {
+        printf("cache not refilled with a batch: ");
+        goto end;
+    }
+
+    StreamTcpSessionClear(ssn);
+    f.protoctx = NULL;
+    if (StreamTcpNewSession(p) != ssn || stt.ssn_cache.free != 1) {
+        printf("returned session not reused: ");
+        goto end;
+    }
+    ssns[0] = ssn;
+
+    for (i = 1; i < 3 * STREAM_SSN_CACHE_BATCH; i++) {
+        f.protoctx = NULL;
+        ssns[i] = StreamTcpNewSession(p);
+        if (ssns[i] == NULL) {
+            printf("no session %d: ", i);
+            goto end;
+        }
+    }
+    if (stt.ssn_cache.alloc != 3 * STREAM_SSN_CACHE_BATCH + 1) {
+        printf("alloc %"PRIu64": ", stt.ssn_cache.alloc);
+        goto end;
+    }
+    for (i = 0; i < 3 * STREAM_SSN_CACHE_BATCH; i++) {
+        StreamTcpSessionClear(ssns[i]);
+        if (stt.ssn_cache.len > 2 * STREAM_SSN_CACHE_BATCH) {
+            printf("cache not flushed: ");
+            goto end;
+        }
+    }
+
+    /* all sessions are either cached or back in the pool */
+    if (ssn_pool->alloc_list_size + stt.ssn_cache.len != pool_free) {
+        printf("lost sessions: %u + %u != %u: ", ssn_pool->alloc_list_size,
+                stt.ssn_cache.len, pool_free);
+        goto end;
+    }
+
+    ret = 1;
+end:
+    ssn_cache = NULL;
+    StreamTcpSessionCacheFlush(&stt.ssn_cache, stt.ssn_cache.len);
+    StreamTcpFreeConfig(TRUE);
+    SCFree(p);
+    return ret;
+}
+
 /**
  *  \test   Test the deallocation of TCP session for a given packet and return
  *          the memory back to ssn_pool and corresponding segments to segment
@@ -9790,6 +10007,8 @@ void StreamTcpRegisterTests (void) {
 #ifdef UNITTESTS
     UtRegisterTest("StreamTcpTest01 -- TCP session allocation",
                     StreamTcpTest01, 1);
+    UtRegisterTest("StreamTcpSessionCacheTest01 -- TCP session thread cache",
+                    StreamTcpSessionCacheTest01, 1);
     UtRegisterTest("StreamTcpTest02 -- TCP session deallocation",
                     StreamTcpTest02, 1);
     UtRegisterTest("StreamTcpTest03 -- SYN missed MidStream session",
@@ -38,6 +38,9 @@
 /* Flag to indicate that the checksum validation for the stream engine
    has been enabled */
 #define STREAMTCP_INIT_FLAG_CHECKSUM_VALIDATION    0x01
+/* Flag to indicate that in order segment data is kept in a per stream
+   buffer, so app layer reassembly can use it without copying */
+#define STREAMTCP_INIT_FLAG_ZERO_COPY              0x02
 
 /*global flow data*/
 typedef struct TcpStreamCnf_ {
@@ -68,6 +71,16 @@ typedef struct TcpStreamCnf_ {
     uint8_t max_synack_queued;
 } TcpStreamCnf;
 
+/** per thread cache of free sessions */
+typedef struct StreamTcpSessionCache_ {
+    struct TcpSession_ *list;       /**< free sessions, linked by next */
+    uint32_t len;
+
+    uint64_t alloc;                 /**< sessions handed out from the cache */
+    uint64_t free;                  /**< sessions returned to the cache */
+    uint64_t steal;                 /**< sessions taken from the global pool */
+} StreamTcpSessionCache;
+
 typedef struct StreamTcpThread_ {
     uint64_t pkts;
 
@@ -95,6 +108,14 @@ typedef struct StreamTcpThread_ {
     uint16_t counter_tcp_synack;
     /** rst pkts */
     uint16_t counter_tcp_rst;
+    /** session cache stats */
+    uint16_t counter_tcp_ssn_cache_alloc;
+    uint16_t counter_tcp_ssn_cache_free;
+    uint16_t counter_tcp_ssn_cache_steal;
+
+    /** sessions are taken from and returned to this cache, which is
+     *  refilled from and flushed to the global ssn_pool in batches */
+    StreamTcpSessionCache ssn_cache;
 
     /** tcp reassembly thread data */
     TcpReassemblyThreadCtx *ra_ctx;
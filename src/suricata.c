@@ -90,6 +90,7 @@
 #include "tm-threads.h"
 
 #include "tmqh-flow.h"
+#include "tmqh-spsc.h"
 
 #include "conf.h"
 #include "conf-yaml-loader.h"
@@ -1399,6 +1400,8 @@ int main(int argc, char **argv)
 
     /* load the pattern matchers */
     MpmTableSetup();
+    SimdSearchInit();
+    ChecksumSumInit();
 
     if (run_mode != RUNMODE_UNITTEST &&
             !list_keywords &&
@@ -1498,6 +1501,25 @@ int main(int argc, char **argv)
 
     SCLogDebug("Max pending packets set to %"PRIiMAX, max_pending_packets);
 
+    /* Pull the batch size from the config, packets are handed to the
+     * thread modules one by one if it is not set. */
+    intmax_t batch_size;
+    if (ConfGetInt("batch-size", &batch_size) == 1) {
+        if (batch_size < 1 || batch_size > TM_BATCH_SIZE_MAX) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY,
+                    "batch-size should be between 1 and %d. "
+                    "Please check %s for errors", TM_BATCH_SIZE_MAX,
+                    conf_filename);
+            exit(EXIT_FAILURE);
+        }
+        /* every packet of a batch is taken from the packet pool */
+        if (batch_size > max_pending_packets)
+            batch_size = max_pending_packets;
+        tm_batch_size = (uint16_t)batch_size;
+    }
+
+    SCLogDebug("Batch size set to %"PRIu16, tm_batch_size);
+
     /* Pull the default packet size from the config, if not found fall
      * back on a sane default. */
     char *temp_default_packet_size;
@@ -1757,7 +1779,10 @@ int main(int argc, char **argv)
         ConfRegisterTests();
         ConfYamlRegisterTests();
         TmqhFlowRegisterTests();
+        TmqhSpscRegisterTests();
+        TmThreadsRegisterTests();
         FlowRegisterTests();
+        FlowHashRegisterTests();
         SCSigRegisterSignatureOrderingTests();
         SCRadixRegisterTests();
         DefragRegisterTests();
@@ -1767,6 +1792,8 @@ int main(int argc, char **argv)
         AppLayerParserRegisterTests();
         ThreadMacrosRegisterTests();
         UtilSpmSearchRegistertests();
+        SimdSearchRegisterTests();
+        ChecksumSumRegisterTests();
         UtilActionRegisterTests();
         SCClassConfRegisterTests();
         SCThresholdConfRegisterTests();
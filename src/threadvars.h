@@ -40,6 +40,7 @@ struct ThreadVars_;
 #endif
 
 struct TmSlot_;
+struct FlowPartition_;
 
 /** Thread flags set and read by threads to control the threads */
 #define THV_USE       1 /** thread is in use */
@@ -113,6 +114,11 @@ typedef struct ThreadVars_ {
     void *(*tm_func)(void *);
     struct TmSlot_ *tm_slots;
 
+    /** private flow hash partition, only used with flow.thread-local */
+    struct FlowPartition_ *flow_part;
+    /** set if setting up flow_part failed, we use the global hash then */
+    uint8_t flow_part_failed;
+
     uint8_t thread_setup_flags;
     uint16_t cpu_affinity; /** cpu or core number to set affinity to */
     int thread_priority; /** priority (real time) for this thread. Look at threads.h */
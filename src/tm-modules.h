@@ -43,6 +43,12 @@ typedef struct TmModule_ {
 
     /** the packet processing function */
     TmEcode (*Func)(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
+    /** optional batch version of Func, called with up to tm_batch_size
+     *  packets. Only used for the leading slots of a thread, like decode.
+     *  Stateful modules like stream and detect must not have one, as
+     *  they have to be done with a packet before the next one of its
+     *  flow comes in. */
+    TmEcode (*FuncBatch)(ThreadVars *, Packet **, uint32_t, void *, PacketQueue *, PacketQueue *);
 
     TmEcode (*PktAcqLoop)(ThreadVars *, void *, void *);
 
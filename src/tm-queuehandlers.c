@@ -39,6 +39,7 @@
 #include "tmqh-packetpool.h"
 #include "tmqh-flow.h"
 #include "tmqh-ringbuffer.h"
+#include "tmqh-spsc.h"
 
 void TmqhSetup (void) {
     memset(&tmqh_table, 0, sizeof(tmqh_table));
@@ -49,6 +50,7 @@ void TmqhSetup (void) {
     TmqhPacketpoolRegister();
     TmqhFlowRegister();
     TmqhRingBufferRegister();
+    TmqhSpscRegister();
 #ifdef __tile__
     TmqhTmcQueueRegister();
 #endif
@@ -57,6 +59,8 @@ void TmqhSetup (void) {
 /** \brief Clean up registration time allocs */
 void TmqhCleanup(void) {
     TmqhRingBufferDestroy();
+    TmqhSpscDestroy();
+    TmqhFlowDestroy();
 }
 
 Tmqh* TmqhGetQueueHandlerByName(char *name) {
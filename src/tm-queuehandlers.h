@@ -35,6 +35,7 @@ enum {
     TMQH_RINGBUFFER_MRSW,
     TMQH_RINGBUFFER_SRSW,
     TMQH_RINGBUFFER_SRMW,
+    TMQH_SPSC,
 
     TMQH_SIZE,
 };
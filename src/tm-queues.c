@@ -28,7 +28,6 @@
 #include "tm-queues.h"
 #include "util-debug.h"
 
-#define TMQ_MAX_QUEUES 256
 
 static uint16_t tmq_id = 0;
 static Tmq tmqs[TMQ_MAX_QUEUES];
@@ -24,6 +24,9 @@
 #ifndef __TM_QUEUES_H__
 #define __TM_QUEUES_H__
 
+/** max number of queues, and so of queue ids */
+#define TMQ_MAX_QUEUES 256
+
 typedef struct Tmq_ {
     char *name;
     uint16_t id;
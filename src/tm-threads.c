@@ -34,6 +34,7 @@
 #include "tm-queuehandlers.h"
 #include "tm-threads.h"
 #include "tmqh-packetpool.h"
+#include "flow.h"
 #include "threads.h"
 #include "util-debug.h"
 #include "util-privs.h"
@@ -105,6 +106,9 @@ SCMutex tv_root_lock = PTHREAD_MUTEX_INITIALIZER;
  * thread encounters a failure.  Defaults to restart the failed thread */
 uint8_t tv_aof = THV_RESTART_THREAD;
 
+/* packets per batch handed to the slots by the capture methods */
+uint16_t tm_batch_size = 1;
+
 void TmThreadExchange(ThreadVars *otv, ThreadVars *ntv, int type);
 
 /**
@@ -679,6 +683,88 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p,
     return TM_ECODE_OK;
 }
 
+/**
+ * \brief Batch version of TmThreadsSlotVarRun.
+ *
+ * The leading slots that have a FuncBatch, decode and with it the flow
+ * lookup, get the whole batch in one call. From the first slot without
+ * one on, the packets are run through the remaining slots one at a time
+ * like in the per packet path. So stream and detect are done with a
+ * packet, and the pseudo packets it caused, before they see the next
+ * packet of the same flow.
+ */
+TmEcode TmThreadsSlotVarRunBatch(ThreadVars *tv, Packet **pkts, uint32_t cnt,
+                                 TmSlot *slot)
+{
+    TmEcode r = TM_ECODE_OK;
+    TmSlot *s;
+    Packet *extra_p;
+    uint32_t i;
+
+    for (s = slot; s != NULL; s = s->slot_next) {
+        /* a delayed slot that is not active yet runs the dummy func,
+         * so the batch func can only be used if the slot is live */
+        if (s->SlotFuncBatch == NULL ||
+                SC_ATOMIC_GET(s->SlotFunc) == TmDummyFunc)
+            break;
+
+        PacketQueue *post_pq = (s->id == 0) ? &s->slot_post_pq : NULL;
+        r = s->SlotFuncBatch(tv, pkts, cnt, SC_ATOMIC_GET(s->slot_data),
+                &s->slot_pre_pq, post_pq);
+
+        /* handle error */
+        if (unlikely(r == TM_ECODE_FAILED)) {
+            TmqhReleasePacketsToPacketPool(&s->slot_pre_pq);
+
+            SCMutexLock(&s->slot_post_pq.mutex_q);
+            TmqhReleasePacketsToPacketPool(&s->slot_post_pq);
+            SCMutexUnlock(&s->slot_post_pq.mutex_q);
+
+            TmThreadsSetFlag(tv, THV_FAILED);
+            return TM_ECODE_FAILED;
+        }
+
+        /* handle new packets */
+        while (s->slot_pre_pq.top != NULL) {
+            extra_p = PacketDequeue(&s->slot_pre_pq);
+            if (unlikely(extra_p == NULL))
+                continue;
+
+            if (s->slot_next != NULL) {
+                r = TmThreadsSlotVarRun(tv, extra_p, s->slot_next);
+                if (unlikely(r == TM_ECODE_FAILED)) {
+                    TmqhReleasePacketsToPacketPool(&s->slot_pre_pq);
+
+                    SCMutexLock(&s->slot_post_pq.mutex_q);
+                    TmqhReleasePacketsToPacketPool(&s->slot_post_pq);
+                    SCMutexUnlock(&s->slot_post_pq.mutex_q);
+
+                    TmqhOutputPacketpool(tv, extra_p);
+                    TmThreadsSetFlag(tv, THV_FAILED);
+                    return TM_ECODE_FAILED;
+                }
+            }
+            tv->tmqh_out(tv, extra_p);
+        }
+    }
+
+    if (s == NULL)
+        return TM_ECODE_OK;
+
+    for (i = 0; i < cnt; i++) {
+        /* the flow of the next packet is fetched into the cache while
+         * this one is handled */
+        if (i + 1 < cnt && pkts[i + 1]->flow != NULL)
+            __builtin_prefetch(pkts[i + 1]->flow);
+
+        r = TmThreadsSlotVarRun(tv, pkts[i], s);
+        if (unlikely(r == TM_ECODE_FAILED))
+            return TM_ECODE_FAILED;
+    }
+
+    return TM_ECODE_OK;
+}
+
 /*
 
     pcap/nfq
@@ -764,6 +850,9 @@ void *TmThreadsSlotPktAcqLoop(void *td) {
         SCMutexInit(&slot->slot_post_pq.mutex_q, NULL);
     }
 
+    /* capture threads get their packets from a private pool */
+    PacketPoolThreadInit();
+
     TmThreadsSetFlag(tv, THV_INIT_DONE);
 
     while(run) {
@@ -803,6 +892,8 @@ void *TmThreadsSlotPktAcqLoop(void *td) {
         }
     }
 
+    PacketPoolThreadDeinit();
+
     SCLogDebug("%s ending", tv->name);
     TmThreadsSetFlag(tv, THV_CLOSED);
     pthread_exit((void *) 0);
@@ -1062,6 +1153,7 @@ static inline TmSlot * _TmSlotSetFuncAppend(ThreadVars *tv, TmModule *tm, void *
     slot->slot_initdata = data;
     SC_ATOMIC_INIT(slot->SlotFunc);
     (void)SC_ATOMIC_SET(slot->SlotFunc, tm->Func);
+    slot->SlotFuncBatch = tm->FuncBatch;
     slot->PktAcqLoop = tm->PktAcqLoop;
     slot->SlotThreadExitPrintStats = tm->ThreadExitPrintStats;
     slot->SlotThreadDeinit = tm->ThreadDeinit;
@@ -1462,7 +1554,6 @@ ThreadVars *TmThreadCreate(char *name, char *inq_name, char *inqh_name,
     memset(tv, 0, sizeof(ThreadVars));
 
     SC_ATOMIC_INIT(tv->flags);
-    SCMutexInit(&tv->sc_perf_pctx.m, NULL);
 
     tv->name = name;
     /* default state for every newly created thread */
@@ -2037,7 +2128,10 @@ void TmThreadFree(ThreadVars *tv)
 
     SCLogDebug("Freeing thread '%s'.", tv->name);
 
-    SCMutexDestroy(&tv->sc_perf_pctx.m);
+    if (tv->flow_part != NULL) {
+        FlowPartitionRelease(tv->flow_part);
+        tv->flow_part = NULL;
+    }
 
     s = (TmSlot *)tv->tm_slots;
     while (s) {
@@ -2431,3 +2525,148 @@ ThreadVars *TmThreadsGetCallingThread(void)
 
     return NULL;
 }
+
+#ifdef UNITTESTS
+#include "util-unittest.h"
+#include "pkt-var.h"
+
+/** payload of the last packet the test stream slot handled, like the
+ *  stream state of the single flow of the test */
+static uint8_t *tm_test_flow_state = NULL;
+/** packets in the order the test detect slot saw them */
+static Packet *tm_test_detect_order[4];
+static int tm_test_detect_cnt = 0;
+static Packet *tm_test_pseudo = NULL;
+
+static TmEcode TmThreadsTestDecode(ThreadVars *tv, Packet *p, void *data,
+        PacketQueue *pq, PacketQueue *postpq)
+{
+    p->flags |= PKT_HAS_FLOW;
+    return TM_ECODE_OK;
+}
+
+static TmEcode TmThreadsTestDecodeBatch(ThreadVars *tv, Packet **pkts,
+        uint32_t cnt, void *data, PacketQueue *pq, PacketQueue *postpq)
+{
+    uint32_t i;
+    for (i = 0; i < cnt; i++)
+        TmThreadsTestDecode(tv, pkts[i], data, pq, postpq);
+    return TM_ECODE_OK;
+}
+
+/** updates the flow state to the packet, and queues a pseudo packet for
+ *  the last packet like the stream engine does at the end of a session */
+static TmEcode TmThreadsTestStream(ThreadVars *tv, Packet *p, void *data,
+        PacketQueue *pq, PacketQueue *postpq)
+{
+    tm_test_flow_state = p->payload;
+    if (p->payload_len == 3 && memcmp(p->payload, "two", 3) == 0)
+        PacketEnqueue(pq, tm_test_pseudo);
+    return TM_ECODE_OK;
+}
+
+/** alerts if the flow state is that of the packet itself */
+static TmEcode TmThreadsTestDetect(ThreadVars *tv, Packet *p, void *data,
+        PacketQueue *pq, PacketQueue *postpq)
+{
+    if (tm_test_detect_cnt < 4)
+        tm_test_detect_order[tm_test_detect_cnt++] = p;
+    if (p != tm_test_pseudo && tm_test_flow_state == p->payload)
+        p->alerts.cnt = 1;
+    return TM_ECODE_OK;
+}
+
+static void TmThreadsTestOut(ThreadVars *tv, Packet *p)
+{
+}
+
+/** \test the packets of a batch go through stream and detect one at a
+ *        time: two packets of a flow each alert on their own payload, and
+ *        a pseudo packet queued for the second packet is inspected after
+ *        the first one */
+static int TmThreadsBatchTest01(void)
+{
+    TmSlot slots[3];
+    ThreadVars tv;
+    Packet *pkts[2] = { NULL, NULL };
+    uint8_t one[] = "one";
+    uint8_t two[] = "two";
+    int result = 0;
+    int i;
+
+    memset(&slots, 0, sizeof(slots));
+    memset(&tv, 0, sizeof(tv));
+    tv.tmqh_out = TmThreadsTestOut;
+    tm_test_flow_state = NULL;
+    tm_test_detect_cnt = 0;
+
+    TmSlotFunc funcs[3] = { TmThreadsTestDecode, TmThreadsTestStream,
+                            TmThreadsTestDetect };
+    int tm_ids[3] = { TMM_DECODEPCAPFILE, TMM_STREAMTCP, TMM_DETECT };
+    for (i = 0; i < 3; i++) {
+        SC_ATOMIC_INIT(slots[i].SlotFunc);
+        SC_ATOMIC_INIT(slots[i].slot_data);
+        (void)SC_ATOMIC_SET(slots[i].SlotFunc, funcs[i]);
+        slots[i].tv = &tv;
+        slots[i].tm_id = tm_ids[i];
+        slots[i].id = i;
+        slots[i].slot_next = (i < 2) ? &slots[i + 1] : NULL;
+    }
+    slots[0].SlotFuncBatch = TmThreadsTestDecodeBatch;
+
+    for (i = 0; i < 2; i++) {
+        pkts[i] = SCMalloc(SIZE_OF_PACKET);
+        if (pkts[i] == NULL)
+            goto end;
+        PACKET_INITIALIZE(pkts[i]);
+        pkts[i]->payload = (i == 0) ? one : two;
+        pkts[i]->payload_len = 3;
+    }
+    tm_test_pseudo = SCMalloc(SIZE_OF_PACKET);
+    if (tm_test_pseudo == NULL)
+        goto end;
+    PACKET_INITIALIZE(tm_test_pseudo);
+
+    if (TmThreadsSlotVarRunBatch(&tv, pkts, 2, &slots[0]) != TM_ECODE_OK)
+        goto end;
+
+    for (i = 0; i < 2; i++) {
+        if (!(pkts[i]->flags & PKT_HAS_FLOW)) {
+            printf("packet %d not decoded: ", i);
+            goto end;
+        }
+        if (pkts[i]->alerts.cnt != 1) {
+            printf("packet %d didn't alert on its own payload: ", i);
+            goto end;
+        }
+    }
+    if (tm_test_detect_cnt != 3 || tm_test_detect_order[0] != pkts[0] ||
+            tm_test_detect_order[1] != tm_test_pseudo ||
+            tm_test_detect_order[2] != pkts[1]) {
+        printf("detect order wrong: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    for (i = 0; i < 2; i++) {
+        if (pkts[i] != NULL) {
+            PACKET_CLEANUP(pkts[i]);
+            SCFree(pkts[i]);
+        }
+    }
+    if (tm_test_pseudo != NULL) {
+        PACKET_CLEANUP(tm_test_pseudo);
+        SCFree(tm_test_pseudo);
+        tm_test_pseudo = NULL;
+    }
+    return result;
+}
+#endif /* UNITTESTS */
+
+void TmThreadsRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("TmThreadsBatchTest01", TmThreadsBatchTest01, 1);
+#endif /* UNITTESTS */
+}
@@ -35,12 +35,24 @@
 typedef TmEcode (*TmSlotFunc)(ThreadVars *, Packet *, void *, PacketQueue *,
                         PacketQueue *);
 
+typedef TmEcode (*TmSlotFuncBatch)(ThreadVars *, Packet **, uint32_t, void *,
+                        PacketQueue *, PacketQueue *);
+
+/** upper limit for the batch-size setting */
+#define TM_BATCH_SIZE_MAX 64
+
+/** number of packets the capture methods hand to the slots in one go,
+ *  1 means per packet processing */
+extern uint16_t tm_batch_size;
+
 typedef struct TmSlot_ {
     /* the TV holding this slot */
     ThreadVars *tv;
 
     /* function pointers */
     SC_ATOMIC_DECLARE(TmSlotFunc, SlotFunc);
+    /* optional batch version of SlotFunc, NULL if the module has none */
+    TmSlotFuncBatch SlotFuncBatch;
 
     TmEcode (*PktAcqLoop)(ThreadVars *, void *, void *);
 
@@ -126,11 +138,54 @@ void TmThreadsUnsetFlag(ThreadVars *, uint16_t);
 void TmThreadWaitForFlag(ThreadVars *, uint16_t);
 
 TmEcode TmThreadsSlotVarRun (ThreadVars *tv, Packet *p, TmSlot *slot);
+void TmThreadsRegisterTests(void);
+TmEcode TmThreadsSlotVarRunBatch(ThreadVars *tv, Packet **pkts, uint32_t cnt,
+        TmSlot *slot);
 
 ThreadVars *TmThreadsGetTVContainingSlot(TmSlot *);
 void TmThreadDisableThreadsWithTMS(uint8_t tm_flags);
 TmSlot *TmThreadGetFirstTmSlotForPartialPattern(const char *);
 
+/**
+ *  \brief Run the packets the slots queued in their post_pq through the
+ *         remaining slots and hand them to the output handler.
+ */
+static inline TmEcode TmThreadsSlotProcessPostPq(ThreadVars *tv, TmSlot *s)
+{
+    TmEcode r = TM_ECODE_OK;
+    TmSlot *slot = s;
+
+    while (slot != NULL) {
+        if (slot->slot_post_pq.top != NULL) {
+            while (1) {
+                SCMutexLock(&slot->slot_post_pq.mutex_q);
+                Packet *extra_p = PacketDequeue(&slot->slot_post_pq);
+                SCMutexUnlock(&slot->slot_post_pq.mutex_q);
+
+                if (extra_p == NULL)
+                    break;
+
+                if (slot->slot_next != NULL) {
+                    r = TmThreadsSlotVarRun(tv, extra_p, slot->slot_next);
+                    if (r == TM_ECODE_FAILED) {
+                        SCMutexLock(&slot->slot_post_pq.mutex_q);
+                        TmqhReleasePacketsToPacketPool(&slot->slot_post_pq);
+                        SCMutexUnlock(&slot->slot_post_pq.mutex_q);
+
+                        TmqhOutputPacketpool(tv, extra_p);
+                        TmThreadsSetFlag(tv, THV_FAILED);
+                        break;
+                    }
+                }
+                tv->tmqh_out(tv, extra_p);
+            }
+        } /* if (slot->slot_post_pq.top != NULL) */
+        slot = slot->slot_next;
+    } /* while (slot != NULL) */
+
+    return r;
+}
+
 /**
  *  \brief Process the rest of the functions (if any) and queue.
  */
@@ -159,38 +214,54 @@ static inline TmEcode TmThreadsSlotProcessPkt(ThreadVars *tv, TmSlot *s, Packet
     } else {
         tv->tmqh_out(tv, p);
 
-        /* post process pq */
+        r = TmThreadsSlotProcessPostPq(tv, s);
+    }
+
+    return r;
+}
+
+/**
+ *  \brief Process a batch of packets through the rest of the functions
+ *         (if any) and queue.
+ *
+ *  The leading slots with a FuncBatch hook see the whole batch before the
+ *  next slot runs, the rest of the slots are run per packet, see
+ *  TmThreadsSlotVarRunBatch(). The batch is expected to hold at most
+ *  tm_batch_size packets.
+ */
+static inline TmEcode TmThreadsSlotProcessPktBatch(ThreadVars *tv, TmSlot *s,
+        Packet **pkts, uint32_t cnt)
+{
+    uint32_t i;
+
+    if (s == NULL) {
+        for (i = 0; i < cnt; i++) {
+            tv->tmqh_out(tv, pkts[i]);
+        }
+        return TM_ECODE_OK;
+    }
+
+    if (TmThreadsSlotVarRunBatch(tv, pkts, cnt, s) == TM_ECODE_FAILED) {
+        for (i = 0; i < cnt; i++) {
+            TmqhOutputPacketpool(tv, pkts[i]);
+        }
         TmSlot *slot = s;
         while (slot != NULL) {
-            if (slot->slot_post_pq.top != NULL) {
-                while (1) {
-                    SCMutexLock(&slot->slot_post_pq.mutex_q);
-                    Packet *extra_p = PacketDequeue(&slot->slot_post_pq);
-                    SCMutexUnlock(&slot->slot_post_pq.mutex_q);
-
-                    if (extra_p == NULL)
-                        break;
+            SCMutexLock(&slot->slot_post_pq.mutex_q);
+            TmqhReleasePacketsToPacketPool(&slot->slot_post_pq);
+            SCMutexUnlock(&slot->slot_post_pq.mutex_q);
 
-                    if (slot->slot_next != NULL) {
-                        r = TmThreadsSlotVarRun(tv, extra_p, slot->slot_next);
-                        if (r == TM_ECODE_FAILED) {
-                            SCMutexLock(&slot->slot_post_pq.mutex_q);
-                            TmqhReleasePacketsToPacketPool(&slot->slot_post_pq);
-                            SCMutexUnlock(&slot->slot_post_pq.mutex_q);
-
-                            TmqhOutputPacketpool(tv, extra_p);
-                            TmThreadsSetFlag(tv, THV_FAILED);
-                            break;
-                        }
-                    }
-                    tv->tmqh_out(tv, extra_p);
-                }
-            } /* if (slot->slot_post_pq.top != NULL) */
             slot = slot->slot_next;
-        } /* while (slot != NULL) */
+        }
+        TmThreadsSetFlag(tv, THV_FAILED);
+        return TM_ECODE_FAILED;
     }
 
-    return r;
+    for (i = 0; i < cnt; i++) {
+        tv->tmqh_out(tv, pkts[i]);
+    }
+
+    return TmThreadsSlotProcessPostPq(tv, s);
 }
 
 #endif /* __TM_THREADS_H__ */
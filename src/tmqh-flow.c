@@ -37,16 +37,28 @@
 #include "tm-queuehandlers.h"
 
 #include "conf.h"
+#include "counters.h"
 #include "util-unittest.h"
 
 Packet *TmqhInputFlow(ThreadVars *t);
 void TmqhOutputFlowHash(ThreadVars *t, Packet *p);
 void TmqhOutputFlowActivePackets(ThreadVars *t, Packet *p);
 void TmqhOutputFlowRoundRobin(ThreadVars *t, Packet *p);
+void TmqhOutputFlowLoadBalance(ThreadVars *t, Packet *p);
 void *TmqhOutputFlowSetupCtx(char *queue_str);
 void TmqhOutputFlowFreeCtx(void *ctx);
 void TmqhFlowRegisterTests(void);
 
+static int32_t TmqhFlowSelectRoundRobin(TmqhFlowCtx *, Packet *);
+static int32_t TmqhFlowSelectActivePackets(TmqhFlowCtx *, Packet *);
+static int32_t TmqhFlowSelectHash(TmqhFlowCtx *, Packet *);
+static int32_t TmqhFlowSelectLoadBalance(TmqhFlowCtx *, Packet *);
+static void TmqhFlowLoadInit(void);
+static void TmqhFlowLoadRegisterCounters(TmqhFlowCtx *);
+
+/** queue selection of the configured "autofp-scheduler" */
+static int32_t (*tmqh_flow_select)(TmqhFlowCtx *, Packet *) = TmqhFlowSelectActivePackets;
+
 void TmqhFlowRegister(void)
 {
     tmqh_table[TMQH_FLOW].name = "flow";
@@ -55,17 +67,26 @@ void TmqhFlowRegister(void)
     tmqh_table[TMQH_FLOW].OutHandlerCtxFree = TmqhOutputFlowFreeCtx;
     tmqh_table[TMQH_FLOW].RegisterTests = TmqhFlowRegisterTests;
 
+    TmqhFlowLoadInit();
+
     char *scheduler = NULL;
     if (ConfGet("autofp-scheduler", &scheduler) == 1) {
         if (strcasecmp(scheduler, "round-robin") == 0) {
             SCLogInfo("AutoFP mode using \"Round Robin\" flow load balancer");
             tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowRoundRobin;
+            tmqh_flow_select = TmqhFlowSelectRoundRobin;
         } else if (strcasecmp(scheduler, "active-packets") == 0) {
             SCLogInfo("AutoFP mode using \"Active Packets\" flow load balancer");
             tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowActivePackets;
+            tmqh_flow_select = TmqhFlowSelectActivePackets;
         } else if (strcasecmp(scheduler, "hash") == 0) {
             SCLogInfo("AutoFP mode using \"Hash\" flow load balancer");
             tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
+            tmqh_flow_select = TmqhFlowSelectHash;
+        } else if (strcasecmp(scheduler, "load-balance") == 0) {
+            SCLogInfo("AutoFP mode using \"Load Balance\" flow load balancer");
+            tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowLoadBalance;
+            tmqh_flow_select = TmqhFlowSelectLoadBalance;
         } else {
             SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry \"%s\" "
                        "for autofp-scheduler in conf.  Killing engine.",
@@ -75,6 +96,7 @@ void TmqhFlowRegister(void)
     } else {
         SCLogInfo("AutoFP mode using default \"Active Packets\" flow load balancer");
         tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowActivePackets;
+        tmqh_flow_select = TmqhFlowSelectActivePackets;
     }
 
     return;
@@ -141,6 +163,8 @@ static int StoreQueueId(TmqhFlowCtx *ctx, char *name)
         memset(ctx->queues + (ctx->size - 1), 0, sizeof(TmqhFlowMode));
     }
     ctx->queues[ctx->size - 1].q = &trans_q[id];
+    ctx->queues[ctx->size - 1].id = id;
+    ctx->queues[ctx->size - 1].name = tmq->name;
     SC_ATOMIC_INIT(ctx->queues[ctx->size - 1].total_packets);
     SC_ATOMIC_INIT(ctx->queues[ctx->size - 1].total_flows);
 
@@ -192,6 +216,12 @@ void *TmqhOutputFlowSetupCtx(char *queue_str)
     } while (tstr != NULL);
 
     SC_ATOMIC_INIT(ctx->round_robin_idx);
+    ctx->lb_rand = (uint32_t)(uintptr_t)ctx ^ (uint32_t)time(NULL);
+    if (ctx->lb_rand == 0)
+        ctx->lb_rand = 1;
+
+    if (tmqh_flow_select == TmqhFlowSelectLoadBalance)
+        TmqhFlowLoadRegisterCounters(ctx);
 
     SCFree(str);
     return (void *)ctx;
@@ -223,18 +253,38 @@ void TmqhOutputFlowFreeCtx(void *ctx)
     return;
 }
 
+/**
+ * \brief enqueue a packet into the selected queue and wake up its reader
+ *
+ * \param ctx flow handler ctx
+ * \param qid queue to output to
+ * \param p packet
+ */
+static inline void TmqhFlowEnqueue(TmqhFlowCtx *ctx, int32_t qid, Packet *p)
+{
+    PacketQueue *q = ctx->queues[qid].q;
+    SCMutexLock(&q->mutex_q);
+    PacketEnqueue(q, p);
+#ifdef __tile__
+    q->cond_q = 1;
+#else
+    SCCondSignal(&q->cond_q);
+#endif
+    SCMutexUnlock(&q->mutex_q);
+}
+
 /**
  * \brief select the queue to output in a round robin fashion.
  *
- * \param tv thread vars
+ * \param ctx flow handler ctx
  * \param p packet
+ *
+ * \retval qid index into ctx->queues
  */
-void TmqhOutputFlowRoundRobin(ThreadVars *tv, Packet *p)
+static int32_t TmqhFlowSelectRoundRobin(TmqhFlowCtx *ctx, Packet *p)
 {
     int32_t qid = 0;
 
-    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
-
     /* if no flow we use the first queue,
      * should be rare */
     if (p->flow != NULL) {
@@ -256,31 +306,21 @@ void TmqhOutputFlowRoundRobin(ThreadVars *tv, Packet *p)
     }
     (void) SC_ATOMIC_ADD(ctx->queues[qid].total_packets, 1);
 
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-#ifdef __tile__
-    q->cond_q = 1;
-#else
-    SCCondSignal(&q->cond_q);
-#endif
-    SCMutexUnlock(&q->mutex_q);
-
-    return;
+    return qid;
 }
 
 /**
  * \brief select the queue to output to based on queue lengths.
  *
- * \param tv thread vars
+ * \param ctx flow handler ctx
  * \param p packet
+ *
+ * \retval qid index into ctx->queues
  */
-void TmqhOutputFlowActivePackets(ThreadVars *tv, Packet *p)
+static int32_t TmqhFlowSelectActivePackets(TmqhFlowCtx *ctx, Packet *p)
 {
     int32_t qid = 0;
 
-    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
-
     /* if no flow we use the first queue,
      * should be rare */
     if (p->flow != NULL) {
@@ -308,31 +348,21 @@ void TmqhOutputFlowActivePackets(ThreadVars *tv, Packet *p)
     }
     (void) SC_ATOMIC_ADD(ctx->queues[qid].total_packets, 1);
 
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-#ifdef __tile__
-    q->cond_q = 1;
-#else
-    SCCondSignal(&q->cond_q);
-#endif
-    SCMutexUnlock(&q->mutex_q);
-
-    return;
+    return qid;
 }
 
 /**
  * \brief select the queue to output based on address hash.
  *
- * \param tv thread vars.
- * \param p packet.
+ * \param ctx flow handler ctx
+ * \param p packet
+ *
+ * \retval qid index into ctx->queues
  */
-void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
+static int32_t TmqhFlowSelectHash(TmqhFlowCtx *ctx, Packet *p)
 {
     int32_t qid = 0;
 
-    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
-
     /* if no flow we use the first queue,
      * should be rare */
     if (p->flow != NULL) {
@@ -359,17 +389,440 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
     }
     (void) SC_ATOMIC_ADD(ctx->queues[qid].total_packets, 1);
 
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-#ifdef __tile__
-    q->cond_q = 1;
-#else
-    SCCondSignal(&q->cond_q);
-#endif
-    SCMutexUnlock(&q->mutex_q);
+    return qid;
+}
 
-    return;
+/** queues whose backlogs differ by less than this count as equally busy */
+#define TMQH_FLOW_LB_BACKLOG_SLACK  8
+/** min backlog of a queue before flows are moved off it */
+#define TMQH_FLOW_LB_HOT_BACKLOG    32
+/** load of a queue, in percent of the mean of the queues, from which
+ *  flows are moved off it */
+#define TMQH_FLOW_LB_HOT_LOAD       150
+/** min share, in percent, a flow has of its queue's byte rate to be moved */
+#define TMQH_FLOW_LB_MIN_SHARE      10
+
+/** load of a queue, shared by all writers to it */
+typedef struct TmqhFlowLoad_ {
+    /** bytes sent to the queue, handed in by the writers once a second */
+    SC_ATOMIC_DECLARE(uint64_t, bytes);
+    /** flows moved off the queue */
+    SC_ATOMIC_DECLARE(uint64_t, moved);
+    /** second a flow was last moved off the queue */
+    SC_ATOMIC_DECLARE(uint32_t, moved_sec);
+
+    /* set by the writer that closes a second */
+    uint64_t last_bytes;
+    /** bytes per second */
+    uint64_t rate;
+    /** rate in percent of the mean rate of the queues */
+    uint32_t load;
+
+    /* perf counter ids, 0 if not registered */
+    uint16_t rate_id;
+    uint16_t backlog_id;
+    uint16_t load_id;
+    uint16_t moved_id;
+} TmqhFlowLoad;
+
+static TmqhFlowLoad tmqh_flow_load[256];
+/** last second closed */
+static SC_ATOMIC_DECLARE(uint32_t, tmqh_flow_load_sec);
+
+/** queue load counters, published under "AutoFP" */
+static SCMutex tmqh_flow_perf_m;
+static SCPerfContext tmqh_flow_perf_ctx;
+static SCPerfCounterArray *tmqh_flow_perf_pca = NULL;
+static uint16_t tmqh_flow_imbalance_id = 0;
+
+static void TmqhFlowLoadInit(void)
+{
+    int i;
+
+    memset(tmqh_flow_load, 0, sizeof(tmqh_flow_load));
+    for (i = 0; i < 256; i++) {
+        SC_ATOMIC_INIT(tmqh_flow_load[i].bytes);
+        SC_ATOMIC_INIT(tmqh_flow_load[i].moved);
+        SC_ATOMIC_INIT(tmqh_flow_load[i].moved_sec);
+    }
+    SC_ATOMIC_INIT(tmqh_flow_load_sec);
+
+    SCMutexInit(&tmqh_flow_perf_m, NULL);
+    memset(&tmqh_flow_perf_ctx, 0, sizeof(tmqh_flow_perf_ctx));
+    tmqh_flow_perf_pca = NULL;
+    tmqh_flow_imbalance_id = 0;
+}
+
+/** \brief free the load counters. Called when all threads are gone. */
+void TmqhFlowDestroy(void)
+{
+    if (tmqh_flow_perf_pca != NULL) {
+        SCPerfReleasePCA(tmqh_flow_perf_pca);
+        tmqh_flow_perf_pca = NULL;
+    }
+    if (tmqh_flow_perf_ctx.head != NULL) {
+        SCPerfReleasePerfCounterS(tmqh_flow_perf_ctx.head);
+        memset(&tmqh_flow_perf_ctx, 0, sizeof(tmqh_flow_perf_ctx));
+    }
+    tmqh_flow_imbalance_id = 0;
+}
+
+/**
+ * \brief register the load counters of the queues of a writer ctx
+ *
+ * Per queue the byte rate, the backlog, the load in percent of the mean
+ * and the number of flows moved off it, and the load of the busiest
+ * queue as "autofp.imbalance". Called at thread setup.
+ */
+static void TmqhFlowLoadRegisterCounters(TmqhFlowCtx *ctx)
+{
+    char name[128];
+    uint16_t i;
+
+    SCMutexLock(&tmqh_flow_perf_m);
+    if (tmqh_flow_imbalance_id == 0) {
+        tmqh_flow_imbalance_id = SCPerfRegisterCounter("autofp.imbalance",
+                "AutoFP", SC_PERF_TYPE_UINT64, "NULL", &tmqh_flow_perf_ctx);
+        SCPerfAddToClubbedTMTable("AutoFP", &tmqh_flow_perf_ctx);
+    }
+
+    for (i = 0; i < ctx->size; i++) {
+        TmqhFlowLoad *l = &tmqh_flow_load[ctx->queues[i].id];
+        if (l->rate_id != 0)
+            continue;
+
+        snprintf(name, sizeof(name), "autofp.%s.bytes_per_sec",
+                ctx->queues[i].name);
+        l->rate_id = SCPerfRegisterCounter(name, "AutoFP",
+                SC_PERF_TYPE_UINT64, "NULL", &tmqh_flow_perf_ctx);
+        snprintf(name, sizeof(name), "autofp.%s.backlog",
+                ctx->queues[i].name);
+        l->backlog_id = SCPerfRegisterCounter(name, "AutoFP",
+                SC_PERF_TYPE_UINT64, "NULL", &tmqh_flow_perf_ctx);
+        snprintf(name, sizeof(name), "autofp.%s.load",
+                ctx->queues[i].name);
+        l->load_id = SCPerfRegisterCounter(name, "AutoFP",
+                SC_PERF_TYPE_UINT64, "NULL", &tmqh_flow_perf_ctx);
+        snprintf(name, sizeof(name), "autofp.%s.flows_moved",
+                ctx->queues[i].name);
+        l->moved_id = SCPerfRegisterCounter(name, "AutoFP",
+                SC_PERF_TYPE_UINT64, "NULL", &tmqh_flow_perf_ctx);
+    }
+    SCMutexUnlock(&tmqh_flow_perf_m);
+}
+
+/**
+ * \brief publish the queue loads to the counters
+ */
+static void TmqhFlowLoadPublish(TmqhFlowCtx *ctx, uint32_t max_load)
+{
+    uint16_t i;
+
+    if (tmqh_flow_perf_ctx.curr_id == 0)
+        return;
+
+    SCMutexLock(&tmqh_flow_perf_m);
+    if (tmqh_flow_perf_pca == NULL ||
+            tmqh_flow_perf_pca->size != tmqh_flow_perf_ctx.curr_id) {
+        if (tmqh_flow_perf_pca != NULL)
+            SCPerfReleasePCA(tmqh_flow_perf_pca);
+        tmqh_flow_perf_pca = SCPerfGetAllCountersArray(NULL,
+                &tmqh_flow_perf_ctx);
+        if (tmqh_flow_perf_pca == NULL) {
+            SCMutexUnlock(&tmqh_flow_perf_m);
+            return;
+        }
+    }
+
+    for (i = 0; i < ctx->size; i++) {
+        TmqhFlowLoad *l = &tmqh_flow_load[ctx->queues[i].id];
+        if (l->rate_id == 0)
+            continue;
+
+        SCPerfCounterSetUI64(l->rate_id, tmqh_flow_perf_pca, l->rate);
+        SCPerfCounterSetUI64(l->backlog_id, tmqh_flow_perf_pca,
+                (uint64_t)ctx->queues[i].q->len);
+        SCPerfCounterSetUI64(l->load_id, tmqh_flow_perf_pca, l->load);
+        SCPerfCounterSetUI64(l->moved_id, tmqh_flow_perf_pca,
+                SC_ATOMIC_GET(l->moved));
+    }
+    SCPerfCounterSetUI64(tmqh_flow_imbalance_id, tmqh_flow_perf_pca, max_load);
+    SCPerfUpdateCounterArray(tmqh_flow_perf_pca, &tmqh_flow_perf_ctx, 0);
+    SCMutexUnlock(&tmqh_flow_perf_m);
+}
+
+/**
+ * \brief start a new second: hand the bytes we sent in the last one to
+ *        the queues. The first writer to get here for a second also
+ *        updates the queue rates and loads.
+ *
+ * \param ctx flow handler ctx
+ * \param sec second of the packet we're handling
+ */
+static void TmqhFlowLoadTick(TmqhFlowCtx *ctx, uint32_t sec)
+{
+    uint16_t i;
+
+    for (i = 0; i < ctx->size; i++) {
+        if (ctx->queues[i].lb_bytes != 0) {
+            (void) SC_ATOMIC_ADD(tmqh_flow_load[ctx->queues[i].id].bytes,
+                    ctx->queues[i].lb_bytes);
+            ctx->queues[i].lb_bytes = 0;
+        }
+    }
+    ctx->lb_sec = sec;
+
+    uint32_t last = SC_ATOMIC_GET(tmqh_flow_load_sec);
+    if (sec <= last || !SC_ATOMIC_CAS(&tmqh_flow_load_sec, last, sec))
+        return;
+
+    uint32_t elapsed = (last != 0) ? sec - last : 1;
+    uint64_t total = 0;
+    for (i = 0; i < ctx->size; i++) {
+        TmqhFlowLoad *l = &tmqh_flow_load[ctx->queues[i].id];
+        uint64_t bytes = SC_ATOMIC_GET(l->bytes);
+
+        l->rate = (bytes - l->last_bytes) / elapsed;
+        l->last_bytes = bytes;
+        total += l->rate;
+    }
+
+    uint64_t mean = total / ctx->size;
+    uint32_t max_load = 0;
+    for (i = 0; i < ctx->size; i++) {
+        TmqhFlowLoad *l = &tmqh_flow_load[ctx->queues[i].id];
+
+        l->load = (mean != 0) ? (uint32_t)(l->rate * 100 / mean) : 100;
+        if (l->load > max_load)
+            max_load = l->load;
+    }
+    SCLogDebug("second %"PRIu32": mean %"PRIu64" bytes/s per queue, busiest "
+            "queue at %"PRIu32"%%", sec, mean, max_load);
+
+    TmqhFlowLoadPublish(ctx, max_load);
+}
+
+/** Flow::autofp_load from a second and the bytes seen in it */
+#define TMQH_FLOW_LOAD(sec, bytes)  (((uint64_t)(sec) << 32) | (uint32_t)(bytes))
+#define TMQH_FLOW_LOAD_SEC(v)       (uint32_t)((v) >> 32)
+#define TMQH_FLOW_LOAD_BYTES(v)     (uint32_t)(v)
+
+/**
+ * \brief account the bytes of a packet to its flow. autofp_rate holds
+ *        the bytes of the previous second, if the flow was active then.
+ *
+ * Packets of a flow can come in on more than one capture thread, so the
+ * second and its bytes are updated together with a CAS. Only the thread
+ * that moves the flow to a new second sets the rate.
+ */
+static inline void TmqhFlowLoadUpdateFlow(Flow *f, uint32_t sec, uint32_t len)
+{
+    uint64_t cur, nv;
+
+    do {
+        cur = SC_ATOMIC_GET(f->autofp_load);
+        if (TMQH_FLOW_LOAD_SEC(cur) != sec) {
+            nv = TMQH_FLOW_LOAD(sec, len);
+        } else {
+            uint32_t bytes = TMQH_FLOW_LOAD_BYTES(cur);
+            /* don't carry into the second */
+            if (bytes > UINT32_MAX - len)
+                return;
+            nv = cur + len;
+        }
+    } while (!SC_ATOMIC_CAS(&f->autofp_load, cur, nv));
+
+    if (TMQH_FLOW_LOAD_SEC(cur) != sec) {
+        (void) SC_ATOMIC_SET(f->autofp_rate,
+                (TMQH_FLOW_LOAD_SEC(cur) + 1 == sec) ?
+                TMQH_FLOW_LOAD_BYTES(cur) : 0);
+    }
+}
+
+/**
+ * \brief is queue a less busy than queue b. The backlog decides, unless
+ *        the backlogs are about the same, then the byte rate does.
+ */
+static inline int TmqhFlowLoadLess(TmqhFlowCtx *ctx, int32_t a, int32_t b)
+{
+    uint32_t alen = (uint32_t)ctx->queues[a].q->len;
+    uint32_t blen = (uint32_t)ctx->queues[b].q->len;
+
+    if (alen + TMQH_FLOW_LB_BACKLOG_SLACK < blen)
+        return 1;
+    if (blen + TMQH_FLOW_LB_BACKLOG_SLACK < alen)
+        return 0;
+
+    return tmqh_flow_load[ctx->queues[a].id].rate <
+           tmqh_flow_load[ctx->queues[b].id].rate;
+}
+
+/**
+ * \brief place a new flow: pick two queues at random and take the less
+ *        busy one. Looking at only two keeps writers that place flows at
+ *        the same time from all picking the same queue, as the rates
+ *        are only updated once a second.
+ */
+static int32_t TmqhFlowLoadPlace(TmqhFlowCtx *ctx)
+{
+    if (ctx->size == 1)
+        return 0;
+
+    /* xorshift */
+    uint32_t r = ctx->lb_rand;
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    ctx->lb_rand = r;
+
+    int32_t a = r % ctx->size;
+    int32_t b = (a + 1 + (r >> 16) % (ctx->size - 1)) % ctx->size;
+
+    return TmqhFlowLoadLess(ctx, b, a) ? b : a;
+}
+
+/**
+ * \brief move a flow off a hot queue, to the least busy queue
+ *
+ * Only flows that carry a good part of the queue's bytes are moved, at
+ * most one per queue per second. The flow is only moved when none of
+ * its packets is queued or being processed, so its packets can't be
+ * reordered: the packet we're handling holds the only reference to it.
+ *
+ * \retval qid queue the packet goes to
+ */
+static int32_t TmqhFlowLoadMove(TmqhFlowCtx *ctx, Flow *f, int32_t qid,
+                                uint32_t sec)
+{
+    TmqhFlowLoad *l = &tmqh_flow_load[ctx->queues[qid].id];
+    uint64_t frate = SC_ATOMIC_GET(f->autofp_rate);
+    uint32_t fbytes = TMQH_FLOW_LOAD_BYTES(SC_ATOMIC_GET(f->autofp_load));
+    int32_t target = 0;
+    int32_t i;
+
+    if (fbytes > frate)
+        frate = fbytes;
+    if (frate * 100 < l->rate * TMQH_FLOW_LB_MIN_SHARE)
+        return qid;
+
+    if (SC_ATOMIC_GET(f->use_cnt) != 1)
+        return qid;
+
+    for (i = 1; i < ctx->size; i++) {
+        if (TmqhFlowLoadLess(ctx, i, target))
+            target = i;
+    }
+    if (target == qid)
+        return qid;
+
+    /* only move if it makes the loads more even, not just moves the
+     * hot spot */
+    TmqhFlowLoad *t = &tmqh_flow_load[ctx->queues[target].id];
+    if (t->rate + 2 * frate >= l->rate ||
+            (uint32_t)ctx->queues[target].q->len >= TMQH_FLOW_LB_HOT_BACKLOG)
+        return qid;
+
+    uint32_t moved_sec = SC_ATOMIC_GET(l->moved_sec);
+    if (moved_sec == sec || !SC_ATOMIC_CAS(&l->moved_sec, moved_sec, sec))
+        return qid;
+
+    if (!SC_ATOMIC_CAS(&f->autofp_tmqh_flow_qid, qid, target))
+        return SC_ATOMIC_GET(f->autofp_tmqh_flow_qid);
+
+    (void) SC_ATOMIC_ADD(l->moved, 1);
+    (void) SC_ATOMIC_ADD(ctx->queues[target].total_flows, 1);
+    SCLogDebug("flow %p (%"PRIu64" bytes/s) moved from queue %"PRIu16
+            " (load %"PRIu32"%%) to %"PRIu16, f, frate,
+            ctx->queues[qid].id, l->load, ctx->queues[target].id);
+    return target;
+}
+
+/**
+ * \brief select the queue to output to based on the queue loads.
+ *
+ * New flows go to the less busy of two random queues. Flows on a hot
+ * queue, one that has a backlog and gets more bytes than the others, are
+ * moved to the least busy queue when that can be done without
+ * reordering their packets.
+ *
+ * \param ctx flow handler ctx
+ * \param p packet
+ *
+ * \retval qid index into ctx->queues
+ */
+static int32_t TmqhFlowSelectLoadBalance(TmqhFlowCtx *ctx, Packet *p)
+{
+    int32_t qid = 0;
+    uint32_t sec = (uint32_t)p->ts.tv_sec;
+
+    if (unlikely(sec != ctx->lb_sec))
+        TmqhFlowLoadTick(ctx, sec);
+
+    /* if no flow we use the first queue,
+     * should be rare */
+    if (p->flow != NULL) {
+        Flow *f = p->flow;
+
+        TmqhFlowLoadUpdateFlow(f, sec, GET_PKT_LEN(p));
+
+        qid = SC_ATOMIC_GET(f->autofp_tmqh_flow_qid);
+        if (qid == -1) {
+            qid = TmqhFlowLoadPlace(ctx);
+            (void) SC_ATOMIC_SET(f->autofp_tmqh_flow_qid, qid);
+            (void) SC_ATOMIC_ADD(ctx->queues[qid].total_flows, 1);
+        } else if (tmqh_flow_load[ctx->queues[qid].id].load >= TMQH_FLOW_LB_HOT_LOAD &&
+                (uint32_t)ctx->queues[qid].q->len >= TMQH_FLOW_LB_HOT_BACKLOG) {
+            qid = TmqhFlowLoadMove(ctx, f, qid, sec);
+        }
+    } else {
+        qid = ctx->last++;
+
+        if (ctx->last == ctx->size)
+            ctx->last = 0;
+    }
+    ctx->queues[qid].lb_bytes += GET_PKT_LEN(p);
+    (void) SC_ATOMIC_ADD(ctx->queues[qid].total_packets, 1);
+
+    return qid;
+}
+
+/**
+ * \brief select the queue to output to using the "autofp-scheduler"
+ *        set at registration. Used by queue handlers that share the
+ *        flow handler's ctx and load balancing.
+ *
+ * \param ctx flow handler ctx
+ * \param p packet
+ *
+ * \retval qid index into ctx->queues
+ */
+int32_t TmqhFlowSelectQueue(TmqhFlowCtx *ctx, Packet *p)
+{
+    return tmqh_flow_select(ctx, p);
+}
+
+void TmqhOutputFlowRoundRobin(ThreadVars *tv, Packet *p)
+{
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    TmqhFlowEnqueue(ctx, TmqhFlowSelectRoundRobin(ctx, p), p);
+}
+
+void TmqhOutputFlowActivePackets(ThreadVars *tv, Packet *p)
+{
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    TmqhFlowEnqueue(ctx, TmqhFlowSelectActivePackets(ctx, p), p);
+}
+
+void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
+{
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    TmqhFlowEnqueue(ctx, TmqhFlowSelectHash(ctx, p), p);
+}
+
+void TmqhOutputFlowLoadBalance(ThreadVars *tv, Packet *p)
+{
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    TmqhFlowEnqueue(ctx, TmqhFlowSelectLoadBalance(ctx, p), p);
 }
 
 #ifdef UNITTESTS
@@ -510,6 +963,260 @@ end:
     return retval;
 }
 
+/** \test new flows go to the less busy queue, by backlog first and byte
+ *        rate second */
+static int TmqhFlowLoadTest01(void)
+{
+    int retval = 0;
+    TmqhFlowCtx *fctx = NULL;
+    Flow f;
+    int i;
+
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    if (unlikely(p == NULL))
+        return 0;
+    memset(p, 0, SIZE_OF_PACKET);
+    memset(&f, 0, sizeof(f));
+
+    TmqResetQueues();
+    TmqhFlowLoadInit();
+
+    fctx = TmqhOutputFlowSetupCtx("queue1,queue2");
+    if (fctx == NULL)
+        goto end;
+
+    p->flow = &f;
+    p->pktlen = 100;
+    p->ts.tv_sec = 1000;
+
+    trans_q[0].len = 50;
+    trans_q[1].len = 0;
+    for (i = 0; i < 16; i++) {
+        (void) SC_ATOMIC_SET(f.autofp_tmqh_flow_qid, -1);
+        if (TmqhFlowSelectLoadBalance(fctx, p) != 1)
+            goto end;
+    }
+
+    trans_q[0].len = 4;
+    tmqh_flow_load[0].rate = 1000;
+    tmqh_flow_load[1].rate = 10;
+    for (i = 0; i < 16; i++) {
+        (void) SC_ATOMIC_SET(f.autofp_tmqh_flow_qid, -1);
+        if (TmqhFlowSelectLoadBalance(fctx, p) != 1)
+            goto end;
+    }
+
+    tmqh_flow_load[1].rate = 5000;
+    for (i = 0; i < 16; i++) {
+        (void) SC_ATOMIC_SET(f.autofp_tmqh_flow_qid, -1);
+        if (TmqhFlowSelectLoadBalance(fctx, p) != 0)
+            goto end;
+    }
+
+    retval = 1;
+end:
+    trans_q[0].len = 0;
+    trans_q[1].len = 0;
+    if (fctx != NULL) {
+        TmqhOutputFlowFreeCtx(fctx);
+        SCFree(fctx);
+    }
+    SCFree(p);
+    TmqhFlowLoadInit();
+    TmqResetQueues();
+    return retval;
+}
+
+/** \test only heavy flows without packets in flight are moved off a hot
+ *        queue, one per second */
+static int TmqhFlowLoadTest02(void)
+{
+    int retval = 0;
+    TmqhFlowCtx *fctx = NULL;
+    Flow f;
+
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    if (unlikely(p == NULL))
+        return 0;
+    memset(p, 0, SIZE_OF_PACKET);
+    memset(&f, 0, sizeof(f));
+
+    TmqResetQueues();
+    TmqhFlowLoadInit();
+
+    fctx = TmqhOutputFlowSetupCtx("queue1,queue2");
+    if (fctx == NULL)
+        goto end;
+
+    p->flow = &f;
+    p->pktlen = 100;
+    p->ts.tv_sec = 1000;
+
+    /* close the second first, it resets the rates */
+    (void) SC_ATOMIC_SET(f.autofp_tmqh_flow_qid, 0);
+    (void) TmqhFlowSelectLoadBalance(fctx, p);
+
+    trans_q[0].len = 64;
+    trans_q[1].len = 0;
+    tmqh_flow_load[0].rate = 10000;
+    tmqh_flow_load[0].load = 200;
+    tmqh_flow_load[1].rate = 0;
+    tmqh_flow_load[1].load = 0;
+
+    /* 1% of the queue's bytes, not worth it */
+    (void) SC_ATOMIC_SET(f.use_cnt, 1);
+    (void) SC_ATOMIC_SET(f.autofp_load, TMQH_FLOW_LOAD(999, 100));
+    if (TmqhFlowSelectLoadBalance(fctx, p) != 0)
+        goto end;
+
+    /* heavy, but its last packet is still being processed */
+    (void) SC_ATOMIC_SET(f.use_cnt, 2);
+    (void) SC_ATOMIC_SET(f.autofp_load, TMQH_FLOW_LOAD(999, 3000));
+    if (TmqhFlowSelectLoadBalance(fctx, p) != 0)
+        goto end;
+
+    (void) SC_ATOMIC_SET(f.use_cnt, 1);
+    (void) SC_ATOMIC_SET(f.autofp_load, TMQH_FLOW_LOAD(999, 3000));
+    if (TmqhFlowSelectLoadBalance(fctx, p) != 1)
+        goto end;
+    if (SC_ATOMIC_GET(f.autofp_tmqh_flow_qid) != 1 ||
+            SC_ATOMIC_GET(tmqh_flow_load[0].moved) != 1)
+        goto end;
+
+    /* a second flow has to wait for the next second */
+    (void) SC_ATOMIC_SET(f.autofp_tmqh_flow_qid, 0);
+    (void) SC_ATOMIC_SET(f.autofp_load, TMQH_FLOW_LOAD(999, 3000));
+    if (TmqhFlowSelectLoadBalance(fctx, p) != 0)
+        goto end;
+
+    retval = 1;
+end:
+    trans_q[0].len = 0;
+    trans_q[1].len = 0;
+    if (fctx != NULL) {
+        TmqhOutputFlowFreeCtx(fctx);
+        SCFree(fctx);
+    }
+    SCFree(p);
+    TmqhFlowLoadInit();
+    TmqResetQueues();
+    return retval;
+}
+
+/** \test queue and flow byte rates and queue loads at second boundaries */
+static int TmqhFlowLoadTest03(void)
+{
+    int retval = 0;
+    TmqhFlowCtx *fctx = NULL;
+    Flow f1, f2;
+    int i;
+
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    if (unlikely(p == NULL))
+        return 0;
+    memset(p, 0, SIZE_OF_PACKET);
+    memset(&f1, 0, sizeof(f1));
+    memset(&f2, 0, sizeof(f2));
+
+    TmqResetQueues();
+    TmqhFlowLoadInit();
+
+    fctx = TmqhOutputFlowSetupCtx("queue1,queue2");
+    if (fctx == NULL)
+        goto end;
+
+    (void) SC_ATOMIC_SET(f1.autofp_tmqh_flow_qid, 0);
+    (void) SC_ATOMIC_SET(f2.autofp_tmqh_flow_qid, 1);
+    p->pktlen = 100;
+    p->ts.tv_sec = 1000;
+
+    for (i = 0; i < 10; i++) {
+        p->flow = &f1;
+        if (TmqhFlowSelectLoadBalance(fctx, p) != 0)
+            goto end;
+        p->flow = &f2;
+        if (TmqhFlowSelectLoadBalance(fctx, p) != 1)
+            goto end;
+        if (TmqhFlowSelectLoadBalance(fctx, p) != 1)
+            goto end;
+        if (TmqhFlowSelectLoadBalance(fctx, p) != 1)
+            goto end;
+    }
+
+    p->ts.tv_sec = 1001;
+    p->flow = &f1;
+    (void) TmqhFlowSelectLoadBalance(fctx, p);
+
+    if (tmqh_flow_load[0].rate != 1000 || tmqh_flow_load[1].rate != 3000)
+        goto end;
+    if (tmqh_flow_load[0].load != 50 || tmqh_flow_load[1].load != 150)
+        goto end;
+    if (SC_ATOMIC_GET(f1.autofp_rate) != 1000 ||
+            SC_ATOMIC_GET(f1.autofp_load) != TMQH_FLOW_LOAD(1001, 100))
+        goto end;
+    if (SC_ATOMIC_GET(f2.autofp_load) != TMQH_FLOW_LOAD(1000, 3000))
+        goto end;
+
+    /* a flow that was idle for a while has no rate */
+    p->ts.tv_sec = 1005;
+    p->flow = &f2;
+    (void) TmqhFlowSelectLoadBalance(fctx, p);
+    if (SC_ATOMIC_GET(f2.autofp_rate) != 0 ||
+            SC_ATOMIC_GET(f2.autofp_load) != TMQH_FLOW_LOAD(1005, 100))
+        goto end;
+
+    retval = 1;
+end:
+    if (fctx != NULL) {
+        TmqhOutputFlowFreeCtx(fctx);
+        SCFree(fctx);
+    }
+    SCFree(p);
+    TmqhFlowLoadInit();
+    TmqResetQueues();
+    return retval;
+}
+
+#define TMQH_FLOW_TEST_UPDATES 100000
+
+static void *TmqhFlowLoadTestThread(void *data)
+{
+    Flow *f = (Flow *)data;
+    int i;
+
+    for (i = 0; i < TMQH_FLOW_TEST_UPDATES; i++)
+        TmqhFlowLoadUpdateFlow(f, 1000, 1);
+    return NULL;
+}
+
+/** \test two capture threads updating the bytes of the same flow */
+static int TmqhFlowLoadTest04(void)
+{
+    Flow f;
+    pthread_t t1, t2;
+
+    memset(&f, 0, sizeof(f));
+    SC_ATOMIC_INIT(f.autofp_load);
+    SC_ATOMIC_INIT(f.autofp_rate);
+    (void) SC_ATOMIC_SET(f.autofp_load, TMQH_FLOW_LOAD(999, 500));
+
+    if (pthread_create(&t1, NULL, TmqhFlowLoadTestThread, &f) != 0)
+        return 0;
+    if (pthread_create(&t2, NULL, TmqhFlowLoadTestThread, &f) != 0) {
+        pthread_join(t1, NULL);
+        return 0;
+    }
+    pthread_join(t1, NULL);
+    pthread_join(t2, NULL);
+
+    if (SC_ATOMIC_GET(f.autofp_load) !=
+            TMQH_FLOW_LOAD(1000, 2 * TMQH_FLOW_TEST_UPDATES))
+        return 0;
+    if (SC_ATOMIC_GET(f.autofp_rate) != 500)
+        return 0;
+    return 1;
+}
+
 #endif /* UNITTESTS */
 
 void TmqhFlowRegisterTests(void)
@@ -518,6 +1225,10 @@ void TmqhFlowRegisterTests(void)
     UtRegisterTest("TmqhOutputFlowSetupCtxTest01", TmqhOutputFlowSetupCtxTest01, 1);
     UtRegisterTest("TmqhOutputFlowSetupCtxTest02", TmqhOutputFlowSetupCtxTest02, 1);
     UtRegisterTest("TmqhOutputFlowSetupCtxTest03", TmqhOutputFlowSetupCtxTest03, 1);
+    UtRegisterTest("TmqhFlowLoadTest01", TmqhFlowLoadTest01, 1);
+    UtRegisterTest("TmqhFlowLoadTest02", TmqhFlowLoadTest02, 1);
+    UtRegisterTest("TmqhFlowLoadTest03", TmqhFlowLoadTest03, 1);
+    UtRegisterTest("TmqhFlowLoadTest04", TmqhFlowLoadTest04, 1);
 #endif
 
     return;
@@ -26,6 +26,12 @@
 
 typedef struct TmqhFlowMode_ {
     PacketQueue *q;
+    /** id of the queue, index into trans_q, and its name */
+    uint16_t id;
+    char *name;
+
+    /** bytes sent to the queue since the last second, "load-balance" */
+    uint64_t lb_bytes;
 
     SC_ATOMIC_DECLARE(uint64_t, total_packets);
     SC_ATOMIC_DECLARE(uint64_t, total_flows);
@@ -40,6 +46,10 @@ typedef struct TmqhFlowCtx_ {
 
     TmqhFlowMode *queues;
 
+    /** second of the last packet and random state, "load-balance" */
+    uint32_t lb_sec;
+    uint32_t lb_rand;
+
 #ifdef __tile__
     SC_ATOMIC_DECLARE(uint32_t, round_robin_idx);
 #else
@@ -48,6 +58,10 @@ typedef struct TmqhFlowCtx_ {
 } TmqhFlowCtx;
 
 void TmqhFlowRegister (void);
+void *TmqhOutputFlowSetupCtx(char *queue_str);
+void TmqhOutputFlowFreeCtx(void *ctx);
+int32_t TmqhFlowSelectQueue(TmqhFlowCtx *ctx, Packet *p);
 void TmqhFlowRegisterTests(void);
+void TmqhFlowDestroy(void);
 
 #endif /* __TMQH_FLOW_H__ */
@@ -26,6 +26,15 @@
  * because every thread can return packets to the pool and multiple parts
  * of the code retrieve packets (Decode, Defrag) and these can run in their
  * own threads as well.
+ *
+ * To keep the capture threads off the shared ringbuffer, every capture
+ * thread has a private free list that it refills from the ringbuffer in
+ * batches. Packets remember the pool they were taken into. The owner
+ * thread returns them to its free list without locking, other threads
+ * push them on the owner's lock free return stack, which the owner takes
+ * over in one go when its free list runs dry. Other threads (flow manager,
+ * pseudo packet producers) take single packets from the ringbuffer, as
+ * they would otherwise keep a batch of packets the capture threads need.
  */
 
 #include "suricata.h"
@@ -65,6 +74,43 @@
 static RingBuffer16 *ringbuffer[MAX_TILERA_PIPELINES] = { NULL };
 #else
 static RingBuffer16 *ringbuffer = NULL;
+
+/** packets moved from the ringbuffer to a thread pool in one go */
+#define PKT_POOL_REFILL_BATCH   32
+/** free packets a thread keeps, the rest goes back to the ringbuffer */
+#define PKT_POOL_MAX_LOCAL      (2 * PKT_POOL_REFILL_BATCH)
+
+/** \brief per thread packet pool */
+typedef struct PktPool_ {
+    /** free list, only touched by the owner thread */
+    Packet *head;
+    uint32_t cnt;
+
+    /** packets returned by other threads, linked through Packet::next */
+    SC_ATOMIC_DECLARE(Packet *, return_stack);
+    SC_ATOMIC_DECLARE(uint32_t, return_cnt);
+
+    /** set when the owner thread exited, the pool is then handed to
+     *  the next thread that needs one */
+    SC_ATOMIC_DECLARE(int, orphan);
+
+    /** gets that found neither a local nor a shared packet */
+    uint64_t starved;
+
+    struct PktPool_ *next;
+} PktPool;
+
+/** pool of the current thread, NULL until it got its first packet */
+static __thread PktPool *thread_pool = NULL;
+/** set by PacketPoolThreadInit() for the threads that may have a pool */
+static __thread int thread_pool_enabled = 0;
+/** key to get notified about the exit of a pool owner */
+static pthread_key_t thread_pool_key;
+static int thread_pool_key_set = 0;
+
+/** all pools, they're only freed at PacketPoolDestroy */
+static PktPool *pools = NULL;
+static SCMutex pools_lock = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
 int mica_memcpy_enabled = 0;
@@ -109,6 +155,250 @@ void TmqhPacketpoolDestroy (void) {
      * where we also clean the packets */
 }
 
+#ifndef __tile__
+/**
+ *  \brief Give the packets on the return stack of a pool to the
+ *         ringbuffer. Safe to call from any thread.
+ */
+static void PktPoolDrainReturned(PktPool *pool)
+{
+    Packet *head;
+    uint32_t cnt = 0;
+
+    do {
+        head = SC_ATOMIC_GET(pool->return_stack);
+        if (head == NULL)
+            return;
+    } while (SC_ATOMIC_CAS(&pool->return_stack, head, NULL) == 0);
+
+    while (head != NULL) {
+        Packet *p = head;
+        head = p->next;
+        p->next = NULL;
+        p->pool = NULL;
+        RingBufferMrMwPut(ringbuffer, (void *)p);
+        cnt++;
+    }
+    (void)SC_ATOMIC_SUB(pool->return_cnt, cnt);
+}
+
+/**
+ *  \brief Give the free packets of an exiting thread back to the
+ *         ringbuffer and mark its pool for reuse.
+ *
+ *  Packets still in flight keep pointing to the pool. Once the pool is
+ *  marked orphan the threads releasing them put them in the ringbuffer,
+ *  and the return stack is drained for the ones pushed before.
+ */
+static void PktPoolThreadExit(void *data)
+{
+    PktPool *pool = (PktPool *)data;
+    Packet *p;
+
+    while ((p = pool->head) != NULL) {
+        pool->head = p->next;
+        p->next = NULL;
+        p->pool = NULL;
+        RingBufferMrMwPut(ringbuffer, (void *)p);
+    }
+    pool->cnt = 0;
+
+    /* full barrier, pairs with the push in PktPoolReturnPacket() */
+    (void)SC_ATOMIC_SET(pool->orphan, 1);
+    PktPoolDrainReturned(pool);
+}
+
+/**
+ *  \brief Get the pool of the calling thread, setting it up on first use.
+ *
+ *  \retval pool or NULL if no pool could be set up
+ */
+static PktPool *PktPoolGetThreadPool(void)
+{
+    PktPool *pool = thread_pool;
+    if (likely(pool != NULL))
+        return pool;
+    if (!thread_pool_enabled)
+        return NULL;
+
+    SCMutexLock(&pools_lock);
+    /* reuse the pool of a thread that is gone */
+    for (pool = pools; pool != NULL; pool = pool->next) {
+        if (SC_ATOMIC_GET(pool->orphan) == 1) {
+            (void)SC_ATOMIC_SET(pool->orphan, 0);
+            break;
+        }
+    }
+    if (pool == NULL) {
+        pool = SCMalloc(sizeof(PktPool));
+        if (unlikely(pool == NULL)) {
+            SCMutexUnlock(&pools_lock);
+            return NULL;
+        }
+        memset(pool, 0x00, sizeof(PktPool));
+        SC_ATOMIC_INIT(pool->return_stack);
+        SC_ATOMIC_INIT(pool->return_cnt);
+        SC_ATOMIC_INIT(pool->orphan);
+
+        pool->next = pools;
+        pools = pool;
+    }
+    SCMutexUnlock(&pools_lock);
+
+    if (thread_pool_key_set)
+        (void)pthread_setspecific(thread_pool_key, pool);
+    thread_pool = pool;
+    return pool;
+}
+
+/**
+ *  \brief Take over the packets other threads returned to the pool.
+ */
+static void PktPoolTakeReturned(PktPool *pool)
+{
+    Packet *head;
+    uint32_t cnt = 0;
+
+    do {
+        head = SC_ATOMIC_GET(pool->return_stack);
+        if (head == NULL)
+            return;
+    } while (SC_ATOMIC_CAS(&pool->return_stack, head, NULL) == 0);
+
+    Packet *p = head;
+    while (p != NULL) {
+        Packet *next = p->next;
+        p->next = pool->head;
+        pool->head = p;
+        cnt++;
+        p = next;
+    }
+    pool->cnt += cnt;
+    (void)SC_ATOMIC_SUB(pool->return_cnt, cnt);
+}
+
+/**
+ *  \brief Refill an empty pool, from its return stack if there is
+ *         something on it, from the ringbuffer otherwise.
+ */
+static void PktPoolRefill(PktPool *pool)
+{
+    PktPoolTakeReturned(pool);
+    if (pool->head != NULL)
+        return;
+
+    int i;
+    for (i = 0; i < PKT_POOL_REFILL_BATCH; i++) {
+        if (RingBufferIsEmpty(ringbuffer))
+            break;
+
+        Packet *p = RingBufferMrMwGetNoWait(ringbuffer);
+        if (p == NULL)
+            break;
+
+        p->pool = pool;
+        p->next = pool->head;
+        pool->head = p;
+        pool->cnt++;
+    }
+}
+
+/**
+ *  \brief Return a packet to the pool it belongs to.
+ */
+static void PktPoolReturnPacket(Packet *p)
+{
+    PktPool *pool = p->pool;
+
+    if (pool == NULL || SC_ATOMIC_GET(pool->orphan) == 1) {
+        /* no owner to take it back, give it to the ringbuffer */
+        p->pool = NULL;
+        RingBufferMrMwPut(ringbuffer, (void *)p);
+    } else if (pool == thread_pool) {
+        if (pool->cnt >= PKT_POOL_MAX_LOCAL) {
+            p->pool = NULL;
+            RingBufferMrMwPut(ringbuffer, (void *)p);
+            return;
+        }
+        p->next = pool->head;
+        pool->head = p;
+        pool->cnt++;
+    } else {
+        Packet *head;
+        do {
+            head = SC_ATOMIC_GET(pool->return_stack);
+            p->next = head;
+        } while (SC_ATOMIC_CAS(&pool->return_stack, head, p) == 0);
+        (void)SC_ATOMIC_ADD(pool->return_cnt, 1);
+
+        /* the owner may have exited after we checked, after its last
+         * look at the stack. Then nobody takes the stack, so drain it. */
+        if (unlikely(SC_ATOMIC_GET(pool->orphan) == 1))
+            PktPoolDrainReturned(pool);
+    }
+}
+
+/**
+ *  \brief Update the packet pool counters of the calling thread
+ *
+ *  \param tv thread vars the counters are registered to
+ *  \param depth id of the pool depth counter
+ *  \param starved id of the pool starvation counter
+ */
+void PacketPoolUpdateCounters(ThreadVars *tv, uint16_t depth, uint16_t starved)
+{
+    PktPool *pool = thread_pool;
+    if (pool == NULL)
+        return;
+
+    SCPerfCounterSetUI64(depth, tv->sc_perf_pca,
+            pool->cnt + SC_ATOMIC_GET(pool->return_cnt));
+    SCPerfCounterSetUI64(starved, tv->sc_perf_pca, pool->starved);
+}
+
+/**
+ *  \brief Let the calling thread use a private packet pool. Only for
+ *         capture threads, they are the ones giving packets back.
+ */
+void PacketPoolThreadInit(void)
+{
+    thread_pool_enabled = 1;
+}
+
+/**
+ *  \brief Give the packets of the calling thread's pool back to the
+ *         ringbuffer. Called when a capture thread deinits.
+ */
+void PacketPoolThreadDeinit(void)
+{
+    PktPool *pool = thread_pool;
+
+    thread_pool_enabled = 0;
+    if (pool == NULL)
+        return;
+
+    PktPoolTakeReturned(pool);
+    PktPoolThreadExit(pool);
+
+    if (thread_pool_key_set)
+        (void)pthread_setspecific(thread_pool_key, NULL);
+    thread_pool = NULL;
+}
+#else /* __tile__ */
+/* the tile packet pools are per pipeline, there is no thread pool */
+void PacketPoolUpdateCounters(ThreadVars *tv, uint16_t depth, uint16_t starved)
+{
+}
+
+void PacketPoolThreadInit(void)
+{
+}
+
+void PacketPoolThreadDeinit(void)
+{
+}
+#endif /* !__tile__ */
+
 #ifdef __tile__
 int PacketPoolIsEmpty(int pool) {
     return RingBufferIsEmpty(ringbuffer[pool]);
@@ -125,7 +415,13 @@ uint16_t PacketPoolSize(int pool) {
 }
 #else
 uint16_t PacketPoolSize(void) {
-    return RingBufferSize(ringbuffer);
+    uint32_t size = RingBufferSize(ringbuffer);
+    PktPool *pool = thread_pool;
+
+    if (pool != NULL)
+        size += pool->cnt + SC_ATOMIC_GET(pool->return_cnt);
+
+    return (size > 0xffff) ? 0xffff : (uint16_t)size;
 }
 #endif
 
@@ -178,10 +474,26 @@ Packet *PacketPoolGetPacket(int pool) {
 }
 #else
 Packet *PacketPoolGetPacket(void) {
-    if (RingBufferIsEmpty(ringbuffer))
-        return NULL;
+    PktPool *pool = PktPoolGetThreadPool();
+    if (unlikely(pool == NULL)) {
+        if (RingBufferIsEmpty(ringbuffer))
+            return NULL;
+
+        return RingBufferMrMwGetNoWait(ringbuffer);
+    }
 
-    Packet *p = RingBufferMrMwGetNoWait(ringbuffer);
+    if (pool->head == NULL) {
+        PktPoolRefill(pool);
+        if (pool->head == NULL) {
+            pool->starved++;
+            return NULL;
+        }
+    }
+
+    Packet *p = pool->head;
+    pool->head = p->next;
+    pool->cnt--;
+    p->next = NULL;
     return p;
 }
 #endif
@@ -192,6 +504,13 @@ void PacketPoolInit(intmax_t max_pending_packets) {
 }
 #else
 void PacketPoolInit(intmax_t max_pending_packets) {
+    if (pthread_key_create(&thread_pool_key, PktPoolThreadExit) == 0) {
+        thread_pool_key_set = 1;
+    } else {
+        SCLogWarning(SC_ERR_THREAD_INIT, "can't track packet pool owners, "
+                "pools of exited threads won't be reused");
+    }
+
     /* pre allocate packets */
     SCLogDebug("preallocating packets... packet size %" PRIuMAX "", (uintmax_t)SIZE_OF_PACKET);
     int i = 0;
@@ -222,13 +541,35 @@ void PacketPoolDestroy(void) {
     }
 
     Packet *p = NULL;
-    while ((p = PacketPoolGetPacket()) != NULL) {
+    PktPool *pool = pools;
+    while (pool != NULL) {
+        PktPool *next = pool->next;
+
+        PktPoolTakeReturned(pool);
+        while ((p = pool->head) != NULL) {
+            pool->head = p->next;
+            PACKET_CLEANUP(p);
+            SCFree(p);
+        }
+        SCFree(pool);
+        pool = next;
+    }
+    pools = NULL;
+    thread_pool = NULL;
+
+    while (!RingBufferIsEmpty(ringbuffer) &&
+            (p = RingBufferMrMwGetNoWait(ringbuffer)) != NULL) {
         PACKET_CLEANUP(p);
         SCFree(p);
     }
 
     RingBufferDestroy(ringbuffer);
     ringbuffer = NULL;
+
+    if (thread_pool_key_set) {
+        (void)pthread_key_delete(thread_pool_key);
+        thread_pool_key_set = 0;
+    }
 }
 #endif
 
@@ -375,7 +716,7 @@ void TmqhOutputPacketpool(ThreadVars *t, Packet *p)
 #ifdef __tile__
             MPIPE_FREE_PACKET(p->root);
 #else
-            RingBufferMrMwPut(ringbuffer, (void *)p->root);
+            PktPoolReturnPacket(p->root);
 #endif
         }
 
@@ -422,7 +763,7 @@ void TmqhOutputPacketpool(ThreadVars *t, Packet *p)
             //tmc_mem_fence();
             MPIPE_FREE_PACKET(p);
 #else
-            RingBufferMrMwPut(ringbuffer, (void *)p);
+            PktPoolReturnPacket(p);
 #endif
 #ifdef __tilegx__
         }
@@ -39,6 +39,9 @@ uint16_t PacketPoolSize(void);
 void PacketPoolWait(void);
 #endif
 void PacketPoolStorePacket(Packet *);
+void PacketPoolUpdateCounters(ThreadVars *, uint16_t, uint16_t);
+void PacketPoolThreadInit(void);
+void PacketPoolThreadDeinit(void);
 
 void PacketPoolInit(intmax_t max_pending_packets);
 void PacketPoolDestroy(void);
@@ -0,0 +1,810 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Flow pinned queue handler built on lock free single producer, single
+ * consumer rings. Load balancing is the same as the "flow" handler's
+ * (see "autofp-scheduler"), but every writer thread gets a ring of its
+ * own into each of the queues, so no queue mutex is taken and no
+ * condition is signalled for each packet.
+ *
+ * A ring slot is free when it is NULL. The writer only fills free slots
+ * and the reader clears the slots it takes, so the two sides don't share
+ * a head or tail index, only the cache lines of the slots themselves.
+ * The reader takes up to TMQH_SPSC_BATCH packets from its rings at a
+ * time and hands them out one by one.
+ *
+ * The queue's len is kept as the number of packets the reader has not
+ * picked up yet, so the "active-packets" scheduler and the shutdown code
+ * that waits for the queues to dry out work unchanged.
+ *
+ * An idle reader spins, then yields, then sleeps on the queue's
+ * condition. The spin time adapts: it grows when spinning found packets
+ * and shrinks when the reader had to go to sleep anyway. Writers only
+ * take the queue mutex to wake up a reader that is sleeping.
+ *
+ * Each queue must have a single reader thread, as in the autofp runmodes.
+ */
+
+#include "suricata.h"
+#include "packet-queue.h"
+#include "decode.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tmqh-flow.h"
+#include "tmqh-spsc.h"
+#include "tm-queues.h"
+
+#include "tm-queuehandlers.h"
+#include "tm-threads.h"
+
+#include "util-optimize.h"
+#include "util-unittest.h"
+
+extern intmax_t max_pending_packets;
+
+/** max number of writer threads per queue */
+#define TMQH_SPSC_MAX_RINGS     64
+/** max number of packets the reader takes from its rings at a time */
+#define TMQH_SPSC_BATCH         32
+/** bounds of the adaptive spin of an idle reader */
+#define TMQH_SPSC_SPIN_MIN      64
+#define TMQH_SPSC_SPIN_MAX      16384
+/** yields of an idle reader between spinning and sleeping */
+#define TMQH_SPSC_YIELDS        8
+/** max time a reader sleeps before checking its thread flags */
+#define TMQH_SPSC_WAIT_USEC     10000
+/** min number of slots per ring */
+#define TMQH_SPSC_MIN_SLOTS     64
+
+#ifdef __ATOMIC_ACQUIRE
+#define TMQH_SPSC_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define TMQH_SPSC_STORE(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#else
+#define TMQH_SPSC_LOAD(ptr) ({ \
+    __typeof__(*(ptr)) _v = *(volatile __typeof__(*(ptr)) *)(ptr); \
+    hw_barrier(); \
+    _v; \
+})
+#define TMQH_SPSC_STORE(ptr, val) do { \
+    hw_barrier(); \
+    *(volatile __typeof__(*(ptr)) *)(ptr) = (val); \
+} while (0)
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+#define TMQH_SPSC_PAUSE() __asm__ __volatile__("pause" : : : "memory")
+#else
+#define TMQH_SPSC_PAUSE() cc_barrier()
+#endif
+
+struct TmqhSpscQueue_;
+
+/** ring from one writer thread into one queue */
+typedef struct TmqhSpscRing_ {
+    /* writer side */
+    uint32_t tail;
+    /** packets the writer had to wait for a free slot for */
+    uint64_t stalls;
+    /** set when the writer is gone, so the ring can be handed to a new
+     *  writer */
+    int gone;
+
+    /* read only */
+    struct TmqhSpscQueue_ *sq;
+    uint32_t mask;
+    Packet **slots;
+
+    /* reader side, a cache line away from the writer side */
+    uint8_t pad[64];
+    uint32_t head;
+} TmqhSpscRing;
+
+/** rings and reader state of one queue */
+typedef struct TmqhSpscQueue_ {
+    PacketQueue *q;
+
+    /** rings of the writers, only added to */
+    TmqhSpscRing *rings[TMQH_SPSC_MAX_RINGS];
+    uint32_t nrings;
+
+    /* reader side, a cache line away from the rings */
+    uint8_t pad[64];
+    /** set while the reader sleeps */
+    volatile int waiting;
+    uint32_t spin;
+    uint32_t next;
+    /** packets taken in the last batch and how many were handed out */
+    uint32_t cnt;
+    uint32_t idx;
+    Packet *batch[TMQH_SPSC_BATCH];
+} TmqhSpscQueue;
+
+/** writer thread ctx */
+typedef struct TmqhSpscCtx_ {
+    /** queues and load balancing, as in the "flow" handler */
+    TmqhFlowCtx *fctx;
+    /** our ring into each of fctx->queues */
+    TmqhSpscRing **rings;
+} TmqhSpscCtx;
+
+/** per queue id, TmqCreateQueue() hands out ids below TMQ_MAX_QUEUES */
+static TmqhSpscQueue *spsc_queues[TMQ_MAX_QUEUES];
+
+Packet *TmqhInputSpsc(ThreadVars *t);
+void TmqhOutputSpsc(ThreadVars *t, Packet *p);
+void *TmqhOutputSpscSetupCtx(char *queue_str);
+void TmqhOutputSpscFreeCtx(void *ctx);
+
+void TmqhSpscRegister(void)
+{
+    tmqh_table[TMQH_SPSC].name = "spsc";
+    tmqh_table[TMQH_SPSC].InHandler = TmqhInputSpsc;
+    tmqh_table[TMQH_SPSC].OutHandler = TmqhOutputSpsc;
+    tmqh_table[TMQH_SPSC].OutHandlerCtxSetup = TmqhOutputSpscSetupCtx;
+    tmqh_table[TMQH_SPSC].OutHandlerCtxFree = TmqhOutputSpscFreeCtx;
+    tmqh_table[TMQH_SPSC].RegisterTests = TmqhSpscRegisterTests;
+
+    memset(spsc_queues, 0, sizeof(spsc_queues));
+}
+
+/** \brief free the rings. Only to be called when all threads are gone. */
+void TmqhSpscDestroy(void)
+{
+    int i;
+    uint32_t r;
+
+    for (i = 0; i < TMQ_MAX_QUEUES; i++) {
+        TmqhSpscQueue *sq = spsc_queues[i];
+        if (sq == NULL)
+            continue;
+
+        for (r = 0; r < sq->nrings; r++) {
+            SCFree(sq->rings[r]->slots);
+            SCFree(sq->rings[r]);
+        }
+        SCFree(sq);
+        spsc_queues[i] = NULL;
+    }
+}
+
+/**
+ * \brief get a ring into a queue for a new writer. A ring of a writer
+ *        that is gone is reused, otherwise a new one is added.
+ *
+ * Called at thread setup time, before the writer runs.
+ *
+ * \param id queue id
+ *
+ * \retval ring or NULL on error
+ */
+static TmqhSpscRing *TmqhSpscRingGet(uint16_t id)
+{
+    TmqhSpscQueue *sq;
+    uint32_t r;
+
+    if (id >= TMQ_MAX_QUEUES) {
+        SCLogError(SC_ERR_INVALID_VALUE, "queue id %"PRIu16" out of range, "
+                "the spsc handler supports at most %d queues", id,
+                TMQ_MAX_QUEUES);
+        return NULL;
+    }
+
+    sq = spsc_queues[id];
+    if (sq == NULL) {
+        sq = SCMalloc(sizeof(TmqhSpscQueue));
+        if (unlikely(sq == NULL))
+            return NULL;
+        memset(sq, 0, sizeof(TmqhSpscQueue));
+        sq->q = &trans_q[id];
+        sq->spin = TMQH_SPSC_SPIN_MIN;
+        spsc_queues[id] = sq;
+    }
+
+    for (r = 0; r < sq->nrings; r++) {
+        if (sq->rings[r]->gone) {
+            sq->rings[r]->gone = 0;
+            sq->rings[r]->stalls = 0;
+            return sq->rings[r];
+        }
+    }
+
+    if (sq->nrings == TMQH_SPSC_MAX_RINGS) {
+        SCLogError(SC_ERR_INVALID_VALUE, "more than %d writers to queue "
+                "id %"PRIu16, TMQH_SPSC_MAX_RINGS, id);
+        return NULL;
+    }
+
+    /* size the ring for the packet pool. Packets from PacketGetFromAlloc()
+     * when the pool is empty aren't bounded by it, so the ring can still
+     * fill up. The writer then yields until the reader frees a slot, which
+     * is counted in stalls and logged when the writer goes away. */
+    uint32_t size = TMQH_SPSC_MIN_SLOTS;
+    while (size < (uint32_t)max_pending_packets && size < (1 << 20))
+        size <<= 1;
+
+    TmqhSpscRing *ring = SCMalloc(sizeof(TmqhSpscRing));
+    if (unlikely(ring == NULL))
+        return NULL;
+    memset(ring, 0, sizeof(TmqhSpscRing));
+
+    ring->slots = SCMalloc(size * sizeof(Packet *));
+    if (unlikely(ring->slots == NULL)) {
+        SCFree(ring);
+        return NULL;
+    }
+    memset(ring->slots, 0, size * sizeof(Packet *));
+    ring->mask = size - 1;
+    ring->sq = sq;
+
+    sq->rings[sq->nrings] = ring;
+    /* a running reader picks up the new ring on its next batch */
+    TMQH_SPSC_STORE(&sq->nrings, sq->nrings + 1);
+    return ring;
+}
+
+/**
+ * \brief setup the writer ctx
+ *
+ * Parses the comma separated queue names like the "flow" handler does
+ * and gets a ring into each of the queues.
+ *
+ * \param queue_str comma separated string with output queue names
+ *
+ * \retval ctx queue handler ctx or NULL on error
+ */
+void *TmqhOutputSpscSetupCtx(char *queue_str)
+{
+    TmqhSpscCtx *ctx = NULL;
+    uint16_t i;
+
+    TmqhFlowCtx *fctx = TmqhOutputFlowSetupCtx(queue_str);
+    if (fctx == NULL)
+        return NULL;
+
+    ctx = SCMalloc(sizeof(TmqhSpscCtx));
+    if (unlikely(ctx == NULL))
+        goto error;
+    memset(ctx, 0, sizeof(TmqhSpscCtx));
+    ctx->fctx = fctx;
+
+    ctx->rings = SCMalloc(fctx->size * sizeof(TmqhSpscRing *));
+    if (unlikely(ctx->rings == NULL))
+        goto error;
+    memset(ctx->rings, 0, fctx->size * sizeof(TmqhSpscRing *));
+
+    for (i = 0; i < fctx->size; i++) {
+        ctx->rings[i] = TmqhSpscRingGet(fctx->queues[i].q - trans_q);
+        if (ctx->rings[i] == NULL)
+            goto error;
+    }
+
+    return (void *)ctx;
+
+error:
+    if (ctx != NULL) {
+        if (ctx->rings != NULL) {
+            for (i = 0; i < fctx->size; i++) {
+                if (ctx->rings[i] != NULL)
+                    ctx->rings[i]->gone = 1;
+            }
+            SCFree(ctx->rings);
+        }
+        SCFree(ctx);
+    }
+    TmqhOutputFlowFreeCtx(fctx);
+    SCFree(fctx);
+    return NULL;
+}
+
+/**
+ * \brief free the writer ctx. The rings stay with their queues, as the
+ *        reader may still have to pick up packets from them.
+ */
+void TmqhOutputSpscFreeCtx(void *ctx)
+{
+    TmqhSpscCtx *sctx = (TmqhSpscCtx *)ctx;
+    uint16_t i;
+
+    for (i = 0; i < sctx->fctx->size; i++) {
+        TmqhSpscRing *ring = sctx->rings[i];
+        if (ring->stalls > 0) {
+            SCLogInfo("spsc queue %"PRIu16": writer waited for a free slot "
+                    "for %"PRIu64" packets, ring size %"PRIu32,
+                    (uint16_t)(ring->sq->q - trans_q), ring->stalls,
+                    ring->mask + 1);
+        }
+        ring->gone = 1;
+    }
+
+    TmqhOutputFlowFreeCtx(sctx->fctx);
+    SCFree(sctx->fctx);
+    SCFree(sctx->rings);
+    SCFree(sctx);
+}
+
+/**
+ * \brief put a packet in our ring into the queue selected for its flow
+ *
+ * \param tv thread vars
+ * \param p packet
+ */
+void TmqhOutputSpsc(ThreadVars *tv, Packet *p)
+{
+    TmqhSpscCtx *ctx = (TmqhSpscCtx *)tv->outctx;
+    int32_t qid = TmqhFlowSelectQueue(ctx->fctx, p);
+    TmqhSpscRing *ring = ctx->rings[qid];
+    TmqhSpscQueue *sq = ring->sq;
+    PacketQueue *q = sq->q;
+    Packet **slot = &ring->slots[ring->tail & ring->mask];
+
+    /* ring full, the reader is awake as it has packets to process */
+    if (unlikely(TMQH_SPSC_LOAD(slot) != NULL)) {
+        ring->stalls++;
+        do {
+            sched_yield();
+        } while (TMQH_SPSC_LOAD(slot) != NULL);
+    }
+
+    /* count the packet before the reader can see it, so len never
+     * drops below the number of packets in the rings. The atomic op
+     * also orders it with the check for a sleeping reader below. */
+    (void)SCAtomicAddAndFetch(&q->len, 1);
+    TMQH_SPSC_STORE(slot, p);
+    ring->tail++;
+
+    if (unlikely(sq->waiting)) {
+#ifndef __tile__
+        SCMutexLock(&q->mutex_q);
+        SCCondSignal(&q->cond_q);
+        SCMutexUnlock(&q->mutex_q);
+#endif
+    }
+}
+
+/**
+ * \brief take a batch of packets from the rings of a queue, starting at
+ *        a different ring each time so no writer is favoured
+ *
+ * \retval cnt number of packets taken
+ */
+static uint32_t TmqhSpscTakeBatch(TmqhSpscQueue *sq)
+{
+    uint32_t nrings = TMQH_SPSC_LOAD(&sq->nrings);
+    uint32_t cnt = 0;
+    uint32_t r;
+
+    if (nrings == 0)
+        return 0;
+
+    for (r = 0; r < nrings && cnt < TMQH_SPSC_BATCH; r++) {
+        TmqhSpscRing *ring = sq->rings[(sq->next + r) % nrings];
+
+        while (cnt < TMQH_SPSC_BATCH) {
+            Packet **slot = &ring->slots[ring->head & ring->mask];
+            Packet *p = TMQH_SPSC_LOAD(slot);
+            if (p == NULL)
+                break;
+
+            TMQH_SPSC_STORE(slot, NULL);
+            ring->head++;
+            sq->batch[cnt++] = p;
+        }
+    }
+    sq->next = (sq->next + 1) % nrings;
+
+    sq->cnt = cnt;
+    sq->idx = 0;
+    return cnt;
+}
+
+/**
+ * \brief sleep until a writer wakes us up or the wait times out
+ */
+static void TmqhSpscSleep(ThreadVars *tv, TmqhSpscQueue *sq)
+{
+    PacketQueue *q = sq->q;
+
+#ifdef __tile__
+    usleep(TMQH_SPSC_WAIT_USEC / 10);
+#else
+    struct timeval tv_now;
+    struct timespec ts;
+
+    gettimeofday(&tv_now, NULL);
+    tv_now.tv_usec += TMQH_SPSC_WAIT_USEC;
+    ts.tv_sec = tv_now.tv_sec + tv_now.tv_usec / 1000000;
+    ts.tv_nsec = (tv_now.tv_usec % 1000000) * 1000;
+
+    SCMutexLock(&q->mutex_q);
+    sq->waiting = 1;
+    /* pairs with the atomic len update of the writers: either they see
+     * us waiting, or we see the packet they counted */
+    hw_barrier();
+    if (q->len == 0 && !TmThreadsCheckFlag(tv, THV_KILL)) {
+        SCCondTimedwait(&q->cond_q, &q->mutex_q, &ts);
+    }
+    sq->waiting = 0;
+    SCMutexUnlock(&q->mutex_q);
+#endif
+}
+
+/**
+ * \brief get the next packet for the reader of the queue
+ *
+ * \retval p packet or NULL if none came in while we waited
+ */
+Packet *TmqhInputSpsc(ThreadVars *tv)
+{
+    PacketQueue *q = &trans_q[tv->inq->id];
+    TmqhSpscQueue *sq = spsc_queues[tv->inq->id];
+    uint32_t spins;
+
+    if (sq == NULL) {
+        /* no writers (yet) */
+        usleep(TMQH_SPSC_WAIT_USEC);
+        return NULL;
+    }
+
+    if (sq->idx < sq->cnt)
+        return sq->batch[sq->idx++];
+
+    SCPerfSyncCountersIfSignalled(tv, 0);
+
+    /* the packets of the last batch have all been handed out, only now
+     * they stop counting as queued */
+    if (sq->cnt > 0) {
+        (void)SCAtomicSubAndFetch(&q->len, sq->cnt);
+        sq->cnt = sq->idx = 0;
+    }
+
+    if (TmqhSpscTakeBatch(sq) > 0)
+        return sq->batch[sq->idx++];
+
+    for (spins = 0; spins < sq->spin; spins++) {
+        TMQH_SPSC_PAUSE();
+        if (q->len != 0 && TmqhSpscTakeBatch(sq) > 0) {
+            if (sq->spin < TMQH_SPSC_SPIN_MAX)
+                sq->spin <<= 1;
+            return sq->batch[sq->idx++];
+        }
+    }
+    if (sq->spin > TMQH_SPSC_SPIN_MIN)
+        sq->spin >>= 1;
+
+    for (spins = 0; spins < TMQH_SPSC_YIELDS; spins++) {
+        sched_yield();
+        if (q->len != 0 && TmqhSpscTakeBatch(sq) > 0)
+            return sq->batch[sq->idx++];
+    }
+
+    TmqhSpscSleep(tv, sq);
+
+    if (TmqhSpscTakeBatch(sq) > 0)
+        return sq->batch[sq->idx++];
+
+    /* nothing yet, let the caller check the thread flags */
+    return NULL;
+}
+
+#ifdef UNITTESTS
+
+/** \test writers get a ring into each queue, rings of writers that
+ *        are gone are reused */
+static int TmqhSpscTest01(void)
+{
+    int result = 0;
+    TmqhSpscCtx *ctx1 = NULL;
+    TmqhSpscCtx *ctx2 = NULL;
+
+    TmqResetQueues();
+    TmqhSpscDestroy();
+
+    ctx1 = TmqhOutputSpscSetupCtx("spsc1,spsc2");
+    if (ctx1 == NULL)
+        goto end;
+    ctx2 = TmqhOutputSpscSetupCtx("spsc1,spsc2");
+    if (ctx2 == NULL)
+        goto end;
+
+    if (ctx1->fctx->size != 2 || spsc_queues[0] == NULL ||
+            spsc_queues[1] == NULL || spsc_queues[2] != NULL)
+        goto end;
+    if (spsc_queues[0]->nrings != 2 || spsc_queues[1]->nrings != 2)
+        goto end;
+    if (ctx1->rings[0] == ctx2->rings[0] ||
+            ctx1->rings[0]->sq != spsc_queues[0] ||
+            ctx1->rings[1]->sq != spsc_queues[1])
+        goto end;
+    if (ctx1->rings[0]->mask + 1 < TMQH_SPSC_MIN_SLOTS ||
+            ctx1->rings[0]->mask + 1 < (uint32_t)max_pending_packets)
+        goto end;
+
+    TmqhSpscRing *ring = ctx1->rings[1];
+    TmqhOutputSpscFreeCtx(ctx1);
+    ctx1 = TmqhOutputSpscSetupCtx("spsc2");
+    if (ctx1 == NULL)
+        goto end;
+    if (ctx1->rings[0] != ring || spsc_queues[1]->nrings != 2)
+        goto end;
+
+    /* no queue has an id this high */
+    if (TmqhSpscRingGet(TMQ_MAX_QUEUES) != NULL)
+        goto end;
+
+    result = 1;
+end:
+    if (ctx1 != NULL)
+        TmqhOutputSpscFreeCtx(ctx1);
+    if (ctx2 != NULL)
+        TmqhOutputSpscFreeCtx(ctx2);
+    TmqhSpscDestroy();
+    TmqResetQueues();
+    return result;
+}
+
+/** \test packets come out of each queue in order, len counts the
+ *        packets the reader didn't pick up yet */
+static int TmqhSpscTest02(void)
+{
+    int result = 0;
+    TmqhSpscCtx *ctx = NULL;
+    Packet *pkts[TMQH_SPSC_BATCH * 3];
+    ThreadVars wtv, rtv[2];
+    int i;
+
+    memset(pkts, 0, sizeof(pkts));
+    memset(&wtv, 0, sizeof(wtv));
+    memset(&rtv, 0, sizeof(rtv));
+
+    TmqResetQueues();
+    TmqhSpscDestroy();
+
+    ctx = TmqhOutputSpscSetupCtx("spsc1,spsc2");
+    if (ctx == NULL)
+        goto end;
+    wtv.outctx = ctx;
+    rtv[0].inq = TmqGetQueueByName("spsc1");
+    rtv[1].inq = TmqGetQueueByName("spsc2");
+    if (rtv[0].inq == NULL || rtv[1].inq == NULL)
+        goto end;
+
+    /* packets without a flow alternate between the queues */
+    for (i = 0; i < TMQH_SPSC_BATCH * 3; i++) {
+        pkts[i] = SCMalloc(SIZE_OF_PACKET);
+        if (pkts[i] == NULL)
+            goto end;
+        memset(pkts[i], 0, SIZE_OF_PACKET);
+        TmqhOutputSpsc(&wtv, pkts[i]);
+    }
+
+    PacketQueue *q = &trans_q[rtv[0].inq->id];
+    if (q->len != TMQH_SPSC_BATCH * 3 / 2)
+        goto end;
+
+    for (i = 0; i < TMQH_SPSC_BATCH * 3; i += 2) {
+        if (TmqhInputSpsc(&rtv[0]) != pkts[i])
+            goto end;
+    }
+    /* the last batch counts until the reader comes back for more */
+    if (q->len == 0)
+        goto end;
+    if (TmqhInputSpsc(&rtv[0]) != NULL)
+        goto end;
+    if (q->len != 0)
+        goto end;
+
+    for (i = 1; i < TMQH_SPSC_BATCH * 3; i += 2) {
+        if (TmqhInputSpsc(&rtv[1]) != pkts[i])
+            goto end;
+    }
+
+    result = 1;
+end:
+    for (i = 0; i < TMQH_SPSC_BATCH * 3; i++) {
+        if (pkts[i] != NULL)
+            SCFree(pkts[i]);
+    }
+    if (ctx != NULL)
+        TmqhOutputSpscFreeCtx(ctx);
+    TmqhSpscDestroy();
+    TmqResetQueues();
+    return result;
+}
+
+#define TMQH_SPSC_TEST_PKTS 200000
+#define TMQH_SPSC_TEST_WRITERS 2
+
+typedef struct TmqhSpscTestWriter_ {
+    ThreadVars tv;
+    Packet *pkts[4];
+} TmqhSpscTestWriter;
+
+static void *TmqhSpscTestWriterThread(void *data)
+{
+    TmqhSpscTestWriter *w = (TmqhSpscTestWriter *)data;
+    uint32_t i;
+
+    for (i = 0; i < TMQH_SPSC_TEST_PKTS; i++) {
+        TmqhOutputSpsc(&w->tv, w->pkts[i % 4]);
+    }
+    return NULL;
+}
+
+/** \test writer threads racing a sleeping reader, nothing is lost or
+ *        reordered and len drops back to 0 */
+static int TmqhSpscTest03(void)
+{
+    int result = 0;
+    TmqhSpscTestWriter w[TMQH_SPSC_TEST_WRITERS];
+    pthread_t threads[TMQH_SPSC_TEST_WRITERS];
+    uint32_t seen[TMQH_SPSC_TEST_WRITERS];
+    ThreadVars rtv;
+    int i, j, started = 0;
+
+    memset(&w, 0, sizeof(w));
+    memset(&seen, 0, sizeof(seen));
+    memset(&rtv, 0, sizeof(rtv));
+
+    TmqResetQueues();
+    TmqhSpscDestroy();
+
+    for (i = 0; i < TMQH_SPSC_TEST_WRITERS; i++) {
+        w[i].tv.outctx = TmqhOutputSpscSetupCtx("spsc1");
+        if (w[i].tv.outctx == NULL)
+            goto end;
+        for (j = 0; j < 4; j++) {
+            w[i].pkts[j] = SCMalloc(SIZE_OF_PACKET);
+            if (w[i].pkts[j] == NULL)
+                goto end;
+            memset(w[i].pkts[j], 0, SIZE_OF_PACKET);
+        }
+    }
+    rtv.inq = TmqGetQueueByName("spsc1");
+    if (rtv.inq == NULL)
+        goto end;
+
+    for (i = 0; i < TMQH_SPSC_TEST_WRITERS; i++) {
+        if (pthread_create(&threads[i], NULL, TmqhSpscTestWriterThread,
+                    &w[i]) != 0)
+            goto join;
+        started++;
+    }
+
+    uint32_t total = 0;
+    while (total < TMQH_SPSC_TEST_PKTS * TMQH_SPSC_TEST_WRITERS) {
+        Packet *p = TmqhInputSpsc(&rtv);
+        if (p == NULL)
+            continue;
+
+        for (i = 0; i < TMQH_SPSC_TEST_WRITERS; i++) {
+            if (p == w[i].pkts[seen[i] % 4])
+                break;
+        }
+        if (i == TMQH_SPSC_TEST_WRITERS) {
+            printf("packet out of order: ");
+            goto join;
+        }
+        seen[i]++;
+        total++;
+    }
+    if (TmqhInputSpsc(&rtv) != NULL || trans_q[rtv.inq->id].len != 0)
+        goto join;
+
+    result = 1;
+join:
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+end:
+    for (i = 0; i < TMQH_SPSC_TEST_WRITERS; i++) {
+        if (w[i].tv.outctx != NULL)
+            TmqhOutputSpscFreeCtx(w[i].tv.outctx);
+        for (j = 0; j < 4; j++) {
+            if (w[i].pkts[j] != NULL)
+                SCFree(w[i].pkts[j]);
+        }
+    }
+    TmqhSpscDestroy();
+    TmqResetQueues();
+    return result;
+}
+
+static void *TmqhSpscTestStallThread(void *data)
+{
+    TmqhSpscTestWriter *w = (TmqhSpscTestWriter *)data;
+
+    TmqhOutputSpsc(&w->tv, w->pkts[0]);
+    return NULL;
+}
+
+/** \test a writer that finds its ring full waits for the reader and
+ *        the wait is counted */
+static int TmqhSpscTest04(void)
+{
+    int result = 0;
+    TmqhSpscTestWriter w;
+    pthread_t thread;
+    ThreadVars rtv;
+    int started = 0;
+    uint32_t i, size = 0;
+
+    memset(&w, 0, sizeof(w));
+    memset(&rtv, 0, sizeof(rtv));
+
+    TmqResetQueues();
+    TmqhSpscDestroy();
+
+    TmqhSpscCtx *ctx = TmqhOutputSpscSetupCtx("spsc1");
+    if (ctx == NULL)
+        goto end;
+    w.tv.outctx = ctx;
+    w.pkts[0] = SCMalloc(SIZE_OF_PACKET);
+    if (w.pkts[0] == NULL)
+        goto end;
+    memset(w.pkts[0], 0, SIZE_OF_PACKET);
+    rtv.inq = TmqGetQueueByName("spsc1");
+    if (rtv.inq == NULL)
+        goto end;
+
+    TmqhSpscRing *ring = ctx->rings[0];
+    size = ring->mask + 1;
+    for (i = 0; i < size; i++)
+        TmqhOutputSpsc(&w.tv, w.pkts[0]);
+    if (ring->stalls != 0)
+        goto end;
+
+    if (pthread_create(&thread, NULL, TmqhSpscTestStallThread, &w) != 0)
+        goto end;
+    started = 1;
+
+    while (TMQH_SPSC_LOAD(&ring->stalls) == 0)
+        sched_yield();
+
+    /* taking a batch frees the slot the writer waits for */
+    for (i = 0; i < size + 1; i++) {
+        if (TmqhInputSpsc(&rtv) != w.pkts[0])
+            goto join;
+    }
+    if (ring->stalls != 1)
+        goto join;
+
+    result = 1;
+join:
+    pthread_join(thread, NULL);
+end:
+    if (w.tv.outctx != NULL)
+        TmqhOutputSpscFreeCtx(w.tv.outctx);
+    if (w.pkts[0] != NULL)
+        SCFree(w.pkts[0]);
+    TmqhSpscDestroy();
+    TmqResetQueues();
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void TmqhSpscRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("TmqhSpscTest01", TmqhSpscTest01, 1);
+    UtRegisterTest("TmqhSpscTest02", TmqhSpscTest02, 1);
+    UtRegisterTest("TmqhSpscTest03", TmqhSpscTest03, 1);
+    UtRegisterTest("TmqhSpscTest04", TmqhSpscTest04, 1);
+#endif
+}
@@ -32,6 +32,7 @@
 #include "util-privs.h"
 #include "util-debug.h"
 #include "util-signal.h"
+#include "util-profiling.h"
 
 #include <sys/un.h>
 #include <sys/stat.h>
@@ -852,6 +853,10 @@ void *UnixManagerThread(void *td)
     UnixManagerRegisterCommand("capture-mode", UnixManagerCaptureModeCommand, &command, 0);
     UnixManagerRegisterCommand("conf-get", UnixManagerConfGetCommand, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("dump-counters", SCPerfOutputCounterSocket, NULL, 0);
+#ifdef PROFILING
+    UnixManagerRegisterCommand("profiling-sample-rate",
+            SCProfilingSampleRateCommand, NULL, UNIX_CMD_TAKE_ARGS);
+#endif
 #if 0
     UnixManagerRegisterCommand("reload-rules", UnixManagerReloadRules, NULL, 0);
 #endif
@@ -0,0 +1,319 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * SIMD one's complement sum. The 16 bit words are summed in host byte
+ * order, like the scalar loops of the checksum functions did, so the
+ * result can be compared to the checksum field as it is in the packet.
+ *
+ * The SSE2 and AVX2 versions zero extend 8 or 16 words to 32 bit lanes
+ * per load and add them up. A lane can take 32768 loads before it can
+ * overflow, so the lanes are added to a 64 bit total well before that.
+ * The carries are folded back in at the end.
+ *
+ * The AVX2 version is compiled in when the compiler supports per
+ * function targets, and used when ChecksumSumInit finds a cpu with AVX2.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "util-debug.h"
+#include "util-checksum-simd.h"
+#include "util-unittest.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(__clang__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define CHECKSUM_SIMD_AVX2 1
+#include <immintrin.h>
+#endif
+
+/** loads after which the 32 bit lanes are added to the total */
+#define CHECKSUM_SIMD_FLUSH 16384
+
+typedef uint32_t (*ChecksumSumFunc)(const uint16_t *, uint32_t);
+
+/**
+ * \brief Fold a 64 bit sum to 16 bits, adding the carries back in
+ */
+static inline uint32_t ChecksumFold(uint64_t sum)
+{
+    sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+    sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    return (uint32_t)sum;
+}
+
+/**
+ * \brief Sum the words of the tail and the trailing odd byte
+ */
+static inline uint64_t ChecksumSumTail(const uint16_t *pkt, uint32_t len)
+{
+    uint64_t sum = 0;
+    uint16_t pad = 0;
+
+    while (len > 1) {
+        sum += pkt[0];
+        pkt += 1;
+        len -= 2;
+    }
+
+    if (len == 1) {
+        *(uint8_t *)(&pad) = (*(uint8_t *)pkt);
+        sum += pad;
+    }
+    return sum;
+}
+
+static uint32_t ChecksumSumScalar(const uint16_t *pkt, uint32_t len)
+{
+    uint64_t sum = 0;
+
+    while (len >= 32) {
+        sum += pkt[0] + pkt[1] + pkt[2] + pkt[3] + pkt[4] + pkt[5] + pkt[6] +
+            pkt[7] + pkt[8] + pkt[9] + pkt[10] + pkt[11] + pkt[12] + pkt[13] +
+            pkt[14] + pkt[15];
+        len -= 32;
+        pkt += 16;
+    }
+
+    sum += ChecksumSumTail(pkt, len);
+    return ChecksumFold(sum);
+}
+
+#ifdef __SSE2__
+static uint32_t ChecksumSumSSE2(const uint16_t *pkt, uint32_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const uint8_t *buf = (const uint8_t *)pkt;
+    uint64_t sum = 0;
+
+    while (len >= 16) {
+        __m128i acc = _mm_setzero_si128();
+        uint32_t n = 0;
+
+        for ( ; len >= 16 && n < CHECKSUM_SIMD_FLUSH; n++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)buf);
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+            buf += 16;
+            len -= 16;
+        }
+
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    sum += ChecksumSumTail((const uint16_t *)buf, len);
+    return ChecksumFold(sum);
+}
+#endif /* __SSE2__ */
+
+#ifdef CHECKSUM_SIMD_AVX2
+__attribute__((target("avx2")))
+static uint32_t ChecksumSumAVX2(const uint16_t *pkt, uint32_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const uint8_t *buf = (const uint8_t *)pkt;
+    uint64_t sum = 0;
+
+    while (len >= 32) {
+        __m256i acc = _mm256_setzero_si256();
+        uint32_t n = 0;
+
+        for ( ; len >= 32 && n < CHECKSUM_SIMD_FLUSH; n++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)buf);
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+            buf += 32;
+            len -= 32;
+        }
+
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+            lanes[4] + lanes[5] + lanes[6] + lanes[7];
+    }
+
+    sum += ChecksumSumTail((const uint16_t *)buf, len);
+    return ChecksumFold(sum);
+}
+#endif /* CHECKSUM_SIMD_AVX2 */
+
+#ifdef __SSE2__
+static ChecksumSumFunc checksum_sum = ChecksumSumSSE2;
+#else
+static ChecksumSumFunc checksum_sum = ChecksumSumScalar;
+#endif
+
+/**
+ * \brief One's complement sum of a buffer, in host byte order. Use
+ *        ChecksumSum, which sums short buffers inline.
+ *
+ * \param pkt pointer to the data to sum
+ * \param len length of the data in bytes. If it is odd, the last byte
+ *            is padded with a zero byte
+ *
+ * \retval sum folded to 16 bits, not inverted
+ */
+uint32_t ChecksumSumSIMD(const uint16_t *pkt, uint32_t len)
+{
+    return checksum_sum(pkt, len);
+}
+
+/**
+ * \brief Select the widest implementation the cpu supports. Has to be
+ *        called before the packet threads start.
+ */
+void ChecksumSumInit(void)
+{
+#ifdef CHECKSUM_SIMD_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        checksum_sum = ChecksumSumAVX2;
+        SCLogDebug("using AVX2 checksum sum");
+        return;
+    }
+#endif
+#ifdef __SSE2__
+    SCLogDebug("using SSE2 checksum sum");
+#else
+    SCLogDebug("using scalar checksum sum");
+#endif
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+static ChecksumSumFunc ChecksumSumTestFuncs(int i)
+{
+    switch (i) {
+        case 0:
+            return ChecksumSumScalar;
+#ifdef __SSE2__
+        case 1:
+            return ChecksumSumSSE2;
+#endif
+#ifdef CHECKSUM_SIMD_AVX2
+        case 2:
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return ChecksumSumAVX2;
+            break;
+#endif
+    }
+    return NULL;
+}
+
+/** \brief byte by byte reference sum */
+static uint32_t ChecksumSumTestRef(const uint8_t *buf, uint32_t len)
+{
+    uint64_t sum = 0;
+    uint32_t i;
+
+    for (i = 0; i + 1 < len; i += 2) {
+        uint16_t w;
+        memcpy(&w, buf + i, 2);
+        sum += w;
+    }
+    if (len & 1) {
+        uint16_t w = 0;
+        memcpy(&w, buf + len - 1, 1);
+        sum += w;
+    }
+    while (sum >> 16)
+        sum = (sum >> 16) + (sum & 0xFFFF);
+    return (uint32_t)sum;
+}
+
+/** \test all implementations against the reference, for all lengths up
+ *        to 300 at all alignments */
+static int ChecksumSumTest01(void)
+{
+    uint8_t buf[320];
+    uint32_t i;
+
+    for (i = 0; i < sizeof(buf); i++)
+        buf[i] = (uint8_t)(i * 131 + 7);
+
+    for (int f = 0; f < 3; f++) {
+        ChecksumSumFunc func = ChecksumSumTestFuncs(f);
+        if (func == NULL)
+            continue;
+
+        for (uint32_t off = 0; off < 16; off++) {
+            for (uint32_t len = 0; len <= 300; len++) {
+                uint32_t ref = ChecksumSumTestRef(buf + off, len);
+                uint32_t r = func((uint16_t *)(buf + off), len);
+                if (r != ref) {
+                    printf("impl %d off %u len %u: %04x != %04x: ", f, off,
+                            len, r, ref);
+                    return 0;
+                }
+            }
+        }
+    }
+
+    return 1;
+}
+
+/** \test sums that need the 64 bit total and the carries folded back */
+static int ChecksumSumTest02(void)
+{
+    uint32_t len = 1024 * 1024 + 5;
+    uint8_t *buf = SCMalloc(len);
+    if (buf == NULL)
+        return 0;
+    memset(buf, 0xff, len);
+
+    int result = 0;
+    for (int f = 0; f < 3; f++) {
+        ChecksumSumFunc func = ChecksumSumTestFuncs(f);
+        if (func == NULL)
+            continue;
+
+        uint32_t ref = ChecksumSumTestRef(buf, len);
+        uint32_t r = func((uint16_t *)buf, len);
+        if (r != ref) {
+            printf("impl %d: %04x != %04x: ", f, r, ref);
+            goto end;
+        }
+    }
+    result = 1;
+end:
+    SCFree(buf);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void ChecksumSumRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("ChecksumSumTest01", ChecksumSumTest01, 1);
+    UtRegisterTest("ChecksumSumTest02", ChecksumSumTest02, 1);
+#endif /* UNITTESTS */
+}
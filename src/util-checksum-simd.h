@@ -0,0 +1,73 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * SIMD one's complement sum used by the packet checksum functions.
+ */
+
+#ifndef __UTIL_CHECKSUM_SIMD_H__
+#define __UTIL_CHECKSUM_SIMD_H__
+
+#include "suricata-common.h"
+
+/** below this length the call isn't worth it, the words are summed inline */
+#define CHECKSUM_SIMD_MIN_LEN   128
+
+uint32_t ChecksumSumSIMD(const uint16_t *, uint32_t);
+void ChecksumSumInit(void);
+void ChecksumSumRegisterTests(void);
+
+/**
+ * \brief One's complement sum of a buffer, in host byte order
+ *
+ * \param pkt pointer to the data to sum
+ * \param len length of the data in bytes. If it is odd, the last byte
+ *            is padded with a zero byte
+ *
+ * \retval sum, fits in 22 bits, not inverted
+ */
+static inline uint32_t ChecksumSum(const uint16_t *pkt, uint32_t len)
+{
+    uint16_t pad = 0;
+    uint32_t csum = 0;
+
+    if (len >= CHECKSUM_SIMD_MIN_LEN)
+        return ChecksumSumSIMD(pkt, len);
+
+    while (len >= 8) {
+        csum += pkt[0] + pkt[1] + pkt[2] + pkt[3];
+        len -= 8;
+        pkt += 4;
+    }
+
+    while (len > 1) {
+        csum += pkt[0];
+        pkt += 1;
+        len -= 2;
+    }
+
+    if (len == 1) {
+        *(uint8_t *)(&pad) = (*(uint8_t *)pkt);
+        csum += pad;
+    }
+
+    return csum;
+}
+
+#endif /* __UTIL_CHECKSUM_SIMD_H__ */
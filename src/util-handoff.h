@@ -0,0 +1,139 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Handoff of a thread owned object to a sweeper thread while the owner
+ * is idle, without a lock in the owner's path.
+ *
+ * The owner bumps seq when it starts working on the object (odd) and
+ * when it is done (even), and checks that no sweeper has the object.
+ * The sweeper only takes an object whose seq didn't change for a while,
+ * with a CAS on state, and then checks seq again. The owner's store to
+ * seq and the sweeper's CAS are each followed by a full barrier, so one
+ * of the two always sees the other: either the sweeper backs off, or the
+ * owner waits for the sweeper to finish.
+ */
+
+#ifndef __UTIL_HANDOFF_H__
+#define __UTIL_HANDOFF_H__
+
+#include "util-atomic.h"
+#include "util-optimize.h"
+
+#define SC_HANDOFF_OWNER    0   /**< the owner thread may use the object */
+#define SC_HANDOFF_SWEEP    1   /**< a sweeper thread has the object */
+
+typedef struct SCHandoff_ {
+    /** only written by the owner, odd while it works on the object */
+    volatile uint32_t seq;
+    SC_ATOMIC_DECLARE(int, state);
+
+    /* sweeper side */
+    uint32_t idle_seq;      /**< seq at the sweeper's last check */
+    uint32_t idle_sec;      /**< time idle_seq was seen first */
+} SCHandoff;
+
+static inline void SCHandoffInit(SCHandoff *h)
+{
+    h->seq = 0;
+    SC_ATOMIC_INIT(h->state);
+    /* so the first check only records the seq */
+    h->idle_seq = 0xFFFFFFFF;
+    h->idle_sec = 0;
+}
+
+static inline void SCHandoffDestroy(SCHandoff *h)
+{
+    SC_ATOMIC_DESTROY(h->state);
+}
+
+/**
+ * \brief owner starts working on the object. Waits in the rare case a
+ *        sweeper took it while the owner was idle.
+ */
+static inline void SCHandoffOwnerEnter(SCHandoff *h)
+{
+    h->seq++;
+    /* pairs with the CAS in SCHandoffSweepTry() */
+    hw_barrier();
+    if (unlikely(SC_ATOMIC_GET(h->state) != SC_HANDOFF_OWNER)) {
+        do {
+            sched_yield();
+            cc_barrier();
+        } while (SC_ATOMIC_GET(h->state) != SC_HANDOFF_OWNER);
+        /* see what the sweeper did */
+        hw_barrier();
+    }
+}
+
+/**
+ * \brief owner is done with the object for now
+ */
+static inline void SCHandoffOwnerLeave(SCHandoff *h)
+{
+#ifdef __ATOMIC_RELEASE
+    __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELEASE);
+#else
+    hw_barrier();
+    h->seq++;
+#endif
+}
+
+/**
+ * \brief sweeper tries to take an object whose owner has been idle
+ *
+ * \param now current time, in the sweeper's time base
+ * \param idle_secs seconds the owner must have been idle
+ *
+ * \retval 1 the sweeper has the object until SCHandoffSweepDone()
+ * \retval 0 the owner is not idle
+ */
+static inline int SCHandoffSweepTry(SCHandoff *h, uint32_t now, uint32_t idle_secs)
+{
+    uint32_t seq = h->seq;
+
+    if (seq != h->idle_seq || (seq & 1) ||
+            (int32_t)(now - h->idle_sec) < 0) {
+        h->idle_seq = seq;
+        h->idle_sec = now;
+        return 0;
+    }
+    if (now - h->idle_sec < idle_secs)
+        return 0;
+
+    if (SC_ATOMIC_CAS(&h->state, SC_HANDOFF_OWNER, SC_HANDOFF_SWEEP) == 0)
+        return 0;
+
+    /* the owner came in before it could see us */
+    if (h->seq != seq) {
+        (void)SC_ATOMIC_CAS(&h->state, SC_HANDOFF_SWEEP, SC_HANDOFF_OWNER);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * \brief sweeper hands the object back to its owner
+ */
+static inline void SCHandoffSweepDone(SCHandoff *h)
+{
+    (void)SC_ATOMIC_CAS(&h->state, SC_HANDOFF_SWEEP, SC_HANDOFF_OWNER);
+}
+
+#endif /* __UTIL_HANDOFF_H__ */
@@ -0,0 +1,3430 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Aho-corasick with an alphabet compressed state table.
+ *
+ * Builds the same delta table as util-mpm-ac.c, but a state row does not
+ * have an entry for each of the 256 byte values:
+ *
+ *  - Bytes that are in no pattern always lead to the same state as each
+ *    other, so they share a single column.
+ *  - Upper case letters are folded into the column of their lower case
+ *    letter, so the search doesn't have to lowercase the input.
+ *
+ * The byte to column map (xlate) is applied to each input byte. Rows are
+ * rounded up to a power of 2, so finding a row stays a shift like in the
+ * ac mpm. For mostly text patterns a row shrinks from 256 to 64 entries.
+ * States are 16 bits if there are less than 32767, 32 bits otherwise,
+ * like in the ac mpm.
+ *
+ * The tables are only a function of the pattern set. Contexts that end up
+ * with the same patterns, something that happens a lot with per sig group
+ * head contexts, share the tables through a global refcounted hash instead
+ * of each building their own copy.
+ *
+ * With pattern-matcher.ac-compact.cache-dir set, built tables are also
+ * written to a file per pattern set. On the next start, or rule reload,
+ * a context with the same patterns maps the file instead of building the
+ * tables again. The file holds the pattern set it was built from, and is
+ * only used if that is identical and the checksum is valid. This only
+ * saves the table build of each context: rules are still parsed and
+ * grouped, and the patterns still added, sorted and hashed to find the
+ * file. SCACCompactBench02 times the prepare step with and without it.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "util-mpm-ac-compact.h"
+
+#include "conf.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-memcmp.h"
+#include "util-hash-lookup3.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+void SCACCompactInitCtx(MpmCtx *, int);
+void SCACCompactInitThreadCtx(ThreadVars *, MpmCtx *, MpmThreadCtx *, uint32_t);
+void SCACCompactDestroyCtx(MpmCtx *);
+void SCACCompactDestroyThreadCtx(MpmCtx *, MpmThreadCtx *);
+int SCACCompactAddPatternCI(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                            uint32_t, uint32_t, uint8_t);
+int SCACCompactAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                            uint32_t, uint32_t, uint8_t);
+int SCACCompactPreparePatterns(MpmCtx *mpm_ctx);
+uint32_t SCACCompactSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                           PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen);
+void SCACCompactPrintInfo(MpmCtx *mpm_ctx);
+void SCACCompactPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
+void SCACCompactRegisterTests(void);
+
+/* a placeholder to denote a failure transition in the goto table */
+#define SC_AC_COMPACT_FAIL (-1)
+/* size of the hash table used to speed up pattern insertions initially */
+#define INIT_HASH_SIZE 65536
+/* size of the hash holding the tables for sharing */
+#define SHARED_HASH_SIZE 4096
+
+/** tables that can be shared, hashed by pattern set */
+static SCACCompactTable *shared_tables[SHARED_HASH_SIZE];
+static SCMutex shared_tables_lock = PTHREAD_MUTEX_INITIALIZER;
+/** memory of the tables in shared_tables, each counted once. Contexts
+ *  don't count the tables they use in their memory_size. */
+static uint64_t shared_tables_memuse = 0;
+
+/** directory of the table cache, NULL if caching is disabled */
+static char *cache_dir = NULL;
+static int cache_conf_loaded = 0;
+
+/**
+ * \brief Register the aho-corasick mpm with compact state tables.
+ */
+void MpmACCompactRegister(void)
+{
+    mpm_table[MPM_AC_COMPACT].name = "ac-compact";
+    mpm_table[MPM_AC_COMPACT].max_pattern_length = 0;
+
+    mpm_table[MPM_AC_COMPACT].InitCtx = SCACCompactInitCtx;
+    mpm_table[MPM_AC_COMPACT].InitThreadCtx = SCACCompactInitThreadCtx;
+    mpm_table[MPM_AC_COMPACT].DestroyCtx = SCACCompactDestroyCtx;
+    mpm_table[MPM_AC_COMPACT].DestroyThreadCtx = SCACCompactDestroyThreadCtx;
+    mpm_table[MPM_AC_COMPACT].AddPattern = SCACCompactAddPatternCS;
+    mpm_table[MPM_AC_COMPACT].AddPatternNocase = SCACCompactAddPatternCI;
+    mpm_table[MPM_AC_COMPACT].Prepare = SCACCompactPreparePatterns;
+    mpm_table[MPM_AC_COMPACT].Search = SCACCompactSearch;
+    mpm_table[MPM_AC_COMPACT].Cleanup = NULL;
+    mpm_table[MPM_AC_COMPACT].PrintCtx = SCACCompactPrintInfo;
+    mpm_table[MPM_AC_COMPACT].PrintThreadCtx = SCACCompactPrintSearchStats;
+    mpm_table[MPM_AC_COMPACT].RegisterUnittests = SCACCompactRegisterTests;
+
+    return;
+}
+
+static inline uint32_t SCACCompactInitHashRaw(uint8_t *pat, uint16_t patlen)
+{
+    uint32_t hash = patlen * pat[0];
+    if (patlen > 1)
+        hash += pat[1];
+
+    return (hash % INIT_HASH_SIZE);
+}
+
+static inline SCACCompactPattern *SCACCompactInitHashLookup(SCACCompactCtx *ctx,
+        uint8_t *pat, uint16_t patlen, char flags, uint32_t pid)
+{
+    uint32_t hash = SCACCompactInitHashRaw(pat, patlen);
+
+    if (ctx->init_hash == NULL || ctx->init_hash[hash] == NULL) {
+        return NULL;
+    }
+
+    SCACCompactPattern *t = ctx->init_hash[hash];
+    for ( ; t != NULL; t = t->next) {
+        if (t->flags == flags && t->id == pid)
+            return t;
+    }
+
+    return NULL;
+}
+
+static inline SCACCompactPattern *SCACCompactAllocPattern(MpmCtx *mpm_ctx)
+{
+    SCACCompactPattern *p = SCMalloc(sizeof(SCACCompactPattern));
+    if (unlikely(p == NULL)) {
+        exit(EXIT_FAILURE);
+    }
+    memset(p, 0, sizeof(SCACCompactPattern));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCACCompactPattern);
+
+    return p;
+}
+
+static inline void SCACCompactFreePattern(MpmCtx *mpm_ctx, SCACCompactPattern *p)
+{
+    if (p != NULL && p->cs != NULL && p->cs != p->ci) {
+        SCFree(p->cs);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= p->len;
+    }
+
+    if (p != NULL && p->ci != NULL) {
+        SCFree(p->ci);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= p->len;
+    }
+
+    if (p != NULL && p->original_pat != NULL) {
+        SCFree(p->original_pat);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= p->len;
+    }
+
+    if (p != NULL) {
+        SCFree(p);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= sizeof(SCACCompactPattern);
+    }
+    return;
+}
+
+static inline void memcpy_tolower(uint8_t *d, uint8_t *s, uint16_t len)
+{
+    uint16_t i;
+    for (i = 0; i < len; i++)
+        d[i] = u8_tolower(s[i]);
+
+    return;
+}
+
+static inline int SCACCompactInitHashAdd(SCACCompactCtx *ctx, SCACCompactPattern *p)
+{
+    uint32_t hash = SCACCompactInitHashRaw(p->original_pat, p->len);
+
+    if (ctx->init_hash == NULL) {
+        return 0;
+    }
+
+    if (ctx->init_hash[hash] == NULL) {
+        ctx->init_hash[hash] = p;
+        return 0;
+    }
+
+    SCACCompactPattern *tt = NULL;
+    SCACCompactPattern *t = ctx->init_hash[hash];
+
+    /* get the list tail */
+    do {
+        tt = t;
+        t = t->next;
+    } while (t != NULL);
+
+    tt->next = p;
+
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Add a pattern to the mpm-ac-compact context.
+ *
+ * \param mpm_ctx Mpm context.
+ * \param pat     Pointer to the pattern.
+ * \param patlen  Length of the pattern.
+ * \param pid     Pattern id
+ * \param sid     Signature id (internal id).
+ * \param flags   Pattern's MPM_PATTERN_* flags.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+static int SCACCompactAddPattern(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                                 uint16_t offset, uint16_t depth, uint32_t pid,
+                                 uint32_t sid, uint8_t flags)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+
+    SCLogDebug("Adding pattern for ctx %p, patlen %"PRIu16" and pid %" PRIu32,
+               ctx, patlen, pid);
+
+    if (patlen == 0) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENTS, "pattern length 0");
+        return 0;
+    }
+
+    /* check if we have already inserted this pattern */
+    SCACCompactPattern *p = SCACCompactInitHashLookup(ctx, pat, patlen, flags, pid);
+    if (p == NULL) {
+        SCLogDebug("Allocing new pattern");
+
+        /* p will never be NULL */
+        p = SCACCompactAllocPattern(mpm_ctx);
+
+        p->len = patlen;
+        p->flags = flags;
+        p->id = pid;
+
+        p->original_pat = SCMalloc(patlen);
+        if (p->original_pat == NULL)
+            goto error;
+        mpm_ctx->memory_cnt++;
+        mpm_ctx->memory_size += patlen;
+        memcpy(p->original_pat, pat, patlen);
+
+        p->ci = SCMalloc(patlen);
+        if (p->ci == NULL)
+            goto error;
+        mpm_ctx->memory_cnt++;
+        mpm_ctx->memory_size += patlen;
+        memcpy_tolower(p->ci, pat, patlen);
+
+        /* setup the case sensitive part of the pattern */
+        if (p->flags & MPM_PATTERN_FLAG_NOCASE) {
+            /* nocase means no difference between cs and ci */
+            p->cs = p->ci;
+        } else {
+            if (memcmp(p->ci, pat, p->len) == 0) {
+                /* no diff between cs and ci: pat is lowercase */
+                p->cs = p->ci;
+            } else {
+                p->cs = SCMalloc(patlen);
+                if (p->cs == NULL)
+                    goto error;
+                mpm_ctx->memory_cnt++;
+                mpm_ctx->memory_size += patlen;
+                memcpy(p->cs, pat, patlen);
+            }
+        }
+
+        /* put in the pattern hash */
+        SCACCompactInitHashAdd(ctx, p);
+
+        mpm_ctx->pattern_cnt++;
+
+        if (mpm_ctx->maxlen < patlen)
+            mpm_ctx->maxlen = patlen;
+
+        if (mpm_ctx->minlen == 0) {
+            mpm_ctx->minlen = patlen;
+        } else {
+            if (mpm_ctx->minlen > patlen)
+                mpm_ctx->minlen = patlen;
+        }
+
+        /* we need the max pat id */
+        if (pid > ctx->max_pat_id)
+            ctx->max_pat_id = pid;
+    }
+
+    return 0;
+
+error:
+    SCACCompactFreePattern(mpm_ctx, p);
+    return -1;
+}
+
+/**
+ * \internal
+ * \brief Initialize a new state in the goto and output tables.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ *
+ * \retval The state id, of the newly created state.
+ */
+static inline int SCACCompactInitNewState(MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    int ascii_code = 0;
+    int size = 0;
+
+    /* reallocate space in the goto table to include a new state */
+    size = (ctx->state_count + 1) * ctx->single_state_size;
+    ctx->goto_table = SCRealloc(ctx->goto_table, size);
+    if (ctx->goto_table == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    /* set all transitions for the newly assigned state as FAIL transitions */
+    for (ascii_code = 0; ascii_code < 256; ascii_code++) {
+        ctx->goto_table[ctx->state_count][ascii_code] = SC_AC_COMPACT_FAIL;
+    }
+
+    /* reallocate space in the output table for the new state */
+    size = (ctx->state_count + 1) * sizeof(SCACCompactOutputTable);
+    ctx->output_table = SCRealloc(ctx->output_table, size);
+    if (ctx->output_table == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    memset(ctx->output_table + ctx->state_count, 0, sizeof(SCACCompactOutputTable));
+
+    return ctx->state_count++;
+}
+
+/**
+ * \internal
+ * \brief Adds a pid to the output table for a state.
+ *
+ * \param state   The state to whose output table we should add the pid.
+ * \param pid     The pattern id to add.
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+static void SCACCompactSetOutputState(int32_t state, uint32_t pid, MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    SCACCompactOutputTable *output_state = &ctx->output_table[state];
+    uint32_t i = 0;
+
+    for (i = 0; i < output_state->no_of_entries; i++) {
+        if (output_state->pids[i] == pid)
+            return;
+    }
+
+    output_state->no_of_entries++;
+    output_state->pids = SCRealloc(output_state->pids,
+                                   output_state->no_of_entries * sizeof(uint32_t));
+    if (output_state->pids == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    output_state->pids[output_state->no_of_entries - 1] = pid;
+
+    return;
+}
+
+/**
+ * \brief Helper function used by SCACCompactCreateGotoTable.  Adds a
+ *        pattern to the goto table.
+ *
+ * \param pattern     Pointer to the pattern.
+ * \param pattern_len Pattern length.
+ * \param pid         The pattern id, that corresponds to this pattern.
+ * \param mpm_ctx     Pointer to the mpm context.
+ */
+static inline void SCACCompactEnter(uint8_t *pattern, uint16_t pattern_len,
+                                    uint32_t pid, MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    int32_t state = 0;
+    int32_t newstate = 0;
+    int i = 0;
+    int p = 0;
+
+    /* walk down the trie till we have a match for the pattern prefix */
+    for (i = 0; i < pattern_len; i++) {
+        if (ctx->goto_table[state][pattern[i]] != SC_AC_COMPACT_FAIL) {
+            state = ctx->goto_table[state][pattern[i]];
+        } else {
+            break;
+        }
+    }
+
+    /* add the non-matching pattern suffix to the trie, from the last state
+     * we left off */
+    for (p = i; p < pattern_len; p++) {
+        newstate = SCACCompactInitNewState(mpm_ctx);
+        ctx->goto_table[state][pattern[p]] = newstate;
+        state = newstate;
+    }
+
+    /* add this pattern id, to the output table of the last state, where the
+     * pattern ends in the trie */
+    SCACCompactSetOutputState(state, pid, mpm_ctx);
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Create the goto table.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+static inline void SCACCompactCreateGotoTable(MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    uint32_t i = 0;
+
+    /* add each pattern to create the goto table */
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        SCACCompactEnter(ctx->parray[i]->ci, ctx->parray[i]->len,
+                         ctx->parray[i]->id, mpm_ctx);
+    }
+
+    int ascii_code = 0;
+    for (ascii_code = 0; ascii_code < 256; ascii_code++) {
+        if (ctx->goto_table[0][ascii_code] == SC_AC_COMPACT_FAIL) {
+            ctx->goto_table[0][ascii_code] = 0;
+        }
+    }
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Club the output data from 2 states and store it in the 1st state.
+ *        dst_state_data = {dst_state_data} UNION {src_state_data}
+ */
+static inline void SCACCompactClubOutputStates(int32_t dst_state, int32_t src_state,
+                                               MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    SCACCompactOutputTable *output_dst_state = &ctx->output_table[dst_state];
+    SCACCompactOutputTable *output_src_state = &ctx->output_table[src_state];
+
+    for (i = 0; i < output_src_state->no_of_entries; i++) {
+        for (j = 0; j < output_dst_state->no_of_entries; j++) {
+            if (output_src_state->pids[i] == output_dst_state->pids[j]) {
+                break;
+            }
+        }
+        if (j == output_dst_state->no_of_entries) {
+            output_dst_state->no_of_entries++;
+
+            output_dst_state->pids = SCRealloc(output_dst_state->pids,
+                                               (output_dst_state->no_of_entries *
+                                                sizeof(uint32_t)) );
+            if (output_dst_state->pids == NULL) {
+                SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+                exit(EXIT_FAILURE);
+            }
+
+            output_dst_state->pids[output_dst_state->no_of_entries - 1] =
+                output_src_state->pids[i];
+        }
+    }
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Create the failure table.
+ *
+ * As the goto table is a trie, a breadth first walk sees each state once,
+ * so the queue needs no more than state_count entries and doesn't wrap.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param order   Array of state_count entries. Filled with the non root
+ *                states in breadth first order.
+ */
+static inline void SCACCompactCreateFailureTable(MpmCtx *mpm_ctx, int32_t *order)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    int ascii_code = 0;
+    int32_t state = 0;
+    int32_t r_state = 0;
+    uint32_t top = 0;
+    uint32_t bot = 0;
+
+    ctx->failure_table = SCMalloc(ctx->state_count * sizeof(int32_t));
+    if (ctx->failure_table == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    memset(ctx->failure_table, 0, ctx->state_count * sizeof(int32_t));
+
+    /* the states one step from the root fail to the root */
+    for (ascii_code = 0; ascii_code < 256; ascii_code++) {
+        int32_t temp_state = ctx->goto_table[0][ascii_code];
+        if (temp_state != 0) {
+            order[top++] = temp_state;
+            ctx->failure_table[temp_state] = 0;
+        }
+    }
+
+    while (bot < top) {
+        r_state = order[bot++];
+        for (ascii_code = 0; ascii_code < 256; ascii_code++) {
+            int32_t temp_state = ctx->goto_table[r_state][ascii_code];
+            if (temp_state == SC_AC_COMPACT_FAIL)
+                continue;
+            order[top++] = temp_state;
+            state = ctx->failure_table[r_state];
+
+            while (ctx->goto_table[state][ascii_code] == SC_AC_COMPACT_FAIL)
+                state = ctx->failure_table[state];
+            ctx->failure_table[temp_state] = ctx->goto_table[state][ascii_code];
+            SCACCompactClubOutputStates(temp_state, ctx->failure_table[temp_state],
+                                        mpm_ctx);
+        }
+    }
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Set up the byte to alphabet class map.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param t       Table to set the map up for.
+ * \param rep     Filled with a byte of each class, to look up the goto
+ *                table with.
+ */
+static void SCACCompactCreateAlphabet(MpmCtx *mpm_ctx, SCACCompactTable *t,
+                                      uint8_t *rep)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    uint8_t used[256];
+    uint32_t i, j;
+    int c;
+
+    memset(used, 0, sizeof(used));
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        for (j = 0; j < ctx->parray[i]->len; j++)
+            used[ctx->parray[i]->ci[j]] = 1;
+    }
+
+    /* class 0 holds all bytes that are in no pattern. As the goto table
+     * is built from lowercase patterns there is always at least one. */
+    memset(t->xlate, 0, sizeof(t->xlate));
+    t->alpha_size = 1;
+    rep[0] = 'A';
+    for (c = 0; c < 256; c++) {
+        if (used[c]) {
+            t->xlate[c] = t->alpha_size;
+            rep[t->alpha_size++] = c;
+        }
+    }
+    while ((1 << t->row_shift) < t->alpha_size)
+        t->row_shift++;
+
+    /* fold case in the map, so the search doesn't have to */
+    for (c = 0; c < 256; c++) {
+        if (u8_tolower(c) != c)
+            t->xlate[c] = t->xlate[u8_tolower(c)];
+    }
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Create the compressed delta table, with the output state
+ *        presence clubbed into the entries.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param t       Table to create the delta table in.
+ * \param order   The non root states in breadth first order, so that the
+ *                row of a failure state is always done before it's used.
+ * \param rep     A byte of each class.
+ */
+static void SCACCompactCreateDeltaTable(MpmCtx *mpm_ctx, SCACCompactTable *t,
+                                        int32_t *order, uint8_t *rep)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    uint32_t alpha_size = t->alpha_size;
+    uint32_t stride = 1 << t->row_shift;
+    uint32_t size;
+    uint32_t i, cls;
+
+    if (ctx->state_count < 32767) {
+        size = ctx->state_count * stride * sizeof(SC_AC_COMPACT_STATE_TYPE_U16);
+        t->state_table_u16 = SCMalloc(size);
+        if (t->state_table_u16 == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+            exit(EXIT_FAILURE);
+        }
+        memset(t->state_table_u16, 0, size);
+        t->memory_size += size;
+
+        SC_AC_COMPACT_STATE_TYPE_U16 *row = t->state_table_u16;
+        for (cls = 0; cls < alpha_size; cls++) {
+            int32_t next = ctx->goto_table[0][rep[cls]];
+            row[cls] = next;
+            if (ctx->output_table[next].no_of_entries != 0)
+                row[cls] |= (1 << 15);
+        }
+
+        for (i = 0; i < ctx->state_count - 1; i++) {
+            int32_t r_state = order[i];
+            SC_AC_COMPACT_STATE_TYPE_U16 *fail_row = t->state_table_u16 +
+                (ctx->failure_table[r_state] * stride);
+            row = t->state_table_u16 + (r_state * stride);
+
+            for (cls = 0; cls < alpha_size; cls++) {
+                int32_t next = ctx->goto_table[r_state][rep[cls]];
+                if (next != SC_AC_COMPACT_FAIL) {
+                    row[cls] = next;
+                    if (ctx->output_table[next].no_of_entries != 0)
+                        row[cls] |= (1 << 15);
+                } else {
+                    row[cls] = fail_row[cls];
+                }
+            }
+        }
+    } else {
+        if (ctx->state_count >= (1 << 24)) {
+            SCLogError(SC_ERR_AHO_CORASICK, "too many states (%"PRIu32") "
+                       "for the state table", ctx->state_count);
+            exit(EXIT_FAILURE);
+        }
+
+        size = ctx->state_count * stride * sizeof(SC_AC_COMPACT_STATE_TYPE_U32);
+        t->state_table_u32 = SCMalloc(size);
+        if (t->state_table_u32 == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+            exit(EXIT_FAILURE);
+        }
+        memset(t->state_table_u32, 0, size);
+        t->memory_size += size;
+
+        SC_AC_COMPACT_STATE_TYPE_U32 *row = t->state_table_u32;
+        for (cls = 0; cls < alpha_size; cls++) {
+            int32_t next = ctx->goto_table[0][rep[cls]];
+            row[cls] = next;
+            if (ctx->output_table[next].no_of_entries != 0)
+                row[cls] |= (1 << 24);
+        }
+
+        for (i = 0; i < ctx->state_count - 1; i++) {
+            int32_t r_state = order[i];
+            SC_AC_COMPACT_STATE_TYPE_U32 *fail_row = t->state_table_u32 +
+                (ctx->failure_table[r_state] * stride);
+            row = t->state_table_u32 + (r_state * stride);
+
+            for (cls = 0; cls < alpha_size; cls++) {
+                int32_t next = ctx->goto_table[r_state][rep[cls]];
+                if (next != SC_AC_COMPACT_FAIL) {
+                    row[cls] = next;
+                    if (ctx->output_table[next].no_of_entries != 0)
+                        row[cls] |= (1 << 24);
+                } else {
+                    row[cls] = fail_row[cls];
+                }
+            }
+        }
+    }
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Allocate the pid list for t->max_pat_id.
+ */
+static void SCACCompactPatternListAlloc(SCACCompactTable *t)
+{
+    t->pid_pat_list = SCMalloc((t->max_pat_id + 1) * sizeof(SCACCompactPatternList));
+    if (t->pid_pat_list == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    memset(t->pid_pat_list, 0, (t->max_pat_id + 1) * sizeof(SCACCompactPatternList));
+    t->memory_size += (t->max_pat_id + 1) * sizeof(SCACCompactPatternList);
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Add a pattern to the pid list used to verify case sensitive
+ *        matches.
+ */
+static void SCACCompactPatternListAdd(SCACCompactTable *t, uint32_t id,
+                                      uint8_t flags, uint8_t *pat, uint16_t len)
+{
+    SCACCompactPatternList *pl = &t->pid_pat_list[id];
+
+    if (flags & MPM_PATTERN_FLAG_NOCASE) {
+        if (pl->case_state == 0 || pl->case_state == 1)
+            pl->case_state = 1;
+        else
+            pl->case_state = 3;
+    } else {
+        if (pl->cs == NULL) {
+            pl->cs = SCMalloc(len);
+            if (pl->cs == NULL) {
+                SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+                exit(EXIT_FAILURE);
+            }
+            t->memory_size += len;
+        }
+        memcpy(pl->cs, pat, len);
+        pl->patlen = len;
+
+        if (pl->case_state == 0 || pl->case_state == 2)
+            pl->case_state = 2;
+        else
+            pl->case_state = 3;
+    }
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Set up the pid list used to verify case sensitive matches.
+ */
+static void SCACCompactCreatePatternList(MpmCtx *mpm_ctx, SCACCompactTable *t)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    uint32_t i;
+
+    t->max_pat_id = ctx->max_pat_id;
+    SCACCompactPatternListAlloc(t);
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        SCACCompactPattern *p = ctx->parray[i];
+        SCACCompactPatternListAdd(t, p->id, p->flags, p->original_pat, p->len);
+    }
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Mark the pids of case sensitive patterns in the output table.
+ */
+static void SCACCompactInsertCaseSensitiveEntries(SCACCompactTable *t)
+{
+    uint32_t state = 0;
+    uint32_t k = 0;
+
+    for (state = 0; state < t->state_count; state++) {
+        if (t->output_table[state].no_of_entries == 0)
+            continue;
+
+        for (k = 0; k < t->output_table[state].no_of_entries; k++) {
+            if (t->pid_pat_list[t->output_table[state].pids[k]].cs != NULL) {
+                t->output_table[state].pids[k] &= 0x0000FFFF;
+                t->output_table[state].pids[k] |= 1 << 16;
+            }
+        }
+    }
+
+    return;
+}
+
+static void SCACCompactTableFree(SCACCompactTable *t)
+{
+    uint32_t i;
+
+    /* the state table and the pids of a cached table are in the mapping */
+    if (t->map == NULL) {
+        if (t->state_table_u16 != NULL)
+            SCFree(t->state_table_u16);
+        if (t->state_table_u32 != NULL)
+            SCFree(t->state_table_u32);
+    }
+
+    if (t->output_table != NULL) {
+        if (t->map == NULL) {
+            for (i = 0; i < t->state_count; i++) {
+                if (t->output_table[i].pids != NULL)
+                    SCFree(t->output_table[i].pids);
+            }
+        }
+        SCFree(t->output_table);
+    }
+
+    if (t->pid_pat_list != NULL) {
+        for (i = 0; i < (uint32_t)t->max_pat_id + 1; i++) {
+            if (t->pid_pat_list[i].cs != NULL)
+                SCFree(t->pid_pat_list[i].cs);
+        }
+        SCFree(t->pid_pat_list);
+    }
+
+    if (t->key != NULL)
+        SCFree(t->key);
+
+#ifdef HAVE_SYS_MMAN_H
+    if (t->map != NULL)
+        munmap(t->map, t->map_len);
+#endif
+
+    SCFree(t);
+    return;
+}
+
+/**
+ * \internal
+ * \brief Build the search tables from the patterns in parray.
+ *
+ * \retval t the new table, with a refcnt of 1
+ */
+static SCACCompactTable *SCACCompactBuildTable(MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    uint8_t rep[256];
+    uint32_t i;
+
+    SCACCompactTable *t = SCMalloc(sizeof(SCACCompactTable));
+    if (t == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    memset(t, 0, sizeof(SCACCompactTable));
+    t->memory_size = sizeof(SCACCompactTable);
+    t->refcnt = 1;
+
+    /* the memory consumed by a single state in our goto table */
+    ctx->single_state_size = sizeof(int32_t) * 256;
+
+    /* create the 0th state in the goto table and output_table */
+    SCACCompactInitNewState(mpm_ctx);
+    SCACCompactCreateGotoTable(mpm_ctx);
+
+    int32_t *order = SCMalloc(ctx->state_count * sizeof(int32_t));
+    if (order == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    SCACCompactCreateFailureTable(mpm_ctx, order);
+
+    SCACCompactCreateAlphabet(mpm_ctx, t, rep);
+    SCACCompactCreateDeltaTable(mpm_ctx, t, order, rep);
+    SCFree(order);
+
+    /* the output table moves over to the table */
+    t->state_count = ctx->state_count;
+    t->output_table = ctx->output_table;
+    ctx->output_table = NULL;
+    t->memory_size += t->state_count * sizeof(SCACCompactOutputTable);
+    for (i = 0; i < t->state_count; i++)
+        t->memory_size += t->output_table[i].no_of_entries * sizeof(uint32_t);
+
+    SCACCompactCreatePatternList(mpm_ctx, t);
+    SCACCompactInsertCaseSensitiveEntries(t);
+
+    /* we don't need these anymore */
+    SCFree(ctx->goto_table);
+    ctx->goto_table = NULL;
+    SCFree(ctx->failure_table);
+    ctx->failure_table = NULL;
+    ctx->state_count = 0;
+
+    return t;
+}
+
+static int SCACCompactPatternCmp(const void *a, const void *b)
+{
+    const SCACCompactPattern *p1 = *(const SCACCompactPattern **)a;
+    const SCACCompactPattern *p2 = *(const SCACCompactPattern **)b;
+
+    if (p1->id != p2->id)
+        return p1->id < p2->id ? -1 : 1;
+    if (p1->flags != p2->flags)
+        return p1->flags < p2->flags ? -1 : 1;
+    if (p1->len != p2->len)
+        return p1->len < p2->len ? -1 : 1;
+    return memcmp(p1->original_pat, p2->original_pat, p1->len);
+}
+
+/**
+ * \internal
+ * \brief Serialize the (sorted) pattern set into the table hash key.
+ *
+ * The tables only depend on the pattern ids, flags and bytes, so two
+ * contexts with the same key can use the same tables.
+ */
+static void SCACCompactCreateKey(MpmCtx *mpm_ctx, SCACCompactTable *t)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    uint32_t len = 0;
+    uint32_t i, j;
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++)
+        len += sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint16_t) + ctx->parray[i]->len;
+
+    t->key = SCMalloc(len);
+    if (t->key == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+    t->key_len = len;
+    t->memory_size += len;
+
+    uint8_t *k = t->key;
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        SCACCompactPattern *p = ctx->parray[i];
+        memcpy(k, &p->id, sizeof(uint32_t));
+        k += sizeof(uint32_t);
+        *k++ = p->flags;
+        memcpy(k, &p->len, sizeof(uint16_t));
+        k += sizeof(uint16_t);
+        memcpy(k, p->original_pat, p->len);
+        k += p->len;
+    }
+
+    uint32_t hash = 5381;
+    for (j = 0; j < len; j++)
+        hash = ((hash << 5) + hash) + t->key[j];
+    t->key_hash = hash;
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Look up a table with the key of t. Needs shared_tables_lock.
+ */
+static SCACCompactTable *SCACCompactSharedLookup(SCACCompactTable *t)
+{
+    SCACCompactTable *st = shared_tables[t->key_hash % SHARED_HASH_SIZE];
+    for ( ; st != NULL; st = st->next) {
+        if (st->key_hash == t->key_hash && st->key_len == t->key_len &&
+            memcmp(st->key, t->key, t->key_len) == 0)
+            return st;
+    }
+
+    return NULL;
+}
+
+/**
+ * \internal
+ * \brief Drop a reference to a table, freeing it on the last one.
+ */
+static void SCACCompactTableRelease(SCACCompactTable *t)
+{
+    SCMutexLock(&shared_tables_lock);
+    if (--t->refcnt > 0) {
+        SCMutexUnlock(&shared_tables_lock);
+        return;
+    }
+
+    SCACCompactTable **pt = &shared_tables[t->key_hash % SHARED_HASH_SIZE];
+    for ( ; *pt != NULL; pt = &(*pt)->next) {
+        if (*pt == t) {
+            *pt = t->next;
+            shared_tables_memuse -= t->memory_size;
+            break;
+        }
+    }
+    SCMutexUnlock(&shared_tables_lock);
+
+    SCACCompactTableFree(t);
+    return;
+}
+
+/**
+ * \brief Memory used by the tables of all ac-compact contexts. Tables
+ *        shared by several contexts are counted once.
+ */
+uint64_t SCACCompactTablesMemuse(void)
+{
+    SCMutexLock(&shared_tables_lock);
+    uint64_t memuse = shared_tables_memuse;
+    SCMutexUnlock(&shared_tables_lock);
+    return memuse;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+
+#define SC_AC_COMPACT_CACHE_MAGIC   "SCACCMP"
+/* bump when the table layout or the way the tables are built changes */
+#define SC_AC_COMPACT_CACHE_VERSION 1
+#define SC_AC_COMPACT_CACHE_BYTE_ORDER 0x01020304
+/* sections start on a cache line */
+#define SC_AC_COMPACT_CACHE_ALIGN(x) (((x) + 63) & ~((uint64_t)63))
+
+/**
+ * \brief Header of a table cache file. It's followed by the sections
+ *        in the order of SCACCompactCacheLayout, all in host byte order.
+ */
+typedef struct SCACCompactCacheHdr_ {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t key_len;
+    uint32_t key_hash;
+    uint32_t state_count;
+    /* sum of the no_of_entries of the output table */
+    uint32_t pids_cnt;
+    uint16_t alpha_size;
+    uint16_t max_pat_id;
+    uint8_t row_shift;
+    /* 1 if the state table has 32 bit entries */
+    uint8_t wide;
+    uint16_t pad;
+    /* hashlittle of the file after the header */
+    uint32_t checksum;
+    uint64_t file_len;
+} SCACCompactCacheHdr;
+
+/** offsets of the sections of a table cache file */
+typedef struct SCACCompactCacheLayout_ {
+    uint64_t key_off;
+    uint64_t xlate_off;
+    uint64_t states_off;
+    /* no_of_entries of each state */
+    uint64_t counts_off;
+    /* the pids of all states, in state order */
+    uint64_t pids_off;
+    uint64_t len;
+} SCACCompactCacheLayout;
+
+static void SCACCompactCacheGetLayout(const SCACCompactCacheHdr *h,
+                                      SCACCompactCacheLayout *l)
+{
+    uint64_t off = SC_AC_COMPACT_CACHE_ALIGN(sizeof(SCACCompactCacheHdr));
+
+    l->key_off = off;
+    off = SC_AC_COMPACT_CACHE_ALIGN(off + h->key_len);
+    l->xlate_off = off;
+    off = SC_AC_COMPACT_CACHE_ALIGN(off + 256);
+    l->states_off = off;
+    off = SC_AC_COMPACT_CACHE_ALIGN(off + ((uint64_t)h->state_count << h->row_shift) *
+            (h->wide ? sizeof(SC_AC_COMPACT_STATE_TYPE_U32) :
+                       sizeof(SC_AC_COMPACT_STATE_TYPE_U16)));
+    l->counts_off = off;
+    off = SC_AC_COMPACT_CACHE_ALIGN(off + (uint64_t)h->state_count * sizeof(uint32_t));
+    l->pids_off = off;
+    l->len = off + (uint64_t)h->pids_cnt * sizeof(uint32_t);
+
+    return;
+}
+
+static int SCACCompactCachePath(char *path, size_t size, SCACCompactTable *t)
+{
+    int r = snprintf(path, size, "%s/ac-compact-%08x-%u.cache", cache_dir,
+                     t->key_hash, t->key_len);
+    if (r < 0 || (size_t)r >= size)
+        return -1;
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Rebuild the pid list of a cached table from its key, which
+ *        holds the same patterns the list was built from.
+ *
+ * \retval 0 ok, -1 if the key doesn't fit the table
+ */
+static int SCACCompactCreatePatternListFromKey(SCACCompactTable *t)
+{
+    uint8_t *k = t->key;
+    uint8_t *end = t->key + t->key_len;
+
+    SCACCompactPatternListAlloc(t);
+
+    while (k < end) {
+        uint32_t id;
+        uint16_t len;
+        uint8_t flags;
+
+        if (end - k < (ptrdiff_t)(sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint16_t)))
+            return -1;
+        memcpy(&id, k, sizeof(uint32_t));
+        k += sizeof(uint32_t);
+        flags = *k++;
+        memcpy(&len, k, sizeof(uint16_t));
+        k += sizeof(uint16_t);
+        if (id > t->max_pat_id || end - k < len)
+            return -1;
+
+        SCACCompactPatternListAdd(t, id, flags, k, len);
+        k += len;
+    }
+
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Check the tables in a mapped cache file, so a damaged file can't
+ *        make the search read out of bounds.
+ */
+static int SCACCompactCacheValidate(const SCACCompactCacheHdr *h,
+                                    const SCACCompactCacheLayout *l,
+                                    uint8_t *map)
+{
+    uint64_t entries = (uint64_t)h->state_count << h->row_shift;
+    uint64_t i, pids = 0;
+
+    for (i = 0; i < 256; i++) {
+        if (map[l->xlate_off + i] >= h->alpha_size)
+            return -1;
+    }
+
+    if (h->wide) {
+        SC_AC_COMPACT_STATE_TYPE_U32 *st = (SC_AC_COMPACT_STATE_TYPE_U32 *)(map + l->states_off);
+        for (i = 0; i < entries; i++) {
+            if ((st[i] & 0x00FFFFFF) >= h->state_count || (st[i] >> 25) != 0)
+                return -1;
+        }
+    } else {
+        SC_AC_COMPACT_STATE_TYPE_U16 *st = (SC_AC_COMPACT_STATE_TYPE_U16 *)(map + l->states_off);
+        for (i = 0; i < entries; i++) {
+            if ((uint32_t)(st[i] & 0x7FFF) >= h->state_count)
+                return -1;
+        }
+    }
+
+    uint32_t *counts = (uint32_t *)(map + l->counts_off);
+    for (i = 0; i < h->state_count; i++)
+        pids += counts[i];
+    if (pids != h->pids_cnt)
+        return -1;
+
+    uint32_t *pid = (uint32_t *)(map + l->pids_off);
+    for (i = 0; i < h->pids_cnt; i++) {
+        if ((pid[i] & 0x0000FFFF) > h->max_pat_id || (pid[i] >> 17) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Map the cached tables for the pattern set of lookup.
+ *
+ * \param lookup table with the key of the pattern set
+ *
+ * \retval t table using the mapped file, with a refcnt of 1, that takes
+ *           over the key of lookup
+ * \retval NULL no valid cache file
+ */
+static SCACCompactTable *SCACCompactCacheLoad(SCACCompactTable *lookup)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    SCACCompactCacheLayout l;
+    uint32_t i;
+
+    if (cache_dir == NULL || SCACCompactCachePath(path, sizeof(path), lookup) < 0)
+        return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SCACCompactCacheHdr)) {
+        close(fd);
+        return NULL;
+    }
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    const SCACCompactCacheHdr *h = (const SCACCompactCacheHdr *)map;
+    if (memcmp(h->magic, SC_AC_COMPACT_CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != SC_AC_COMPACT_CACHE_VERSION ||
+        h->byte_order != SC_AC_COMPACT_CACHE_BYTE_ORDER ||
+        h->file_len != (uint64_t)st.st_size ||
+        h->key_len != lookup->key_len || h->key_hash != lookup->key_hash ||
+        h->state_count == 0 || h->row_shift > 8 ||
+        h->alpha_size > (1 << h->row_shift) ||
+        h->wide != (h->state_count >= 32767))
+        goto invalid;
+
+    SCACCompactCacheGetLayout(h, &l);
+    if (l.len != h->file_len ||
+        memcmp(map + l.key_off, lookup->key, lookup->key_len) != 0 ||
+        hashlittle(map + sizeof(SCACCompactCacheHdr),
+                   h->file_len - sizeof(SCACCompactCacheHdr), 0) != h->checksum ||
+        SCACCompactCacheValidate(h, &l, map) < 0)
+        goto invalid;
+
+    SCACCompactTable *t = SCMalloc(sizeof(SCACCompactTable));
+    if (t == NULL)
+        goto error;
+    memset(t, 0, sizeof(SCACCompactTable));
+    t->memory_size = sizeof(SCACCompactTable) + st.st_size;
+    t->refcnt = 1;
+    t->map = map;
+    t->map_len = st.st_size;
+
+    memcpy(t->xlate, map + l.xlate_off, sizeof(t->xlate));
+    t->alpha_size = h->alpha_size;
+    t->row_shift = h->row_shift;
+    t->max_pat_id = h->max_pat_id;
+    t->state_count = h->state_count;
+    if (h->wide)
+        t->state_table_u32 = (SC_AC_COMPACT_STATE_TYPE_U32 *)(map + l.states_off);
+    else
+        t->state_table_u16 = (SC_AC_COMPACT_STATE_TYPE_U16 *)(map + l.states_off);
+
+    t->output_table = SCMalloc(t->state_count * sizeof(SCACCompactOutputTable));
+    if (t->output_table == NULL) {
+        SCACCompactTableFree(t);
+        return NULL;
+    }
+    t->memory_size += t->state_count * sizeof(SCACCompactOutputTable);
+    uint32_t *counts = (uint32_t *)(map + l.counts_off);
+    uint32_t *pids = (uint32_t *)(map + l.pids_off);
+    for (i = 0; i < t->state_count; i++) {
+        t->output_table[i].no_of_entries = counts[i];
+        t->output_table[i].pids = counts[i] ? pids : NULL;
+        pids += counts[i];
+    }
+
+    /* take over the key, the pid list is built from it */
+    t->key = lookup->key;
+    t->key_len = lookup->key_len;
+    t->key_hash = lookup->key_hash;
+    t->memory_size += t->key_len;
+    lookup->key = NULL;
+
+    if (SCACCompactCreatePatternListFromKey(t) < 0)
+        goto invalid_table;
+    /* a pid checked case sensitively needs its pattern */
+    for (i = 0; i < h->pids_cnt; i++) {
+        uint32_t pid = ((uint32_t *)(map + l.pids_off))[i];
+        if ((pid & 0xFFFF0000) && t->pid_pat_list[pid & 0x0000FFFF].cs == NULL)
+            goto invalid_table;
+    }
+
+    SCLogDebug("mapped %s: %"PRIu32" states", path, t->state_count);
+    return t;
+
+invalid_table:
+    /* hand the key back, the caller builds the table with it */
+    lookup->key = t->key;
+    t->key = NULL;
+    SCACCompactTableFree(t);
+    SCLogWarning(SC_ERR_AHO_CORASICK, "ignoring invalid table cache file %s", path);
+    return NULL;
+invalid:
+    SCLogWarning(SC_ERR_AHO_CORASICK, "ignoring invalid table cache file %s", path);
+error:
+    munmap(map, st.st_size);
+    return NULL;
+}
+
+/**
+ * \internal
+ * \brief Write the tables to the cache. The file is written under a
+ *        temporary name and renamed, so a reader only sees complete files.
+ */
+static void SCACCompactCacheStore(SCACCompactTable *t)
+{
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+    SCACCompactCacheHdr h;
+    SCACCompactCacheLayout l;
+    uint32_t i;
+
+    if (cache_dir == NULL || SCACCompactCachePath(path, sizeof(path), t) < 0)
+        return;
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp))
+        return;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SC_AC_COMPACT_CACHE_MAGIC, sizeof(h.magic));
+    h.version = SC_AC_COMPACT_CACHE_VERSION;
+    h.byte_order = SC_AC_COMPACT_CACHE_BYTE_ORDER;
+    h.key_len = t->key_len;
+    h.key_hash = t->key_hash;
+    h.state_count = t->state_count;
+    for (i = 0; i < t->state_count; i++)
+        h.pids_cnt += t->output_table[i].no_of_entries;
+    h.alpha_size = t->alpha_size;
+    h.max_pat_id = t->max_pat_id;
+    h.row_shift = t->row_shift;
+    h.wide = (t->state_table_u32 != NULL);
+    SCACCompactCacheGetLayout(&h, &l);
+    h.file_len = l.len;
+
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        SCLogWarning(SC_ERR_AHO_CORASICK, "can't create table cache file "
+                     "%s: %s", tmp, strerror(errno));
+        return;
+    }
+    if (ftruncate(fd, l.len) != 0)
+        goto error;
+    uint8_t *map = mmap(NULL, l.len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        goto error;
+
+    memcpy(map + l.key_off, t->key, t->key_len);
+    memcpy(map + l.xlate_off, t->xlate, sizeof(t->xlate));
+    if (h.wide)
+        memcpy(map + l.states_off, t->state_table_u32, ((size_t)t->state_count <<
+               t->row_shift) * sizeof(SC_AC_COMPACT_STATE_TYPE_U32));
+    else
+        memcpy(map + l.states_off, t->state_table_u16, ((size_t)t->state_count <<
+               t->row_shift) * sizeof(SC_AC_COMPACT_STATE_TYPE_U16));
+    uint32_t *counts = (uint32_t *)(map + l.counts_off);
+    uint32_t *pids = (uint32_t *)(map + l.pids_off);
+    for (i = 0; i < t->state_count; i++) {
+        counts[i] = t->output_table[i].no_of_entries;
+        memcpy(pids, t->output_table[i].pids, counts[i] * sizeof(uint32_t));
+        pids += counts[i];
+    }
+    h.checksum = hashlittle(map + sizeof(SCACCompactCacheHdr),
+                            l.len - sizeof(SCACCompactCacheHdr), 0);
+    memcpy(map, &h, sizeof(h));
+    munmap(map, l.len);
+
+    if (close(fd) != 0) {
+        fd = -1;
+        goto error;
+    }
+    fd = -1;
+    if (rename(tmp, path) != 0)
+        goto error;
+
+    SCLogDebug("wrote %s: %"PRIu32" states", path, t->state_count);
+    return;
+
+error:
+    SCLogWarning(SC_ERR_AHO_CORASICK, "can't write table cache file %s: %s",
+                 path, strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    unlink(tmp);
+    return;
+}
+
+#else /* HAVE_SYS_MMAN_H */
+
+static SCACCompactTable *SCACCompactCacheLoad(SCACCompactTable *lookup)
+{
+    return NULL;
+}
+
+static void SCACCompactCacheStore(SCACCompactTable *t)
+{
+    return;
+}
+
+#endif /* HAVE_SYS_MMAN_H */
+
+/**
+ * \internal
+ * \brief Read pattern-matcher.ac-compact from the config, once.
+ */
+static void SCACCompactGetConfig(void)
+{
+    ConfNode *pm, *conf;
+    const char *dir = NULL;
+
+    cache_conf_loaded = 1;
+
+    pm = ConfGetNode("pattern-matcher");
+    if (pm == NULL)
+        return;
+
+    TAILQ_FOREACH(conf, &pm->head, next) {
+        if (strcmp(conf->val, "ac-compact") == 0) {
+            dir = ConfNodeLookupChildValue(conf->head.tqh_first, "cache-dir");
+        }
+    }
+    if (dir == NULL)
+        return;
+
+#ifdef HAVE_SYS_MMAN_H
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        SCLogWarning(SC_ERR_AHO_CORASICK, "can't create ac-compact cache-dir "
+                     "%s: %s, not caching tables", dir, strerror(errno));
+        return;
+    }
+    cache_dir = SCStrdup(dir);
+    if (cache_dir == NULL)
+        return;
+    SCLogInfo("ac-compact: caching tables in %s", cache_dir);
+#else
+    SCLogWarning(SC_ERR_AHO_CORASICK, "ac-compact cache-dir is not supported "
+                 "on this platform");
+#endif
+    return;
+}
+
+/**
+ * \brief Process the patterns added to the mpm, and create the internal
+ *        tables, or take a reference to the tables of a context with the
+ *        same patterns.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+int SCACCompactPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    uint32_t i = 0, p = 0;
+
+    if (mpm_ctx->pattern_cnt == 0 || ctx->init_hash == NULL) {
+        SCLogDebug("no patterns supplied to this mpm_ctx");
+        return 0;
+    }
+
+    /* alloc the pattern array */
+    ctx->parray = (SCACCompactPattern **)SCMalloc(mpm_ctx->pattern_cnt *
+                                                  sizeof(SCACCompactPattern *));
+    if (ctx->parray == NULL)
+        goto error;
+    memset(ctx->parray, 0, mpm_ctx->pattern_cnt * sizeof(SCACCompactPattern *));
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (mpm_ctx->pattern_cnt * sizeof(SCACCompactPattern *));
+
+    /* populate it with the patterns in the hash */
+    for (i = 0; i < INIT_HASH_SIZE; i++) {
+        SCACCompactPattern *node = ctx->init_hash[i], *nnode = NULL;
+        while (node != NULL) {
+            nnode = node->next;
+            node->next = NULL;
+            ctx->parray[p++] = node;
+            node = nnode;
+        }
+    }
+
+    /* we no longer need the hash, so free it's memory */
+    SCFree(ctx->init_hash);
+    ctx->init_hash = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= (INIT_HASH_SIZE * sizeof(SCACCompactPattern *));
+
+    /* same pattern set, same order, regardless of how they were added */
+    qsort(ctx->parray, mpm_ctx->pattern_cnt, sizeof(SCACCompactPattern *),
+          SCACCompactPatternCmp);
+
+    SCACCompactTable lookup;
+    memset(&lookup, 0, sizeof(lookup));
+    SCACCompactCreateKey(mpm_ctx, &lookup);
+
+    SCMutexLock(&shared_tables_lock);
+    SCACCompactTable *t = SCACCompactSharedLookup(&lookup);
+    if (t != NULL)
+        t->refcnt++;
+    SCMutexUnlock(&shared_tables_lock);
+
+    if (t != NULL) {
+        SCFree(lookup.key);
+        ctx->shared = 1;
+    } else {
+        /* map or build without holding the lock, so contexts can be
+         * prepared in parallel. If another thread got the same table
+         * meanwhile, use that one. */
+        SCACCompactTable *nt = SCACCompactCacheLoad(&lookup);
+        if (nt == NULL) {
+            nt = SCACCompactBuildTable(mpm_ctx);
+            nt->key = lookup.key;
+            nt->key_len = lookup.key_len;
+            nt->key_hash = lookup.key_hash;
+            nt->memory_size += lookup.key_len;
+
+            SCACCompactCacheStore(nt);
+        }
+
+        SCMutexLock(&shared_tables_lock);
+        t = SCACCompactSharedLookup(nt);
+        if (t != NULL) {
+            t->refcnt++;
+        } else {
+            uint32_t hash = nt->key_hash % SHARED_HASH_SIZE;
+            nt->next = shared_tables[hash];
+            shared_tables[hash] = nt;
+            shared_tables_memuse += nt->memory_size;
+        }
+        SCMutexUnlock(&shared_tables_lock);
+
+        if (t != NULL) {
+            SCACCompactTableFree(nt);
+            ctx->shared = 1;
+        } else {
+            t = nt;
+        }
+    }
+    ctx->table = t;
+
+    SCLogDebug("ctx %p: %"PRIu32" patterns, %"PRIu32" states, %"PRIu16" "
+               "classes, tables %"PRIu32" bytes%s", mpm_ctx,
+               mpm_ctx->pattern_cnt, t->state_count, t->alpha_size,
+               t->memory_size, ctx->shared ? " (shared)" : "");
+
+    /* free all the stored patterns */
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        if (ctx->parray[i] != NULL) {
+            SCACCompactFreePattern(mpm_ctx, ctx->parray[i]);
+        }
+    }
+    SCFree(ctx->parray);
+    ctx->parray = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= (mpm_ctx->pattern_cnt * sizeof(SCACCompactPattern *));
+
+    return 0;
+
+error:
+    return -1;
+}
+
+/**
+ * \brief Init the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param matchsize      We don't need this.
+ */
+void SCACCompactInitThreadCtx(ThreadVars *tv, MpmCtx *mpm_ctx,
+                              MpmThreadCtx *mpm_thread_ctx, uint32_t matchsize)
+{
+    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+
+    mpm_thread_ctx->ctx = SCThreadMalloc(tv, sizeof(SCACCompactThreadCtx));
+    if (mpm_thread_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_thread_ctx->ctx, 0, sizeof(SCACCompactThreadCtx));
+    mpm_thread_ctx->memory_cnt++;
+    mpm_thread_ctx->memory_size += sizeof(SCACCompactThreadCtx);
+
+    return;
+}
+
+/**
+ * \brief Initialize the ac-compact context.
+ *
+ * \param mpm_ctx       Mpm context.
+ * \param module_handle Cuda module handle from the cuda handler API.  We don't
+ *                      have to worry about this here.
+ */
+void SCACCompactInitCtx(MpmCtx *mpm_ctx, int module_handle)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    mpm_ctx->ctx = SCMalloc(sizeof(SCACCompactCtx));
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCACCompactCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCACCompactCtx);
+
+    /* the config is read once, contexts are initialized by the main
+     * thread */
+    if (!cache_conf_loaded)
+        SCACCompactGetConfig();
+
+    /* initialize the hash we use to speed up pattern insertions */
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    ctx->init_hash = SCMalloc(sizeof(SCACCompactPattern *) * INIT_HASH_SIZE);
+    if (ctx->init_hash == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(ctx->init_hash, 0, sizeof(SCACCompactPattern *) * INIT_HASH_SIZE);
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (INIT_HASH_SIZE * sizeof(SCACCompactPattern *));
+
+    SCReturn;
+}
+
+/**
+ * \brief Destroy the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCACCompactDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    SCACCompactPrintSearchStats(mpm_thread_ctx);
+
+    if (mpm_thread_ctx->ctx != NULL) {
+        SCFree(mpm_thread_ctx->ctx);
+        mpm_thread_ctx->ctx = NULL;
+        mpm_thread_ctx->memory_cnt--;
+        mpm_thread_ctx->memory_size -= sizeof(SCACCompactThreadCtx);
+    }
+
+    return;
+}
+
+/**
+ * \brief Destroy the mpm context.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+void SCACCompactDestroyCtx(MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    if (ctx == NULL)
+        return;
+
+    if (ctx->init_hash != NULL) {
+        uint32_t i;
+        for (i = 0; i < INIT_HASH_SIZE; i++) {
+            SCACCompactPattern *p = ctx->init_hash[i], *np = NULL;
+            while (p != NULL) {
+                np = p->next;
+                SCACCompactFreePattern(mpm_ctx, p);
+                p = np;
+            }
+        }
+
+        SCFree(ctx->init_hash);
+        ctx->init_hash = NULL;
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (INIT_HASH_SIZE * sizeof(SCACCompactPattern *));
+    }
+
+    if (ctx->parray != NULL) {
+        uint32_t i;
+        for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+            if (ctx->parray[i] != NULL) {
+                SCACCompactFreePattern(mpm_ctx, ctx->parray[i]);
+            }
+        }
+
+        SCFree(ctx->parray);
+        ctx->parray = NULL;
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (mpm_ctx->pattern_cnt * sizeof(SCACCompactPattern *));
+    }
+
+    if (ctx->table != NULL) {
+        SCACCompactTableRelease(ctx->table);
+        ctx->table = NULL;
+    }
+
+    SCFree(mpm_ctx->ctx);
+    mpm_ctx->ctx = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCACCompactCtx);
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Add the patterns of an output state to the pmq.
+ *
+ * \param t     The search tables.
+ * \param pmq   Pattern matcher queue to add the matches to.
+ * \param buf   Buffer being searched.
+ * \param i     Offset of the last byte of the match in buf.
+ * \param state The output state.
+ *
+ * \retval matches Match count.
+ */
+static inline uint32_t SCACCompactOutput(SCACCompactTable *t,
+        PatternMatcherQueue *pmq, uint8_t *buf, int i, uint32_t state)
+{
+    SCACCompactPatternList *pid_pat_list = t->pid_pat_list;
+    uint32_t no_of_entries = t->output_table[state].no_of_entries;
+    uint32_t *pids = t->output_table[state].pids;
+    uint32_t matches = 0;
+    uint32_t k;
+
+    for (k = 0; k < no_of_entries; k++) {
+        uint32_t pid = pids[k];
+
+        if (pid & 0xFFFF0000) {
+            pid &= 0x0000FFFF;
+            if (SCMemcmp(pid_pat_list[pid].cs,
+                         buf + i - pid_pat_list[pid].patlen + 1,
+                         pid_pat_list[pid].patlen) != 0) {
+                /* inside loop */
+                if (pid_pat_list[pid].case_state != 3) {
+                    continue;
+                }
+            }
+        }
+
+        if (!(pmq->pattern_id_bitarray[pid / 8] & (1 << (pid % 8)))) {
+            pmq->pattern_id_bitarray[pid / 8] |= (1 << (pid % 8));
+            pmq->pattern_id_array[pmq->pattern_id_array_cnt++] = pid;
+        }
+        matches++;
+    }
+
+    return matches;
+}
+
+/**
+ * \brief The aho corasick search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCACCompactSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                           PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    SCACCompactTable *t = ctx->table;
+    uint32_t matches = 0;
+    int i = 0;
+
+    if (buflen == 0 || t == NULL)
+        return 0;
+
+    const uint8_t *xlate = t->xlate;
+    const uint32_t row_shift = t->row_shift;
+
+    /* this following implies (t->state_count < 32767) */
+    if (t->state_table_u16 != NULL) {
+        SC_AC_COMPACT_STATE_TYPE_U16 *state_table = t->state_table_u16;
+        register uint32_t state = 0;
+        for (i = 0; i < buflen; i++) {
+            state = state_table[((state & 0x7FFF) << row_shift) + xlate[buf[i]]];
+            if (unlikely(state & 0x8000)) {
+                matches += SCACCompactOutput(t, pmq, buf, i, state & 0x7FFF);
+            }
+        }
+    } else {
+        SC_AC_COMPACT_STATE_TYPE_U32 *state_table = t->state_table_u32;
+        register SC_AC_COMPACT_STATE_TYPE_U32 state = 0;
+        for (i = 0; i < buflen; i++) {
+            state = state_table[((state & 0x00FFFFFF) << row_shift) + xlate[buf[i]]];
+            if (unlikely(state & 0xFF000000)) {
+                matches += SCACCompactOutput(t, pmq, buf, i, state & 0x00FFFFFF);
+            }
+        }
+    }
+
+    return matches;
+}
+
+/**
+ * \brief Add a case insensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     Ignored.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCACCompactAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                            uint16_t offset, uint16_t depth, uint32_t pid,
+                            uint32_t sid, uint8_t flags)
+{
+    flags |= MPM_PATTERN_FLAG_NOCASE;
+    return SCACCompactAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+/**
+ * \brief Add a case sensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     Ignored.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCACCompactAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                            uint16_t offset, uint16_t depth, uint32_t pid,
+                            uint32_t sid, uint8_t flags)
+{
+    return SCACCompactAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+void SCACCompactPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+#ifdef SC_AC_COMPACT_COUNTERS
+    SCACCompactThreadCtx *ctx = (SCACCompactThreadCtx *)mpm_thread_ctx->ctx;
+    printf("AC Compact Thread Search stats (ctx %p)\n", ctx);
+    printf("Total calls: %" PRIu32 "\n", ctx->total_calls);
+    printf("Total matches: %" PRIu64 "\n", ctx->total_matches);
+#endif /* SC_AC_COMPACT_COUNTERS */
+
+    return;
+}
+
+void SCACCompactPrintInfo(MpmCtx *mpm_ctx)
+{
+    SCACCompactCtx *ctx = (SCACCompactCtx *)mpm_ctx->ctx;
+    SCACCompactTable *t = ctx->table;
+
+    printf("MPM AC Compact Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf(" Sizeof:\n");
+    printf("  MpmCtx              %" PRIuMAX "\n", (uintmax_t)sizeof(MpmCtx));
+    printf("  SCACCompactCtx:     %" PRIuMAX "\n", (uintmax_t)sizeof(SCACCompactCtx));
+    printf("  SCACCompactTable:   %" PRIuMAX "\n", (uintmax_t)sizeof(SCACCompactTable));
+    printf("  SCACCompactPattern  %" PRIuMAX "\n", (uintmax_t)sizeof(SCACCompactPattern));
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    if (t != NULL) {
+        uint32_t entry_size = t->state_table_u16 != NULL ?
+            sizeof(SC_AC_COMPACT_STATE_TYPE_U16) : sizeof(SC_AC_COMPACT_STATE_TYPE_U32);
+        printf("Total states in the state table:    %" PRIu32 "\n", t->state_count);
+        printf("Alphabet classes:                   %" PRIu16 "\n", t->alpha_size);
+        printf("State table size:                   %" PRIu32 " (%" PRIu32
+               " uncompressed)\n", (t->state_count << t->row_shift) * entry_size,
+               t->state_count * 256 * entry_size);
+        printf("Tables size:                        %" PRIu32 "%s, used by %"
+               PRIu32 " contexts\n", t->memory_size,
+               ctx->shared ? " (shared)" : "", t->refcnt);
+    }
+    printf("\n");
+
+    return;
+}
+
+/*************************************Unittests********************************/
+#ifdef __tilegx__
+/*
+ * Remove this temporarily on Tilera
+ * Needs a little more work because of the ThreadVars stuff
+ */
+#undef UNITTESTS
+#endif
+
+#ifdef UNITTESTS
+
+#include <dirent.h>
+
+static int SCACCompactTest01(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest02(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"abce", 4, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 0)
+        result = 1;
+    else
+        printf("0 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest03(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    /* 1 match */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"bcde", 4, 0, 0, 1, 0, 0);
+    /* 1 match */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"fghj", 4, 0, 0, 2, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 3);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 3)
+        result = 1;
+    else
+        printf("3 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest04(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"bcdegh", 6, 0, 0, 1, 0, 0);
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"fghjxyz", 7, 0, 0, 2, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 3);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest05(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCACCompactAddPatternCI(&mpm_ctx, (uint8_t *)"ABCD", 4, 0, 0, 0, 0, 0);
+    SCACCompactAddPatternCI(&mpm_ctx, (uint8_t *)"bCdEfG", 6, 0, 0, 1, 0, 0);
+    SCACCompactAddPatternCI(&mpm_ctx, (uint8_t *)"fghJikl", 7, 0, 0, 2, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 3);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 3)
+        result = 1;
+    else
+        printf("3 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest06(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcd";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest07(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* should match 30 times */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"A", 1, 0, 0, 0, 0, 0);
+    /* should match 29 times */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 1, 0, 0);
+    /* should match 28 times */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"AAA", 3, 0, 0, 2, 0, 0);
+    /* 26 */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"AAAAA", 5, 0, 0, 3, 0, 0);
+    /* 21 */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"AAAAAAAAAA", 10, 0, 0, 4, 0, 0);
+    /* 1 */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA",
+                     30, 0, 0, 5, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 6);
+    /* total matches: 135 */
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 135)
+        result = 1;
+    else
+        printf("135 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest08(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)"a", 1);
+
+    if (cnt == 0)
+        result = 1;
+    else
+        printf("0 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest09(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"ab", 2, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)"ab", 2);
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest10(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"abcdefgh", 8, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "01234567890123456789012345678901234567890123456789"
+                "01234567890123456789012345678901234567890123456789"
+                "abcdefgh"
+                "01234567890123456789012345678901234567890123456789"
+                "01234567890123456789012345678901234567890123456789";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest11(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    if (SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"he", 2, 0, 0, 1, 0, 0) == -1)
+        goto end;
+    if (SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"she", 3, 0, 0, 2, 0, 0) == -1)
+        goto end;
+    if (SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"his", 3, 0, 0, 3, 0, 0) == -1)
+        goto end;
+    if (SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"hers", 4, 0, 0, 4, 0, 0) == -1)
+        goto end;
+    PmqSetup(NULL, &pmq, 0, 5);
+
+    if (SCACCompactPreparePatterns(&mpm_ctx) == -1)
+        goto end;
+
+    result = 1;
+
+    char *buf = "he";
+    result &= (SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)buf,
+                          strlen(buf)) == 1);
+    buf = "she";
+    result &= (SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)buf,
+                          strlen(buf)) == 2);
+    buf = "his";
+    result &= (SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)buf,
+                          strlen(buf)) == 1);
+    buf = "hers";
+    result &= (SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)buf,
+                          strlen(buf)) == 2);
+
+ end:
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest12(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"wxyz", 4, 0, 0, 0, 0, 0);
+    /* 1 match */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"vwxyz", 5, 0, 0, 1, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 2);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghijklmnopqrstuvwxyz";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 2)
+        result = 1;
+    else
+        printf("2 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest13(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    char *pat = "abcdefghijklmnopqrstuvwxyzABCD";
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghijklmnopqrstuvwxyzABCD";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest14(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    char *pat = "abcdefghijklmnopqrstuvwxyzABCDE";
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghijklmnopqrstuvwxyzABCDE";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest15(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    char *pat = "abcdefghijklmnopqrstuvwxyzABCDEF";
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghijklmnopqrstuvwxyzABCDEF";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest16(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    char *pat = "abcdefghijklmnopqrstuvwxyzABC";
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghijklmnopqrstuvwxyzABC";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest17(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    char *pat = "abcdefghijklmnopqrstuvwxyzAB";
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghijklmnopqrstuvwxyzAB";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest18(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    char *pat = "abcde""fghij""klmno""pqrst""uvwxy""z";
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcde""fghij""klmno""pqrst""uvwxy""z";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest19(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 */
+    char *pat = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest20(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 */
+    char *pat = "AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AA";
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AA";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest21(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                              (uint8_t *)"AA", 2);
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest22(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    /* 1 match */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"abcde", 5, 0, 0, 1, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 2);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghijklmnopqrstuvwxyz";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                              (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 2)
+        result = 1;
+    else
+        printf("2 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest23(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                              (uint8_t *)"aa", 2);
+
+    if (cnt == 0)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest24(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 */
+    SCACCompactAddPatternCI(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                              (uint8_t *)"aa", 2);
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest25(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCACCompactAddPatternCI(&mpm_ctx, (uint8_t *)"ABCD", 4, 0, 0, 0, 0, 0);
+    SCACCompactAddPatternCI(&mpm_ctx, (uint8_t *)"bCdEfG", 6, 0, 0, 1, 0, 0);
+    SCACCompactAddPatternCI(&mpm_ctx, (uint8_t *)"fghiJkl", 7, 0, 0, 2, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 3);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 3)
+        result = 1;
+    else
+        printf("3 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest26(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCACCompactAddPatternCI(&mpm_ctx, (uint8_t *)"Works", 5, 0, 0, 0, 0, 0);
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"Works", 5, 0, 0, 1, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 2);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "works";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("3 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest27(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 0 match */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"ONE", 3, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "tone";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 0)
+        result = 1;
+    else
+        printf("0 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACCompactTest28(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 0 match */
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"one", 3, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    char *buf = "tONE";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 0)
+        result = 1;
+    else
+        printf("0 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+
+/** \test contexts with the same patterns share the tables, and a context
+ *        still works after the one that built them is gone */
+static int SCACCompactTest29(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx1, mpm_ctx2;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    uint64_t memuse = SCACCompactTablesMemuse();
+
+    memset(&mpm_ctx1, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx2, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx1, MPM_AC_COMPACT, -1);
+    MpmInitCtx(&mpm_ctx2, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx1, &mpm_thread_ctx, 0);
+
+    /* same patterns, added in a different order */
+    SCACCompactAddPatternCS(&mpm_ctx1, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    SCACCompactAddPatternCI(&mpm_ctx1, (uint8_t *)"BcDe", 4, 0, 0, 1, 0, 0);
+    SCACCompactAddPatternCI(&mpm_ctx2, (uint8_t *)"BcDe", 4, 0, 0, 1, 0, 0);
+    SCACCompactAddPatternCS(&mpm_ctx2, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 2);
+
+    SCACCompactPreparePatterns(&mpm_ctx1);
+    SCACCompactPreparePatterns(&mpm_ctx2);
+
+    SCACCompactCtx *ctx1 = (SCACCompactCtx *)mpm_ctx1.ctx;
+    SCACCompactCtx *ctx2 = (SCACCompactCtx *)mpm_ctx2.ctx;
+    if (ctx1->table == NULL || ctx1->table != ctx2->table) {
+        printf("tables not shared: ");
+        goto end;
+    }
+    if (ctx1->shared || !ctx2->shared || ctx1->table->refcnt != 2) {
+        printf("bad sharing state: ");
+        goto end;
+    }
+    /* the tables are counted once, globally, and not per ctx */
+    if (mpm_ctx2.memory_size != mpm_ctx1.memory_size ||
+        SCACCompactTablesMemuse() != memuse + ctx1->table->memory_size) {
+        printf("shared tables not accounted once: ");
+        goto end;
+    }
+
+    SCACCompactDestroyCtx(&mpm_ctx1);
+    if (SCACCompactTablesMemuse() != memuse + ctx2->table->memory_size) {
+        printf("tables of a ctx in use not accounted: ");
+        goto end;
+    }
+
+    char *buf = "abcde";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx2, &mpm_thread_ctx, &pmq,
+                                     (uint8_t *)buf, strlen(buf));
+    if (cnt == 2)
+        result = 1;
+    else
+        printf("2 != %" PRIu32 " ",cnt);
+
+    SCACCompactDestroyCtx(&mpm_ctx2);
+    if (SCACCompactTablesMemuse() != memuse) {
+        printf("tables memuse %"PRIu64" after free, expected %"PRIu64": ",
+               SCACCompactTablesMemuse(), memuse);
+        result = 0;
+    }
+    SCACCompactDestroyThreadCtx(&mpm_ctx1, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+end:
+    SCACCompactDestroyCtx(&mpm_ctx1);
+    SCACCompactDestroyCtx(&mpm_ctx2);
+    SCACCompactDestroyThreadCtx(&mpm_ctx1, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** \test same bytes with a different id or case flag are not shared */
+static int SCACCompactTest30(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx1, mpm_ctx2, mpm_ctx3;
+
+    memset(&mpm_ctx1, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx2, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx3, 0, sizeof(MpmCtx));
+    MpmInitCtx(&mpm_ctx1, MPM_AC_COMPACT, -1);
+    MpmInitCtx(&mpm_ctx2, MPM_AC_COMPACT, -1);
+    MpmInitCtx(&mpm_ctx3, MPM_AC_COMPACT, -1);
+
+    SCACCompactAddPatternCS(&mpm_ctx1, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    SCACCompactAddPatternCS(&mpm_ctx2, (uint8_t *)"abcd", 4, 0, 0, 1, 0, 0);
+    SCACCompactAddPatternCI(&mpm_ctx3, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+
+    SCACCompactPreparePatterns(&mpm_ctx1);
+    SCACCompactPreparePatterns(&mpm_ctx2);
+    SCACCompactPreparePatterns(&mpm_ctx3);
+
+    SCACCompactCtx *ctx1 = (SCACCompactCtx *)mpm_ctx1.ctx;
+    SCACCompactCtx *ctx2 = (SCACCompactCtx *)mpm_ctx2.ctx;
+    SCACCompactCtx *ctx3 = (SCACCompactCtx *)mpm_ctx3.ctx;
+    if (ctx1->table != ctx2->table && ctx1->table != ctx3->table &&
+        ctx2->table != ctx3->table && !ctx1->shared && !ctx2->shared &&
+        !ctx3->shared)
+        result = 1;
+    else
+        printf("tables shared: ");
+
+    SCACCompactDestroyCtx(&mpm_ctx1);
+    SCACCompactDestroyCtx(&mpm_ctx2);
+    SCACCompactDestroyCtx(&mpm_ctx3);
+    return result;
+}
+
+/** \test the alphabet has a class per pattern byte, folds case and keeps
+ *        binary bytes apart */
+static int SCACCompactTest31(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCACCompactAddPatternCI(&mpm_ctx, (uint8_t *)"GET", 3, 0, 0, 0, 0, 0);
+    SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)"\x00\xff\x41", 3, 0, 0, 1, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 2);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    SCACCompactTable *t = ((SCACCompactCtx *)mpm_ctx.ctx)->table;
+    /* g, e, t, 0x00, 0xff, a and the rest */
+    if (t->alpha_size != 7) {
+        printf("alpha_size %"PRIu16" != 7: ", t->alpha_size);
+        goto end;
+    }
+    if (t->xlate['g'] != t->xlate['G'] || t->xlate['a'] != t->xlate['A'] ||
+        t->xlate['x'] != 0 || t->xlate[0x00] == 0 || t->xlate[0xff] == 0) {
+        printf("bad xlate: ");
+        goto end;
+    }
+
+    uint8_t buf[] = "gEt \x00\xff\x61 \x00\xff\x41";
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                     buf, sizeof(buf) - 1);
+    if (cnt == 2 && pmq.pattern_id_array_cnt == 2)
+        result = 1;
+    else
+        printf("2 != %" PRIu32 " ",cnt);
+
+end:
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** \test enough states for the 32 bit state table */
+static int SCACCompactTest32(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    char pat[32];
+    uint32_t i;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* every pattern adds at least 8 states */
+    for (i = 0; i < 5000; i++) {
+        snprintf(pat, sizeof(pat), "%05"PRIu32"-%08"PRIx32, i, i * 2654435761U);
+        SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, i, 0, 0);
+    }
+    PmqSetup(NULL, &pmq, 0, 5000);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+
+    SCACCompactTable *t = ((SCACCompactCtx *)mpm_ctx.ctx)->table;
+    if (t->state_table_u32 == NULL) {
+        printf("no u32 table, %"PRIu32" states: ", t->state_count);
+        goto end;
+    }
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "xx%05"PRIu32"-%08"PRIx32"xx%05"PRIu32"-%08"PRIx32,
+             4999, 4999 * 2654435761U, 17, 17 * 2654435761U);
+    uint32_t cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                     (uint8_t *)buf, strlen(buf));
+    if (cnt == 2 && pmq.pattern_id_array_cnt == 2)
+        result = 1;
+    else
+        printf("2 != %" PRIu32 " ",cnt);
+
+end:
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+/** \internal
+ *  \brief build a ctx with npats patterns, every third one nocase, and
+ *         search a buffer with some of them
+ *
+ *  \param mapped set to 1 if the tables came from the cache
+ *  \param cnt set to the match count
+ */
+static int SCACCompactCacheTestRun(uint32_t npats, int *mapped, uint32_t *cnt)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    char pat[32];
+    char buf[128];
+    uint32_t i;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    SCACCompactInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    for (i = 0; i < npats; i++) {
+        snprintf(pat, sizeof(pat), "Pat%05"PRIu32"-%08"PRIx32, i, i * 2654435761U);
+        if (i % 3 == 0)
+            SCACCompactAddPatternCI(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, i, 0, 0);
+        else
+            SCACCompactAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, i, 0, 0);
+    }
+    PmqSetup(NULL, &pmq, 0, npats);
+
+    SCACCompactPreparePatterns(&mpm_ctx);
+    *mapped = (((SCACCompactCtx *)mpm_ctx.ctx)->table->map != NULL);
+
+    /* pattern 0 and 1 match, 2 is in the wrong case */
+    snprintf(buf, sizeof(buf), "xxPAT%05"PRIu32"-%08"PRIx32"xxPat%05"PRIu32"-%08"PRIx32
+             "xxPAT%05"PRIu32"-%08"PRIx32, 0, 0U, 1, 2654435761U, 2, 2 * 2654435761U);
+    *cnt = SCACCompactSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                             (uint8_t *)buf, strlen(buf));
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    SCACCompactDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return 1;
+}
+
+/** \internal
+ *  \brief remove the files in the test cache dir and the dir */
+static void SCACCompactCacheTestCleanup(char *dir)
+{
+    char path[PATH_MAX];
+    struct dirent *de;
+
+    DIR *d = opendir(dir);
+    if (d != NULL) {
+        while ((de = readdir(d)) != NULL) {
+            if (de->d_name[0] == '.')
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            unlink(path);
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+/** \internal
+ *  \brief flip a byte in the middle of every file in the test cache dir */
+static void SCACCompactCacheTestCorrupt(char *dir)
+{
+    char path[PATH_MAX];
+    struct dirent *de;
+    struct stat st;
+
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        int fd = open(path, O_RDWR);
+        if (fd < 0)
+            continue;
+        if (fstat(fd, &st) == 0) {
+            uint8_t c;
+            if (pread(fd, &c, 1, st.st_size / 2) == 1) {
+                c ^= 0x5a;
+                if (pwrite(fd, &c, 1, st.st_size / 2) != 1)
+                    printf("pwrite failed: ");
+            }
+        }
+        close(fd);
+    }
+    closedir(d);
+}
+
+/** \test tables written to the cache are mapped by the next ctx with the
+ *        same patterns and search the same, for 16 and 32 bit tables, and
+ *        a damaged file is rebuilt */
+static int SCACCompactCacheTest01(void)
+{
+    char dir[] = "/tmp/suricata-ac-compact-XXXXXX";
+    uint32_t npats[2] = { 30, 5000 };
+    int result = 0;
+    int mapped;
+    uint32_t cnt, cnt1;
+    int i;
+
+    if (mkdtemp(dir) == NULL)
+        return 0;
+    cache_conf_loaded = 1;
+    cache_dir = dir;
+
+    for (i = 0; i < 2; i++) {
+        /* build and store */
+        SCACCompactCacheTestRun(npats[i], &mapped, &cnt1);
+        if (mapped || cnt1 != 2) {
+            printf("%"PRIu32" patterns: first run mapped %d cnt %"PRIu32": ",
+                   npats[i], mapped, cnt1);
+            goto end;
+        }
+        /* mapped from the cache */
+        SCACCompactCacheTestRun(npats[i], &mapped, &cnt);
+        if (!mapped || cnt != cnt1) {
+            printf("%"PRIu32" patterns: second run mapped %d cnt %"PRIu32": ",
+                   npats[i], mapped, cnt);
+            goto end;
+        }
+        /* damaged, so built again */
+        SCACCompactCacheTestCorrupt(dir);
+        SCACCompactCacheTestRun(npats[i], &mapped, &cnt);
+        if (mapped || cnt != cnt1) {
+            printf("%"PRIu32" patterns: corrupt run mapped %d cnt %"PRIu32": ",
+                   npats[i], mapped, cnt);
+            goto end;
+        }
+        /* and stored again */
+        SCACCompactCacheTestRun(npats[i], &mapped, &cnt);
+        if (!mapped || cnt != cnt1) {
+            printf("%"PRIu32" patterns: rebuilt run mapped %d cnt %"PRIu32": ",
+                   npats[i], mapped, cnt);
+            goto end;
+        }
+        SCACCompactCacheTestCleanup(dir);
+        if (mkdir(dir, 0700) != 0)
+            goto end;
+    }
+
+    result = 1;
+end:
+    cache_dir = NULL;
+    SCACCompactCacheTestCleanup(dir);
+    return result;
+}
+#endif /* HAVE_SYS_MMAN_H */
+
+//#define AC_COMPACT_BENCH 1
+#ifdef AC_COMPACT_BENCH
+#include "util-clock.h"
+
+static char *ac_compact_bench_words[] = {
+    "user-agent: ", "/index.php?", "cmd.exe", "select ", "content-type: ",
+    "/cgi-bin/", "passwd", "eval(", "|0d 0a|", "http/1.", "mozilla/", "script",
+};
+#define AC_COMPACT_BENCH_WORDS \
+    (sizeof(ac_compact_bench_words) / sizeof(ac_compact_bench_words[0]))
+
+/** \internal
+ *  \brief build a ctx with npats rule like patterns and time searching buf
+ *
+ *  \param memory set to the memory used by the ctx
+ *
+ *  \retval secs seconds spent in search
+ */
+static double SCACCompactBenchSearch(uint16_t mpm_type, uint32_t npats,
+                                     uint8_t *buf, uint16_t buflen,
+                                     uint32_t loops, uint32_t *memory)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    char pat[64];
+    uint32_t i;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, mpm_type, -1);
+    mpm_table[mpm_type].InitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, npats);
+
+    for (i = 0; i < npats; i++) {
+        snprintf(pat, sizeof(pat), "%s%"PRIx32, ac_compact_bench_words[i % AC_COMPACT_BENCH_WORDS], i * 2654435761U);
+        mpm_table[mpm_type].AddPatternNocase(&mpm_ctx, (uint8_t *)pat,
+                strlen(pat), 0, 0, i, i, 0);
+    }
+    PmqSetup(NULL, &pmq, 0, npats);
+    mpm_table[mpm_type].Prepare(&mpm_ctx);
+    *memory = mpm_ctx.memory_size;
+    /* the only ac-compact ctx alive, so these are its tables */
+    if (mpm_type == MPM_AC_COMPACT)
+        *memory += SCACCompactTablesMemuse();
+
+    CLOCK_INIT;
+    CLOCK_START;
+    for (i = 0; i < loops; i++) {
+        mpm_table[mpm_type].Search(&mpm_ctx, &mpm_thread_ctx, &pmq, buf, buflen);
+        PmqReset(&pmq);
+    }
+    CLOCK_END;
+
+    mpm_table[mpm_type].DestroyCtx(&mpm_ctx);
+    mpm_table[mpm_type].DestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return (clo2 - clo1) / (double)CLOCKS_PER_SEC;
+}
+
+/** \test memory use and search speed of ac and ac-compact */
+static int SCACCompactBench01(void)
+{
+    uint32_t npats[] = { 100, 1000, 5000, 20000 };
+    uint32_t loops = 20000;
+    uint8_t buf[1400];
+    uint32_t i;
+
+    /* the words of the patterns with random suffixes, so the search walks
+     * deep into the tree, but mostly doesn't match */
+    uint32_t rnd = 1;
+    uint32_t len = 0;
+    while (len < sizeof(buf)) {
+        char tmp[64];
+        rnd = rnd * 1103515245 + 12345;
+        int n = snprintf(tmp, sizeof(tmp), "%s%"PRIx32,
+                ac_compact_bench_words[(rnd >> 16) % AC_COMPACT_BENCH_WORDS],
+                rnd * 2654435761U);
+        for (i = 0; i < (uint32_t)n && len < sizeof(buf); i++)
+            buf[len++] = tmp[i];
+    }
+
+    printf("\n");
+    for (i = 0; i < sizeof(npats) / sizeof(npats[0]); i++) {
+        uint32_t ac_mem = 0, compact_mem = 0;
+        double ac = SCACCompactBenchSearch(MPM_AC, npats[i], buf, sizeof(buf),
+                                           loops, &ac_mem);
+        double compact = SCACCompactBenchSearch(MPM_AC_COMPACT, npats[i], buf,
+                                                sizeof(buf), loops, &compact_mem);
+
+        printf("%5"PRIu32" patterns: ac %"PRIu32" KB %.1f MB/s, "
+               "ac-compact %"PRIu32" KB %.1f MB/s\n", npats[i],
+               ac_mem / 1024, (double)sizeof(buf) * loops / ac / 1000000,
+               compact_mem / 1024, (double)sizeof(buf) * loops / compact / 1000000);
+    }
+    return 1;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+/** \internal
+ *  \brief time preparing a ctx with npats rule like patterns
+ *
+ *  \retval secs seconds spent in SCACCompactPreparePatterns
+ */
+static double SCACCompactBenchPrepare(uint32_t npats)
+{
+    MpmCtx mpm_ctx;
+    char pat[64];
+    uint32_t i;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_COMPACT, -1);
+    for (i = 0; i < npats; i++) {
+        snprintf(pat, sizeof(pat), "%s%"PRIx32, ac_compact_bench_words[i % AC_COMPACT_BENCH_WORDS], i * 2654435761U);
+        SCACCompactAddPatternCI(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, i, i, 0);
+    }
+
+    CLOCK_INIT;
+    CLOCK_START;
+    SCACCompactPreparePatterns(&mpm_ctx);
+    CLOCK_END;
+
+    SCACCompactDestroyCtx(&mpm_ctx);
+    return (clo2 - clo1) / (double)CLOCKS_PER_SEC;
+}
+
+/** \test what the table cache saves at a restart: preparing a ctx without
+ *        the cache, with an empty cache (build and store) and with the
+ *        tables in the cache (map). Rule parsing and grouping, which the
+ *        cache doesn't save, are not part of this. */
+static int SCACCompactBench02(void)
+{
+    char dir[] = "/tmp/suricata-ac-compact-XXXXXX";
+    uint32_t npats[] = { 100, 1000, 5000, 20000 };
+    uint32_t i;
+
+    if (mkdtemp(dir) == NULL)
+        return 0;
+    cache_conf_loaded = 1;
+
+    printf("\n");
+    for (i = 0; i < sizeof(npats) / sizeof(npats[0]); i++) {
+        cache_dir = NULL;
+        double none = SCACCompactBenchPrepare(npats[i]);
+        cache_dir = dir;
+        double store = SCACCompactBenchPrepare(npats[i]);
+        double map = SCACCompactBenchPrepare(npats[i]);
+
+        printf("%5"PRIu32" patterns: no cache %.2f ms, store %.2f ms, "
+               "mapped %.2f ms\n", npats[i], none * 1000, store * 1000,
+               map * 1000);
+    }
+
+    cache_dir = NULL;
+    SCACCompactCacheTestCleanup(dir);
+    return 1;
+}
+#endif /* HAVE_SYS_MMAN_H */
+#endif /* AC_COMPACT_BENCH */
+
+#endif /* UNITTESTS */
+
+void SCACCompactRegisterTests(void)
+{
+
+#ifdef UNITTESTS
+    UtRegisterTest("SCACCompactTest01", SCACCompactTest01, 1);
+    UtRegisterTest("SCACCompactTest02", SCACCompactTest02, 1);
+    UtRegisterTest("SCACCompactTest03", SCACCompactTest03, 1);
+    UtRegisterTest("SCACCompactTest04", SCACCompactTest04, 1);
+    UtRegisterTest("SCACCompactTest05", SCACCompactTest05, 1);
+    UtRegisterTest("SCACCompactTest06", SCACCompactTest06, 1);
+    UtRegisterTest("SCACCompactTest07", SCACCompactTest07, 1);
+    UtRegisterTest("SCACCompactTest08", SCACCompactTest08, 1);
+    UtRegisterTest("SCACCompactTest09", SCACCompactTest09, 1);
+    UtRegisterTest("SCACCompactTest10", SCACCompactTest10, 1);
+    UtRegisterTest("SCACCompactTest11", SCACCompactTest11, 1);
+    UtRegisterTest("SCACCompactTest12", SCACCompactTest12, 1);
+    UtRegisterTest("SCACCompactTest13", SCACCompactTest13, 1);
+    UtRegisterTest("SCACCompactTest14", SCACCompactTest14, 1);
+    UtRegisterTest("SCACCompactTest15", SCACCompactTest15, 1);
+    UtRegisterTest("SCACCompactTest16", SCACCompactTest16, 1);
+    UtRegisterTest("SCACCompactTest17", SCACCompactTest17, 1);
+    UtRegisterTest("SCACCompactTest18", SCACCompactTest18, 1);
+    UtRegisterTest("SCACCompactTest19", SCACCompactTest19, 1);
+    UtRegisterTest("SCACCompactTest20", SCACCompactTest20, 1);
+    UtRegisterTest("SCACCompactTest21", SCACCompactTest21, 1);
+    UtRegisterTest("SCACCompactTest22", SCACCompactTest22, 1);
+    UtRegisterTest("SCACCompactTest23", SCACCompactTest23, 1);
+    UtRegisterTest("SCACCompactTest24", SCACCompactTest24, 1);
+    UtRegisterTest("SCACCompactTest25", SCACCompactTest25, 1);
+    UtRegisterTest("SCACCompactTest26", SCACCompactTest26, 1);
+    UtRegisterTest("SCACCompactTest27", SCACCompactTest27, 1);
+    UtRegisterTest("SCACCompactTest28", SCACCompactTest28, 1);
+    UtRegisterTest("SCACCompactTest29", SCACCompactTest29, 1);
+    UtRegisterTest("SCACCompactTest30", SCACCompactTest30, 1);
+    UtRegisterTest("SCACCompactTest31", SCACCompactTest31, 1);
+    UtRegisterTest("SCACCompactTest32", SCACCompactTest32, 1);
+#ifdef HAVE_SYS_MMAN_H
+    UtRegisterTest("SCACCompactCacheTest01", SCACCompactCacheTest01, 1);
+#endif
+#ifdef AC_COMPACT_BENCH
+    UtRegisterTest("SCACCompactBench01", SCACCompactBench01, 1);
+#ifdef HAVE_SYS_MMAN_H
+    UtRegisterTest("SCACCompactBench02", SCACCompactBench02, 1);
+#endif
+#endif /* AC_COMPACT_BENCH */
+#endif /* UNITTESTS */
+
+    return;
+}
@@ -0,0 +1,141 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Aho-corasick with an alphabet compressed state table.
+ */
+
+#ifndef __UTIL_MPM_AC_COMPACT_H__
+#define __UTIL_MPM_AC_COMPACT_H__
+
+#define SC_AC_COMPACT_STATE_TYPE_U16 uint16_t
+#define SC_AC_COMPACT_STATE_TYPE_U32 uint32_t
+
+typedef struct SCACCompactPattern_ {
+    /* length of the pattern */
+    uint16_t len;
+    /* flags decribing the pattern */
+    uint8_t flags;
+    /* holds the original pattern that was added */
+    uint8_t *original_pat;
+    /* case sensitive */
+    uint8_t *cs;
+    /* case INsensitive */
+    uint8_t *ci;
+    /* pattern id */
+    uint32_t id;
+
+    struct SCACCompactPattern_ *next;
+} SCACCompactPattern;
+
+typedef struct SCACCompactPatternList_ {
+    uint8_t *cs;
+    uint16_t patlen;
+    uint16_t case_state;
+} SCACCompactPatternList;
+
+typedef struct SCACCompactOutputTable_ {
+    /* list of pattern sids */
+    uint32_t *pids;
+    /* no of entries we have in pids */
+    uint32_t no_of_entries;
+} SCACCompactOutputTable;
+
+/**
+ * \brief Search tables built from a pattern set.
+ *
+ * Immutable once built. Contexts with the same pattern set, e.g. the
+ * same buffer of different sig group heads, share a single instance.
+ */
+typedef struct SCACCompactTable_ {
+    /* byte to alphabet class map. Bytes that are in no pattern share
+     * class 0, and upper case letters map to the class of their lower
+     * case letter */
+    uint8_t xlate[256];
+
+    /* number of classes, i.e. the number of entries in a state row */
+    uint16_t alpha_size;
+    /* log2 of the row size, alpha_size rounded up to a power of 2 */
+    uint8_t row_shift;
+    uint16_t max_pat_id;
+    uint32_t state_count;
+
+    /* state_count rows of 1 << row_shift entries. Only one of the two
+     * is set, u16 if the state count allows it */
+    SC_AC_COMPACT_STATE_TYPE_U16 *state_table_u16;
+    SC_AC_COMPACT_STATE_TYPE_U32 *state_table_u32;
+
+    SCACCompactOutputTable *output_table;
+    SCACCompactPatternList *pid_pat_list;
+
+    /* memory used by this table */
+    uint32_t memory_size;
+
+    /* the pattern set, used to look up the table for sharing */
+    uint8_t *key;
+    uint32_t key_len;
+    uint32_t key_hash;
+    /* no of contexts using this table */
+    uint32_t refcnt;
+
+    /* cache file mapping the state table and the output pids point
+     * into, NULL if the table was built in memory */
+    uint8_t *map;
+    size_t map_len;
+
+    struct SCACCompactTable_ *next;
+} SCACCompactTable;
+
+typedef struct SCACCompactCtx_ {
+    /* the search tables, possibly shared with other contexts */
+    SCACCompactTable *table;
+    /* 1 if table was built by another context */
+    uint8_t shared;
+
+    /* hash used during ctx initialization */
+    SCACCompactPattern **init_hash;
+
+    /* pattern arrays.  We need this only during the goto table creation phase */
+    SCACCompactPattern **parray;
+
+    /* no of states used during the table creation */
+    uint32_t state_count;
+
+    /* goto_table, failure table and output table.  Needed to create the
+     * state table.  Will be freed, once we have created the state table */
+    int32_t (*goto_table)[256];
+    int32_t *failure_table;
+    SCACCompactOutputTable *output_table;
+
+    /* the size of each state in the goto table */
+    uint16_t single_state_size;
+    uint16_t max_pat_id;
+} SCACCompactCtx;
+
+typedef struct SCACCompactThreadCtx_ {
+    /* the total calls we make to the search function */
+    uint32_t total_calls;
+    /* the total patterns that we ended up matching against */
+    uint64_t total_matches;
+} SCACCompactThreadCtx;
+
+void MpmACCompactRegister(void);
+uint64_t SCACCompactTablesMemuse(void);
+
+#endif /* __UTIL_MPM_AC_COMPACT_H__ */
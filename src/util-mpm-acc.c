@@ -115,6 +115,8 @@ void MpmACCRegister(void)
     mpm_table[MPM_ACC].PrintCtx = SCACCPrintInfo;
     mpm_table[MPM_ACC].PrintThreadCtx = SCACCPrintSearchStats;
     mpm_table[MPM_ACC].RegisterUnittests = SCACCRegisterTests;
+    /* the delta table dedup uses static lists */
+    mpm_table[MPM_ACC].flags = MPM_FLAG_SERIAL_PREPARE;
 
     return;
 }
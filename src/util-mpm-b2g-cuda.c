@@ -116,6 +116,8 @@ void MpmB2gCudaRegister(void)
     mpm_table[MPM_B2G_CUDA].PrintCtx = B2gCudaPrintInfo;
     mpm_table[MPM_B2G_CUDA].PrintThreadCtx = B2gCudaPrintSearchStats;
     mpm_table[MPM_B2G_CUDA].RegisterUnittests = B2gCudaRegisterTests;
+    /* the device memory is allocated in the cuda ctx of the build thread */
+    mpm_table[MPM_B2G_CUDA].flags = MPM_FLAG_SERIAL_PREPARE;
 }
 
 void B2gCudaPrintInfo(MpmCtx *mpm_ctx)
@@ -313,9 +313,10 @@ static uint32_t B2gcHashPatternInitHash(HashListTable *ht, void *pattern, uint16
 #define B2GC_SORTHASH_MODE_UU   3
 #define B2GC_SORTHASH_MODE_CS   4
 
-/* copy of ctx->m for use in B2gcHashPatternSortHash */
-static B2GC_TYPE m;
-static int b2gc_sorthash_mode = B2GC_SORTHASH_MODE_LL;
+/* copy of ctx->m for use in B2gcHashPatternSortHash. Thread local as
+ * ctxs can be prepared on several threads at once. */
+static __thread B2GC_TYPE m;
+static __thread int b2gc_sorthash_mode = B2GC_SORTHASH_MODE_LL;
 
 static uint32_t B2gcHashPatternSortHash(HashListTable *ht, void *pattern, uint16_t len) {
     BUG_ON(len != sizeof(B2gcPattern));
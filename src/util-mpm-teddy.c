@@ -0,0 +1,1917 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Teddy multi pattern matcher.
+ *
+ * Patterns are spread over 8 buckets. For each of the first (up to 3)
+ * pattern bytes we keep two 16 byte tables, indexed by the low and the
+ * high nibble of a byte, holding the buckets that have a pattern with
+ * that nibble at that position. Using pshufb on 16 input bytes at a time
+ * this gives, for each of the 16 positions, the buckets that may have a
+ * pattern starting there. Only those candidates are verified.
+ *
+ * The filter works best for small pattern sets. Contexts with more than
+ * TEDDY_MAX_PATTERNS patterns, or builds without SSSE3, hand the patterns
+ * to an AC ctx at prepare time and search with that.
+ *
+ * Only the 16 byte SSSE3 filter exists. A 32 byte AVX2 one could be
+ * selected at run time like the spm in util-spm-simd.c does.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "detect.h"
+#include "util-mpm-teddy.h"
+#include "conf.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-memcmp.h"
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+void SCTeddyInitCtx(MpmCtx *, int);
+void SCTeddyInitThreadCtx(ThreadVars *, MpmCtx *, MpmThreadCtx *, uint32_t);
+void SCTeddyDestroyCtx(MpmCtx *);
+void SCTeddyDestroyThreadCtx(MpmCtx *, MpmThreadCtx *);
+int SCTeddyAddPatternCI(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, uint32_t, uint8_t);
+int SCTeddyAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, uint32_t, uint8_t);
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx);
+uint32_t SCTeddySearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen);
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx);
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
+void SCTeddyRegisterTests(void);
+
+/* size of the hash table used to cull duplicate patterns at insertion */
+#define TEDDY_INIT_HASH_SIZE 1024
+
+/**
+ * \brief Register the teddy mpm.
+ */
+void MpmTeddyRegister(void)
+{
+    mpm_table[MPM_TEDDY].name = "teddy";
+    mpm_table[MPM_TEDDY].max_pattern_length = 0;
+
+    mpm_table[MPM_TEDDY].InitCtx = SCTeddyInitCtx;
+    mpm_table[MPM_TEDDY].InitThreadCtx = SCTeddyInitThreadCtx;
+    mpm_table[MPM_TEDDY].DestroyCtx = SCTeddyDestroyCtx;
+    mpm_table[MPM_TEDDY].DestroyThreadCtx = SCTeddyDestroyThreadCtx;
+    mpm_table[MPM_TEDDY].AddPattern = SCTeddyAddPatternCS;
+    mpm_table[MPM_TEDDY].AddPatternNocase = SCTeddyAddPatternCI;
+    mpm_table[MPM_TEDDY].Prepare = SCTeddyPreparePatterns;
+    mpm_table[MPM_TEDDY].Search = SCTeddySearch;
+    mpm_table[MPM_TEDDY].Cleanup = NULL;
+    mpm_table[MPM_TEDDY].PrintCtx = SCTeddyPrintInfo;
+    mpm_table[MPM_TEDDY].PrintThreadCtx = SCTeddyPrintSearchStats;
+    mpm_table[MPM_TEDDY].RegisterUnittests = SCTeddyRegisterTests;
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Free a pattern and the copies it holds.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param p       Pattern to free.
+ * \param free_p  Free p itself too, not only its buffers.
+ */
+static void SCTeddyFreePattern(MpmCtx *mpm_ctx, SCTeddyPattern *p, int free_p)
+{
+    if (p->cs != NULL) {
+        SCFree(p->cs);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= p->len;
+    }
+    if (p->ci != NULL) {
+        SCFree(p->ci);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= p->len;
+    }
+    if (free_p) {
+        SCFree(p);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= sizeof(SCTeddyPattern);
+    }
+}
+
+/**
+ * \internal
+ * \brief Add a pattern to the teddy context.
+ *
+ * \param mpm_ctx Mpm context.
+ * \param pat     Pointer to the pattern.
+ * \param patlen  Length of the pattern.
+ * \param pid     Pattern id
+ * \param sid     Signature id (internal id).
+ * \param flags   Pattern's MPM_PATTERN_* flags.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+static int SCTeddyAddPattern(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                             uint16_t offset, uint16_t depth, uint32_t pid,
+                             uint32_t sid, uint8_t flags)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    if (patlen == 0) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENTS, "pattern length 0");
+        return 0;
+    }
+
+    if (ctx->init_hash == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENTS, "can't add patterns to a "
+                   "prepared teddy ctx");
+        return -1;
+    }
+
+    /* check if we have already inserted this pattern */
+    uint32_t hash = pid % TEDDY_INIT_HASH_SIZE;
+    SCTeddyPattern *p;
+    for (p = ctx->init_hash[hash]; p != NULL; p = p->next) {
+        if (p->flags == flags && p->id == pid)
+            return 0;
+    }
+
+    p = SCMalloc(sizeof(SCTeddyPattern));
+    if (unlikely(p == NULL))
+        return -1;
+    memset(p, 0, sizeof(SCTeddyPattern));
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCTeddyPattern);
+
+    p->len = patlen;
+    p->flags = flags;
+    p->id = pid;
+
+    p->cs = SCMalloc(patlen);
+    if (p->cs == NULL)
+        goto error;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += patlen;
+    memcpy(p->cs, pat, patlen);
+
+    p->ci = SCMalloc(patlen);
+    if (p->ci == NULL)
+        goto error;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += patlen;
+    uint16_t u;
+    for (u = 0; u < patlen; u++)
+        p->ci[u] = u8_tolower(pat[u]);
+
+    p->next = ctx->init_hash[hash];
+    ctx->init_hash[hash] = p;
+
+    mpm_ctx->pattern_cnt++;
+
+    if (mpm_ctx->maxlen < patlen)
+        mpm_ctx->maxlen = patlen;
+
+    if (mpm_ctx->minlen == 0 || mpm_ctx->minlen > patlen)
+        mpm_ctx->minlen = patlen;
+
+    return 0;
+
+error:
+    SCTeddyFreePattern(mpm_ctx, p, 1);
+    return -1;
+}
+
+/**
+ * \internal
+ * \brief Move the patterns over to an AC ctx.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+static int SCTeddyPrepareAC(MpmCtx *mpm_ctx, SCTeddyPattern **plist)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint32_t i;
+
+    ctx->ac_ctx = SCMalloc(sizeof(MpmCtx));
+    if (ctx->ac_ctx == NULL)
+        return -1;
+    memset(ctx->ac_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(ctx->ac_ctx, MPM_AC, -1);
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        SCTeddyPattern *p = plist[i];
+        if (mpm_table[MPM_AC].AddPattern(ctx->ac_ctx, p->cs, p->len, 0, 0,
+                    p->id, 0, p->flags) != 0)
+            return -1;
+    }
+
+    if (mpm_table[MPM_AC].Prepare(ctx->ac_ctx) != 0)
+        return -1;
+
+    mpm_ctx->memory_cnt += ctx->ac_ctx->memory_cnt + 1;
+    mpm_ctx->memory_size += ctx->ac_ctx->memory_size + sizeof(MpmCtx);
+    return 0;
+}
+
+#if defined(__SSSE3__)
+/**
+ * \internal
+ * \brief Mark the buckets in the nibble masks for byte c at position k.
+ */
+static inline void SCTeddySetMask(SCTeddyCtx *ctx, int k, uint8_t c, int bucket)
+{
+    ctx->lo_mask[k][c & 0x0f] |= (1 << bucket);
+    ctx->hi_mask[k][c >> 4] |= (1 << bucket);
+}
+
+/**
+ * \internal
+ * \brief Spread the patterns over the buckets and set up the masks.
+ *
+ * Patterns sharing their leading bytes go in the same bucket, so they
+ * add no extra candidates to the bucket.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+static int SCTeddyPrepareBuckets(MpmCtx *mpm_ctx, SCTeddyPattern **plist)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint8_t bucket[TEDDY_MAX_PATTERNS];
+    uint32_t cnt[TEDDY_BUCKETS];
+    uint32_t i;
+    int k;
+
+    ctx->nmasks = (mpm_ctx->minlen < TEDDY_MAX_MASKS) ?
+        mpm_ctx->minlen : TEDDY_MAX_MASKS;
+
+    memset(cnt, 0, sizeof(cnt));
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        uint32_t hash = 0;
+        for (k = 0; k < ctx->nmasks; k++)
+            hash = hash * 31 + plist[i]->ci[k];
+        bucket[i] = hash % TEDDY_BUCKETS;
+        cnt[bucket[i]]++;
+    }
+
+    ctx->bucket_start[0] = 0;
+    for (k = 0; k < TEDDY_BUCKETS; k++)
+        ctx->bucket_start[k + 1] = ctx->bucket_start[k] + cnt[k];
+
+    ctx->parray = SCMalloc(mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern));
+    if (ctx->parray == NULL)
+        return -1;
+    memset(ctx->parray, 0, mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern));
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern);
+
+    memset(ctx->lo_mask, 0, sizeof(ctx->lo_mask));
+    memset(ctx->hi_mask, 0, sizeof(ctx->hi_mask));
+    memset(cnt, 0, sizeof(cnt));
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        SCTeddyPattern *p = plist[i];
+        int b = bucket[i];
+
+        for (k = 0; k < ctx->nmasks; k++) {
+            if (p->flags & MPM_PATTERN_FLAG_NOCASE) {
+                SCTeddySetMask(ctx, k, p->ci[k], b);
+                SCTeddySetMask(ctx, k, toupper(p->ci[k]), b);
+            } else {
+                SCTeddySetMask(ctx, k, p->cs[k], b);
+            }
+        }
+
+        /* the buffers move over to parray */
+        ctx->parray[ctx->bucket_start[b] + cnt[b]] = *p;
+        ctx->parray[ctx->bucket_start[b] + cnt[b]].next = NULL;
+        cnt[b]++;
+        p->cs = NULL;
+        p->ci = NULL;
+    }
+
+    return 0;
+}
+#endif /* __SSSE3__ */
+
+/**
+ * \brief Process the patterns added to the mpm, and create the filter
+ *        masks, or the AC ctx if teddy can't handle the patterns.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    int r = 0;
+    uint32_t i, n = 0;
+
+    if (mpm_ctx->pattern_cnt == 0 || ctx->init_hash == NULL) {
+        SCLogDebug("no patterns supplied to this mpm_ctx");
+        return 0;
+    }
+
+    SCTeddyPattern **plist = SCMalloc(mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern *));
+    if (plist == NULL)
+        return -1;
+
+    for (i = 0; i < TEDDY_INIT_HASH_SIZE; i++) {
+        SCTeddyPattern *p = ctx->init_hash[i];
+        for ( ; p != NULL; p = p->next)
+            plist[n++] = p;
+    }
+
+#if defined(__SSSE3__)
+    if (mpm_ctx->pattern_cnt <= TEDDY_MAX_PATTERNS)
+        r = SCTeddyPrepareBuckets(mpm_ctx, plist);
+    else
+#endif
+        r = SCTeddyPrepareAC(mpm_ctx, plist);
+
+    /* the init patterns are no longer needed */
+    for (i = 0; i < n; i++)
+        SCTeddyFreePattern(mpm_ctx, plist[i], 1);
+    SCFree(plist);
+
+    SCFree(ctx->init_hash);
+    ctx->init_hash = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= TEDDY_INIT_HASH_SIZE * sizeof(SCTeddyPattern *);
+
+    return r;
+}
+
+/**
+ * \brief Init the mpm thread context. Teddy keeps no per thread state,
+ *        the ctx of the AC fallback is used.
+ */
+void SCTeddyInitThreadCtx(ThreadVars *tv, MpmCtx *mpm_ctx,
+                          MpmThreadCtx *mpm_thread_ctx, uint32_t matchsize)
+{
+    mpm_table[MPM_AC].InitThreadCtx(tv, mpm_ctx, mpm_thread_ctx, matchsize);
+}
+
+/**
+ * \brief Initialize the teddy context.
+ *
+ * \param mpm_ctx       Mpm context.
+ * \param module_handle Cuda module handle from the cuda handler API.  We don't
+ *                      have to worry about this here.
+ */
+void SCTeddyInitCtx(MpmCtx *mpm_ctx, int module_handle)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    mpm_ctx->ctx = SCMalloc(sizeof(SCTeddyCtx));
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCTeddyCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCTeddyCtx);
+
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    ctx->init_hash = SCMalloc(sizeof(SCTeddyPattern *) * TEDDY_INIT_HASH_SIZE);
+    if (ctx->init_hash == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(ctx->init_hash, 0, sizeof(SCTeddyPattern *) * TEDDY_INIT_HASH_SIZE);
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCTeddyPattern *) * TEDDY_INIT_HASH_SIZE;
+
+    SCReturn;
+}
+
+/**
+ * \brief Destroy the mpm thread context.
+ */
+void SCTeddyDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    mpm_table[MPM_AC].DestroyThreadCtx(mpm_ctx, mpm_thread_ctx);
+}
+
+/**
+ * \brief Destroy the mpm context.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+void SCTeddyDestroyCtx(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint32_t i;
+
+    if (ctx == NULL)
+        return;
+
+    if (ctx->init_hash != NULL) {
+        for (i = 0; i < TEDDY_INIT_HASH_SIZE; i++) {
+            SCTeddyPattern *p = ctx->init_hash[i];
+            while (p != NULL) {
+                SCTeddyPattern *next = p->next;
+                SCTeddyFreePattern(mpm_ctx, p, 1);
+                p = next;
+            }
+        }
+        SCFree(ctx->init_hash);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= TEDDY_INIT_HASH_SIZE * sizeof(SCTeddyPattern *);
+    }
+
+    if (ctx->parray != NULL) {
+        for (i = 0; i < mpm_ctx->pattern_cnt; i++)
+            SCTeddyFreePattern(mpm_ctx, &ctx->parray[i], 0);
+        SCFree(ctx->parray);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern);
+    }
+
+    if (ctx->ac_ctx != NULL) {
+        mpm_ctx->memory_cnt -= ctx->ac_ctx->memory_cnt + 1;
+        mpm_ctx->memory_size -= ctx->ac_ctx->memory_size + sizeof(MpmCtx);
+        mpm_table[MPM_AC].DestroyCtx(ctx->ac_ctx);
+        SCFree(ctx->ac_ctx);
+    }
+
+    SCFree(mpm_ctx->ctx);
+    mpm_ctx->ctx = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCTeddyCtx);
+
+    return;
+}
+
+#if defined(__SSSE3__)
+/**
+ * \internal
+ * \brief Verify the patterns of the candidate buckets at buf + pos.
+ *
+ * \retval matches number of patterns that matched
+ */
+static inline uint32_t SCTeddyVerify(SCTeddyCtx *ctx, PatternMatcherQueue *pmq,
+                                     uint8_t *buf, uint16_t buflen,
+                                     uint32_t pos, uint8_t buckets)
+{
+    uint32_t matches = 0;
+
+    while (buckets != 0) {
+        int b = __builtin_ctz(buckets);
+        buckets &= buckets - 1;
+
+        uint32_t i;
+        for (i = ctx->bucket_start[b]; i < ctx->bucket_start[b + 1]; i++) {
+            SCTeddyPattern *p = &ctx->parray[i];
+
+            if (p->len > buflen - pos)
+                continue;
+
+            if (p->flags & MPM_PATTERN_FLAG_NOCASE) {
+                if (SCMemcmpLowercase(p->ci, buf + pos, p->len) != 0)
+                    continue;
+            } else {
+                if (SCMemcmp(p->cs, buf + pos, p->len) != 0)
+                    continue;
+            }
+
+            if (!(pmq->pattern_id_bitarray[p->id / 8] & (1 << (p->id % 8)))) {
+                pmq->pattern_id_bitarray[p->id / 8] |= (1 << (p->id % 8));
+                pmq->pattern_id_array[pmq->pattern_id_array_cnt++] = p->id;
+            }
+            matches++;
+        }
+    }
+
+    return matches;
+}
+
+/**
+ * \internal
+ * \brief Run the filter on the 16 positions starting at data.
+ *
+ * Reads 16 + nmasks - 1 bytes from data.
+ *
+ * \retval res per position, the buckets that may match there
+ */
+static inline __m128i SCTeddyFilter(const __m128i *lo, const __m128i *hi,
+                                    uint8_t nmasks, const uint8_t *data)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i res = _mm_set1_epi8((char)0xff);
+    uint8_t k;
+
+    for (k = 0; k < nmasks; k++) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(data + k));
+        __m128i l = _mm_shuffle_epi8(lo[k], _mm_and_si128(in, nibble));
+        __m128i h = _mm_shuffle_epi8(hi[k],
+                _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+        res = _mm_and_si128(res, _mm_and_si128(l, h));
+    }
+
+    return res;
+}
+
+/**
+ * \internal
+ * \brief Verify the candidates the filter found in a block.
+ *
+ * \param base  buf offset of the first position of the block
+ * \param limit number of positions of the block that are in buf
+ */
+static inline uint32_t SCTeddyBlock(SCTeddyCtx *ctx, PatternMatcherQueue *pmq,
+                                    uint8_t *buf, uint16_t buflen,
+                                    uint32_t base, uint32_t limit, __m128i res)
+{
+    uint8_t r[16] __attribute__((aligned(16)));
+    uint32_t matches = 0;
+
+    uint32_t bits = ~_mm_movemask_epi8(_mm_cmpeq_epi8(res, _mm_setzero_si128())) & 0xffff;
+    if (bits == 0)
+        return 0;
+
+    if (limit < 16)
+        bits &= (1 << limit) - 1;
+
+    _mm_store_si128((__m128i *)r, res);
+    while (bits != 0) {
+        int j = __builtin_ctz(bits);
+        bits &= bits - 1;
+        matches += SCTeddyVerify(ctx, pmq, buf, buflen, base + j, r[j]);
+    }
+
+    return matches;
+}
+
+static uint32_t SCTeddySearchSSSE3(MpmCtx *mpm_ctx, PatternMatcherQueue *pmq,
+                                   uint8_t *buf, uint16_t buflen)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    __m128i lo[TEDDY_MAX_MASKS];
+    __m128i hi[TEDDY_MAX_MASKS];
+    uint8_t nmasks = ctx->nmasks;
+    uint32_t matches = 0;
+    uint32_t i;
+    uint8_t k;
+
+    for (k = 0; k < nmasks; k++) {
+        lo[k] = _mm_loadu_si128((const __m128i *)ctx->lo_mask[k]);
+        hi[k] = _mm_loadu_si128((const __m128i *)ctx->hi_mask[k]);
+    }
+
+    /* full blocks, the filter reads nmasks - 1 bytes beyond them */
+    for (i = 0; i + 16 + nmasks - 1 <= buflen; i += 16) {
+        __m128i res = SCTeddyFilter(lo, hi, nmasks, buf + i);
+        matches += SCTeddyBlock(ctx, pmq, buf, buflen, i, 16, res);
+    }
+
+    /* the rest goes through a zero padded copy */
+    if (i < buflen) {
+        uint8_t tail[32 + TEDDY_MAX_MASKS];
+        uint32_t rem = buflen - i;
+        uint32_t t;
+
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, buf + i, rem);
+
+        for (t = 0; t < rem; t += 16) {
+            __m128i res = SCTeddyFilter(lo, hi, nmasks, tail + t);
+            matches += SCTeddyBlock(ctx, pmq, buf, buflen, i + t, rem - t, res);
+        }
+    }
+
+    return matches;
+}
+#endif /* __SSSE3__ */
+
+/**
+ * \brief The teddy search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCTeddySearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    if (ctx->ac_ctx != NULL)
+        return mpm_table[MPM_AC].Search(ctx->ac_ctx, mpm_thread_ctx, pmq,
+                                        buf, buflen);
+
+#if defined(__SSSE3__)
+    if (ctx->parray == NULL || buflen < mpm_ctx->minlen)
+        return 0;
+
+    return SCTeddySearchSSSE3(mpm_ctx, pmq, buf, buflen);
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \brief Add a case insensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     Ignored.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        uint32_t sid, uint8_t flags)
+{
+    flags |= MPM_PATTERN_FLAG_NOCASE;
+    return SCTeddyAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+/**
+ * \brief Add a case sensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     Ignored.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        uint32_t sid, uint8_t flags)
+{
+    return SCTeddyAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+    return;
+}
+
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    printf("MPM Teddy Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf(" Sizeof:\n");
+    printf("  MpmCtx         %" PRIuMAX "\n", (uintmax_t)sizeof(MpmCtx));
+    printf("  SCTeddyCtx:    %" PRIuMAX "\n", (uintmax_t)sizeof(SCTeddyCtx));
+    printf("  SCTeddyPattern %" PRIuMAX "\n", (uintmax_t)sizeof(SCTeddyPattern));
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    printf("Search method:   %s\n", ctx->ac_ctx != NULL ? "ac" : "teddy");
+    printf("\n");
+
+    return;
+}
+
+/*************************************Unittests********************************/
+#ifdef __tilegx__
+/*
+ * Remove this temporarily on Tilera
+ * Needs a little more work because of the ThreadVars stuff
+ */
+#undef UNITTESTS
+#endif
+
+#ifdef UNITTESTS
+
+static int SCTeddyTest01(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest02(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abce", 4, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 0)
+        result = 1;
+    else
+        printf("0 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest03(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    /* 1 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"bcde", 4, 0, 0, 1, 0, 0);
+    /* 1 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"fghj", 4, 0, 0, 2, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 3);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 3)
+        result = 1;
+    else
+        printf("3 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest04(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"bcdegh", 6, 0, 0, 1, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"fghjxyz", 7, 0, 0, 2, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 3);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest05(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCTeddyAddPatternCI(&mpm_ctx, (uint8_t *)"ABCD", 4, 0, 0, 0, 0, 0);
+    SCTeddyAddPatternCI(&mpm_ctx, (uint8_t *)"bCdEfG", 6, 0, 0, 1, 0, 0);
+    SCTeddyAddPatternCI(&mpm_ctx, (uint8_t *)"fghJikl", 7, 0, 0, 2, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 3);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 3)
+        result = 1;
+    else
+        printf("3 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest06(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcd";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest07(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* should match 30 times */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"A", 1, 0, 0, 0, 0, 0);
+    /* should match 29 times */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 1, 0, 0);
+    /* should match 28 times */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"AAA", 3, 0, 0, 2, 0, 0);
+    /* 26 */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"AAAAA", 5, 0, 0, 3, 0, 0);
+    /* 21 */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"AAAAAAAAAA", 10, 0, 0, 4, 0, 0);
+    /* 1 */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA",
+                     30, 0, 0, 5, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 6);
+    /* total matches: 135 */
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 135)
+        result = 1;
+    else
+        printf("135 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest08(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)"a", 1);
+
+    if (cnt == 0)
+        result = 1;
+    else
+        printf("0 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest09(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"ab", 2, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)"ab", 2);
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest10(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abcdefgh", 8, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "01234567890123456789012345678901234567890123456789"
+                "01234567890123456789012345678901234567890123456789"
+                "abcdefgh"
+                "01234567890123456789012345678901234567890123456789"
+                "01234567890123456789012345678901234567890123456789";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest11(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    if (SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"he", 2, 0, 0, 1, 0, 0) == -1)
+        goto end;
+    if (SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"she", 3, 0, 0, 2, 0, 0) == -1)
+        goto end;
+    if (SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"his", 3, 0, 0, 3, 0, 0) == -1)
+        goto end;
+    if (SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"hers", 4, 0, 0, 4, 0, 0) == -1)
+        goto end;
+    PmqSetup(NULL, &pmq, 0, 5);
+
+    if (SCTeddyPreparePatterns(&mpm_ctx) == -1)
+        goto end;
+
+    result = 1;
+
+    char *buf = "he";
+    result &= (SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)buf,
+                          strlen(buf)) == 1);
+    buf = "she";
+    result &= (SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)buf,
+                          strlen(buf)) == 2);
+    buf = "his";
+    result &= (SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)buf,
+                          strlen(buf)) == 1);
+    buf = "hers";
+    result &= (SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)buf,
+                          strlen(buf)) == 2);
+
+ end:
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest12(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"wxyz", 4, 0, 0, 0, 0, 0);
+    /* 1 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"vwxyz", 5, 0, 0, 1, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 2);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghijklmnopqrstuvwxyz";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 2)
+        result = 1;
+    else
+        printf("2 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest13(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    char *pat = "abcdefghijklmnopqrstuvwxyzABCD";
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghijklmnopqrstuvwxyzABCD";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest14(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    char *pat = "abcdefghijklmnopqrstuvwxyzABCDE";
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghijklmnopqrstuvwxyzABCDE";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest15(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    char *pat = "abcdefghijklmnopqrstuvwxyzABCDEF";
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghijklmnopqrstuvwxyzABCDEF";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest16(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    char *pat = "abcdefghijklmnopqrstuvwxyzABC";
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghijklmnopqrstuvwxyzABC";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest17(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    char *pat = "abcdefghijklmnopqrstuvwxyzAB";
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghijklmnopqrstuvwxyzAB";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest18(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    char *pat = "abcde""fghij""klmno""pqrst""uvwxy""z";
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcde""fghij""klmno""pqrst""uvwxy""z";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest19(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 */
+    char *pat = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest20(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 */
+    char *pat = "AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AA";
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AA";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest21(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                              (uint8_t *)"AA", 2);
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest22(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    /* 1 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abcde", 5, 0, 0, 1, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 2);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghijklmnopqrstuvwxyz";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                              (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 2)
+        result = 1;
+    else
+        printf("2 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest23(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                              (uint8_t *)"aa", 2);
+
+    if (cnt == 0)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest24(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 */
+    SCTeddyAddPatternCI(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                              (uint8_t *)"aa", 2);
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest25(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCTeddyAddPatternCI(&mpm_ctx, (uint8_t *)"ABCD", 4, 0, 0, 0, 0, 0);
+    SCTeddyAddPatternCI(&mpm_ctx, (uint8_t *)"bCdEfG", 6, 0, 0, 1, 0, 0);
+    SCTeddyAddPatternCI(&mpm_ctx, (uint8_t *)"fghiJkl", 7, 0, 0, 2, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 3);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 3)
+        result = 1;
+    else
+        printf("3 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest26(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCTeddyAddPatternCI(&mpm_ctx, (uint8_t *)"Works", 5, 0, 0, 0, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"Works", 5, 0, 0, 1, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 2);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "works";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("3 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest27(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 0 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"ONE", 3, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "tone";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 0)
+        result = 1;
+    else
+        printf("0 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest28(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 0 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"one", 3, 0, 0, 0, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "tONE";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 0)
+        result = 1;
+    else
+        printf("0 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** \test more patterns than teddy handles go to the AC fallback */
+static int SCTeddyTest29(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    char pat[16];
+    uint32_t i;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    for (i = 0; i < TEDDY_MAX_PATTERNS + 1; i++) {
+        snprintf(pat, sizeof(pat), "pat%03"PRIu32"x", i);
+        SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, i, 0, 0);
+    }
+    PmqSetup(NULL, &pmq, 0, TEDDY_MAX_PATTERNS + 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx.ctx;
+    if (ctx->ac_ctx == NULL) {
+        printf("no AC fallback: ");
+        goto end;
+    }
+
+    char *buf = "xxpat000xpat015xpat016x";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 3 && pmq.pattern_id_array_cnt == 3)
+        result = 1;
+    else
+        printf("3 != %" PRIu32 " ",cnt);
+
+end:
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** \test matches in the full blocks, across the block boundaries and in
+ *        the tail of the buffer */
+static int SCTeddyTest30(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY, -1);
+    SCTeddyInitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"GET", 3, 0, 0, 0, 0, 0);
+    SCTeddyAddPatternCI(&mpm_ctx, (uint8_t *)"host:", 5, 0, 0, 1, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"\r\n\r\n", 4, 0, 0, 2, 0, 0);
+    SCTeddyAddPatternCI(&mpm_ctx, (uint8_t *)"user-agent", 10, 0, 0, 3, 0, 0);
+    PmqSetup(NULL, &pmq, 0, 4);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    /* "Host:" straddles the first block boundary, the end of headers
+     * is in the tail */
+    char *buf = "GET / HTTP/1.1\r\nHost: www.example.com\r\n"
+                "User-Agent: get\r\n\r\n";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                               (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 4 && pmq.pattern_id_array_cnt == 4)
+        result = 1;
+    else
+        printf("4 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** Uncomment to run the search benchmark of teddy vs ac vs b2g.
+ *  #define TEDDY_BENCH 1
+ *
+ *  The numbers are for synthetic input only: a hand picked list of
+ *  fast_pattern like strings, numbered copies of them past the first 32,
+ *  and one repeated http request line as the buffer. The |xx| hex parts
+ *  are added as literal text. They are not from a real ruleset or from
+ *  real traffic, so don't read them as what a deployment will see.
+ */
+#ifdef TEDDY_BENCH
+#include "util-clock.h"
+
+/* typical fast_pattern contents of http and dns rules */
+static char *teddy_bench_patterns[] = {
+    "User-Agent|3a| ", "/wp-login.php", "cmd.exe", "/etc/passwd",
+    "Content-Type|3a| application/x-msdownload", "POST", ".php?id=",
+    "union select", "/bin/sh", "eval(", "document.write", "<iframe",
+    "Mozilla/4.0 (compatible|3b| MSIE 6.0", "|0d 0a 0d 0a|MZ", "%u9090",
+    "base64_decode", "/admin/", "X-Forwarded-For", ".exe HTTP/1.",
+    "/cgi-bin/", "phpMyAdmin", "passwd=", "Authorization|3a| Basic",
+    "application/x-shockwave-flash", "ActiveXObject", "unescape(",
+    "/.git/", "wget http", "curl/", "python-requests", "sqlmap",
+    "Nikto",
+};
+
+/** \internal
+ *  \brief time searching the buffer with npats of the patterns
+ *
+ *  \retval secs seconds spent in search, -1 on error
+ */
+static double SCTeddyBenchSearch(uint16_t mpm_type, uint32_t npats,
+                                 uint8_t *buf, uint16_t buflen, uint32_t loops)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    uint32_t n = sizeof(teddy_bench_patterns) / sizeof(teddy_bench_patterns[0]);
+    char pat[64];
+    uint32_t i;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, mpm_type, -1);
+    mpm_table[mpm_type].InitThreadCtx(NULL, &mpm_ctx, &mpm_thread_ctx, npats);
+
+    /* beyond the base set, derive variants as a big ruleset would have */
+    for (i = 0; i < npats; i++) {
+        if (i < n)
+            snprintf(pat, sizeof(pat), "%s", teddy_bench_patterns[i]);
+        else
+            snprintf(pat, sizeof(pat), "%s%"PRIu32, teddy_bench_patterns[i % n], i);
+        mpm_table[mpm_type].AddPatternNocase(&mpm_ctx, (uint8_t *)pat,
+                strlen(pat), 0, 0, i, i, 0);
+    }
+    PmqSetup(NULL, &pmq, 0, npats);
+    mpm_table[mpm_type].Prepare(&mpm_ctx);
+
+    CLOCK_INIT;
+    CLOCK_START;
+    for (i = 0; i < loops; i++) {
+        mpm_table[mpm_type].Search(&mpm_ctx, &mpm_thread_ctx, &pmq, buf, buflen);
+        PmqReset(&pmq);
+    }
+    CLOCK_END;
+
+    mpm_table[mpm_type].DestroyCtx(&mpm_ctx);
+    mpm_table[mpm_type].DestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return (clo2 - clo1) / (double)CLOCKS_PER_SEC;
+}
+
+/** \test search cost of teddy, ac and b2g on a http request sized buffer
+ *        for 4 to 256 patterns */
+static int SCTeddyBench01(void)
+{
+    uint32_t npats[] = { 4, 8, 16, 32, 256 };
+    uint32_t loops = 200000;
+    uint8_t buf[1400];
+    uint32_t i;
+
+    /* mostly text that almost matches, like real traffic */
+    for (i = 0; i < sizeof(buf); i++)
+        buf[i] = "GET /index.html HTTP/1.1\r\nHost: www.example.com\r\n"[i % 51];
+
+    printf("\n");
+    for (i = 0; i < sizeof(npats) / sizeof(npats[0]); i++) {
+        double teddy = SCTeddyBenchSearch(MPM_TEDDY, npats[i], buf, sizeof(buf), loops);
+        double ac = SCTeddyBenchSearch(MPM_AC, npats[i], buf, sizeof(buf), loops);
+        double b2g = SCTeddyBenchSearch(MPM_B2G, npats[i], buf, sizeof(buf), loops);
+
+        printf("%4"PRIu32" patterns: teddy %.1f MB/s, ac %.1f MB/s, b2g %.1f MB/s\n",
+                npats[i],
+                (double)sizeof(buf) * loops / teddy / 1000000,
+                (double)sizeof(buf) * loops / ac / 1000000,
+                (double)sizeof(buf) * loops / b2g / 1000000);
+    }
+    return 1;
+}
+#endif /* TEDDY_BENCH */
+
+#endif /* UNITTESTS */
+
+void SCTeddyRegisterTests(void)
+{
+
+#ifdef UNITTESTS
+    UtRegisterTest("SCTeddyTest01", SCTeddyTest01, 1);
+    UtRegisterTest("SCTeddyTest02", SCTeddyTest02, 1);
+    UtRegisterTest("SCTeddyTest03", SCTeddyTest03, 1);
+    UtRegisterTest("SCTeddyTest04", SCTeddyTest04, 1);
+    UtRegisterTest("SCTeddyTest05", SCTeddyTest05, 1);
+    UtRegisterTest("SCTeddyTest06", SCTeddyTest06, 1);
+    UtRegisterTest("SCTeddyTest07", SCTeddyTest07, 1);
+    UtRegisterTest("SCTeddyTest08", SCTeddyTest08, 1);
+    UtRegisterTest("SCTeddyTest09", SCTeddyTest09, 1);
+    UtRegisterTest("SCTeddyTest10", SCTeddyTest10, 1);
+    UtRegisterTest("SCTeddyTest11", SCTeddyTest11, 1);
+    UtRegisterTest("SCTeddyTest12", SCTeddyTest12, 1);
+    UtRegisterTest("SCTeddyTest13", SCTeddyTest13, 1);
+    UtRegisterTest("SCTeddyTest14", SCTeddyTest14, 1);
+    UtRegisterTest("SCTeddyTest15", SCTeddyTest15, 1);
+    UtRegisterTest("SCTeddyTest16", SCTeddyTest16, 1);
+    UtRegisterTest("SCTeddyTest17", SCTeddyTest17, 1);
+    UtRegisterTest("SCTeddyTest18", SCTeddyTest18, 1);
+    UtRegisterTest("SCTeddyTest19", SCTeddyTest19, 1);
+    UtRegisterTest("SCTeddyTest20", SCTeddyTest20, 1);
+    UtRegisterTest("SCTeddyTest21", SCTeddyTest21, 1);
+    UtRegisterTest("SCTeddyTest22", SCTeddyTest22, 1);
+    UtRegisterTest("SCTeddyTest23", SCTeddyTest23, 1);
+    UtRegisterTest("SCTeddyTest24", SCTeddyTest24, 1);
+    UtRegisterTest("SCTeddyTest25", SCTeddyTest25, 1);
+    UtRegisterTest("SCTeddyTest26", SCTeddyTest26, 1);
+    UtRegisterTest("SCTeddyTest27", SCTeddyTest27, 1);
+    UtRegisterTest("SCTeddyTest28", SCTeddyTest28, 1);
+    UtRegisterTest("SCTeddyTest29", SCTeddyTest29, 1);
+    UtRegisterTest("SCTeddyTest30", SCTeddyTest30, 1);
+#ifdef TEDDY_BENCH
+    UtRegisterTest("SCTeddyBench01", SCTeddyBench01, 1);
+#endif /* TEDDY_BENCH */
+#endif /* UNITTESTS */
+
+    return;
+}
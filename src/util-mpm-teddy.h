@@ -0,0 +1,72 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Teddy: SIMD multi pattern matcher for small pattern sets.
+ */
+
+#ifndef __UTIL_MPM_TEDDY_H__
+#define __UTIL_MPM_TEDDY_H__
+
+/** number of pattern buckets, one per bit of the nibble masks */
+#define TEDDY_BUCKETS       8
+/** max number of leading pattern bytes used for the filter */
+#define TEDDY_MAX_MASKS     3
+/** more patterns than this and the ctx is handed to AC */
+#define TEDDY_MAX_PATTERNS  16
+
+typedef struct SCTeddyPattern_ {
+    /* length of the pattern */
+    uint16_t len;
+    /* flags describing the pattern */
+    uint8_t flags;
+    /* pattern as it was added */
+    uint8_t *cs;
+    /* lowercase copy, used for nocase patterns */
+    uint8_t *ci;
+    /* pattern id */
+    uint32_t id;
+
+    struct SCTeddyPattern_ *next;
+} SCTeddyPattern;
+
+typedef struct SCTeddyCtx_ {
+    /* hash used during ctx initialization, keyed by pattern id */
+    SCTeddyPattern **init_hash;
+
+    /* patterns ordered by bucket, set up by prepare */
+    SCTeddyPattern *parray;
+    /* parray index of the first pattern of each bucket */
+    uint32_t bucket_start[TEDDY_BUCKETS + 1];
+
+    /* per leading byte, the buckets that have a pattern with a byte with
+     * that low/high nibble at that position */
+    uint8_t lo_mask[TEDDY_MAX_MASKS][16];
+    uint8_t hi_mask[TEDDY_MAX_MASKS][16];
+    /* number of leading bytes the filter checks */
+    uint8_t nmasks;
+
+    /* AC ctx holding the patterns, if there were too many for teddy or
+     * no SSSE3 support was compiled in */
+    MpmCtx *ac_ctx;
+} SCTeddyCtx;
+
+void MpmTeddyRegister(void);
+
+#endif /* __UTIL_MPM_TEDDY_H__ */
@@ -38,6 +38,8 @@
 #include "util-mpm-acc.h"
 #include "util-mpm-ac-gfbs.h"
 #include "util-mpm-ac-bs.h"
+#include "util-mpm-ac-compact.h"
+#include "util-mpm-teddy.h"
 #include "util-hashlist.h"
 
 #include "detect-engine.h"
@@ -456,6 +458,8 @@ void MpmTableSetup(void) {
     MpmACCRegister();
     MpmACBSRegister();
     MpmACGfbsRegister();
+    MpmACCompactRegister();
+    MpmTeddyRegister();
 }
 
 /** \brief  Function to return the default hash size for the mpm algorithm,
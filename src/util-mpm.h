@@ -80,6 +80,10 @@ enum {
     /* aho-corasick-goto-failure state based */
     MPM_AC_GFBS,
     MPM_AC_BS,
+    /* aho-corasick with alphabet compressed, shared state tables */
+    MPM_AC_COMPACT,
+    /* teddy simd filter, ac for large pattern sets */
+    MPM_TEDDY,
     /* table size */
     MPM_TABLE_SIZE,
 };
@@ -156,6 +160,9 @@ typedef struct MpmCtxFactoryContainer_ {
 /** one byte pattern (used in b2g) */
 #define MPM_PATTERN_ONE_BYTE        0x10
 
+/** matcher can't prepare several ctxs concurrently */
+#define MPM_FLAG_SERIAL_PREPARE     0x01
+
 typedef struct MpmTableElmt_ {
     char *name;
     uint8_t max_pattern_length;
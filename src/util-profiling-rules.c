@@ -369,6 +369,11 @@ SCProfilingRuleDump(SCProfileDetectCtx *rules_ctx)
             tms->tm_hour,tms->tm_min, tms->tm_sec);
     fprintf(fp, "  ----------------------------------------------"
             "----------------------------\n");
+    if (profiling_sample_rate > 1) {
+        fprintf(fp, "  Note: 1 in %"PRIu32" %s profiled, ticks, checks "
+                "and matches are scaled to all packets.\n", profiling_sample_rate,
+                profiling_sample_flows ? "flows" : "packets");
+    }
     fprintf(fp, "   %-8s %-12s %-8s %-8s %-12s %-6s %-8s %-8s %-11s %-11s %-11s %-11s\n", "Num", "Rule", "Gid", "Rev", "Ticks", "%", "Checks", "Matches", "Max Ticks", "Avg Ticks", "Avg Match", "Avg No Match");
     fprintf(fp, "  -------- "
         "------------ "
@@ -429,7 +434,9 @@ SCProfilingRegisterRuleCounter(SCProfileDetectCtx *ctx)
 }
 
 /**
- * \brief Update a rule counter.
+ * \brief Update a rule counter. The checks, matches and ticks are scaled
+ *        by the sample weight of the packet, so they estimate the totals
+ *        over all packets.
  *
  * \param id The ID of this counter.
  * \param ticks Number of CPU ticks for this rule.
@@ -440,15 +447,16 @@ SCProfilingRuleUpdateCounter(DetectEngineThreadCtx *det_ctx, uint16_t id, uint64
 {
     if (det_ctx != NULL && det_ctx->rule_perf_data != NULL && det_ctx->rule_perf_data_size > id) {
         SCProfileData *p = &det_ctx->rule_perf_data[id];
+        uint32_t weight = det_ctx->rule_perf_weight;
 
-        p->checks++;
-        p->matches += match;
+        p->checks += weight;
+        p->matches += match * weight;
         if (ticks > p->max)
             p->max = ticks;
         if (match == 1)
-            p->ticks_match += ticks;
+            p->ticks_match += ticks * weight;
         else
-            p->ticks_no_match += ticks;
+            p->ticks_no_match += ticks * weight;
     }
 }
 
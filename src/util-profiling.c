@@ -101,6 +101,20 @@ const char *profiling_packets_file_mode = "a";
  */
 __thread int profiling_rules_entered = 0;
 
+/**
+ * One in profiling_sample_rate packets is profiled. The counters of a
+ * profiled packet are scaled by the rate, so the dumps show totals.
+ */
+uint32_t profiling_sample_rate = 1;
+__thread uint32_t profiling_sample_cnt = 0;
+
+/**
+ * With sample-flows, the decision is made per flow instead, and all
+ * packets of a profiled flow are profiled.
+ */
+int profiling_sample_flows = 0;
+__thread uint32_t profiling_sample_flow_cnt = 0;
+
 void SCProfilingDumpPacketStats(void);
 const char * PacketProfileDetectIdToString(PacketProfileDetectId id);
 
@@ -122,6 +136,21 @@ void
 SCProfilingInit(void)
 {
     ConfNode *conf;
+    intmax_t sample_rate;
+
+    if (ConfGetInt("profiling.sample-rate", &sample_rate) == 1) {
+        if (sample_rate < 1 || sample_rate > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid profiling sample "
+                    "rate %"PRIdMAX", profiling all packets.", sample_rate);
+        } else {
+            SCProfilingSetSampleRate((uint32_t)sample_rate);
+        }
+    }
+    if (ConfGetBool("profiling.sample-flows", &profiling_sample_flows) == 1 &&
+            profiling_sample_flows) {
+        SCLogInfo("profiling sampled per flow, packets without a flow "
+                "are not profiled");
+    }
 
     conf = ConfGetNode("profiling.packets");
     if (conf != NULL) {
@@ -253,6 +282,44 @@ SCProfilingInit(void)
 
 }
 
+/**
+ * \brief Set the packet sample rate. Can be changed while the packet
+ *        threads run, they pick it up with the next packet.
+ *
+ * \param rate profile one in rate packets, 0 or 1 to profile all
+ */
+void
+SCProfilingSetSampleRate(uint32_t rate)
+{
+    if (rate == 0)
+        rate = 1;
+
+    profiling_sample_rate = rate;
+    SCLogInfo("profiling 1 in %"PRIu32" packets", rate);
+}
+
+#ifdef BUILD_UNIX_SOCKET
+/**
+ * \brief Unix socket command to set the packet sample rate
+ */
+TmEcode
+SCProfilingSampleRateCommand(json_t *cmd, json_t *answer, void *data)
+{
+    json_t *jarg = json_object_get(cmd, "rate");
+    if (!json_is_integer(jarg) || json_integer_value(jarg) < 1 ||
+            json_integer_value(jarg) > UINT32_MAX) {
+        json_object_set_new(answer, "message",
+                json_string("rate is not a positive integer"));
+        return TM_ECODE_FAILED;
+    }
+
+    SCProfilingSetSampleRate((uint32_t)json_integer_value(jarg));
+
+    json_object_set_new(answer, "message", json_integer(profiling_sample_rate));
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
 /**
  * \brief Free resources used by profiling.
  */
@@ -308,6 +375,11 @@ void SCProfilingDumpPacketStats(void) {
     }
 
     fprintf(fp, "\n\nPacket profile dump:\n");
+    if (profiling_sample_rate > 1) {
+        fprintf(fp, "Note: 1 in %"PRIu32" %s profiled, cnt and tot are "
+                "scaled to all packets.\n", profiling_sample_rate,
+                profiling_sample_flows ? "flows" : "packets");
+    }
 
     fprintf(fp, "\n%-6s   %-5s   %-12s   %-12s   %-12s   %-12s   %-12s  %-3s\n",
             "IP ver", "Proto", "cnt", "min", "max", "avg", "tot", "%%");
@@ -617,7 +689,23 @@ void SCProfilingPrintPacketProfile(Packet *p) {
     fprintf(packet_profile_csv_fp,"\n");
 }
 
-static void SCProfilingUpdatePacketDetectRecord(PacketProfileDetectId id, uint8_t ipproto, PktProfilingDetectData *pdt, int ipver) {
+/**
+ * \brief Add a sampled measurement to a record. cnt and tot are scaled
+ *        by the weight of the sample, min and max are not.
+ */
+static inline void SCProfilingUpdatePacketData(SCProfilePacketData *pd, uint64_t delta, uint32_t weight) {
+    if (pd->min == 0 || delta < pd->min) {
+        pd->min = delta;
+    }
+    if (pd->max < delta) {
+        pd->max = delta;
+    }
+
+    pd->tot += delta * weight;
+    pd->cnt += weight;
+}
+
+static void SCProfilingUpdatePacketDetectRecord(PacketProfileDetectId id, uint8_t ipproto, PktProfilingDetectData *pdt, int ipver, uint32_t weight) {
     if (pdt == NULL) {
         return;
     }
@@ -628,15 +716,7 @@ static void SCProfilingUpdatePacketDetectRecord(PacketProfileDetectId id, uint8_
     else
         pd = &packet_profile_detect_data6[id][ipproto];
 
-    if (pd->min == 0 || pdt->ticks_spent < pd->min) {
-        pd->min = pdt->ticks_spent;
-    }
-    if (pd->max < pdt->ticks_spent) {
-        pd->max = pdt->ticks_spent;
-    }
-
-    pd->tot += pdt->ticks_spent;
-    pd->cnt ++;
+    SCProfilingUpdatePacketData(pd, pdt->ticks_spent, weight);
 }
 
 void SCProfilingUpdatePacketDetectRecords(Packet *p) {
@@ -646,33 +726,25 @@ void SCProfilingUpdatePacketDetectRecords(Packet *p) {
 
         if (pdt->ticks_spent > 0) {
             if (PKT_IS_IPV4(p)) {
-                SCProfilingUpdatePacketDetectRecord(i, p->proto, pdt, 4);
+                SCProfilingUpdatePacketDetectRecord(i, p->proto, pdt, 4, p->profile.weight);
             } else {
-                SCProfilingUpdatePacketDetectRecord(i, p->proto, pdt, 6);
+                SCProfilingUpdatePacketDetectRecord(i, p->proto, pdt, 6, p->profile.weight);
             }
         }
     }
 }
 
-static void SCProfilingUpdatePacketAppPdRecord(uint8_t ipproto, uint32_t ticks_spent, int ipver) {
+static void SCProfilingUpdatePacketAppPdRecord(uint8_t ipproto, uint32_t ticks_spent, int ipver, uint32_t weight) {
     SCProfilePacketData *pd;
     if (ipver == 4)
         pd = &packet_profile_app_pd_data4[ipproto];
     else
         pd = &packet_profile_app_pd_data6[ipproto];
 
-    if (pd->min == 0 || ticks_spent < pd->min) {
-        pd->min = ticks_spent;
-    }
-    if (pd->max < ticks_spent) {
-        pd->max = ticks_spent;
-    }
-
-    pd->tot += ticks_spent;
-    pd->cnt ++;
+    SCProfilingUpdatePacketData(pd, ticks_spent, weight);
 }
 
-static void SCProfilingUpdatePacketAppRecord(int alproto, uint8_t ipproto, PktProfilingAppData *pdt, int ipver) {
+static void SCProfilingUpdatePacketAppRecord(int alproto, uint8_t ipproto, PktProfilingAppData *pdt, int ipver, uint32_t weight) {
     if (pdt == NULL) {
         return;
     }
@@ -683,15 +755,7 @@ static void SCProfilingUpdatePacketAppRecord(int alproto, uint8_t ipproto, PktPr
     else
         pd = &packet_profile_app_data6[alproto][ipproto];
 
-    if (pd->min == 0 || pdt->ticks_spent < pd->min) {
-        pd->min = pdt->ticks_spent;
-    }
-    if (pd->max < pdt->ticks_spent) {
-        pd->max = pdt->ticks_spent;
-    }
-
-    pd->tot += pdt->ticks_spent;
-    pd->cnt ++;
+    SCProfilingUpdatePacketData(pd, pdt->ticks_spent, weight);
 }
 
 void SCProfilingUpdatePacketAppRecords(Packet *p) {
@@ -701,23 +765,23 @@ void SCProfilingUpdatePacketAppRecords(Packet *p) {
 
         if (pdt->ticks_spent > 0) {
             if (PKT_IS_IPV4(p)) {
-                SCProfilingUpdatePacketAppRecord(i, p->proto, pdt, 4);
+                SCProfilingUpdatePacketAppRecord(i, p->proto, pdt, 4, p->profile.weight);
             } else {
-                SCProfilingUpdatePacketAppRecord(i, p->proto, pdt, 6);
+                SCProfilingUpdatePacketAppRecord(i, p->proto, pdt, 6, p->profile.weight);
             }
         }
     }
 
     if (p->profile.proto_detect > 0) {
         if (PKT_IS_IPV4(p)) {
-            SCProfilingUpdatePacketAppPdRecord(p->proto, p->profile.proto_detect, 4);
+            SCProfilingUpdatePacketAppPdRecord(p->proto, p->profile.proto_detect, 4, p->profile.weight);
         } else {
-            SCProfilingUpdatePacketAppPdRecord(p->proto, p->profile.proto_detect, 6);
+            SCProfilingUpdatePacketAppPdRecord(p->proto, p->profile.proto_detect, 6, p->profile.weight);
         }
     }
 }
 
-void SCProfilingUpdatePacketTmmRecord(int module, uint8_t proto, PktProfilingTmmData *pdt, int ipver) {
+void SCProfilingUpdatePacketTmmRecord(int module, uint8_t proto, PktProfilingTmmData *pdt, int ipver, uint32_t weight) {
     if (pdt == NULL) {
         return;
     }
@@ -729,23 +793,15 @@ void SCProfilingUpdatePacketTmmRecord(int module, uint8_t proto, PktProfilingTmm
         pd = &packet_profile_tmm_data6[module][proto];
 
     uint32_t delta = (uint32_t)pdt->ticks_end - pdt->ticks_start;
-    if (pd->min == 0 || delta < pd->min) {
-        pd->min = delta;
-    }
-    if (pd->max < delta) {
-        pd->max = delta;
-    }
-
-    pd->tot += (uint64_t)delta;
-    pd->cnt ++;
+    SCProfilingUpdatePacketData(pd, (uint64_t)delta, weight);
 
 #ifdef PROFILE_LOCKING
-    pd->lock += pdt->mutex_lock_cnt;
-    pd->ticks += pdt->mutex_lock_wait_ticks;
-    pd->contention += pdt->mutex_lock_contention;
-    pd->slock += pdt->spin_lock_cnt;
-    pd->sticks += pdt->spin_lock_wait_ticks;
-    pd->scontention += pdt->spin_lock_contention;
+    pd->lock += pdt->mutex_lock_cnt * weight;
+    pd->ticks += pdt->mutex_lock_wait_ticks * weight;
+    pd->contention += pdt->mutex_lock_contention * weight;
+    pd->slock += pdt->spin_lock_cnt * weight;
+    pd->sticks += pdt->spin_lock_wait_ticks * weight;
+    pd->scontention += pdt->spin_lock_contention * weight;
 #endif
 }
 
@@ -759,9 +815,9 @@ void SCProfilingUpdatePacketTmmRecords(Packet *p) {
         }
 
         if (PKT_IS_IPV4(p)) {
-            SCProfilingUpdatePacketTmmRecord(i, p->proto, pdt, 4);
+            SCProfilingUpdatePacketTmmRecord(i, p->proto, pdt, 4, p->profile.weight);
         } else {
-            SCProfilingUpdatePacketTmmRecord(i, p->proto, pdt, 6);
+            SCProfilingUpdatePacketTmmRecord(i, p->proto, pdt, 6, p->profile.weight);
         }
     }
 }
@@ -780,28 +836,11 @@ void SCProfilingAddPacket(Packet *p) {
             SCProfilePacketData *pd = &packet_profile_data4[p->proto];
 
             uint64_t delta = p->profile.ticks_end - p->profile.ticks_start;
-            if (pd->min == 0 || delta < pd->min) {
-                pd->min = delta;
-            }
-            if (pd->max < delta) {
-                pd->max = delta;
-            }
-
-            pd->tot += delta;
-            pd->cnt ++;
+            SCProfilingUpdatePacketData(pd, delta, p->profile.weight);
 
             if (IS_TUNNEL_PKT(p)) {
                 pd = &packet_profile_data4[256];
-
-                if (pd->min == 0 || delta < pd->min) {
-                    pd->min = delta;
-                }
-                if (pd->max < delta) {
-                    pd->max = delta;
-                }
-
-                pd->tot += delta;
-                pd->cnt ++;
+                SCProfilingUpdatePacketData(pd, delta, p->profile.weight);
             }
 
             SCProfilingUpdatePacketTmmRecords(p);
@@ -812,28 +851,11 @@ void SCProfilingAddPacket(Packet *p) {
             SCProfilePacketData *pd = &packet_profile_data6[p->proto];
 
             uint64_t delta = p->profile.ticks_end - p->profile.ticks_start;
-            if (pd->min == 0 || delta < pd->min) {
-                pd->min = delta;
-            }
-            if (pd->max < delta) {
-                pd->max = delta;
-            }
-
-            pd->tot += delta;
-            pd->cnt ++;
+            SCProfilingUpdatePacketData(pd, delta, p->profile.weight);
 
             if (IS_TUNNEL_PKT(p)) {
                 pd = &packet_profile_data6[256];
-
-                if (pd->min == 0 || delta < pd->min) {
-                    pd->min = delta;
-                }
-                if (pd->max < delta) {
-                    pd->max = delta;
-                }
-
-                pd->tot += delta;
-                pd->cnt ++;
+                SCProfilingUpdatePacketData(pd, delta, p->profile.weight);
             }
 
             SCProfilingUpdatePacketTmmRecords(p);
@@ -988,6 +1010,105 @@ ProfilingGenericTicksTest01(void) {
     return 1;
 }
 
+/** \test one in rate packets is sampled, with the rate as weight, and
+ *        the records are scaled by the weight */
+static int
+ProfilingSampleTest01(void) {
+    uint32_t saved_rate = profiling_sample_rate;
+    SCProfilePacketData pd;
+    int result = 0;
+    int i;
+
+    profiling_sample_rate = 1;
+    for (i = 0; i < 8; i++) {
+        if (SCProfilingSample() != 1)
+            goto end;
+    }
+
+    profiling_sample_rate = 4;
+    profiling_sample_cnt = 0;
+    for (i = 1; i <= 16; i++) {
+        uint32_t weight = SCProfilingSample();
+        if (weight != ((i % 4) == 0 ? 4 : 0)) {
+            printf("packet %d weight %"PRIu32": ", i, weight);
+            goto end;
+        }
+    }
+
+    memset(&pd, 0x00, sizeof(pd));
+    SCProfilingUpdatePacketData(&pd, 100, 4);
+    SCProfilingUpdatePacketData(&pd, 50, 4);
+    if (pd.cnt != 8 || pd.tot != 600 || pd.min != 50 || pd.max != 100) {
+        printf("cnt %"PRIu64" tot %"PRIu64" min %"PRIu64" max %"PRIu64": ",
+                pd.cnt, pd.tot, pd.min, pd.max);
+        goto end;
+    }
+
+    result = 1;
+end:
+    profiling_sample_rate = saved_rate;
+    profiling_sample_cnt = 0;
+    return result;
+}
+
+/** \test with sample-flows one in rate flows is sampled, and only the
+ *        packets of those, app layer included, are profiled */
+static int
+ProfilingSampleTest02(void) {
+    uint32_t saved_rate = profiling_sample_rate;
+    int saved_packets = profiling_packets_enabled;
+    AlpProtoDetectThreadCtx dp;
+    Flow f[4];
+    int result = 0;
+    int i;
+
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    if (unlikely(p == NULL))
+        return 0;
+    memset(p, 0x00, SIZE_OF_PACKET);
+    memset(&f, 0x00, sizeof(f));
+    memset(&dp, 0x00, sizeof(dp));
+
+    profiling_packets_enabled = 1;
+    profiling_sample_flows = 1;
+    profiling_sample_rate = 4;
+    profiling_sample_flow_cnt = 0;
+    for (i = 0; i < 4; i++) {
+        FLOW_PROFILING_SAMPLE(&f[i]);
+    }
+    if (f[0].profile_weight != 0 || f[3].profile_weight != 4)
+        goto end;
+
+    /* not profiled before the flow is known */
+    PACKET_PROFILING_START(p);
+    if (p->profile.weight != 0 || p->profile.ticks_start != 0)
+        goto end;
+
+    /* flow not sampled: no ticks read for the app layer either */
+    PACKET_PROFILING_FLOW_SAMPLE(p, &f[0]);
+    PACKET_PROFILING_APP_SAMPLE(&dp, p);
+    PACKET_PROFILING_APP_PD_START(&dp);
+    if (p->profile.weight != 0 || dp.proto_detect_ticks_start != 0)
+        goto end;
+
+    /* flow sampled */
+    PACKET_PROFILING_FLOW_SAMPLE(p, &f[3]);
+    PACKET_PROFILING_APP_SAMPLE(&dp, p);
+    PACKET_PROFILING_APP_PD_START(&dp);
+    if (p->profile.weight != 4 || p->profile.ticks_start == 0 ||
+            dp.proto_detect_ticks_start == 0)
+        goto end;
+
+    result = 1;
+end:
+    profiling_packets_enabled = saved_packets;
+    profiling_sample_flows = 0;
+    profiling_sample_rate = saved_rate;
+    profiling_sample_flow_cnt = 0;
+    SCFree(p);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void
@@ -995,6 +1116,8 @@ SCProfilingRegisterTests(void)
 {
 #ifdef UNITTESTS
     UtRegisterTest("ProfilingGenericTicksTest01", ProfilingGenericTicksTest01, 1);
+    UtRegisterTest("ProfilingSampleTest01", ProfilingSampleTest01, 1);
+    UtRegisterTest("ProfilingSampleTest02", ProfilingSampleTest02, 1);
 #endif /* UNITTESTS */
 }
 
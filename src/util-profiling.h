@@ -33,14 +33,59 @@
 extern int profiling_rules_enabled;
 extern int profiling_packets_enabled;
 extern __thread int profiling_rules_entered;
+extern uint32_t profiling_sample_rate;
+extern __thread uint32_t profiling_sample_cnt;
+extern int profiling_sample_flows;
+extern __thread uint32_t profiling_sample_flow_cnt;
 
 void SCProfilingPrintPacketProfile(Packet *);
 void SCProfilingAddPacket(Packet *);
 
-#define RULE_PROFILING_START \
+/**
+ * \brief Decide if a packet is profiled. One in profiling_sample_rate
+ *        packets is, per thread.
+ *
+ * \retval weight of the sample, i.e. the number of packets it stands
+ *         for, or 0 if the packet is not profiled
+ */
+static inline uint32_t SCProfilingSample(void)
+{
+    uint32_t rate = profiling_sample_rate;
+
+    if (rate <= 1)
+        return 1;
+    if (++profiling_sample_cnt < rate)
+        return 0;
+    profiling_sample_cnt = 0;
+    return rate;
+}
+
+/**
+ * \brief Decide if a new flow is profiled, if profiling.sample-flows is
+ *        set. One in profiling_sample_rate flows is, per thread.
+ *
+ * \retval weight of the sample, or 0 if the flow is not profiled
+ */
+static inline uint32_t SCProfilingSampleFlow(void)
+{
+    uint32_t rate = profiling_sample_rate;
+
+    if (rate <= 1)
+        return 1;
+    if (++profiling_sample_flow_cnt < rate)
+        return 0;
+    profiling_sample_flow_cnt = 0;
+    return rate;
+}
+
+/** use the sample decision of the packet for the rules run on it */
+#define RULE_PROFILING_SAMPLE(ctx, p) \
+    (ctx)->rule_perf_weight = (p)->profile.weight
+
+#define RULE_PROFILING_START(ctx) \
     uint64_t profile_rule_start_ = 0; \
     uint64_t profile_rule_end_ = 0; \
-    if (profiling_rules_enabled) { \
+    if (profiling_rules_enabled && (ctx)->rule_perf_weight) { \
         if (profiling_rules_entered > 0) { \
             SCLogError(SC_ERR_FATAL, "Re-entered profiling, exiting."); \
             exit(1); \
@@ -50,20 +95,44 @@ void SCProfilingAddPacket(Packet *);
     }
 
 #define RULE_PROFILING_END(ctx, r, m) \
-    if (profiling_rules_enabled) { \
+    if (profiling_rules_enabled && (ctx)->rule_perf_weight) { \
         profile_rule_end_ = UtilCpuGetTicks(); \
         SCProfilingRuleUpdateCounter(ctx, r->profiling_id, \
             profile_rule_end_ - profile_rule_start_, m); \
         profiling_rules_entered--; \
     }
 
+/* with flow sampling the packet is profiled from the flow lookup on, if
+ * its flow is, see PACKET_PROFILING_FLOW_SAMPLE */
 #define PACKET_PROFILING_START(p)                                   \
-    if (profiling_packets_enabled) {                                \
-        (p)->profile.ticks_start = UtilCpuGetTicks();               \
+    if (profiling_packets_enabled || profiling_rules_enabled) {     \
+        (p)->profile.weight = profiling_sample_flows ? 0 :          \
+            SCProfilingSample();                                    \
+        if (profiling_packets_enabled && (p)->profile.weight) {     \
+            (p)->profile.ticks_start = UtilCpuGetTicks();           \
+        }                                                           \
+    }
+
+/** decide if a new flow is profiled */
+#define FLOW_PROFILING_SAMPLE(f)                                    \
+    if (profiling_sample_flows &&                                   \
+            (profiling_packets_enabled || profiling_rules_enabled)) { \
+        (f)->profile_weight = SCProfilingSampleFlow();              \
+    }
+
+/** use the sample decision of the flow for the packet */
+#define PACKET_PROFILING_FLOW_SAMPLE(p, f)                          \
+    if (profiling_sample_flows &&                                   \
+            (profiling_packets_enabled || profiling_rules_enabled)) { \
+        (p)->profile.weight = (f)->profile_weight;                  \
+        if (profiling_packets_enabled && (p)->profile.weight &&     \
+                (p)->profile.ticks_start == 0) {                    \
+            (p)->profile.ticks_start = UtilCpuGetTicks();           \
+        }                                                           \
     }
 
 #define PACKET_PROFILING_END(p)                                     \
-    if (profiling_packets_enabled) {                                \
+    if (profiling_packets_enabled && (p)->profile.weight) {         \
         (p)->profile.ticks_end = UtilCpuGetTicks();                 \
         SCProfilingAddPacket((p));                                  \
     }
@@ -108,7 +177,7 @@ void SCProfilingAddPacket(Packet *);
 #endif
 
 #define PACKET_PROFILING_TMM_START(p, id)                           \
-    if (profiling_packets_enabled) {                                \
+    if (profiling_packets_enabled && (p)->profile.weight) {         \
         if ((id) < TMM_SIZE) {                                      \
             (p)->profile.tmm[(id)].ticks_start = UtilCpuGetTicks(); \
             PACKET_PROFILING_RESET_LOCKS;                           \
@@ -116,26 +185,27 @@ void SCProfilingAddPacket(Packet *);
     }
 
 #define PACKET_PROFILING_TMM_END(p, id)                             \
-    if (profiling_packets_enabled) {                                \
+    if (profiling_packets_enabled && (p)->profile.weight) {         \
         if ((id) < TMM_SIZE) {                                      \
             PACKET_PROFILING_COPY_LOCKS((p), (id));                 \
             (p)->profile.tmm[(id)].ticks_end = UtilCpuGetTicks();   \
         }                                                           \
     }
 
+/* only sampled packets have profile data to clear */
 #define PACKET_PROFILING_RESET(p)                                   \
-    if (profiling_packets_enabled) {                                \
+    if (profiling_packets_enabled && (p)->profile.weight) {         \
         memset(&(p)->profile, 0x00, sizeof(PktProfiling));          \
     }
 
 #define PACKET_PROFILING_APP_START(dp, id)                          \
-    if (profiling_packets_enabled) {                                \
+    if (profiling_packets_enabled && (dp)->profile_weight) {    \
         (dp)->ticks_start = UtilCpuGetTicks();                      \
         (dp)->alproto = (id);                                       \
     }
 
 #define PACKET_PROFILING_APP_END(dp, id)                            \
-    if (profiling_packets_enabled) {                                \
+    if (profiling_packets_enabled && (dp)->profile_weight) {    \
         BUG_ON((id) != (dp)->alproto);                              \
         (dp)->ticks_end = UtilCpuGetTicks();                        \
         if ((dp)->ticks_start != 0 && (dp)->ticks_start < ((dp)->ticks_end)) {  \
@@ -144,12 +214,12 @@ void SCProfilingAddPacket(Packet *);
     }
 
 #define PACKET_PROFILING_APP_PD_START(dp)                           \
-    if (profiling_packets_enabled) {                                \
+    if (profiling_packets_enabled && (dp)->profile_weight) {    \
         (dp)->proto_detect_ticks_start = UtilCpuGetTicks();         \
     }
 
 #define PACKET_PROFILING_APP_PD_END(dp)                             \
-    if (profiling_packets_enabled) {                                \
+    if (profiling_packets_enabled && (dp)->profile_weight) {    \
         (dp)->proto_detect_ticks_end = UtilCpuGetTicks();           \
         if ((dp)->proto_detect_ticks_start != 0 && (dp)->proto_detect_ticks_start < ((dp)->proto_detect_ticks_end)) {  \
             (dp)->proto_detect_ticks_spent =                        \
@@ -168,8 +238,12 @@ void SCProfilingAddPacket(Packet *);
         (dp)->proto_detect_ticks_spent = 0;                         \
     }
 
+/** use the sample decision of the packet for the app layer run on it */
+#define PACKET_PROFILING_APP_SAMPLE(dp, p)                          \
+    (dp)->profile_weight = (p)->profile.weight
+
 #define PACKET_PROFILING_APP_STORE(dp, p)                           \
-    if (profiling_packets_enabled) {                                \
+    if (profiling_packets_enabled && (p)->profile.weight) {         \
         if ((dp)->alproto < ALPROTO_MAX) {                          \
             (p)->profile.app[(dp)->alproto].ticks_spent += (dp)->ticks_spent;   \
             (p)->profile.proto_detect += (dp)->proto_detect_ticks_spent;        \
@@ -177,14 +251,14 @@ void SCProfilingAddPacket(Packet *);
     }
 
 #define PACKET_PROFILING_DETECT_START(p, id)                        \
-    if (profiling_packets_enabled) {                                \
+    if (profiling_packets_enabled && (p)->profile.weight) {         \
         if ((id) < PROF_DETECT_SIZE) {                              \
             (p)->profile.detect[(id)].ticks_start = UtilCpuGetTicks(); \
         }                                                           \
     }
 
 #define PACKET_PROFILING_DETECT_END(p, id)                          \
-    if (profiling_packets_enabled) {                                \
+    if (profiling_packets_enabled && (p)->profile.weight) {         \
         if ((id) < PROF_DETECT_SIZE) {                              \
             (p)->profile.detect[(id)].ticks_end = UtilCpuGetTicks();\
             if ((p)->profile.detect[(id)].ticks_start != 0 &&       \
@@ -206,17 +280,26 @@ void SCProfilingRuleThreadCleanup(DetectEngineThreadCtx *);
 
 void SCProfilingInit(void);
 void SCProfilingDestroy(void);
+void SCProfilingSetSampleRate(uint32_t);
+#ifdef BUILD_UNIX_SOCKET
+#include <jansson.h>
+TmEcode SCProfilingSampleRateCommand(json_t *, json_t *, void *);
+#endif
 void SCProfilingRegisterTests(void);
 void SCProfilingDump(void);
 
 #else
 
-#define RULE_PROFILING_START
+#define RULE_PROFILING_SAMPLE(ctx, p)
+#define RULE_PROFILING_START(ctx)
 #define RULE_PROFILING_END(a,b,c)
 
 #define PACKET_PROFILING_START(p)
 #define PACKET_PROFILING_END(p)
 
+#define FLOW_PROFILING_SAMPLE(f)
+#define PACKET_PROFILING_FLOW_SAMPLE(p, f)
+
 #define PACKET_PROFILING_TMM_START(p, id)
 #define PACKET_PROFILING_TMM_END(p, id)
 
@@ -225,6 +308,7 @@ void SCProfilingDump(void);
 #define PACKET_PROFILING_APP_START(dp, id)
 #define PACKET_PROFILING_APP_END(dp, id)
 #define PACKET_PROFILING_APP_RESET(dp)
+#define PACKET_PROFILING_APP_SAMPLE(dp, p)
 #define PACKET_PROFILING_APP_STORE(dp, p)
 
 #define PACKET_PROFILING_APP_PD_START(dp)
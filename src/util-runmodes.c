@@ -393,6 +393,33 @@ int RunModeSetLiveCaptureAuto(DetectEngineCtx *de_ctx,
     return 0;
 }
 
+/**
+ * \brief get the queue handler that passes the packets from the capture
+ *        threads to the detect threads in autofp mode, set with
+ *        "autofp-queue-handler"
+ *
+ * \retval name queue handler name
+ */
+static char *RunModeAutoFpQueueHandler(void)
+{
+    char *handler = NULL;
+
+    if (ConfGet("autofp-queue-handler", &handler) != 1)
+        return "flow";
+
+    if (strcasecmp(handler, "flow") == 0) {
+        return "flow";
+    } else if (strcasecmp(handler, "spsc") == 0) {
+        SCLogInfo("AutoFP mode using \"spsc\" queue handler");
+        return "spsc";
+    }
+
+    SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry \"%s\" "
+               "for autofp-queue-handler in conf.  Killing engine.",
+               handler);
+    exit(EXIT_FAILURE);
+}
+
 int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
                               ConfigIfaceParserFunc ConfigParser,
                               ConfigIfaceThreadsCountFunc ModThreadsCount,
@@ -407,6 +434,7 @@ int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
     /* Available cpus */
     uint16_t ncpus = UtilCpuGetNumProcessorsOnline();
     int nlive = LiveGetDeviceCount();
+    char *qhandler = RunModeAutoFpQueueHandler();
     int thread_max = TmThreadGetNbThreads(DETECT_CPU_SET);
     /* always create at least one thread */
     if (thread_max == 0)
@@ -451,7 +479,7 @@ int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
             ThreadVars *tv_receive =
                 TmThreadCreatePacketHandler(thread_name,
                         "packetpool", "packetpool",
-                        queues, "flow", "pktacqloop");
+                        queues, qhandler, "pktacqloop");
             if (tv_receive == NULL) {
                 SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
                 exit(EXIT_FAILURE);
@@ -514,7 +542,7 @@ int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
                 ThreadVars *tv_receive =
                     TmThreadCreatePacketHandler(thread_name,
                             "packetpool", "packetpool",
-                            queues, "flow", "pktacqloop");
+                            queues, qhandler, "pktacqloop");
                 if (tv_receive == NULL) {
                     SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
                     exit(EXIT_FAILURE);
@@ -556,7 +584,7 @@ int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
         }
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(thread_name,
-                                        qname, "flow",
+                                        qname, qhandler,
                                         "packetpool", "packetpool",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
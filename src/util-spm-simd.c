@@ -0,0 +1,410 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * SIMD single pattern search. 16 (SSE2) or 32 (AVX2) haystack positions
+ * are checked at a time by comparing the bytes at the position and at
+ * position + needle_len - 1 with the first and last byte of the needle.
+ * Only the positions where both match are compared in full. As both
+ * ends have to match, the filter is selective even for needles made of
+ * common bytes, and it needs no context, so it works on the content as
+ * it is stored in the signature.
+ *
+ * For nocase the needle bytes are lowercased, and for the needle bytes
+ * that are letters the haystack bytes are OR'ed with 0x20. For a letter
+ * that is an exact case fold: only the upper and lower case letter have
+ * the same value with the 0x20 bit set.
+ *
+ * The AVX2 version is compiled in when the compiler supports per
+ * function targets, and used when SimdSearchInit finds a cpu with AVX2.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "util-debug.h"
+#include "util-spm-simd.h"
+#include "util-spm-bs.h"
+#include "util-unittest.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(__clang__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define SPM_SIMD_AVX2 1
+#include <immintrin.h>
+#endif
+
+typedef uint8_t *(*SimdSearchFunc)(const uint8_t *, uint32_t,
+        const uint8_t *, uint16_t, int);
+
+/** \brief first/last byte values and fold masks of a needle */
+typedef struct SimdNeedle_ {
+    uint8_t first;
+    uint8_t last;
+    uint8_t first_fold;
+    uint8_t last_fold;
+} SimdNeedle;
+
+static inline void SimdNeedleSetup(SimdNeedle *sn, const uint8_t *needle,
+        uint16_t needle_len, int nocase)
+{
+    sn->first = needle[0];
+    sn->last = needle[needle_len - 1];
+    sn->first_fold = 0;
+    sn->last_fold = 0;
+
+    if (nocase) {
+        if (isalpha(sn->first)) {
+            sn->first = u8_tolower(sn->first);
+            sn->first_fold = 0x20;
+        }
+        if (isalpha(sn->last)) {
+            sn->last = u8_tolower(sn->last);
+            sn->last_fold = 0x20;
+        }
+    }
+}
+
+/**
+ * \brief compare the needle bytes between the first and the last one,
+ *        which the filter already matched
+ */
+static inline int SimdVerify(const uint8_t *h, const uint8_t *needle,
+        uint16_t needle_len, int nocase)
+{
+    if (needle_len <= 2)
+        return 1;
+
+    if (!nocase)
+        return (memcmp(h + 1, needle + 1, needle_len - 2) == 0);
+
+    uint16_t i;
+    for (i = 1; i < needle_len - 1; i++) {
+        if (u8_tolower(h[i]) != u8_tolower(needle[i]))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * \brief check the positions from offset on one by one. Used for the
+ *        tail the vector loops leave, and without SSE2.
+ */
+static inline uint8_t *SimdSearchTail(const uint8_t *haystack, uint32_t haystack_len,
+        const uint8_t *needle, uint16_t needle_len, int nocase,
+        const SimdNeedle *sn, uint32_t offset)
+{
+    uint32_t last = needle_len - 1;
+    uint32_t i;
+
+    for (i = offset; i + last < haystack_len; i++) {
+        if ((haystack[i] | sn->first_fold) == sn->first &&
+            (haystack[i + last] | sn->last_fold) == sn->last &&
+            SimdVerify(haystack + i, needle, needle_len, nocase))
+        {
+            return (uint8_t *)(haystack + i);
+        }
+    }
+    return NULL;
+}
+
+static uint8_t *SimdSearchScalar(const uint8_t *haystack, uint32_t haystack_len,
+        const uint8_t *needle, uint16_t needle_len, int nocase)
+{
+    SimdNeedle sn;
+
+    if (needle_len == 0 || needle_len > haystack_len)
+        return NULL;
+
+    SimdNeedleSetup(&sn, needle, needle_len, nocase);
+    return SimdSearchTail(haystack, haystack_len, needle, needle_len, nocase, &sn, 0);
+}
+
+#ifdef __SSE2__
+static uint8_t *SimdSearchSSE2(const uint8_t *haystack, uint32_t haystack_len,
+        const uint8_t *needle, uint16_t needle_len, int nocase)
+{
+    SimdNeedle sn;
+
+    if (needle_len == 0 || needle_len > haystack_len)
+        return NULL;
+
+    SimdNeedleSetup(&sn, needle, needle_len, nocase);
+
+    const uint32_t last = needle_len - 1;
+    const __m128i first = _mm_set1_epi8((char)sn.first);
+    const __m128i lastb = _mm_set1_epi8((char)sn.last);
+    const __m128i first_fold = _mm_set1_epi8((char)sn.first_fold);
+    const __m128i last_fold = _mm_set1_epi8((char)sn.last_fold);
+    uint32_t i = 0;
+
+    for ( ; i + last + 16 <= haystack_len; i += 16) {
+        __m128i f = _mm_loadu_si128((const __m128i *)(haystack + i));
+        __m128i l = _mm_loadu_si128((const __m128i *)(haystack + i + last));
+        f = _mm_cmpeq_epi8(_mm_or_si128(f, first_fold), first);
+        l = _mm_cmpeq_epi8(_mm_or_si128(l, last_fold), lastb);
+
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(f, l));
+        while (mask) {
+            uint32_t pos = i + __builtin_ctz(mask);
+            if (SimdVerify(haystack + pos, needle, needle_len, nocase))
+                return (uint8_t *)(haystack + pos);
+            mask &= mask - 1;
+        }
+    }
+
+    return SimdSearchTail(haystack, haystack_len, needle, needle_len, nocase, &sn, i);
+}
+#endif /* __SSE2__ */
+
+#ifdef SPM_SIMD_AVX2
+__attribute__((target("avx2")))
+static uint8_t *SimdSearchAVX2(const uint8_t *haystack, uint32_t haystack_len,
+        const uint8_t *needle, uint16_t needle_len, int nocase)
+{
+    SimdNeedle sn;
+
+    if (needle_len == 0 || needle_len > haystack_len)
+        return NULL;
+
+    SimdNeedleSetup(&sn, needle, needle_len, nocase);
+
+    const uint32_t last = needle_len - 1;
+    const __m256i first = _mm256_set1_epi8((char)sn.first);
+    const __m256i lastb = _mm256_set1_epi8((char)sn.last);
+    const __m256i first_fold = _mm256_set1_epi8((char)sn.first_fold);
+    const __m256i last_fold = _mm256_set1_epi8((char)sn.last_fold);
+    uint32_t i = 0;
+
+    for ( ; i + last + 32 <= haystack_len; i += 32) {
+        __m256i f = _mm256_loadu_si256((const __m256i *)(haystack + i));
+        __m256i l = _mm256_loadu_si256((const __m256i *)(haystack + i + last));
+        f = _mm256_cmpeq_epi8(_mm256_or_si256(f, first_fold), first);
+        l = _mm256_cmpeq_epi8(_mm256_or_si256(l, last_fold), lastb);
+
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(f, l));
+        while (mask) {
+            uint32_t pos = i + __builtin_ctz(mask);
+            if (SimdVerify(haystack + pos, needle, needle_len, nocase))
+                return (uint8_t *)(haystack + pos);
+            mask &= mask - 1;
+        }
+    }
+
+    return SimdSearchTail(haystack, haystack_len, needle, needle_len, nocase, &sn, i);
+}
+#endif /* SPM_SIMD_AVX2 */
+
+#ifdef __SSE2__
+static SimdSearchFunc simd_search = SimdSearchSSE2;
+#else
+static SimdSearchFunc simd_search = SimdSearchScalar;
+#endif
+
+/**
+ * \brief Search a needle in a haystack
+ *
+ * \param haystack pointer to the buffer to search in
+ * \param haystack_len length limit of the buffer
+ * \param needle pointer to the pattern we are searching for
+ * \param needle_len length limit of the needle
+ *
+ * \retval ptr to start of the match; NULL if no match
+ */
+uint8_t *SimdSearch(const uint8_t *haystack, uint32_t haystack_len,
+        const uint8_t *needle, uint16_t needle_len)
+{
+    return simd_search(haystack, haystack_len, needle, needle_len, 0);
+}
+
+/**
+ * \brief Search a needle in a haystack, case insensitive
+ *
+ * \param haystack pointer to the buffer to search in
+ * \param haystack_len length limit of the buffer
+ * \param needle pointer to the pattern we are searching for, any case
+ * \param needle_len length limit of the needle
+ *
+ * \retval ptr to start of the match; NULL if no match
+ */
+uint8_t *SimdSearchNocase(const uint8_t *haystack, uint32_t haystack_len,
+        const uint8_t *needle, uint16_t needle_len)
+{
+    return simd_search(haystack, haystack_len, needle, needle_len, 1);
+}
+
+/**
+ * \brief Select the widest implementation the cpu supports. Has to be
+ *        called before the packet threads start.
+ */
+void SimdSearchInit(void)
+{
+#ifdef SPM_SIMD_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        simd_search = SimdSearchAVX2;
+        SCLogDebug("using AVX2 single pattern search");
+        return;
+    }
+#endif
+#ifdef __SSE2__
+    SCLogDebug("using SSE2 single pattern search");
+#else
+    SCLogDebug("using scalar single pattern search");
+#endif
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+static SimdSearchFunc SimdSearchTestFuncs(int i)
+{
+    switch (i) {
+        case 0:
+            return SimdSearchScalar;
+#ifdef __SSE2__
+        case 1:
+            return SimdSearchSSE2;
+#endif
+#ifdef SPM_SIMD_AVX2
+        case 2:
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return SimdSearchAVX2;
+            break;
+#endif
+    }
+    return NULL;
+}
+
+static int SimdSearchTestCompare(SimdSearchFunc func, const uint8_t *h,
+        uint32_t hlen, const uint8_t *n, uint16_t nlen, int nocase)
+{
+    uint8_t *r = func(h, hlen, n, nlen, nocase);
+    uint8_t *e = nocase ? BasicSearchNocase(h, hlen, n, nlen) :
+                          BasicSearch(h, hlen, n, nlen);
+    if (r != e) {
+        printf("needle_len %u haystack_len %u nocase %d: got offset %d, "
+               "expected %d: ", nlen, hlen, nocase,
+               r ? (int)(r - h) : -1, e ? (int)(e - h) : -1);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * \test all implementations against BasicSearch, for needle lengths
+ *       1 to 255 at every offset class
+ */
+static int SimdSearchTest01(void)
+{
+    uint8_t haystack[1024];
+    uint8_t needle[256];
+    uint32_t seed = 1;
+    int f, nocase;
+    uint32_t i, nlen;
+
+    /* small alphabet, so partial matches are common */
+    for (i = 0; i < sizeof(haystack); i++) {
+        seed = seed * 1103515245 + 12345;
+        haystack[i] = "aAbB@`[{"[(seed >> 16) & 7];
+    }
+
+    for (f = 0; f < 3; f++) {
+        SimdSearchFunc func = SimdSearchTestFuncs(f);
+        if (func == NULL)
+            continue;
+
+        for (nocase = 0; nocase < 2; nocase++) {
+            for (nlen = 1; nlen < 256; nlen++) {
+                uint32_t off;
+                for (off = 0; off + nlen <= sizeof(haystack); off += 97) {
+                    memcpy(needle, haystack + off, nlen);
+                    if (nocase) {
+                        for (i = 0; i < nlen; i += 3)
+                            needle[i] = toupper(needle[i]);
+                    }
+                    /* needle taken from the haystack */
+                    if (!SimdSearchTestCompare(func, haystack, sizeof(haystack),
+                                needle, nlen, nocase))
+                        return 0;
+                    /* haystack ends in the middle of the match */
+                    if (!SimdSearchTestCompare(func, haystack, off + nlen - 1,
+                                needle, nlen, nocase))
+                        return 0;
+                    /* needle that likely isn't in the haystack */
+                    needle[nlen / 2] = 'z';
+                    if (!SimdSearchTestCompare(func, haystack, sizeof(haystack),
+                                needle, nlen, nocase))
+                        return 0;
+                }
+            }
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * \test nocase only folds letters: '@' and '`' differ only in the 0x20
+ *       bit but are different chars
+ */
+static int SimdSearchTest02(void)
+{
+    uint8_t haystack[64];
+    int f;
+
+    memset(haystack, '`', sizeof(haystack));
+    memcpy(haystack + 40, "@X@", 3);
+
+    for (f = 0; f < 3; f++) {
+        SimdSearchFunc func = SimdSearchTestFuncs(f);
+        if (func == NULL)
+            continue;
+
+        if (func(haystack, sizeof(haystack), (uint8_t *)"@x@", 3, 1) != haystack + 40)
+            return 0;
+        if (func(haystack, sizeof(haystack), (uint8_t *)"@x@", 3, 0) != NULL)
+            return 0;
+        if (func(haystack, sizeof(haystack), (uint8_t *)"`x`", 3, 1) != NULL)
+            return 0;
+        if (func(haystack, sizeof(haystack), (uint8_t *)"@", 1, 1) != haystack + 40)
+            return 0;
+        if (func(haystack, sizeof(haystack), (uint8_t *)"{", 1, 1) != NULL)
+            return 0;
+        if (func(haystack, 0, (uint8_t *)"`", 1, 0) != NULL)
+            return 0;
+    }
+
+    return 1;
+}
+
+#endif /* UNITTESTS */
+
+void SimdSearchRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SimdSearchTest01", SimdSearchTest01, 1);
+    UtRegisterTest("SimdSearchTest02", SimdSearchTest02, 1);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,36 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * SIMD single pattern search, filtering on the first and last byte of
+ * the needle.
+ */
+
+#ifndef __UTIL_SPM_SIMD_H__
+#define __UTIL_SPM_SIMD_H__
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+uint8_t *SimdSearch(const uint8_t *, uint32_t, const uint8_t *, uint16_t);
+uint8_t *SimdSearchNocase(const uint8_t *, uint32_t, const uint8_t *, uint16_t);
+void SimdSearchInit(void);
+void SimdSearchRegisterTests(void);
+
+#endif /* __UTIL_SPM_SIMD_H__ */
@@ -21,8 +21,9 @@
  * \author Pablo Rincon Crespo <pablo.rincon.crespo@gmail.com>
  *
  * PR (17/01/2010): Single pattern search algorithms:
- * Currently there are 3 algorithms to choose: BasicSearch, Bs2Bm and
- * BoyerMoore (Boyer Moores algorithm). The first one doesn't need a context.
+ * Currently there are 4 algorithms to choose: BasicSearch, Bs2Bm,
+ * BoyerMoore (Boyer Moores algorithm) and SimdSearch (first/last byte
+ * SIMD filter). BasicSearch and SimdSearch don't need a context.
  * But for Bs2Bm and BoyerMoore, you'll need to build some arrays.
  *
  * !! If you are going to use the same pattern multiple times,
@@ -51,7 +52,10 @@
 #include "util-spm-bs.h"
 #include "util-spm-bs2bm.h"
 #include "util-spm-bm.h"
+#include "util-spm-simd.h"
 #include "util-clock.h"
+#include "util-debug.h"
+#include "conf.h"
 
 
 /**
@@ -139,6 +143,30 @@ uint8_t *BoyerMooreNocaseSearch(uint8_t *text, uint32_t textlen, uint8_t *needle
 }
 
 
+/**
+ * \brief Get the single pattern matcher for content inspection from the
+ *        "spm-algo" setting: "bm" (default) or "simd".
+ *
+ * \retval SPM_BM or SPM_SIMD
+ */
+uint8_t SinglePatternMatchDefaultMatcher(void) {
+    char *spm_algo = NULL;
+
+    if ((ConfGet("spm-algo", &spm_algo)) == 1 && spm_algo != NULL) {
+        if (strcmp(spm_algo, "bm") == 0) {
+            return SPM_BM;
+        } else if (strcmp(spm_algo, "simd") == 0) {
+            return SPM_SIMD;
+        }
+
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid spm algo supplied "
+                "in the yaml conf file: \"%s\"", spm_algo);
+        exit(EXIT_FAILURE);
+    }
+
+    return SPM_BM;
+}
+
 #ifdef UNITTESTS
 
 /** Comment out this if you want stats
@@ -279,6 +307,38 @@ uint8_t *BoyerMooreNocaseWrapper(uint8_t *text, uint8_t *needle, int times) {
 
 }
 
+uint8_t *SimdSearchWrapper(uint8_t *text, uint8_t *needle, int times) {
+    uint32_t textlen = strlen((char *)text);
+    uint16_t needlelen = strlen((char *)needle);
+
+    uint8_t *ret = NULL;
+    int i = 0;
+
+    CLOCK_INIT;
+    if (times > 1) CLOCK_START;
+    for (i = 0; i < times; i++) {
+        ret = SimdSearch(text, textlen, needle, needlelen);
+    }
+    if (times > 1) { CLOCK_END; CLOCK_PRINT_SEC; };
+    return ret;
+}
+
+uint8_t *SimdSearchNocaseWrapper(uint8_t *text, uint8_t *needle, int times) {
+    uint32_t textlen = strlen((char *)text);
+    uint16_t needlelen = strlen((char *)needle);
+
+    uint8_t *ret = NULL;
+    int i = 0;
+
+    CLOCK_INIT;
+    if (times > 1) CLOCK_START;
+    for (i = 0; i < times; i++) {
+        ret = SimdSearchNocase(text, textlen, needle, needlelen);
+    }
+    if (times > 1) { CLOCK_END; CLOCK_PRINT_SEC; };
+    return ret;
+}
+
 /**
  * \brief Unittest helper function wrappers for the search algorithms
  * \param text pointer to the buffer to search in
@@ -602,6 +662,56 @@ int UtilSpmBoyerMooreSearchNocaseTest02() {
         return 1;
 }
 
+/**
+ * \test Generic test for simd matching
+ */
+int UtilSpmSimdSearchTest01() {
+    uint8_t *needle = (uint8_t *)"oPqRsT";
+    uint8_t *text = (uint8_t *)"aBcDeFgHiJkLmNoPqRsTuVwXyZ";
+    uint8_t *found = SimdSearchWrapper(text, needle, 1);
+    //printf("found: %s\n", found);
+    if (found != NULL)
+        return 1;
+    else
+        return 0;
+}
+
+/**
+ * \test Generic test for simd nocase matching
+ */
+int UtilSpmSimdSearchNocaseTest01() {
+    uint8_t *needle = (uint8_t *)"OpQrSt";
+    uint8_t *text = (uint8_t *)"aBcDeFgHiJkLmNoPqRsTuVwXyZ";
+    uint8_t *found = SimdSearchNocaseWrapper(text, needle, 1);
+    //printf("found: %s\n", found);
+    if (found != NULL)
+        return 1;
+    else
+        return 0;
+}
+
+int UtilSpmSimdSearchTest02() {
+    uint8_t *needle = (uint8_t *)"oPQRsT";
+    uint8_t *text = (uint8_t *)"aBcDeFgHiJkLmNoPqRsTuVwXyZ";
+    uint8_t *found = SimdSearchWrapper(text, needle, 1);
+    //printf("found: %s\n", found);
+    if (found != NULL)
+        return 0;
+    else
+        return 1;
+}
+
+int UtilSpmSimdSearchNocaseTest02() {
+    uint8_t *needle = (uint8_t *)"OpZrSt";
+    uint8_t *text = (uint8_t *)"aBcDeFgHiJkLmNoPqRsTuVwXyZ";
+    uint8_t *found = SimdSearchNocaseWrapper(text, needle, 1);
+    //printf("found: %s\n", found);
+    if (found != NULL)
+        return 0;
+    else
+        return 1;
+}
+
 /**
  * \test Check that all the algorithms work at any offset and any pattern length
  */
@@ -1032,6 +1142,11 @@ int UtilSpmSearchOffsetsTest01() {
                 printf("Error3 searching for %s in text %s\n", needle[i], text[i][j]);
                 return 0;
             }
+            found = SimdSearchWrapper((uint8_t *)text[i][j], (uint8_t *)needle[i], 1);
+            if (found == 0) {
+                printf("Error4 searching for %s in text %s\n", needle[i], text[i][j]);
+                return 0;
+            }
         }
     }
     return 1;
@@ -1467,6 +1582,11 @@ int UtilSpmSearchOffsetsNocaseTest01() {
                 printf("Error3 searching for %s in text %s\n", needle[i], text[i][j]);
                 return 0;
             }
+            found = SimdSearchNocaseWrapper((uint8_t *)text[i][j], (uint8_t *)needle[i], 1);
+            if (found == 0) {
+                printf("Error4 searching for %s in text %s\n", needle[i], text[i][j]);
+                return 0;
+            }
         }
     }
     return 1;
@@ -2287,6 +2407,59 @@ int UtilSpmNocaseSearchStatsTest07() {
     return 1;
 }
 
+/**
+ * \test Give some stats for all the algorithms over needle lengths 1 to 255,
+ *       with a text full of partial matches of the needle
+ */
+int UtilSpmSearchStatsTest08() {
+    uint8_t text[4096 + 1];
+    uint8_t needle[255 + 1];
+    uint8_t *found = NULL;
+    int len, i, nocase;
+
+    for (nocase = 0; nocase < 2; nocase++) {
+        printf("\nStats for needle lengths 1 to 255%s:\n", nocase ? " (nocase)" : "");
+        for (len = 1; len < 256; len++) {
+            for (i = 0; i < len; i++)
+                needle[i] = "aBcDeFgHiJkLmNoPqRsTuVwXyZ"[i % 26];
+            needle[len] = '\0';
+
+            /* repeat the needle with its last byte replaced, then put the
+             * needle at the end */
+            for (i = 0; i < 4096 - len; i++) {
+                text[i] = ((i % len) == len - 1) ? 'z' : needle[i % len];
+                if (nocase)
+                    text[i] = toupper(text[i]);
+            }
+            memcpy(text + 4096 - len, needle, len);
+            text[4096] = '\0';
+
+            printf("Pattern length %d with BasicSearch:", len);
+            found = nocase ? BasicSearchNocaseWrapper(text, needle, STATS_TIMES / 1000) :
+                             BasicSearchWrapper(text, needle, STATS_TIMES / 1000);
+            if (found == NULL)
+                return 0;
+            printf("Pattern length %d with Bs2BmSearch:", len);
+            found = nocase ? Bs2bmNocaseWrapper(text, needle, STATS_TIMES / 1000) :
+                             Bs2bmWrapper(text, needle, STATS_TIMES / 1000);
+            if (found == NULL)
+                return 0;
+            printf("Pattern length %d with BoyerMooreSearch:", len);
+            found = nocase ? BoyerMooreNocaseWrapper(text, needle, STATS_TIMES / 1000) :
+                             BoyerMooreWrapper(text, needle, STATS_TIMES / 1000);
+            if (found == NULL)
+                return 0;
+            printf("Pattern length %d with SimdSearch:", len);
+            found = nocase ? SimdSearchNocaseWrapper(text, needle, STATS_TIMES / 1000) :
+                             SimdSearchWrapper(text, needle, STATS_TIMES / 1000);
+            if (found == NULL)
+                return 0;
+            printf("\n");
+        }
+    }
+    return 1;
+}
+
 #endif
 
 /* Register unittests */
@@ -2312,6 +2485,11 @@ void UtilSpmSearchRegistertests(void) {
     UtRegisterTest("UtilSpmBoyerMooreSearchTest02", UtilSpmBoyerMooreSearchTest02, 1);
     UtRegisterTest("UtilSpmBoyerMooreSearchNocaseTest02", UtilSpmBoyerMooreSearchNocaseTest02, 1);
 
+    UtRegisterTest("UtilSpmSimdSearchTest01", UtilSpmSimdSearchTest01, 1);
+    UtRegisterTest("UtilSpmSimdSearchNocaseTest01", UtilSpmSimdSearchNocaseTest01, 1);
+    UtRegisterTest("UtilSpmSimdSearchTest02", UtilSpmSimdSearchTest02, 1);
+    UtRegisterTest("UtilSpmSimdSearchNocaseTest02", UtilSpmSimdSearchNocaseTest02, 1);
+
     /* test matches at any offset */
     UtRegisterTest("UtilSpmSearchOffsetsTest01", UtilSpmSearchOffsetsTest01, 1);
     UtRegisterTest("UtilSpmSearchOffsetsNocaseTest01", UtilSpmSearchOffsetsNocaseTest01, 1);
@@ -2337,6 +2515,9 @@ void UtilSpmSearchRegistertests(void) {
     UtRegisterTest("UtilSpmNocaseSearchStatsTest06", UtilSpmNocaseSearchStatsTest06, 1);
     UtRegisterTest("UtilSpmNocaseSearchStatsTest07", UtilSpmNocaseSearchStatsTest07, 1);
 
+    /* All algorithms, needle lengths 1 to 255 */
+    UtRegisterTest("UtilSpmSearchStatsTest08", UtilSpmSearchStatsTest08, 1);
+
 #endif
 #endif
 }
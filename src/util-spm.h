@@ -27,6 +27,13 @@
 #include "util-spm-bs.h"
 #include "util-spm-bs2bm.h"
 #include "util-spm-bm.h"
+#include "util-spm-simd.h"
+
+/** single pattern matchers for content inspection, see "spm-algo" */
+enum {
+    SPM_BM = 0,
+    SPM_SIMD,
+};
 
 /** Default algorithm to use: Boyer Moore */
 uint8_t *Bs2bmSearch(uint8_t *text, uint32_t textlen, uint8_t *needle, uint16_t needlelen);
@@ -57,5 +64,7 @@ uint8_t *BoyerMooreNocaseSearch(uint8_t *text, uint32_t textlen, uint8_t *needle
     mfound; \
     })
 
+uint8_t SinglePatternMatchDefaultMatcher(void);
+
 void UtilSpmSearchRegistertests(void);
 #endif /* __UTIL_SPM_H__ */